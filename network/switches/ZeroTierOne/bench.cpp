@@ -0,0 +1,788 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+/*
+ * Microbenchmarks for the hot paths of the node core
+ *
+ * Each benchmark is a function that performs its operation a given number of
+ * times. The harness grows the iteration count until one batch takes at least
+ * the target time, then times several batches of that size and reports the
+ * median. Results can be saved as a baseline and later runs compared to it;
+ * a benchmark counts as regressed if it is slower than the baseline by more
+ * than both the threshold and the spread between its own fastest and slowest
+ * batches.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "node/Constants.hpp"
+#include "node/RuntimeEnvironment.hpp"
+#include "node/InetAddress.hpp"
+#include "node/Utils.hpp"
+#include "node/Identity.hpp"
+#include "node/Packet.hpp"
+#include "node/Salsa20.hpp"
+#include "node/Poly1305.hpp"
+#include "node/C25519.hpp"
+#include "node/Dictionary.hpp"
+#include "node/DictionaryReader.hpp"
+#include "node/NetworkConfig.hpp"
+#include "node/CMWC4096.hpp"
+#include "node/Metrics.hpp"
+#include "node/Peer.hpp"
+#include "node/Path.hpp"
+#include "node/Topology.hpp"
+#include "node/Switch.hpp"
+#include "node/Multicaster.hpp"
+#include "node/MulticastGroup.hpp"
+#include "node/AntiRecursion.hpp"
+#include "node/NodeConfig.hpp"
+#include "node/Socket.hpp"
+#include "node/SocketManager.hpp"
+#include "node/MAC.hpp"
+#include "node/MPSCQueue.hpp"
+
+#ifdef __WINDOWS__
+#include <tchar.h>
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+using namespace ZeroTier;
+
+#define KNOWN_GOOD_IDENTITY "8e4df28b72:0:ac3d46abe0c21f3cfe7a6c8d6a85cfcffcb82fbd55af6a4d6350657c68200843fa2e16f9418bbd9702cae365f2af5fb4c420908b803a681d4daef6114d78a2d7:bd8dd6e4ce7022d2f812797a80c6ee8ad180dc4ebf301dec8b06d1be08832bddd63a2f1cfa7b2c504474c75bdc8898ba476ef92e8e2d0509f8441985171ff16e"
+
+/**
+ * Default minimum wall clock time of one timed batch in milliseconds
+ */
+#define ZT_BENCH_DEFAULT_BATCH_TIME 100
+
+/**
+ * Default number of timed batches per benchmark (median is reported)
+ */
+#define ZT_BENCH_DEFAULT_BATCHES 5
+
+/**
+ * Default slowdown in percent versus baseline that counts as a regression
+ */
+#define ZT_BENCH_DEFAULT_THRESHOLD 10.0
+
+/**
+ * Number of peers in the simulated topology
+ */
+#define ZT_BENCH_PEERS 1024
+
+/**
+ * Multicast fan-out limit used by multicaster/send
+ */
+#define ZT_BENCH_MULTICAST_LIMIT 32
+
+/**
+ * Ethernet frame payload size for packet, multicast and anti-recursion benchmarks
+ */
+#define ZT_BENCH_FRAME_SIZE 1400
+
+/**
+ * Payload size of the packet reassembled by switch/defrag (head plus two fragments)
+ */
+#define ZT_BENCH_DEFRAG_SIZE 4000
+
+/**
+ * Largest buffer size used by the Salsa20 and Poly1305 benchmarks
+ */
+#define ZT_BENCH_MAX_CRYPTO_SIZE 16384
+
+/**
+ * Home folder for the simulated node's identity cache, removed on exit
+ */
+#define ZT_BENCH_HOME "bench.d"
+
+// Results of benchmarked work are folded into this so it can't be optimized out
+static volatile unsigned long benchSink = 0;
+
+/**
+ * Socket that goes nowhere, used as the receiving socket for fed-in packets
+ */
+class BenchSocket : public Socket
+{
+public:
+	BenchSocket() : Socket(Socket::ZT_SOCKET_TYPE_UDP_V4) {}
+	virtual bool send(const InetAddress &to,const void *msg,unsigned int msglen) { return true; }
+};
+
+/**
+ * Socket manager that counts and discards everything sent
+ */
+class BenchSocketManager : public SocketManager
+{
+public:
+	BenchSocketManager() : packets(0),bytes(0) {}
+	virtual bool send(const InetAddress &to,bool tcp,bool autoConnectTcp,const void *msg,unsigned int msglen)
+	{
+		++packets;
+		bytes += msglen;
+		return true;
+	}
+	virtual void poll(unsigned long timeout,void (*handler)(const SharedPtr<Socket> &,void *,const InetAddress &,Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> &),void *arg) {}
+	virtual void whack() {}
+	virtual void closeTcpSockets() {}
+
+	uint64_t packets;
+	uint64_t bytes;
+};
+
+/**
+ * Node core objects and test fixtures shared by all benchmarks
+ *
+ * This wires up the same core objects Node does, minus anything that
+ * starts threads or touches the real network.
+ */
+struct BenchEnvironment
+{
+	RuntimeEnvironment renv;
+	BenchSocketManager sm;
+	SharedPtr<Socket> sock;
+
+	std::vector<Address> peers;
+	SharedPtr<Peer> remote; // sends us the packets fed into the switch
+	InetAddress remoteAddress;
+
+	unsigned char cryptoKey[32];
+	unsigned char cryptoIv[8];
+	unsigned char cryptoBuf[ZT_BENCH_MAX_CRYPTO_SIZE];
+
+	unsigned char frame[ZT_BENCH_FRAME_SIZE];
+	Packet packet; // unarmored VERB_FRAME carrying frame[]
+	Packet armored;
+	Packet compressed;
+
+	std::vector< Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> > fragments;
+
+	C25519::Pair pair;
+	C25519::Pair otherPair;
+	unsigned char message[64];
+	C25519::Signature signature;
+
+	Dictionary dictionary; // unsigned
+	std::string signedDictionary;
+	std::string binaryNetworkConfig; // signedDictionary in binary form
+
+	uint64_t nwid;
+	MulticastGroup group;
+	MAC frameSource;
+};
+
+static BenchEnvironment *env = (BenchEnvironment *)0;
+
+static Identity makeBenchIdentity(uint64_t a)
+{
+	unsigned char pub[ZT_C25519_PUBLIC_KEY_LEN];
+	Utils::getSecureRandom(pub,sizeof(pub));
+	Identity id;
+	id.fromString((Address(a).toString() + ":0:" + Utils::hex(pub,sizeof(pub))).c_str());
+	return id;
+}
+
+static void setupEnvironment()
+{
+#ifdef __WINDOWS__
+	CreateDirectoryA(ZT_BENCH_HOME,NULL);
+#else
+	mkdir(ZT_BENCH_HOME,0700);
+#endif
+	Utils::rm(std::string(ZT_BENCH_HOME ZT_PATH_SEPARATOR_S "identities.db"));
+
+	env = new BenchEnvironment();
+	RuntimeEnvironment *RR = &(env->renv);
+	RR->homePath = ZT_BENCH_HOME;
+	RR->identity.fromString(KNOWN_GOOD_IDENTITY);
+	RR->synchronous = true;
+	RR->sm = &(env->sm);
+	RR->prng = new CMWC4096();
+	RR->metrics = new Metrics();
+	RR->sw = new Switch(RR);
+	RR->mc = new Multicaster(RR);
+	RR->antiRec = new AntiRecursion();
+	RR->topology = new Topology(RR);
+	RR->nc = new NodeConfig(RR);
+	RR->initialized = true;
+
+	env->sock = SharedPtr<Socket>(new BenchSocket());
+
+	for(unsigned int i=0;i<ZT_BENCH_PEERS;++i) {
+		SharedPtr<Peer> p(RR->topology->addPeer(SharedPtr<Peer>(new Peer(RR->identity,makeBenchIdentity(0x0300000000ULL + (uint64_t)i)))));
+		InetAddress addr(0x0a000000 + i,ZT_DEFAULT_UDP_PORT);
+		p->addPath(Path(addr,Path::PATH_TYPE_UDP,true));
+		env->peers.push_back(p->address());
+		if (!i) {
+			env->remote = p;
+			env->remoteAddress = addr;
+		}
+	}
+
+	Utils::getSecureRandom(env->cryptoKey,sizeof(env->cryptoKey));
+	Utils::getSecureRandom(env->cryptoIv,sizeof(env->cryptoIv));
+	Utils::getSecureRandom(env->cryptoBuf,sizeof(env->cryptoBuf));
+
+	// Half text, half random: roughly how mixed real traffic compresses
+	for(unsigned int i=0;i<ZT_BENCH_FRAME_SIZE;++i)
+		env->frame[i] = (unsigned char)("GET /index.html HTTP/1.1\r\nHost: www.zerotier.com\r\n"[i % 51]);
+	Utils::getSecureRandom(env->frame + (ZT_BENCH_FRAME_SIZE / 2),ZT_BENCH_FRAME_SIZE / 2);
+
+	env->nwid = 0x8056c2e21c000001ULL;
+	env->group = MulticastGroup::deriveMulticastGroupForAddressResolution(InetAddress("10.1.2.3",0));
+	env->frameSource = MAC(0x32,0x11,0x22,0x33,0x44,0x55);
+
+	env->packet.reset(env->remote->address(),RR->identity.address(),Packet::VERB_FRAME);
+	env->packet.append(env->nwid);
+	env->packet.append((uint16_t)0x0800);
+	env->packet.append(env->frame,ZT_BENCH_FRAME_SIZE);
+	env->compressed = env->packet;
+	env->compressed.compress();
+	env->armored = env->packet;
+	env->armored.armor(env->remote->key(),true);
+
+	// A packet from the remote peer big enough to need two fragments after its head
+	{
+		Packet big(RR->identity.address(),env->remote->address(),Packet::VERB_NOP);
+		while (big.size() < (ZT_PACKET_IDX_PAYLOAD + ZT_BENCH_DEFRAG_SIZE))
+			big.append(env->cryptoBuf,std::min((unsigned int)sizeof(env->cryptoBuf),(unsigned int)((ZT_PACKET_IDX_PAYLOAD + ZT_BENCH_DEFRAG_SIZE) - big.size())));
+		unsigned int chunkSize = std::min(big.size(),(unsigned int)ZT_UDP_DEFAULT_PAYLOAD_MTU);
+		big.setFragmented(chunkSize < big.size());
+		big.armor(env->remote->key(),true);
+		env->fragments.push_back(Buffer<ZT_SOCKET_MAX_MESSAGE_LEN>(big.data(),chunkSize));
+		unsigned int fragStart = chunkSize;
+		unsigned int remaining = big.size() - chunkSize;
+		unsigned int totalFragments = 1 + ((remaining + (ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH) - 1) / (ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH));
+		for(unsigned int fno=1;fno<totalFragments;++fno) {
+			chunkSize = std::min(remaining,(unsigned int)(ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH));
+			Packet::Fragment frag(big,fragStart,chunkSize,fno,totalFragments);
+			env->fragments.push_back(Buffer<ZT_SOCKET_MAX_MESSAGE_LEN>(frag.data(),frag.size()));
+			fragStart += chunkSize;
+			remaining -= chunkSize;
+		}
+	}
+
+	env->pair = C25519::generate();
+	env->otherPair = C25519::generate();
+	Utils::getSecureRandom(env->message,sizeof(env->message));
+	env->signature = C25519::sign(env->pair,env->message,sizeof(env->message));
+
+	// Roughly the shape of a network config
+	{
+		Dictionary &d = env->dictionary;
+		char tmp[128];
+		Utils::snprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)env->nwid);
+		d["nwid"] = tmp;
+		d["ts"] = "1418d6f3ac1";
+		d["r"] = "1";
+		d["id"] = RR->identity.address().toString();
+		d["et"] = "0800,0806,86dd";
+		d["p"] = "1";
+		d["n"] = "benchmark network";
+		d["d"] = "A network configuration of typical size";
+		d["v4s"] = "10.147.17.12/24";
+		d["v6s"] = "fd80:56c2:e21c:0000:0199:93ce:4b5b:9207/88";
+		d["ml"] = "20";
+		d["ab"] = "1";
+		d["eb"] = "0";
+		d["com"] = std::string(ZT_BENCH_FRAME_SIZE / 5,'c');
+		d["ea"] = "0000000000;0000000001;0000000002;0000000003";
+		Dictionary s(d);
+		s.sign(RR->identity);
+		env->signedDictionary = s.toString();
+
+		SharedPtr<NetworkConfig> nc(new NetworkConfig(env->signedDictionary.data(),(unsigned int)env->signedDictionary.length()));
+		Buffer<ZT_NETWORKCONFIG_BINARY_MAX_LENGTH> b;
+		nc->serialize(b);
+		env->binaryNetworkConfig.assign((const char *)b.data(),b.size());
+	}
+}
+
+static void teardownEnvironment()
+{
+	RuntimeEnvironment *RR = &(env->renv);
+	RR->initialized = false;
+	env->remote.zero();
+	delete RR->nc;
+	delete RR->topology;
+	delete RR->antiRec;
+	delete RR->mc;
+	delete RR->sw;
+	delete RR->metrics;
+	delete RR->prng;
+	delete env;
+	env = (BenchEnvironment *)0;
+	Utils::rm(std::string(ZT_BENCH_HOME ZT_PATH_SEPARATOR_S "identities.db"));
+	Utils::rm(std::string(ZT_BENCH_HOME ZT_PATH_SEPARATOR_S "local.conf"));
+#ifdef __WINDOWS__
+	RemoveDirectoryA(ZT_BENCH_HOME);
+#else
+	rmdir(ZT_BENCH_HOME);
+#endif
+}
+
+/* ------------------------------------------------------------------------ */
+
+// Includes cipher setup, since armor() keys a new cipher for every packet
+template<unsigned int S>
+static void benchSalsa2012(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i) {
+		Salsa20 s20(env->cryptoKey,256,env->cryptoIv,12);
+		s20.encrypt(env->cryptoBuf,env->cryptoBuf,S);
+	}
+	benchSink += env->cryptoBuf[0];
+}
+
+template<unsigned int S>
+static void benchPoly1305(unsigned long n)
+{
+	unsigned char mac[16];
+	for(unsigned long i=0;i<n;++i) {
+		Poly1305::compute(mac,env->cryptoBuf,S,env->cryptoKey);
+		benchSink += mac[0];
+	}
+}
+
+static void benchPacketArmor(unsigned long n)
+{
+	Packet p(env->packet);
+	for(unsigned long i=0;i<n;++i)
+		p.armor(env->remote->key(),true);
+	benchSink += p[ZT_PACKET_IDX_PAYLOAD];
+}
+
+// Each iteration copies the armored packet, since dearmor() works in place
+static void benchPacketDearmor(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i) {
+		Packet p(env->armored);
+		benchSink += (unsigned long)p.dearmor(env->remote->key());
+	}
+}
+
+static void benchPacketCompress(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i) {
+		Packet p(env->packet);
+		p.compress();
+		benchSink += p.size();
+	}
+}
+
+static void benchPacketUncompress(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i) {
+		Packet p(env->compressed);
+		p.uncompress();
+		benchSink += p.size();
+	}
+}
+
+static void benchIdentityValidate(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i)
+		benchSink += (unsigned long)env->renv.identity.locallyValidate();
+}
+
+static void benchC25519Agree(unsigned long n)
+{
+	unsigned char key[64];
+	for(unsigned long i=0;i<n;++i) {
+		C25519::agree(env->pair,env->otherPair.pub,key,sizeof(key));
+		benchSink += key[0];
+	}
+}
+
+static void benchC25519Sign(unsigned long n)
+{
+	unsigned char sig[ZT_C25519_SIGNATURE_LEN];
+	for(unsigned long i=0;i<n;++i) {
+		C25519::sign(env->pair,env->message,sizeof(env->message),sig);
+		benchSink += sig[0];
+	}
+}
+
+static void benchC25519Verify(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i)
+		benchSink += (unsigned long)C25519::verify(env->pair.pub,env->message,sizeof(env->message),env->signature);
+}
+
+static void benchDictionaryParse(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i) {
+		Dictionary d(env->signedDictionary);
+		benchSink += (unsigned long)d.size();
+	}
+}
+
+static void benchDictionaryRead(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i) {
+		DictionaryReader d(env->signedDictionary.data(),(unsigned int)env->signedDictionary.length());
+		benchSink += (unsigned long)d.size();
+	}
+}
+
+static void benchDictionaryVerify(unsigned long n)
+{
+	DictionaryReader d(env->signedDictionary.data(),(unsigned int)env->signedDictionary.length());
+	for(unsigned long i=0;i<n;++i)
+		benchSink += (unsigned long)d.verify(env->renv.identity);
+}
+
+static void benchNetworkConfigParse(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i) {
+		SharedPtr<NetworkConfig> nc(new NetworkConfig(env->signedDictionary.data(),(unsigned int)env->signedDictionary.length()));
+		benchSink += (unsigned long)nc->multicastLimit();
+	}
+}
+
+static void benchNetworkConfigParseBinary(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i) {
+		SharedPtr<NetworkConfig> nc(new NetworkConfig(env->binaryNetworkConfig.data(),(unsigned int)env->binaryNetworkConfig.length()));
+		benchSink += (unsigned long)nc->multicastLimit();
+	}
+}
+
+static void benchDictionarySign(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i) {
+		Dictionary d(env->dictionary);
+		benchSink += (unsigned long)d.sign(env->renv.identity);
+	}
+}
+
+// Steps through peers with a stride so lookups don't just hit one bucket
+static void benchTopologyGetPeer(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i) {
+		SharedPtr<Peer> p(env->renv.topology->getPeer(env->peers[(i * 7919) % ZT_BENCH_PEERS]));
+		benchSink += (unsigned long)(p->address().toInt() & 0xff);
+	}
+}
+
+// Members are already known after the first pass, so this is the LIKE refresh path
+static void benchMulticasterAdd(unsigned long n)
+{
+	const uint64_t now = Utils::now();
+	for(unsigned long i=0;i<n;++i) {
+		const Address &a = env->peers[i % ZT_BENCH_PEERS];
+		env->renv.mc->add(now,env->nwid,env->group,a,a);
+	}
+}
+
+static void benchMulticasterSend(unsigned long n)
+{
+	const std::vector<Address> alwaysSendTo;
+	for(unsigned long i=0;i<n;++i)
+		env->renv.mc->send((const CertificateOfMembership *)0,ZT_BENCH_MULTICAST_LIMIT,Utils::now(),env->nwid,alwaysSendTo,env->group,env->frameSource,0x0800,env->frame,ZT_BENCH_FRAME_SIZE);
+}
+
+// Feeds head and fragments through the switch, which reassembles, decrypts and handles the packet
+static void benchSwitchDefrag(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i) {
+		for(std::vector< Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> >::const_iterator f(env->fragments.begin());f!=env->fragments.end();++f) {
+			Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> b(*f);
+			env->renv.sw->onRemotePacket(env->sock,env->remoteAddress,b);
+		}
+	}
+}
+
+static void benchAntiRecursionLog(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i)
+		env->renv.antiRec->logOutgoingZT(env->armored.data(),env->armored.size());
+}
+
+// A frame that matches nothing, so the whole history is checked
+static void benchAntiRecursionCheck(unsigned long n)
+{
+	for(unsigned long i=0;i<n;++i)
+		benchSink += (unsigned long)env->renv.antiRec->checkEthernetFrame(env->frame,ZT_BENCH_FRAME_SIZE);
+}
+
+// One frame handed through a queue in place, as between a tap and its reader
+static void benchMPSCQueueHandoff(unsigned long n)
+{
+	static MPSCQueue< Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> > q(64);
+	for(unsigned long i=0;i<n;++i) {
+		unsigned int ticket;
+		Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> *b = q.claim(ticket);
+		b->copyFrom(env->frame,ZT_BENCH_FRAME_SIZE);
+		q.publish(ticket);
+		b = q.front();
+		benchSink += (unsigned long)(*b)[i % ZT_BENCH_FRAME_SIZE];
+		q.pop();
+	}
+}
+
+/* ------------------------------------------------------------------------ */
+
+struct Benchmark
+{
+	const char *name;
+	void (*run)(unsigned long);
+	unsigned int bytes; // bytes processed per operation, or 0 to omit throughput
+};
+
+static const Benchmark BENCHMARKS[] = {
+	{ "salsa2012/64",benchSalsa2012<64>,64 },
+	{ "salsa2012/1444",benchSalsa2012<1444>,1444 },
+	{ "salsa2012/16384",benchSalsa2012<16384>,16384 },
+	{ "poly1305/64",benchPoly1305<64>,64 },
+	{ "poly1305/1444",benchPoly1305<1444>,1444 },
+	{ "poly1305/16384",benchPoly1305<16384>,16384 },
+	{ "packet/armor",benchPacketArmor,ZT_BENCH_FRAME_SIZE },
+	{ "packet/dearmor",benchPacketDearmor,ZT_BENCH_FRAME_SIZE },
+	{ "packet/compress",benchPacketCompress,ZT_BENCH_FRAME_SIZE },
+	{ "packet/uncompress",benchPacketUncompress,ZT_BENCH_FRAME_SIZE },
+	{ "identity/locallyValidate",benchIdentityValidate,0 },
+	{ "c25519/agree",benchC25519Agree,0 },
+	{ "c25519/sign",benchC25519Sign,0 },
+	{ "c25519/verify",benchC25519Verify,0 },
+	{ "dictionary/parse",benchDictionaryParse,0 },
+	{ "dictionary/sign",benchDictionarySign,0 },
+	{ "dictionary/read",benchDictionaryRead,0 },
+	{ "dictionary/verify",benchDictionaryVerify,0 },
+	{ "networkconfig/parse",benchNetworkConfigParse,0 },
+	{ "networkconfig/parseBinary",benchNetworkConfigParseBinary,0 },
+	{ "topology/getPeer",benchTopologyGetPeer,0 },
+	{ "multicaster/add",benchMulticasterAdd,0 },
+	{ "multicaster/send",benchMulticasterSend,ZT_BENCH_FRAME_SIZE },
+	{ "switch/defrag",benchSwitchDefrag,ZT_BENCH_DEFRAG_SIZE },
+	{ "antirecursion/log",benchAntiRecursionLog,0 },
+	{ "antirecursion/check",benchAntiRecursionCheck,ZT_BENCH_FRAME_SIZE },
+	{ "mpscqueue/handoff",benchMPSCQueueHandoff,ZT_BENCH_FRAME_SIZE },
+	{ (const char *)0,0,0 }
+};
+
+struct BenchResult
+{
+	unsigned long iterations; // per timed batch
+	double nsPerOp; // median over batches
+	double spread; // (slowest - fastest) / median
+};
+
+static double timeBatch(const Benchmark &b,unsigned long n)
+{
+	const uint64_t start = Utils::nowMicros();
+	b.run(n);
+	return (double)(Utils::nowMicros() - start) * 1000.0;
+}
+
+static BenchResult runBenchmark(const Benchmark &b,unsigned int batchMs,unsigned int batches)
+{
+	// Grow the batch until it takes at least the target time, so timer
+	// resolution and loop overhead don't matter. This also warms caches.
+	const double target = (double)batchMs * 1000000.0;
+	unsigned long n = 1;
+	for(;;) {
+		const double ns = timeBatch(b,n);
+		if (ns >= target)
+			break;
+		double scale = (ns > 0.0) ? ((target * 1.2) / ns) : 100.0;
+		if (scale > 100.0)
+			scale = 100.0;
+		else if (scale < 2.0)
+			scale = 2.0;
+		n = (unsigned long)((double)n * scale);
+	}
+
+	std::vector<double> samples;
+	for(unsigned int i=0;i<batches;++i)
+		samples.push_back(timeBatch(b,n) / (double)n);
+	std::sort(samples.begin(),samples.end());
+
+	BenchResult r;
+	r.iterations = n;
+	r.nsPerOp = ((samples.size() & 1) != 0) ? samples[samples.size() / 2] : ((samples[(samples.size() / 2) - 1] + samples[samples.size() / 2]) / 2.0);
+	r.spread = (r.nsPerOp > 0.0) ? ((samples.back() - samples.front()) / r.nsPerOp) : 0.0;
+	return r;
+}
+
+static bool selected(const char *name,const std::vector<std::string> &filters)
+{
+	if (filters.empty())
+		return true;
+	for(std::vector<std::string>::const_iterator f(filters.begin());f!=filters.end();++f) {
+		if (strstr(name,f->c_str()))
+			return true;
+	}
+	return false;
+}
+
+static void printUsage(const char *pn)
+{
+	printf("Usage: %s [-option ...] [<name substring> ...]" ZT_EOL_S,pn);
+	printf("Options:" ZT_EOL_S);
+	printf("  -h          - Display this help" ZT_EOL_S);
+	printf("  -l          - List benchmarks and exit" ZT_EOL_S);
+	printf("  -t<ms>      - Minimum time of one timed batch (default: %u)" ZT_EOL_S,ZT_BENCH_DEFAULT_BATCH_TIME);
+	printf("  -n<count>   - Timed batches per benchmark, median is reported (default: %u)" ZT_EOL_S,ZT_BENCH_DEFAULT_BATCHES);
+	printf("  -o<file>    - Save results to file for use as a baseline" ZT_EOL_S);
+	printf("  -b<file>    - Compare results to baseline file" ZT_EOL_S);
+	printf("  -r<percent> - Slowdown versus baseline that counts as a regression (default: %.0f)" ZT_EOL_S,ZT_BENCH_DEFAULT_THRESHOLD);
+	printf("Exit code is 1 if any benchmark regressed versus the baseline." ZT_EOL_S);
+}
+
+#ifdef __WINDOWS__
+int _tmain(int argc, _TCHAR* argv[])
+#else
+int main(int argc,char **argv)
+#endif
+{
+	unsigned int batchMs = ZT_BENCH_DEFAULT_BATCH_TIME;
+	unsigned int batches = ZT_BENCH_DEFAULT_BATCHES;
+	double threshold = ZT_BENCH_DEFAULT_THRESHOLD;
+	const char *savePath = (const char *)0;
+	const char *baselinePath = (const char *)0;
+	std::vector<std::string> filters;
+
+	for(int i=1;i<argc;++i) {
+		if (argv[i][0] == '-') {
+			switch(argv[i][1]) {
+				case 'l':
+					for(const Benchmark *b=BENCHMARKS;b->name;++b)
+						printf("%s" ZT_EOL_S,b->name);
+					return 0;
+				case 't':
+					batchMs = (unsigned int)Utils::strToUInt(argv[i] + 2);
+					break;
+				case 'n':
+					batches = (unsigned int)Utils::strToUInt(argv[i] + 2);
+					break;
+				case 'o':
+					savePath = argv[i] + 2;
+					break;
+				case 'b':
+					baselinePath = argv[i] + 2;
+					break;
+				case 'r':
+					threshold = strtod(argv[i] + 2,(char **)0);
+					break;
+				case 'h':
+				default:
+					printUsage(argv[0]);
+					return ((argv[i][1] == 'h') ? 0 : 1);
+			}
+		} else filters.push_back(std::string(argv[i]));
+	}
+	if ((!batchMs)||(!batches)||(threshold <= 0.0)) {
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	Dictionary baseline;
+	if (baselinePath) {
+		std::string buf;
+		if (!Utils::readFile(baselinePath,buf)) {
+			fprintf(stderr,"%s: unable to read baseline %s" ZT_EOL_S,argv[0],baselinePath);
+			return 1;
+		}
+		baseline.fromString(buf);
+	}
+
+	setupEnvironment();
+
+	printf("%-26s %12s %12s %10s %7s",
+		"benchmark",
+		"iterations",
+		"ns/op",
+		"MB/s",
+		"spread");
+	if (baselinePath)
+		printf(" %12s %8s","baseline","change");
+	printf(ZT_EOL_S);
+
+	Dictionary results;
+	unsigned int regressions = 0;
+	for(const Benchmark *b=BENCHMARKS;b->name;++b) {
+		if (!selected(b->name,filters))
+			continue;
+
+		const BenchResult r(runBenchmark(*b,batchMs,batches));
+
+		char mbps[32];
+		if (b->bytes)
+			Utils::snprintf(mbps,sizeof(mbps),"%.1f",((double)b->bytes * 1000.0) / r.nsPerOp);
+		else Utils::snprintf(mbps,sizeof(mbps),"-");
+		printf("%-26s %12lu %12.1f %10s %6.1f%%",b->name,r.iterations,r.nsPerOp,mbps,r.spread * 100.0);
+
+		if (baselinePath) {
+			const std::string base(baseline.get(b->name,std::string()));
+			const double baseNs = (base.length() > 0) ? strtod(base.c_str(),(char **)0) : 0.0;
+			if (baseNs > 0.0) {
+				const double change = ((r.nsPerOp - baseNs) / baseNs) * 100.0;
+				printf(" %12.1f %+7.1f%%",baseNs,change);
+				if ((change > threshold)&&(change > (r.spread * 100.0))) { // ignore changes within this run's own noise
+					printf(" REGRESSED");
+					++regressions;
+				}
+			} else printf(" %12s %8s","-","-");
+		}
+		printf(ZT_EOL_S);
+		fflush(stdout);
+
+		char tmp[64];
+		Utils::snprintf(tmp,sizeof(tmp),"%.3f",r.nsPerOp);
+		results[b->name] = tmp;
+	}
+
+	// The switch benchmark is meaningless if packets were silently dropped
+	if ((selected("switch/defrag",filters))&&(env->renv.metrics->verbReceived(Packet::VERB_NOP) == 0))
+		fprintf(stderr,"%s: WARNING: switch/defrag packets were not decoded" ZT_EOL_S,argv[0]);
+
+	teardownEnvironment();
+
+	if (savePath) {
+		if (!Utils::writeFile(savePath,results.toString())) {
+			fprintf(stderr,"%s: unable to write %s" ZT_EOL_S,argv[0],savePath);
+			return 1;
+		}
+		printf("results saved to %s" ZT_EOL_S,savePath);
+	}
+
+	if (regressions) {
+		printf("%u benchmark(s) regressed more than %.1f%% versus baseline" ZT_EOL_S,regressions,threshold);
+		return 1;
+	}
+	return 0;
+}
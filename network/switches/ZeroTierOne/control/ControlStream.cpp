@@ -0,0 +1,434 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <stdexcept>
+
+#include "ControlStream.hpp"
+
+#include "../node/Node.hpp"
+#include "../node/Utils.hpp"
+
+#ifndef __WINDOWS__
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace ZeroTier {
+
+static inline void _put(std::string &s,uint64_t v,unsigned int bytes)
+{
+	while (bytes)
+		s.push_back((char)((v >> (8 * --bytes)) & 0xff));
+}
+static inline void _putString(std::string &s,const char *str)
+{
+	unsigned int l = (unsigned int)strlen(str);
+	if (l > 255)
+		l = 255;
+	s.push_back((char)l);
+	s.append(str,l);
+}
+static inline void _putIp(std::string &s,const ZT1_Node_PhysicalAddress &a)
+{
+	unsigned int l = (a.type == ZT1_Node_PhysicalAddress_TYPE_IPV6) ? 16 : ((a.type == ZT1_Node_PhysicalAddress_TYPE_IPV4) ? 4 : 0);
+	s.push_back((char)l);
+	s.append((const char *)a.bits,l);
+}
+
+ControlStream::ControlStream(Node *node,const char *endpoint,const char *authToken) :
+	_node(node),
+	_endpoint(endpoint),
+	_authToken(authToken),
+	_sock(-1),
+	_run(true)
+{
+	_wakePipe[0] = -1;
+	_wakePipe[1] = -1;
+
+#ifdef __WINDOWS__
+	throw std::runtime_error("binary control stream is not supported on this platform");
+#else
+	struct sockaddr_un unaddr;
+	unaddr.sun_family = AF_UNIX;
+	strncpy(unaddr.sun_path,_endpoint.c_str(),sizeof(unaddr.sun_path));
+	unaddr.sun_path[sizeof(unaddr.sun_path) - 1] = (char)0;
+
+	struct stat stattmp;
+	if (!stat(_endpoint.c_str(),&stattmp)) {
+		int testSock = socket(AF_UNIX,SOCK_STREAM,0);
+		if (testSock < 0)
+			throw std::runtime_error("unable to create socket of type AF_UNIX");
+		if (!connect(testSock,(struct sockaddr *)&unaddr,sizeof(unaddr))) {
+			::close(testSock);
+			throw std::runtime_error("control stream endpoint address in use");
+		}
+		::close(testSock); // nothing is listening, orphaned name
+	}
+	::unlink(_endpoint.c_str());
+
+	if (pipe(_wakePipe))
+		throw std::runtime_error("pipe() failed");
+
+	_sock = socket(AF_UNIX,SOCK_STREAM,0);
+	if ((_sock < 0)||(bind(_sock,(struct sockaddr *)&unaddr,sizeof(unaddr)))||(listen(_sock,8))) {
+		if (_sock >= 0)
+			::close(_sock);
+		::close(_wakePipe[0]);
+		::close(_wakePipe[1]);
+		throw std::runtime_error("control stream endpoint could not be bound");
+	}
+	fcntl(_sock,F_SETFL,fcntl(_sock,F_GETFL) | O_NONBLOCK);
+	::chmod(_endpoint.c_str(),0777);
+
+	_thread = Thread::start(this);
+#endif
+}
+
+ControlStream::~ControlStream()
+{
+#ifndef __WINDOWS__
+	_run = false;
+	char c = 0;
+	if (::write(_wakePipe[1],&c,1) < 0) {} // wake the select() in threadMain
+	Thread::join(_thread);
+	::close(_sock);
+	::close(_wakePipe[0]);
+	::close(_wakePipe[1]);
+	::unlink(_endpoint.c_str());
+#endif
+}
+
+void ControlStream::appendFrame(std::string &out,unsigned int type,const std::string &payload)
+{
+	unsigned int l = (payload.length() > 0xffff) ? 0xffff : (unsigned int)payload.length();
+	_put(out,type,1);
+	_put(out,l,2);
+	out.append(payload.data(),l);
+}
+
+bool ControlStream::nextFrame(std::string &in,unsigned int &type,std::string &payload)
+{
+	if (in.length() < 3)
+		return false;
+	unsigned int l = ((unsigned int)((unsigned char)in[1]) << 8) | (unsigned int)((unsigned char)in[2]);
+	if (in.length() < (l + 3))
+		return false;
+	type = (unsigned int)((unsigned char)in[0]);
+	payload.assign(in,3,l);
+	in.erase(0,l + 3);
+	return true;
+}
+
+unsigned int ControlStream::diff(const std::map<uint64_t,std::string> &prev,const std::map<uint64_t,std::string> &cur,unsigned int updateType,unsigned int removeType,unsigned int idBytes,std::string &out)
+{
+	unsigned int n = 0;
+	std::string id;
+
+	// Both maps are sorted, so walk them together
+	std::map<uint64_t,std::string>::const_iterator p(prev.begin());
+	std::map<uint64_t,std::string>::const_iterator c(cur.begin());
+	while ((p != prev.end())||(c != cur.end())) {
+		if ((c == cur.end())||((p != prev.end())&&(p->first < c->first))) {
+			id.clear();
+			_put(id,p->first,idBytes);
+			appendFrame(out,removeType,id);
+			++n;
+			++p;
+		} else if ((p == prev.end())||(c->first < p->first)) {
+			appendFrame(out,updateType,c->second);
+			++n;
+			++c;
+		} else {
+			if (p->second != c->second) {
+				appendFrame(out,updateType,c->second);
+				++n;
+			}
+			++p;
+			++c;
+		}
+	}
+
+	return n;
+}
+
+void ControlStream::threadMain()
+	throw()
+{
+#ifndef __WINDOWS__
+	std::vector<_Client> clients;
+	fd_set readfds,writefds;
+	struct timeval tout;
+	char buf[16384];
+	uint64_t lastPublish = 0;
+	unsigned int type;
+	std::string payload;
+
+	while (_run) {
+		FD_ZERO(&readfds);
+		FD_ZERO(&writefds);
+		FD_SET(_sock,&readfds);
+		FD_SET(_wakePipe[0],&readfds);
+		int maxfd = (_sock > _wakePipe[0]) ? _sock : _wakePipe[0];
+		for(std::vector<_Client>::iterator c(clients.begin());c!=clients.end();++c) {
+			FD_SET(c->sock,&readfds);
+			if (c->outbuf.length())
+				FD_SET(c->sock,&writefds);
+			if (c->sock > maxfd)
+				maxfd = c->sock;
+		}
+
+		uint64_t now = Utils::now();
+		uint64_t wait = ((lastPublish + ZT_CONTROL_STREAM_INTERVAL) > now) ? ((lastPublish + ZT_CONTROL_STREAM_INTERVAL) - now) : 0;
+		tout.tv_sec = (long)(wait / 1000);
+		tout.tv_usec = (long)((wait % 1000) * 1000);
+		if (select(maxfd + 1,&readfds,&writefds,(fd_set *)0,&tout) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (!_run)
+			break;
+		now = Utils::now();
+
+		if (FD_ISSET(_sock,&readfds)) {
+			int s;
+			while ((s = accept(_sock,(struct sockaddr *)0,(socklen_t *)0)) >= 0) {
+				if (s >= FD_SETSIZE) {
+					::close(s);
+					continue;
+				}
+				fcntl(s,F_SETFL,fcntl(s,F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+				int one = 1;
+				::setsockopt(s,SOL_SOCKET,SO_NOSIGPIPE,(char *)&one,sizeof(one));
+#endif
+				clients.push_back(_Client());
+				clients.back().sock = s;
+				clients.back().connectedAt = now;
+			}
+		}
+
+		for(std::vector<_Client>::iterator c(clients.begin());c!=clients.end();++c) {
+			if (!FD_ISSET(c->sock,&readfds))
+				continue;
+			long n = (long)::recv(c->sock,buf,sizeof(buf),0);
+			if (n <= 0) {
+				if ((n < 0)&&((errno == EAGAIN)||(errno == EWOULDBLOCK)||(errno == EINTR)))
+					continue;
+				::close(c->sock);
+				c->sock = -1;
+				continue;
+			}
+			c->inbuf.append(buf,n);
+			while (nextFrame(c->inbuf,type,payload)) {
+				if (!_handleFrame(*c,type,payload)) {
+					// Best effort to deliver the ERROR frame before hanging up
+					::send(c->sock,c->outbuf.data(),c->outbuf.length(),MSG_NOSIGNAL);
+					::close(c->sock);
+					c->sock = -1;
+					break;
+				}
+			}
+		}
+
+		if ((now - lastPublish) >= ZT_CONTROL_STREAM_INTERVAL) {
+			_publish(clients,false);
+			lastPublish = now;
+		} else _publish(clients,true); // new subscribers get their snapshot right away
+
+		for(std::vector<_Client>::iterator c(clients.begin());c!=clients.end();) {
+			if ((c->sock >= 0)&&(c->outbuf.length())) {
+				long n = (long)::send(c->sock,c->outbuf.data(),c->outbuf.length(),MSG_NOSIGNAL);
+				if (n > 0)
+					c->outbuf.erase(0,n);
+				else if ((n < 0)&&(errno != EAGAIN)&&(errno != EWOULDBLOCK)&&(errno != EINTR)) {
+					::close(c->sock);
+					c->sock = -1;
+				}
+			}
+			if ((c->sock >= 0)&&((c->outbuf.length() > ZT_CONTROL_STREAM_MAX_BACKLOG)||((!c->authenticated)&&((now - c->connectedAt) > ZT_CONTROL_STREAM_AUTH_TIMEOUT)))) {
+				::close(c->sock);
+				c->sock = -1;
+			}
+			if (c->sock < 0)
+				c = clients.erase(c);
+			else ++c;
+		}
+	}
+
+	for(std::vector<_Client>::iterator c(clients.begin());c!=clients.end();++c)
+		::close(c->sock);
+#endif
+}
+
+bool ControlStream::_handleFrame(_Client &c,unsigned int type,const std::string &payload)
+{
+	std::string r;
+	switch(type) {
+		case FRAME_AUTH:
+			if ((_authToken.length() > 0)&&(payload == _authToken)) {
+				c.authenticated = true;
+				_put(r,ZT_CONTROL_STREAM_PROTOCOL_VERSION,1);
+				_put(r,_node->address(),5);
+				appendFrame(c.outbuf,FRAME_AUTH_OK,r);
+				return true;
+			}
+			appendFrame(c.outbuf,FRAME_ERROR,std::string("auth failed"));
+			return false;
+
+		case FRAME_SUBSCRIBE:
+			if (!c.authenticated) {
+				appendFrame(c.outbuf,FRAME_ERROR,std::string("unauthorized"));
+				return false;
+			}
+			c.subscriptions = (payload.length() > 0) ? (unsigned int)((unsigned char)payload[0]) : 0;
+			c.subscribed = false;
+			c.peers.clear();
+			c.networks.clear();
+			c.stats.clear();
+			return true;
+
+		default:
+			appendFrame(c.outbuf,FRAME_ERROR,std::string("unrecognized frame type"));
+			return false;
+	}
+}
+
+void ControlStream::_publish(std::vector<_Client> &clients,bool onlyNew)
+{
+	unsigned int want = 0;
+	for(std::vector<_Client>::iterator c(clients.begin());c!=clients.end();++c) {
+		if ((c->sock >= 0)&&((!onlyNew)||(!c->subscribed)))
+			want |= c->subscriptions;
+	}
+	if (!want)
+		return;
+
+	// Take each snapshot once and share it among all subscribers
+	std::map<uint64_t,std::string> peers,networks;
+	std::string stats;
+
+	if ((want & SUBSCRIBE_PEERS)) {
+		ZT1_Node_PeerList *pl = _node->listPeers();
+		if (!pl)
+			return;
+		for(unsigned int i=0;i<pl->numPeers;++i) {
+			const ZT1_Node_Peer &p = pl->peers[i];
+			std::string &rec = peers[p.rawAddress];
+			_put(rec,p.rawAddress,5);
+			_put(rec,(p.latency > 0xffff) ? 0xffff : p.latency,2);
+			_put(rec,(uint64_t)p.role,1);
+			_putString(rec,p.remoteVersion);
+			unsigned int np = (p.numPaths > 255) ? 255 : p.numPaths;
+			_put(rec,np,1);
+			for(unsigned int j=0;j<np;++j) {
+				_put(rec,(uint64_t)p.paths[j].type,1);
+				_putIp(rec,p.paths[j].address);
+				_put(rec,p.paths[j].address.port,2);
+				_put(rec,(p.paths[j].active ? 0x01 : 0x00) | (p.paths[j].fixed ? 0x02 : 0x00),1);
+			}
+		}
+		_node->freeQueryResult(pl);
+	}
+
+	if ((want & SUBSCRIBE_NETWORKS)) {
+		ZT1_Node_NetworkList *nl = _node->listNetworks();
+		if (!nl)
+			return;
+		for(unsigned int i=0;i<nl->numNetworks;++i) {
+			const ZT1_Node_Network &n = nl->networks[i];
+			std::string &rec = networks[n.nwid];
+			_put(rec,n.nwid,8);
+			_put(rec,(uint64_t)n.status,1);
+			_put(rec,(n.enabled ? 0x01 : 0x00) | (n.isPrivate ? 0x02 : 0x00),1);
+			rec.append((const char *)n.mac,6);
+			_putString(rec,n.name);
+			_putString(rec,n.device);
+			unsigned int nip = (n.numIps > 255) ? 255 : n.numIps;
+			_put(rec,nip,1);
+			for(unsigned int j=0;j<nip;++j) {
+				_putIp(rec,n.ips[j]);
+				_put(rec,n.ips[j].port,1);
+			}
+		}
+		_node->freeQueryResult(nl);
+	}
+
+	if ((want & SUBSCRIBE_STATS)) {
+		ZT1_Node_Status s;
+		_node->status(&s);
+		if (!s.initialized)
+			return;
+		_put(stats,s.rawAddress,5);
+		_put(stats,s.online ? 1 : 0,1);
+		_put(stats,s.knownPeers,4);
+		_put(stats,s.supernodes,4);
+		_put(stats,s.directlyConnectedPeers,4);
+		_put(stats,s.alivePeers,4);
+		_put(stats,s.keepalivesSent,8);
+		_put(stats,s.framesCompressed,8);
+		_put(stats,s.compressionBytesSaved,8);
+	}
+
+	for(std::vector<_Client>::iterator c(clients.begin());c!=clients.end();++c) {
+		if ((c->sock < 0)||(!c->subscriptions)||((onlyNew)&&(c->subscribed)))
+			continue;
+		if ((c->subscriptions & SUBSCRIBE_PEERS)) {
+			diff(c->peers,peers,FRAME_PEER,FRAME_PEER_REMOVED,5,c->outbuf);
+			c->peers = peers;
+		}
+		if ((c->subscriptions & SUBSCRIBE_NETWORKS)) {
+			diff(c->networks,networks,FRAME_NETWORK,FRAME_NETWORK_REMOVED,8,c->outbuf);
+			c->networks = networks;
+		}
+		if (((c->subscriptions & SUBSCRIBE_STATS))&&(c->stats != stats)) {
+			appendFrame(c->outbuf,FRAME_STATS,stats);
+			c->stats = stats;
+		}
+		if (!c->subscribed) {
+			appendFrame(c->outbuf,FRAME_SYNC,std::string());
+			c->subscribed = true;
+		}
+	}
+}
+
+} // namespace ZeroTier
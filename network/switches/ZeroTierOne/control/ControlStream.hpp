@@ -0,0 +1,204 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+#ifndef ZT_CONTROLSTREAM_HPP
+#define ZT_CONTROLSTREAM_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <map>
+#include <vector>
+
+#include "../node/Constants.hpp"
+#include "../node/NonCopyable.hpp"
+#include "../node/Thread.hpp"
+
+/**
+ * Suffix appended to the IPC endpoint name for the binary control stream
+ */
+#define ZT_CONTROL_STREAM_ENDPOINT_SUFFIX "-stream"
+
+/**
+ * Control stream protocol version, sent in AUTH_OK
+ */
+#define ZT_CONTROL_STREAM_PROTOCOL_VERSION 1
+
+namespace ZeroTier {
+
+class Node;
+
+/**
+ * Binary streaming control interface with subscriptions
+ *
+ * Unlike the line-based IPC bus, clients of this interface subscribe once
+ * and are then sent only what changed: peers and networks that appeared
+ * or changed, ones that went away, and node stats. Every connection is
+ * served from one thread that select()s over all sockets, and snapshots
+ * of the node are taken once per interval no matter how many clients
+ * are subscribed.
+ *
+ * Frames in both directions are a one byte type, a 16-bit big-endian
+ * payload length, and the payload. Integers are big-endian. A client
+ * sends AUTH with the auth token, then SUBSCRIBE with a mask of
+ * SUBSCRIBE_* flags. It is sent a full snapshot of what it asked for
+ * followed by SYNC, then deltas as they happen. Subscribing again
+ * starts over with a new snapshot.
+ *
+ * PEER: address[5] latency[2] role[1] version-length[1] version
+ *       path-count[1] paths, each type[1] ip-length[1] ip port[2] flags[1]
+ *       (flags: 0x01 active, 0x02 fixed)
+ * NETWORK: nwid[8] status[1] flags[1] mac[6] name-length[1] name
+ *          device-length[1] device ip-count[1] ips, each ip-length[1] ip bits[1]
+ *          (flags: 0x01 enabled, 0x02 private)
+ * STATS: address[5] online[1] known-peers[4] supernodes[4] direct-peers[4]
+ *        alive-peers[4] keepalives-sent[8] frames-compressed[8]
+ *        compression-bytes-saved[8]
+ * PEER_REMOVED: address[5]
+ * NETWORK_REMOVED: nwid[8]
+ * AUTH_OK: protocol-version[1] address[5]
+ * ERROR: message (connection is closed after it is sent)
+ *
+ * Path ages are deliberately left out of PEER records, since they change
+ * every time a packet moves and would turn every interval into a full dump.
+ *
+ * This is only available on Unix-like systems. On Windows the constructor
+ * throws std::runtime_error.
+ */
+class ControlStream : NonCopyable
+{
+public:
+	/**
+	 * Frame types
+	 */
+	enum FrameType
+	{
+		FRAME_AUTH = 0x01,
+		FRAME_SUBSCRIBE = 0x02,
+		FRAME_AUTH_OK = 0x81,
+		FRAME_PEER = 0x82,
+		FRAME_PEER_REMOVED = 0x83,
+		FRAME_NETWORK = 0x84,
+		FRAME_NETWORK_REMOVED = 0x85,
+		FRAME_STATS = 0x86,
+		FRAME_SYNC = 0x87,
+		FRAME_ERROR = 0x8f
+	};
+
+	/**
+	 * Subscription flags for SUBSCRIBE
+	 */
+	enum Subscription
+	{
+		SUBSCRIBE_PEERS = 0x01,
+		SUBSCRIBE_NETWORKS = 0x02,
+		SUBSCRIBE_STATS = 0x04
+	};
+
+	/**
+	 * @param node Node to report on
+	 * @param endpoint Unix domain socket path
+	 * @param authToken Authorization token for clients
+	 * @throws std::runtime_error Endpoint could not be bound or platform not supported
+	 */
+	ControlStream(Node *node,const char *endpoint,const char *authToken);
+
+	~ControlStream();
+
+	/**
+	 * Append a frame to a buffer
+	 *
+	 * Payloads longer than 65535 bytes are truncated.
+	 *
+	 * @param out Buffer to append to
+	 * @param type Frame type
+	 * @param payload Payload
+	 */
+	static void appendFrame(std::string &out,unsigned int type,const std::string &payload);
+
+	/**
+	 * Remove and return the first complete frame in a buffer
+	 *
+	 * @param in Buffer of received data
+	 * @param type Result parameter: frame type
+	 * @param payload Result parameter: payload
+	 * @return True if a frame was returned, false if in does not yet hold a complete frame
+	 */
+	static bool nextFrame(std::string &in,unsigned int &type,std::string &payload);
+
+	/**
+	 * Append frames bringing a client from one set of records to another
+	 *
+	 * Records in cur that are new or differ from prev are sent as-is in
+	 * updateType frames. Keys in prev but not in cur are sent in removeType
+	 * frames as big-endian integers of idBytes bytes.
+	 *
+	 * @param prev Records the client already has
+	 * @param cur Current records
+	 * @param updateType Frame type for new or changed records
+	 * @param removeType Frame type for removed records
+	 * @param idBytes Size of keys in removal frames
+	 * @param out Buffer to append to
+	 * @return Number of frames appended
+	 */
+	static unsigned int diff(const std::map<uint64_t,std::string> &prev,const std::map<uint64_t,std::string> &cur,unsigned int updateType,unsigned int removeType,unsigned int idBytes,std::string &out);
+
+	void threadMain()
+		throw();
+
+private:
+	struct _Client
+	{
+		_Client() : sock(-1),authenticated(false),subscribed(false),subscriptions(0),connectedAt(0) {}
+		int sock;
+		bool authenticated;
+		bool subscribed;
+		unsigned int subscriptions;
+		uint64_t connectedAt;
+		std::string inbuf;
+		std::string outbuf;
+		std::map<uint64_t,std::string> peers;
+		std::map<uint64_t,std::string> networks;
+		std::string stats;
+	};
+
+	bool _handleFrame(_Client &c,unsigned int type,const std::string &payload);
+	void _publish(std::vector<_Client> &clients,bool onlyNew);
+
+	Node *_node;
+	std::string _endpoint;
+	std::string _authToken;
+	int _sock;
+	int _wakePipe[2];
+	volatile bool _run;
+	Thread _thread;
+};
+
+} // namespace ZeroTier
+
+#endif
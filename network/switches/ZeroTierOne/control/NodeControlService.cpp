@@ -42,6 +42,7 @@ namespace ZeroTier {
 NodeControlService::NodeControlService(Node *node,const char *authToken) :
 	_node(node),
 	_listener((IpcListener *)0),
+	_stream((ControlStream *)0),
 	_authToken(authToken),
 	_running(true),
 	_thread(Thread::start(this))
@@ -58,6 +59,7 @@ NodeControlService::~NodeControlService()
 			delete c->first;
 		_connections.clear();
 	}
+	delete _stream;
 	delete _listener;
 }
 
@@ -73,6 +75,12 @@ void NodeControlService::threadMain()
 			} else if ((_node->initialized())&&(_node->address())) {
 				Utils::snprintf(tmp,sizeof(tmp),"%s%.10llx",ZT_IPC_ENDPOINT_BASE,(unsigned long long)_node->address());
 				_listener = new IpcListener(tmp,ZT_IPC_TIMEOUT,&_CBcommandHandler,this);
+#ifndef __WINDOWS__
+				Utils::snprintf(tmp,sizeof(tmp),"%s%.10llx%s",ZT_IPC_ENDPOINT_BASE,(unsigned long long)_node->address(),ZT_CONTROL_STREAM_ENDPOINT_SUFFIX);
+				try {
+					_stream = new ControlStream(_node,tmp,_authToken.c_str());
+				} catch ( ... ) {} // text IPC still works without it
+#endif
 				break;
 			}
 			Thread::sleep(100); // wait for Node to start
@@ -114,8 +122,11 @@ void NodeControlService::_doCommand(IpcConnection *ipcc,const char *commandLine)
 		ipcc->printf("200 help help"ZT_EOL_S);
 		ipcc->printf("200 help auth <token>"ZT_EOL_S);
 		ipcc->printf("200 help info"ZT_EOL_S);
+		ipcc->printf("200 help keepalive"ZT_EOL_S);
+		ipcc->printf("200 help latency"ZT_EOL_S);
 		ipcc->printf("200 help listpeers"ZT_EOL_S);
 		ipcc->printf("200 help listnetworks"ZT_EOL_S);
+		ipcc->printf("200 help metrics"ZT_EOL_S);
 		ipcc->printf("200 help join <network ID>"ZT_EOL_S);
 		ipcc->printf("200 help leave <network ID>"ZT_EOL_S);
 		ipcc->printf("200 help terminate [<reason>]"ZT_EOL_S);
@@ -137,6 +148,24 @@ void NodeControlService::_doCommand(IpcConnection *ipcc,const char *commandLine)
 
 		if (cmd[0] == "info") {
 			ipcc->printf("200 info %.10llx %s %s"ZT_EOL_S,_node->address(),(_node->online() ? "ONLINE" : "OFFLINE"),Node::versionString());
+		} else if (cmd[0] == "keepalive") {
+			ZT1_Node_Status status;
+			_node->status(&status);
+			ipcc->printf("200 keepalive %llu sent, peak %lu/sec"ZT_EOL_S,(unsigned long long)status.keepalivesSent,status.keepalivePeakPerSecond);
+			ipcc->printf("200 keepalive <pings/sec> <seconds>"ZT_EOL_S);
+			for(unsigned int i=0;i<ZT1_NODE_KEEPALIVE_HISTOGRAM_BUCKETS;++i) {
+				if (i == (ZT1_NODE_KEEPALIVE_HISTOGRAM_BUCKETS - 1))
+					ipcc->printf("200 keepalive %lu+ %llu"ZT_EOL_S,1UL << i,(unsigned long long)status.keepalivesPerSecondHistogram[i]);
+				else ipcc->printf("200 keepalive %lu-%lu %llu"ZT_EOL_S,1UL << i,(2UL << i) - 1,(unsigned long long)status.keepalivesPerSecondHistogram[i]);
+			}
+		} else if (cmd[0] == "latency") {
+			ZT1_Node_Status status;
+			_node->status(&status);
+			if (status.latencyEnabled) {
+				ipcc->printf("200 latency <stage> <samples> <p50 us> <p99 us> <p99.9 us> <max us>"ZT_EOL_S);
+				for(unsigned int i=0;i<ZT1_NODE_LATENCY_STAGES;++i)
+					ipcc->printf("200 latency %s %llu %lu %lu %lu %lu"ZT_EOL_S,status.latency[i].name,(unsigned long long)status.latency[i].count,status.latency[i].p50,status.latency[i].p99,status.latency[i].p999,status.latency[i].max);
+			} else ipcc->printf("500 latency not enabled (set latencyMetrics=1 in local.conf and restart)"ZT_EOL_S);
 		} else if (cmd[0] == "listpeers") {
 			ipcc->printf("200 listpeers <ztaddr> <paths> <latency> <version> <role>"ZT_EOL_S);
 			ZT1_Node_PeerList *pl = _node->listPeers();
@@ -213,6 +242,13 @@ void NodeControlService::_doCommand(IpcConnection *ipcc,const char *commandLine)
 				}
 				_node->freeQueryResult(nl);
 			}
+		} else if (cmd[0] == "metrics") {
+			char *m = _node->metrics();
+			if (m) {
+				for(char *saveptr=(char *)0,*l=Utils::stok(m,"\n",&saveptr);(l);l=Utils::stok((char *)0,"\n",&saveptr))
+					ipcc->printf("200 metrics %s"ZT_EOL_S,l);
+				_node->freeQueryResult(m);
+			}
 		} else if (cmd[0] == "join") {
 			if (cmd.size() > 1) {
 				uint64_t nwid = Utils::hexStrToU64(cmd[1].c_str());
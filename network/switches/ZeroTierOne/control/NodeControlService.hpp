@@ -33,6 +33,7 @@
 
 #include "IpcConnection.hpp"
 #include "IpcListener.hpp"
+#include "ControlStream.hpp"
 
 #include "../node/Constants.hpp"
 #include "../node/NonCopyable.hpp"
@@ -47,6 +48,8 @@ class Node;
  *
  * This is used with system-installed instances of ZeroTier One to
  * provide the IPC-based control bus service for node configuration.
+ * It also serves the binary ControlStream for monitoring clients that
+ * want change notifications rather than polling.
  */
 class NodeControlService : NonCopyable
 {
@@ -70,6 +73,7 @@ private:
 
 	Node *_node;
 	IpcListener *_listener;
+	ControlStream *_stream;
 	std::string _authToken;
 
 	std::map< IpcConnection *,bool > _connections;
@@ -140,6 +140,23 @@ int LZ4_compress_withState               (void* state, const char* source, char*
 int LZ4_compress_limitedOutput_withState (void* state, const char* source, char* dest, int inputSize, int maxOutputSize);
 
 
+/*
+LZ4_compress_fast() :
+    Same as LZ4_compress_limitedOutput(), but allows to select an "acceleration" factor.
+    The larger the acceleration value, the faster the algorithm, but also the lesser the compression.
+    Each successive value provides roughly +3% to speed on compressible data.
+    An acceleration value of "1" is the same as regular LZ4_compress_limitedOutput().
+    Values <= 0 will be replaced by ACCELERATION_DEFAULT (see lz4.c), which is 1.
+    If maxOutputSize >= LZ4_compressBound(inputSize), output is not bounds-checked while compressing.
+
+LZ4_compress_fast_extState() :
+    Same as LZ4_compress_fast(), using an externally allocated memory space for its state.
+    Use LZ4_sizeofState() to know how much memory must be allocated; it must be aligned on 4-bytes boundaries.
+*/
+int LZ4_compress_fast          (const char* source, char* dest, int inputSize, int maxOutputSize, int acceleration);
+int LZ4_compress_fast_extState (void* state, const char* source, char* dest, int inputSize, int maxOutputSize, int acceleration);
+
+
 /*
 LZ4_decompress_fast() :
     originalSize : is the original and therefore uncompressed size
@@ -39,6 +39,45 @@
 /* Query result buffers                                                     */
 /* ------------------------------------------------------------------------ */
 
+/**
+ * Number of buckets in ZT1_Node_Status keepalive histogram
+ */
+#define ZT1_NODE_KEEPALIVE_HISTOGRAM_BUCKETS 12
+
+/**
+ * Number of packet pipeline stages in ZT1_Node_Status latency summaries
+ */
+#define ZT1_NODE_LATENCY_STAGES 7
+
+/**
+ * Number of slots in ZT1_Node_Status per-verb packet counts (verbs are 5 bits)
+ */
+#define ZT1_NODE_VERBS 32
+
+/**
+ * Latency percentiles for one stage of the packet pipeline
+ *
+ * Times are in microseconds and are upper bounds of histogram buckets, so
+ * they may be up to 12.5% high.
+ */
+struct ZT1_Node_LatencyStage
+{
+	/**
+	 * Stage name, e.g. "rx_queue" or "tap_write"
+	 */
+	char name[16];
+
+	/**
+	 * Number of samples
+	 */
+	uint64_t count;
+
+	unsigned long p50;
+	unsigned long p99;
+	unsigned long p999;
+	unsigned long max;
+};
+
 /**
  * Node status result buffer
  */
@@ -84,6 +123,69 @@ struct ZT1_Node_Status
 	 */
 	float directLinkSuccessRate;
 
+	/**
+	 * Outgoing frames whose payloads were compressed
+	 */
+	uint64_t framesCompressed;
+
+	/**
+	 * Outgoing frames run through the compressor that did not get smaller
+	 */
+	uint64_t framesIncompressible;
+
+	/**
+	 * Outgoing frames not run through the compressor since their flow compresses poorly
+	 */
+	uint64_t framesCompressionSkipped;
+
+	/**
+	 * Total bytes saved by compression of outgoing frames
+	 */
+	uint64_t compressionBytesSaved;
+
+	/**
+	 * Total bytes not run through the compressor due to skipping (proportional to CPU saved)
+	 */
+	uint64_t compressionBytesSkipped;
+
+	/**
+	 * Keepalive pings sent to peers
+	 */
+	uint64_t keepalivesSent;
+
+	/**
+	 * Most keepalive pings sent in any one second
+	 */
+	unsigned long keepalivePeakPerSecond;
+
+	/**
+	 * Seconds in which keepalives were sent, by pings sent that second
+	 *
+	 * Bucket i counts seconds with 2^i to 2^(i+1)-1 pings. The last bucket
+	 * also counts everything above that.
+	 */
+	uint64_t keepalivesPerSecondHistogram[ZT1_NODE_KEEPALIVE_HISTOGRAM_BUCKETS];
+
+	/**
+	 * True if stage latencies are being recorded (latencyMetrics=1 in local.conf)
+	 */
+	bool latencyEnabled;
+
+	/**
+	 * Latency percentiles by packet pipeline stage, if enabled
+	 */
+	struct ZT1_Node_LatencyStage latency[ZT1_NODE_LATENCY_STAGES];
+
+	/**
+	 * Packets sent by verb, indexed by verb number
+	 */
+	uint64_t packetsSentByVerb[ZT1_NODE_VERBS];
+
+	/**
+	 * Authenticated packets received by verb, indexed by verb number
+	 */
+	uint64_t packetsReceivedByVerb[ZT1_NODE_VERBS];
+
 	/**
 	 * True if connectivity appears good
 	 */
@@ -208,12 +208,25 @@ namespace ZeroTierIdTool { // ------------------------------------------------
 static void printHelp(FILE *out,const char *pn)
 {
 	fprintf(out,"Usage: %s <command> [<args>]"ZT_EOL_S""ZT_EOL_S"Commands:"ZT_EOL_S,pn);
-	fprintf(out,"  generate [<identity.secret>] [<identity.public>]"ZT_EOL_S);
+	fprintf(out,"  generate [-t<threads>] [<identity.secret>] [<identity.public>]"ZT_EOL_S);
 	fprintf(out,"  validate <identity.secret/public>"ZT_EOL_S);
 	fprintf(out,"  getpublic <identity.secret>"ZT_EOL_S);
 	fprintf(out,"  sign <identity.secret> <file>"ZT_EOL_S);
 	fprintf(out,"  verify <identity.secret/public> <file> <signature>"ZT_EOL_S);
 	fprintf(out,"  mkcom <identity.secret> [<id,value,maxDelta> ...] (hexadecimal integers)"ZT_EOL_S);
+	fprintf(out,ZT_EOL_S"generate uses one thread per CPU core unless -t is given."ZT_EOL_S);
+}
+
+static unsigned int cpuCount()
+{
+#ifdef __WINDOWS__
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return ((si.dwNumberOfProcessors > 0) ? (unsigned int)si.dwNumberOfProcessors : 1);
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return ((n > 0) ? (unsigned int)n : 1);
+#endif
 }
 
 static Identity getIdFromArg(char *arg)
@@ -244,20 +257,44 @@ static int main(int argc,char **argv)
 	}
 
 	if (!strcmp(argv[1],"generate")) {
+		unsigned int threads = cpuCount();
+		const char *secretPath = (const char *)0;
+		const char *publicPath = (const char *)0;
+		for(int i=2;i<argc;++i) {
+			if ((argv[i][0] == '-')&&(argv[i][1] == 't')) {
+				threads = (unsigned int)Utils::strToUInt(argv[i] + 2);
+				if ((threads < 1)||(threads > 1024)) {
+					printHelp(stdout,argv[0]);
+					return 1;
+				}
+			} else if (!secretPath) {
+				secretPath = argv[i];
+			} else if (!publicPath) {
+				publicPath = argv[i];
+			} else {
+				printHelp(stdout,argv[0]);
+				return 1;
+			}
+		}
+
 		Identity id;
-		id.generate();
+		uint64_t start = Utils::now();
+		uint64_t tried = id.generate(threads);
+		uint64_t elapsed = Utils::now() - start;
+		fprintf(stderr,"%llu keys tried in %llums with %u thread(s) (%.1f keys/sec)"ZT_EOL_S,(unsigned long long)tried,(unsigned long long)elapsed,threads,(double)tried / ((double)(elapsed + 1) / 1000.0));
+
 		std::string idser = id.toString(true);
-		if (argc >= 3) {
-			if (!Utils::writeFile(argv[2],idser)) {
-				fprintf(stderr,"Error writing to %s"ZT_EOL_S,argv[2]);
+		if (secretPath) {
+			if (!Utils::writeFile(secretPath,idser)) {
+				fprintf(stderr,"Error writing to %s"ZT_EOL_S,secretPath);
 				return 1;
-			} else printf("%s written"ZT_EOL_S,argv[2]);
-			if (argc >= 4) {
+			} else printf("%s written"ZT_EOL_S,secretPath);
+			if (publicPath) {
 				idser = id.toString(false);
-				if (!Utils::writeFile(argv[3],idser)) {
-					fprintf(stderr,"Error writing to %s"ZT_EOL_S,argv[3]);
+				if (!Utils::writeFile(publicPath,idser)) {
+					fprintf(stderr,"Error writing to %s"ZT_EOL_S,publicPath);
 					return 1;
-				} else printf("%s written"ZT_EOL_S,argv[3]);
+				} else printf("%s written"ZT_EOL_S,publicPath);
 			}
 		} else printf("%s",idser.c_str());
 	} else if (!strcmp(argv[1],"validate")) {
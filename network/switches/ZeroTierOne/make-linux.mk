@@ -10,6 +10,11 @@ include objects.mk
 OBJS+=osnet/LinuxRoutingTable.o osnet/LinuxEthernetTap.o osnet/LinuxEthernetTapFactory.o
 TESTNET_OBJS=testnet/SimNet.o testnet/SimNetSocketManager.o testnet/TestEthernetTap.o testnet/TestEthernetTapFactory.o testnet/TestRoutingTable.o
 
+# testnet is built from its own copy of every object with -DZT_SIMULATION,
+# which adds the virtual clock and deterministic random numbers used by its
+# discrete-event mode. Nothing that ships is built with it.
+SIM_OBJS=$(OBJS:.o=.sim.o) $(TESTNET_OBJS:.o=.sim.o) testnet.sim.o
+
 # Enable SSE-optimized Salsa20 on x86 and x86_64 machines
 MACHINE=$(shell uname -m)
 ifeq ($(MACHINE),x86_64)
@@ -48,7 +53,7 @@ ifeq ($(ZT_DEBUG),1)
 	STRIP=echo
 	# The following line enables optimization for the crypto code, since
 	# C25519 in particular is almost UNUSABLE in heavy testing without it.
-ext/lz4/lz4.o node/Salsa20.o node/SHA512.o node/C25519.o node/Poly1305.o: CFLAGS = -Wall -O2 -g -pthread $(INCLUDES) $(DEFS)
+ext/lz4/lz4.o node/Salsa20.o node/SHA512.o node/C25519.o node/Poly1305.o ext/lz4/lz4.sim.o node/Salsa20.sim.o node/SHA512.sim.o node/C25519.sim.o node/Poly1305.sim.o: CFLAGS = -Wall -O2 -g -pthread $(INCLUDES) $(DEFS)
 else
 	CFLAGS=-Wall -O3 -fPIE -fvisibility=hidden -fstack-protector -pthread $(INCLUDES) -DNDEBUG $(DEFS)
 	LDFLAGS=-pie -Wl,-z,relro,-z,now
@@ -74,15 +79,29 @@ selftest:	$(OBJS) selftest.o
 	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-selftest selftest.o $(OBJS) $(LIBS)
 	$(STRIP) zerotier-selftest
 
-testnet: $(TESTNET_OBJS) $(OBJS) testnet.o
-	$(CXX) $(CXXFLAGS) -o zerotier-testnet testnet.o $(OBJS) $(TESTNET_OBJS) $(LIBS)
+bench:	$(OBJS) bench.o
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-bench bench.o $(OBJS) $(LIBS)
+	$(STRIP) zerotier-bench
+
+tapbench:	$(OBJS) tapbench.o
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-tapbench tapbench.o $(OBJS) $(LIBS)
+	$(STRIP) zerotier-tapbench
+
+testnet: $(SIM_OBJS)
+	$(CXX) $(CXXFLAGS) -o zerotier-testnet $(SIM_OBJS) $(LIBS)
 	$(STRIP) zerotier-testnet
 
+%.sim.o: %.cpp
+	$(CXX) $(CXXFLAGS) -DZT_SIMULATION -c -o $@ $<
+
+%.sim.o: %.c
+	$(CC) $(CFLAGS) -DZT_SIMULATION -c -o $@ $<
+
 installer: one FORCE
 	./buildinstaller.sh
 
 clean:
-	rm -rf $(OBJS) $(TESTNET_OBJS) node/*.o osnet/*.o control/*.o testnet/*.o *.o zerotier-* build-* ZeroTierOneInstaller-*
+	rm -rf $(OBJS) $(TESTNET_OBJS) $(SIM_OBJS) node/*.o osnet/*.o control/*.o testnet/*.o *.o zerotier-* build-* ZeroTierOneInstaller-*
 
 debug:	FORCE
 	make -j 4 ZT_DEBUG=1
@@ -9,6 +9,11 @@ include objects.mk
 OBJS+=osnet/BSDRoutingTable.o osnet/OSXEthernetTap.o osnet/OSXEthernetTapFactory.o
 TESTNET_OBJS=testnet/SimNet.o testnet/SimNetSocketManager.o testnet/TestEthernetTap.o testnet/TestEthernetTapFactory.o testnet/TestRoutingTable.o
 
+# testnet is built from its own copy of every object with -DZT_SIMULATION,
+# which adds the virtual clock and deterministic random numbers used by its
+# discrete-event mode. Nothing that ships is built with it.
+SIM_OBJS=$(OBJS:.o=.sim.o) $(TESTNET_OBJS:.o=.sim.o) testnet.sim.o
+
 # Disable codesign since open source users will not have ZeroTier's certs
 CODESIGN=echo
 CODESIGN_CERT=
@@ -34,7 +39,7 @@ ifeq ($(ZT_DEBUG),1)
 	STRIP=echo
 	# The following line enables optimization for the crypto code, since
 	# C25519 in particular is almost UNUSABLE in heavy testing without it.
-ext/lz4/lz4.o node/Salsa20.o node/SHA512.o node/C25519.o node/Poly1305.o: CFLAGS = -Wall -O2 -g -pthread $(INCLUDES) $(DEFS)
+ext/lz4/lz4.o node/Salsa20.o node/SHA512.o node/C25519.o node/Poly1305.o ext/lz4/lz4.sim.o node/Salsa20.sim.o node/SHA512.sim.o node/C25519.sim.o node/Poly1305.sim.o: CFLAGS = -Wall -O2 -g -pthread $(INCLUDES) $(DEFS)
 else
 	CFLAGS=-arch i386 -arch x86_64 -Wall -O3 -flto -fPIE -fvectorize -fstack-protector -pthread -mmacosx-version-min=10.6 -DNDEBUG -Wno-unused-private-field $(INCLUDES) $(DEFS)
 	STRIP=strip
@@ -54,10 +59,20 @@ selftest: $(OBJS) sefltest.o
 	$(CXX) $(CXXFLAGS) -o zerotier-selftest selftest.o $(OBJS) $(LIBS)
 	$(STRIP) zerotier-selftest
 
-testnet: $(TESTNET_OBJS) $(OBJS) testnet.o
-	$(CXX) $(CXXFLAGS) -o zerotier-testnet testnet.o $(OBJS) $(TESTNET_OBJS) $(LIBS)
+bench: $(OBJS) bench.o
+	$(CXX) $(CXXFLAGS) -o zerotier-bench bench.o $(OBJS) $(LIBS)
+	$(STRIP) zerotier-bench
+
+testnet: $(SIM_OBJS)
+	$(CXX) $(CXXFLAGS) -o zerotier-testnet $(SIM_OBJS) $(LIBS)
 	$(STRIP) zerotier-testnet
 
+%.sim.o: %.cpp
+	$(CXX) $(CXXFLAGS) -DZT_SIMULATION -c -o $@ $<
+
+%.sim.o: %.c
+	$(CC) $(CFLAGS) -DZT_SIMULATION -c -o $@ $<
+
 # Requires that ../Qt be symlinked to the Qt root to use for UI build
 mac-ui: FORCE
 	mkdir -p build-ZeroTierUI-release
@@ -68,7 +83,7 @@ mac-ui: FORCE
 	$(CODESIGN) -vvv "build-ZeroTierUI-release/ZeroTier One.app"
 
 clean:
-	rm -rf *.dSYM testnet.o selftest.o build-* *.o $(OBJS) $(TESTNET_OBJS) zerotier-* ZeroTierOneInstaller-* "ZeroTier One.zip" "ZeroTier One.dmg"
+	rm -rf *.dSYM testnet.o selftest.o build-* *.o $(OBJS) $(TESTNET_OBJS) $(SIM_OBJS) zerotier-* ZeroTierOneInstaller-* "ZeroTier One.zip" "ZeroTier One.dmg"
 
 # For our use -- builds official signed binary, packages in installer and download DMG
 official: FORCE
@@ -43,6 +43,7 @@ var ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATE_OF_MEMBERSHIP = "com";
 var ZT_NETWORKCONFIG_DICT_KEY_ENABLE_BROADCAST = "eb";
 var ZT_NETWORKCONFIG_DICT_KEY_ALLOW_PASSIVE_BRIDGING = "pb";
 var ZT_NETWORKCONFIG_DICT_KEY_ACTIVE_BRIDGES = "ab";
+var ZT_NETWORKCONFIG_DICT_KEY_COMPRESSION_ACCELERATION = "ca";
 
 // Path to zerotier-idtool binary, invoked to enerate certificates of membership
 var ZEROTIER_IDTOOL = '/usr/local/bin/zerotier-idtool';
@@ -533,6 +534,8 @@ function doNetconfRequest(message)
 					netconf.data[ZT_NETWORKCONFIG_DICT_KEY_ISSUED_TO] = peerId.address();
 					if (network['multicastLimit'])
 						netconf.data[ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_LIMIT] = network['multicastLimit'];
+					if (network['compressionAcceleration'])
+						netconf.data[ZT_NETWORKCONFIG_DICT_KEY_COMPRESSION_ACCELERATION] = network['compressionAcceleration'];
 					if (network['multicastRates']) {
 						var ratesD = new Dictionary();
 						var ratesJ = JSON.parse(network['multicastRates']);
@@ -166,6 +166,11 @@ public:
 		return _a;
 	}
 
+	/**
+	 * @return Hash code for use with Hashtable
+	 */
+	inline unsigned long hashCode() const throw() { return (unsigned long)_a; }
+
 	/**
 	 * Test whether this address is within a multicast propagation prefix
 	 *
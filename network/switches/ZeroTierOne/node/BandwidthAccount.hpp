@@ -103,7 +103,7 @@ public:
 		double lt = _lastTime;
 		double now = Utils::nowf();
 		_lastTime = now;
-		return (_balance = std::min(_maxBalance,(uint32_t)round((double)_balance + ((double)_accrual * (now - lt)))));
+		return (_balance = (uint32_t)std::min((double)_maxBalance,round((double)_balance + ((double)_accrual * (now - lt)))));
 	}
 
 	/**
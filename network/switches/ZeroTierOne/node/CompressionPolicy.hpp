@@ -0,0 +1,199 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+#ifndef ZT_COMPRESSIONPOLICY_HPP
+#define ZT_COMPRESSIONPOLICY_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Constants.hpp"
+#include "Address.hpp"
+#include "Packet.hpp"
+#include "NonCopyable.hpp"
+
+#ifdef __WINDOWS__
+#include <WinSock2.h>
+#include <Windows.h>
+#endif
+
+/**
+ * Number of flow slots (must be a power of two)
+ */
+#define ZT_COMPRESSION_POLICY_SLOTS 1024
+
+/**
+ * Compressed/original ratio (out of 256) at or above which a flow is skipped
+ */
+#define ZT_COMPRESSION_POLICY_SKIP_RATIO 243
+
+/**
+ * Try compressing a skipped flow again after this many skipped packets
+ */
+#define ZT_COMPRESSION_POLICY_PROBE_INTERVAL 64
+
+namespace ZeroTier {
+
+/**
+ * Decides per flow whether packets are worth running through LZ4
+ *
+ * A flow is a (peer, ethertype) pair. Each flow keeps a moving average of
+ * its compressed/original size ratio. Once that shows the flow doesn't
+ * compress (e.g. TLS, SSH, or tunneled encrypted traffic) we stop running
+ * LZ4 on it, except for one probe packet every so often in case the
+ * traffic changes.
+ *
+ * Flows live in a fixed direct-mapped table, so a collision just resets
+ * the slot and costs at most a few wasted compression attempts. This is
+ * on the send path for every frame, so it takes no locks: slot updates may
+ * race and counters are updated atomically.
+ */
+class CompressionPolicy : NonCopyable
+{
+public:
+	/**
+	 * Counters exported for status reporting
+	 */
+	struct Stats
+	{
+		uint64_t packetsCompressed; // LZ4 was run and reduced size
+		uint64_t packetsIncompressible; // LZ4 was run but could not reduce size
+		uint64_t packetsSkipped; // LZ4 was not run due to poor flow ratio
+		uint64_t bytesSaved; // total reduction in payload size
+		uint64_t bytesSkipped; // payload bytes we didn't run through LZ4 (proportional to CPU saved)
+	};
+
+	CompressionPolicy()
+	{
+		memset((void *)_slots,0,sizeof(_slots));
+		memset((void *)&_stats,0,sizeof(_stats));
+	}
+
+	/**
+	 * Compress a packet's payload if its flow has been compressing well
+	 *
+	 * @param packet Packet to (maybe) compress
+	 * @param peer Peer to which packet is being sent
+	 * @param etherType Ethernet type of frame in packet
+	 * @param acceleration LZ4 acceleration level from network config
+	 * @return True if packet was compressed
+	 */
+	inline bool compress(Packet &packet,const Address &peer,unsigned int etherType,int acceleration = 1)
+	{
+		const uint64_t key = (peer.toInt() << 16) | (uint64_t)(etherType & 0xffff) | 0x8000000000000000ULL; // high bit marks slot as used
+		_Slot &s = _slots[_slotIndex(key)];
+		const unsigned int before = packet.size();
+
+		// Slots are read and written without a lock. Two threads racing on a
+		// slot can lose a ratio sample or reset it early, which only costs an
+		// extra compression attempt or a skipped packet.
+		unsigned int ratio = s.ratio;
+		if (s.key != key) {
+			s.key = key;
+			ratio = 0;
+			s.skipped = 0;
+		} else if ((ratio >= ZT_COMPRESSION_POLICY_SKIP_RATIO)&&(++s.skipped < ZT_COMPRESSION_POLICY_PROBE_INTERVAL)) {
+			_add(&_stats.packetsSkipped,1);
+			_add(&_stats.bytesSkipped,before);
+			return false;
+		}
+
+		const bool compressed = packet.compress(acceleration);
+		const unsigned int sample = (compressed) ? ((packet.size() << 8) / before) : 256;
+
+		if (s.key == key) {
+			s.ratio = ((ratio * 7) + sample) >> 3;
+			s.skipped = 0;
+		}
+		if (compressed) {
+			_add(&_stats.packetsCompressed,1);
+			_add(&_stats.bytesSaved,before - packet.size());
+		} else _add(&_stats.packetsIncompressible,1);
+
+		return compressed;
+	}
+
+	/**
+	 * @return Snapshot of counters (not taken atomically as a set)
+	 */
+	inline Stats stats() const
+	{
+		Stats st;
+		st.packetsCompressed = _stats.packetsCompressed;
+		st.packetsIncompressible = _stats.packetsIncompressible;
+		st.packetsSkipped = _stats.packetsSkipped;
+		st.bytesSaved = _stats.bytesSaved;
+		st.bytesSkipped = _stats.bytesSkipped;
+		return st;
+	}
+
+private:
+	struct _Slot
+	{
+		volatile uint64_t key; // (address << 16) | ethertype, high bit set if used
+		volatile unsigned int ratio; // moving average of compressed/original * 256
+		volatile unsigned int skipped; // packets skipped since last probe
+	};
+
+	struct _Counters
+	{
+		volatile uint64_t packetsCompressed;
+		volatile uint64_t packetsIncompressible;
+		volatile uint64_t packetsSkipped;
+		volatile uint64_t bytesSaved;
+		volatile uint64_t bytesSkipped;
+	};
+
+	static inline unsigned int _slotIndex(uint64_t key) throw()
+	{
+		key ^= (key >> 29);
+		key *= 0xbf58476d1ce4e5b9ULL;
+		key ^= (key >> 32);
+		return (unsigned int)(key & (ZT_COMPRESSION_POLICY_SLOTS - 1));
+	}
+
+	static inline void _add(volatile uint64_t *v,uint64_t n) throw()
+	{
+#ifdef __GNUC__
+		__sync_fetch_and_add(v,n);
+#else
+#ifdef __WINDOWS__
+		InterlockedExchangeAdd64((volatile LONGLONG *)v,(LONGLONG)n);
+#else
+		*v += n; // may lose an occasional update, but this is just stats
+#endif
+#endif
+	}
+
+	_Slot _slots[ZT_COMPRESSION_POLICY_SLOTS];
+	_Counters _stats;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+#ifndef ZT_CONDITION_HPP
+#define ZT_CONDITION_HPP
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+
+#ifdef __WINDOWS__
+
+#include <WinSock2.h>
+#include <Windows.h>
+
+namespace ZeroTier {
+
+class Condition : NonCopyable
+{
+public:
+	Condition()
+		throw()
+	{
+		_ev = CreateEvent(NULL,FALSE,FALSE,NULL);
+	}
+
+	~Condition()
+	{
+		CloseHandle(_ev);
+	}
+
+	inline void wait() const
+		throw()
+	{
+		WaitForSingleObject(_ev,INFINITE);
+	}
+
+	inline void wait(unsigned long ms) const
+		throw()
+	{
+		WaitForSingleObject(_ev,(DWORD)ms);
+	}
+
+	inline void signal() const
+		throw()
+	{
+		SetEvent(_ev);
+	}
+
+private:
+	HANDLE _ev;
+};
+
+} // namespace ZeroTier
+
+#else // !__WINDOWS__
+
+#include <time.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+namespace ZeroTier {
+
+/**
+ * An auto-reset event
+ *
+ * signal() wakes one waiter, or the next caller of wait() if nobody is
+ * waiting. Signals do not accumulate.
+ */
+class Condition : NonCopyable
+{
+public:
+	Condition()
+		throw() :
+		_signaled(false)
+	{
+		pthread_mutex_init(&_mh,(const pthread_mutexattr_t *)0);
+		pthread_cond_init(&_cond,(const pthread_condattr_t *)0);
+	}
+
+	~Condition()
+	{
+		pthread_cond_destroy(&_cond);
+		pthread_mutex_destroy(&_mh);
+	}
+
+	/**
+	 * Wait until signaled
+	 */
+	inline void wait() const
+		throw()
+	{
+		pthread_mutex_lock(const_cast <pthread_mutex_t *>(&_mh));
+		while (!_signaled)
+			pthread_cond_wait(const_cast <pthread_cond_t *>(&_cond),const_cast <pthread_mutex_t *>(&_mh));
+		_signaled = false;
+		pthread_mutex_unlock(const_cast <pthread_mutex_t *>(&_mh));
+	}
+
+	/**
+	 * Wait until signaled or until a timeout expires
+	 *
+	 * @param ms Maximum time to wait in milliseconds
+	 */
+	inline void wait(unsigned long ms) const
+		throw()
+	{
+		struct timeval now;
+		gettimeofday(&now,(struct timezone *)0);
+		struct timespec ts;
+		ts.tv_sec = now.tv_sec + (time_t)(ms / 1000);
+		ts.tv_nsec = (long)(now.tv_usec * 1000) + (long)((ms % 1000) * 1000000);
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_nsec -= 1000000000L;
+			++ts.tv_sec;
+		}
+		pthread_mutex_lock(const_cast <pthread_mutex_t *>(&_mh));
+		while (!_signaled) {
+			if (pthread_cond_timedwait(const_cast <pthread_cond_t *>(&_cond),const_cast <pthread_mutex_t *>(&_mh),&ts))
+				break;
+		}
+		_signaled = false;
+		pthread_mutex_unlock(const_cast <pthread_mutex_t *>(&_mh));
+	}
+
+	/**
+	 * Wake one waiting thread
+	 */
+	inline void signal() const
+		throw()
+	{
+		pthread_mutex_lock(const_cast <pthread_mutex_t *>(&_mh));
+		_signaled = true;
+		pthread_cond_signal(const_cast <pthread_cond_t *>(&_cond));
+		pthread_mutex_unlock(const_cast <pthread_mutex_t *>(&_mh));
+	}
+
+private:
+	pthread_cond_t _cond;
+	pthread_mutex_t _mh;
+	mutable bool _signaled;
+};
+
+} // namespace ZeroTier
+
+#endif // !__WINDOWS__
+
+#endif
@@ -195,6 +195,16 @@
  */
 #define ZT_DB_CLEAN_PERIOD 120000
 
+/**
+ * How often to write a peer snapshot for warm restart, in ms
+ */
+#define ZT_PEER_SNAPSHOT_INTERVAL 300000
+
+/**
+ * How often to write metrics.prom if metricsExport=1 in local.conf, in ms
+ */
+#define ZT_METRICS_EXPORT_INTERVAL 10000
+
 /**
  * How long to remember peer records in RAM if they haven't been used
  */
@@ -220,6 +230,23 @@
  */
 #define ZT_RECEIVE_QUEUE_TIMEOUT (ZT_WHOIS_RETRY_DELAY * (ZT_MAX_WHOIS_RETRIES + 1))
 
+/**
+ * Number of background threads validating identities from HELLO
+ */
+#define ZT_IDENTITY_VALIDATION_THREADS 2
+
+/**
+ * Maximum number of identities waiting for background validation
+ *
+ * HELLOs arriving when this is full are dropped. The sender will retry.
+ */
+#define ZT_IDENTITY_VALIDATION_MAX_QUEUE 1024
+
+/**
+ * Maximum number of remembered identity validation results
+ */
+#define ZT_IDENTITY_VALIDATION_CACHE_SIZE 16384
+
 /**
  * Maximum number of ZT hops allowed (this is not IP hops/TTL)
  * 
@@ -255,7 +282,26 @@
 #define ZT_MULTICAST_DEFAULT_LIMIT 32
 
 /**
- * Delay between scans of the topology active peer DB for peers that need ping
+ * Maximum LZ4 acceleration a network config may request for frame compression
+ */
+#define ZT_MAX_COMPRESSION_ACCELERATION 64
+
+/**
+ * Number of independently locked shards in the multicast group database
+ *
+ * Groups are assigned to shards by hash of network ID and group, so busy
+ * groups (e.g. broadcast and ARP on a supernode) don't serialize LIKE and
+ * GATHER processing for every other group. Must be a power of two.
+ */
+#define ZT_MULTICAST_GROUP_SHARDS 16
+
+/**
+ * Maximum number of armored multicast packets batched for one UDP send call
+ */
+#define ZT_MULTICAST_FANOUT_BATCH_SIZE 32
+
+/**
+ * Delay before re-pinging a peer whose keepalive went unanswered
  */
 #define ZT_PING_CHECK_DELAY 10000
 
@@ -309,6 +355,52 @@
  */
 #define ZT_PEER_PATH_ACTIVITY_TIMEOUT ZT_PEER_ACTIVITY_TIMEOUT
 
+/**
+ * Minimum time between keepalive scheduler runs
+ */
+#define ZT_KEEPALIVE_TICK_INTERVAL 100
+
+/**
+ * Maximum keepalive pings sent per scheduler run
+ *
+ * At one run per ZT_KEEPALIVE_TICK_INTERVAL this caps keepalives at 2560/sec,
+ * enough for about 300k active peers at the default interval.
+ */
+#define ZT_KEEPALIVE_MAX_PER_TICK 256
+
+/**
+ * Default keepalive interval for supernodes (0 to disable)
+ */
+#define ZT_KEEPALIVE_SUPERNODE_INTERVAL ZT_PEER_DIRECT_PING_DELAY
+
+/**
+ * Default keepalive interval for peers we've exchanged frames with recently (0 to disable)
+ */
+#define ZT_KEEPALIVE_ACTIVE_INTERVAL ZT_PEER_DIRECT_PING_DELAY
+
+/**
+ * Default keepalive interval for other peers (0 to disable)
+ */
+#define ZT_KEEPALIVE_IDLE_INTERVAL 0
+
+/**
+ * How often to re-check peers that don't currently get keepalives
+ */
+#define ZT_KEEPALIVE_IDLE_RECHECK_INTERVAL 30000
+
+/**
+ * Deadlines are moved earlier by up to interval / this to spread out bursts
+ */
+#define ZT_KEEPALIVE_JITTER_DIVISOR 8
+
+/**
+ * Number of buckets in the keepalive pings-per-second histogram
+ *
+ * Bucket i counts seconds with between 2^i and 2^(i+1)-1 pings sent, and
+ * the last bucket is open ended.
+ */
+#define ZT_KEEPALIVE_HISTOGRAM_BUCKETS 12
+
 /**
  * Close TCP sockets if unused for this long (SocketManager)
  */
@@ -362,6 +454,20 @@
  */
 #define ZT_NETWORK_CERTIFICATE_TTL_WINDOW (ZT_NETWORK_AUTOCONF_DELAY * 4)
 
+/**
+ * How long a network controller reuses a signed config for the same request
+ *
+ * Cached configs carry the certificate of membership they were signed with,
+ * so this must leave members plenty of the COM TTL window after the last
+ * time a cached copy is handed out.
+ */
+#define ZT_NETCONF_CACHE_TTL (ZT_NETWORK_CERTIFICATE_TTL_WINDOW / 2)
+
+/**
+ * Most (network, member) pairs a network controller caches configs for
+ */
+#define ZT_NETCONF_CACHE_MAX_ENTRIES 262144
+
 /**
  * How often to broadcast beacons over physical local LANs
  */
@@ -410,11 +516,51 @@
  */
 #define ZT_MAX_BRIDGE_SPAM 16
 
+/**
+ * Number of slots in an async Logger's ring (must be a power of two)
+ */
+#define ZT_LOGGER_ASYNC_RING_SIZE 1024
+
+/**
+ * Longest message an async Logger keeps, longer ones are truncated
+ */
+#define ZT_LOGGER_ASYNC_MAX_MESSAGE 384
+
+/**
+ * How often an async Logger's writer thread wakes up to write, in ms
+ */
+#define ZT_LOGGER_ASYNC_FLUSH_INTERVAL 100
+
 /**
  * Timeout for IPC connections (e.g. unix domain sockets) in seconds
  */
 #define ZT_IPC_TIMEOUT 600
 
+/**
+ * How often the binary control stream checks for changes to send subscribers, in ms
+ */
+#define ZT_CONTROL_STREAM_INTERVAL 1000
+
+/**
+ * Unauthenticated control stream connections are closed after this many ms
+ */
+#define ZT_CONTROL_STREAM_AUTH_TIMEOUT 10000
+
+/**
+ * Control stream clients with more than this many bytes unread are disconnected
+ */
+#define ZT_CONTROL_STREAM_MAX_BACKLOG 4194304
+
+/**
+ * Most messages that may wait to be written to a service subprocess
+ */
+#define ZT_SERVICE_MAX_QUEUE 1024
+
+/**
+ * Service requests not answered in this many ms no longer block duplicates
+ */
+#define ZT_SERVICE_REQUEST_TIMEOUT 10000
+
 /**
  * A test pseudo-network-ID that can be joined
  *
@@ -0,0 +1,213 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "DictionaryReader.hpp"
+#include "Identity.hpp"
+
+namespace ZeroTier {
+
+DictionaryReader::DictionaryReader(const char *s,unsigned int len) :
+	_s(s)
+{
+	unsigned int kstart = 0,kend = 0,start = 0,i = 0;
+	bool kesc = false,esc = false,inKey = true;
+	while ((i < len)&&(s[i])) {
+		const char c = s[i];
+		if (c == '\\') {
+			esc = true;
+			if ((++i >= len)||(!s[i]))
+				break;
+		} else if (c == '=') {
+			if (inKey) {
+				kstart = start;
+				kend = i;
+				kesc = esc;
+				start = i + 1;
+				esc = false;
+				inKey = false;
+			} else esc = true; // Dictionary::fromString() drops unescaped '=' in values
+		} else if ((c == '\r')||(c == '\n')) {
+			if (inKey) {
+				if (i > start)
+					_add(start,i,esc,i,i,false,true);
+			} else _add(kstart,kend,kesc,start,i,esc,false);
+			start = i + 1;
+			esc = false;
+			inKey = true;
+		}
+		++i;
+	}
+	if (inKey) {
+		if (i > start)
+			_add(start,i,esc,i,i,false,true);
+	} else _add(kstart,kend,kesc,start,i,esc,false);
+
+	std::stable_sort(_fields.begin(),_fields.end(),_FieldLess(this));
+
+	if (_fields.size() > 1) {
+		std::vector<_Field>::iterator w(_fields.begin());
+		for(std::vector<_Field>::iterator r(_fields.begin() + 1);r!=_fields.end();++r) {
+			if (_cmp(*w,_ptr(r->k,r->kesc),r->klen) == 0) {
+				// Dictionary::fromString() appends the value of a repeated key to the first
+				std::string tmp(_ptr(w->v,w->vesc),w->vlen);
+				tmp.append(_ptr(r->v,r->vesc),r->vlen);
+				w->v = (unsigned int)_esc.length();
+				w->vlen = (unsigned int)tmp.length();
+				w->vesc = true;
+				_esc.append(tmp);
+			} else *(++w) = *r;
+		}
+		_fields.erase(w + 1,_fields.end());
+	}
+}
+
+bool DictionaryReader::get(const char *key,const char *&v,unsigned int &vlen) const
+	throw()
+{
+	const unsigned int klen = (unsigned int)strlen(key);
+	unsigned int lo = 0,hi = (unsigned int)_fields.size();
+	while (lo < hi) {
+		const unsigned int mid = (lo + hi) / 2;
+		const int c = _cmp(_fields[mid],key,klen);
+		if (c < 0)
+			lo = mid + 1;
+		else if (c > 0)
+			hi = mid;
+		else {
+			v = _ptr(_fields[mid].v,_fields[mid].vesc);
+			vlen = _fields[mid].vlen;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool DictionaryReader::verify(const Identity &id) const
+{
+	try {
+		const char *sig;
+		unsigned int siglen;
+		if (!get(ZT_DICTIONARY_SIGNATURE,sig,siglen))
+			return false;
+
+		// Same blob as Dictionary::_mkSigBuf(), which sorts keys the same way
+		std::string buf;
+		unsigned int buflen = 5;
+		for(std::vector<_Field>::const_iterator f(_fields.begin());f!=_fields.end();++f)
+			buflen += f->klen + f->vlen + 2;
+		buf.reserve(buflen);
+		const unsigned int sigKeyLen = (unsigned int)strlen(ZT_DICTIONARY_SIGNATURE);
+		unsigned long pairs = 0;
+		for(std::vector<_Field>::const_iterator f(_fields.begin());f!=_fields.end();++f) {
+			if (_cmp(*f,ZT_DICTIONARY_SIGNATURE,sigKeyLen) != 0) {
+				buf.append(_ptr(f->k,f->kesc),f->klen);
+				buf.push_back('=');
+				buf.append(_ptr(f->v,f->vesc),f->vlen);
+				buf.push_back('\0');
+				++pairs;
+			}
+		}
+		buf.push_back((char)0xff);
+		buf.push_back((char)((pairs >> 24) & 0xff));
+		buf.push_back((char)((pairs >> 16) & 0xff));
+		buf.push_back((char)((pairs >> 8) & 0xff));
+		buf.push_back((char)(pairs & 0xff));
+
+		std::string sigbin(Utils::unhex(sig,siglen));
+		return id.verify(buf.data(),(unsigned int)buf.length(),sigbin.data(),(unsigned int)sigbin.length());
+	} catch ( ... ) {
+		return false;
+	}
+}
+
+int DictionaryReader::_cmp(const _Field &f,const char *key,unsigned int klen) const
+	throw()
+{
+	const int c = memcmp(_ptr(f.k,f.kesc),key,std::min(f.klen,klen));
+	if (c)
+		return c;
+	return ((f.klen < klen) ? -1 : ((f.klen > klen) ? 1 : 0));
+}
+
+void DictionaryReader::_add(unsigned int kstart,unsigned int kend,bool kesc,unsigned int vstart,unsigned int vend,bool vesc,bool keyOnly)
+{
+	_Field f;
+	if (kesc) {
+		f.k = (unsigned int)_esc.length();
+		f.klen = _unescape(kstart,kend);
+		if ((keyOnly)&&(!f.klen)) // a line that unescapes to nothing, e.g. a lone backslash
+			return;
+	} else {
+		f.k = kstart;
+		f.klen = kend - kstart;
+	}
+	f.kesc = kesc;
+	if (vesc) {
+		f.v = (unsigned int)_esc.length();
+		f.vlen = _unescape(vstart,vend);
+	} else {
+		f.v = vstart;
+		f.vlen = vend - vstart;
+	}
+	f.vesc = vesc;
+	_fields.push_back(f);
+}
+
+unsigned int DictionaryReader::_unescape(unsigned int start,unsigned int end)
+{
+	const unsigned int l = (unsigned int)_esc.length();
+	for(unsigned int i=start;i<end;++i) {
+		if (_s[i] == '\\') {
+			if (++i >= end)
+				break;
+			switch(_s[i]) {
+				case '0':
+					_esc.push_back((char)0);
+					break;
+				case 'r':
+					_esc.push_back('\r');
+					break;
+				case 'n':
+					_esc.push_back('\n');
+					break;
+				default:
+					_esc.push_back(_s[i]);
+					break;
+			}
+		} else if (_s[i] != '=') {
+			_esc.push_back(_s[i]);
+		}
+	}
+	return ((unsigned int)_esc.length() - l);
+}
+
+} // namespace ZeroTier
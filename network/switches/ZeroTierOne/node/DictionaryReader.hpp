@@ -0,0 +1,194 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+#ifndef ZT_DICTIONARYREADER_HPP
+#define ZT_DICTIONARYREADER_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "Constants.hpp"
+#include "Dictionary.hpp"
+#include "NonCopyable.hpp"
+#include "Utils.hpp"
+
+namespace ZeroTier {
+
+class Identity;
+
+/**
+ * Read-only view of a string-serialized Dictionary
+ *
+ * This parses the same format as Dictionary::fromString() in one pass,
+ * but keys and values are returned as pointers into the buffer it was
+ * given instead of being copied into a map of strings. Only fields that
+ * contain backslash escapes are unescaped, into one scratch buffer owned
+ * by the reader.
+ *
+ * The buffer must remain valid and unchanged for the life of the reader.
+ * Values returned by get() are not null-terminated.
+ *
+ * Use Dictionary to build, modify, and sign dictionaries, and this to read
+ * large ones like network configs as they arrive.
+ */
+class DictionaryReader : NonCopyable
+{
+public:
+	/**
+	 * @param s String-serialized dictionary (parsing stops at len or a zero byte)
+	 * @param len Length of buffer
+	 */
+	DictionaryReader(const char *s,unsigned int len);
+
+	/**
+	 * @return Number of distinct keys
+	 */
+	inline unsigned int size() const throw() { return (unsigned int)_fields.size(); }
+
+	/**
+	 * Get a key and value by index (fields are sorted by key)
+	 *
+	 * @param i Index from 0 to size()-1
+	 * @param klen Result parameter: key length
+	 * @param v Result parameter: value
+	 * @param vlen Result parameter: value length
+	 * @return Key
+	 */
+	inline const char *field(unsigned int i,unsigned int &klen,const char *&v,unsigned int &vlen) const
+		throw()
+	{
+		const _Field &f = _fields[i];
+		klen = f.klen;
+		v = _ptr(f.v,f.vesc);
+		vlen = f.vlen;
+		return _ptr(f.k,f.kesc);
+	}
+
+	/**
+	 * Look up a key
+	 *
+	 * @param key Key to look up
+	 * @param v Result parameter: pointer to value if found
+	 * @param vlen Result parameter: length of value if found
+	 * @return True if key was found
+	 */
+	bool get(const char *key,const char *&v,unsigned int &vlen) const
+		throw();
+
+	/**
+	 * @param key Key to look up
+	 * @param dfl Default if not present
+	 * @return Copy of value or default
+	 */
+	inline std::string get(const char *key,const std::string &dfl) const
+	{
+		const char *v;
+		unsigned int vlen;
+		if (get(key,v,vlen))
+			return std::string(v,vlen);
+		return dfl;
+	}
+
+	/**
+	 * @param key Key to look up
+	 * @param dfl Default if not present
+	 * @return Value parsed as hex or default
+	 */
+	inline uint64_t getHex(const char *key,uint64_t dfl) const
+		throw()
+	{
+		const char *v;
+		unsigned int vlen;
+		if (get(key,v,vlen))
+			return (uint64_t)Utils::hexStrToU64(v,vlen);
+		return dfl;
+	}
+
+	/**
+	 * @param key Key to check
+	 * @return True if dictionary contains key
+	 */
+	inline bool contains(const char *key) const
+		throw()
+	{
+		const char *v;
+		unsigned int vlen;
+		return get(key,v,vlen);
+	}
+
+	/**
+	 * @return True if this dictionary is cryptographically signed
+	 */
+	inline bool hasSignature() const throw() { return contains(ZT_DICTIONARY_SIGNATURE); }
+
+	/**
+	 * @return Signature timestamp in milliseconds since epoch or 0 if none
+	 */
+	inline uint64_t signatureTimestamp() const throw() { return getHex(ZT_DICTIONARY_SIGNATURE_TIMESTAMP,0); }
+
+	/**
+	 * Verify signature against an identity
+	 *
+	 * This accepts exactly what Dictionary::verify() would for the same
+	 * serialized dictionary.
+	 *
+	 * @param id Identity to verify against
+	 * @return True if signature verification OK
+	 */
+	bool verify(const Identity &id) const;
+
+private:
+	// Offsets are into the source buffer, or into _esc if the field was unescaped
+	struct _Field
+	{
+		unsigned int k,klen,v,vlen;
+		bool kesc,vesc;
+	};
+
+	struct _FieldLess
+	{
+		_FieldLess(const DictionaryReader *r) : reader(r) {}
+		inline bool operator()(const _Field &a,const _Field &b) const throw() { return (reader->_cmp(a,reader->_ptr(b.k,b.kesc),b.klen) < 0); }
+		const DictionaryReader *reader;
+	};
+
+	inline const char *_ptr(unsigned int off,bool esc) const throw() { return ((esc) ? (_esc.data() + off) : (_s + off)); }
+	int _cmp(const _Field &f,const char *key,unsigned int klen) const throw();
+	void _add(unsigned int kstart,unsigned int kend,bool kesc,unsigned int vstart,unsigned int vend,bool vesc,bool keyOnly);
+	unsigned int _unescape(unsigned int start,unsigned int end);
+
+	const char *const _s;
+	std::vector<_Field> _fields;
+	std::string _esc;
+};
+
+} // namespace ZeroTier
+
+#endif
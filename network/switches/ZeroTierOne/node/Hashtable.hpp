@@ -0,0 +1,352 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+#ifndef ZT_HASHTABLE_HPP
+#define ZT_HASHTABLE_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stdexcept>
+#include <vector>
+
+#include "Constants.hpp"
+
+namespace ZeroTier {
+
+/**
+ * A minimal chained hash table
+ *
+ * std::map is a tree and gets slow for very large collections, and
+ * unordered_map is not available on all the compilers we support. This is
+ * a simple chained table with a power of two bucket count that grows as
+ * entries are added. Keys must be copyable and must either be integers or
+ * implement hashCode() returning an unsigned long.
+ *
+ * This is not thread safe. Caller must synchronize access.
+ */
+template<typename K,typename V>
+class Hashtable
+{
+private:
+	struct _Bucket
+	{
+		_Bucket(const K &k,const V &v) : k(k),v(v) {}
+		_Bucket(const K &k) : k(k),v() {}
+		K k;
+		V v;
+		_Bucket *next; // must be set manually for each _Bucket
+	};
+
+public:
+	/**
+	 * Iterator over entries in a Hashtable
+	 *
+	 * Iteration order is arbitrary. The table must not be modified (other
+	 * than by changing values in place) while an iterator is in use.
+	 */
+	class Iterator
+	{
+	public:
+		/**
+		 * @param ht Hash table to iterate over
+		 */
+		Iterator(Hashtable &ht) :
+			_idx(0),
+			_ht(&ht),
+			_b(ht._t[0])
+		{
+		}
+
+		/**
+		 * @param kptr Pointer to set to point to next key
+		 * @param vptr Pointer to set to point to next value
+		 * @return True if kptr and vptr are set, false if no more entries
+		 */
+		inline bool next(K *&kptr,V *&vptr)
+		{
+			for(;;) {
+				if (_b) {
+					kptr = &(_b->k);
+					vptr = &(_b->v);
+					_b = _b->next;
+					return true;
+				}
+				++_idx;
+				if (_idx >= _ht->_bc)
+					return false;
+				_b = _ht->_t[_idx];
+			}
+		}
+
+	private:
+		unsigned long _idx;
+		Hashtable *_ht;
+		typename Hashtable::_Bucket *_b;
+	};
+	friend class Hashtable::Iterator;
+
+	/**
+	 * @param bc Initial capacity in buckets (default: 64, rounded up to a power of two)
+	 */
+	Hashtable(unsigned long bc = 64) :
+		_t((_Bucket **)0),
+		_bc(_pow2(bc)),
+		_s(0)
+	{
+		if (!(_t = (_Bucket **)::malloc(sizeof(_Bucket *) * _bc)))
+			throw std::bad_alloc();
+		memset(_t,0,sizeof(_Bucket *) * _bc);
+	}
+
+	Hashtable(const Hashtable &ht) :
+		_t((_Bucket **)0),
+		_bc(ht._bc),
+		_s(ht._s)
+	{
+		if (!(_t = (_Bucket **)::malloc(sizeof(_Bucket *) * _bc)))
+			throw std::bad_alloc();
+		for(unsigned long i=0;i<_bc;++i) {
+			_Bucket *tail = (_Bucket *)0;
+			_t[i] = (_Bucket *)0;
+			for(const _Bucket *b=ht._t[i];b;b=b->next) {
+				_Bucket *nb = new _Bucket(b->k,b->v);
+				nb->next = (_Bucket *)0;
+				if (tail)
+					tail->next = nb;
+				else _t[i] = nb;
+				tail = nb;
+			}
+		}
+	}
+
+	~Hashtable()
+	{
+		this->clear();
+		::free(_t);
+	}
+
+	inline Hashtable &operator=(const Hashtable &ht)
+	{
+		if (this != &ht) {
+			this->clear();
+			if (ht._s) {
+				for(unsigned long i=0;i<ht._bc;++i) {
+					for(const _Bucket *b=ht._t[i];b;b=b->next)
+						this->set(b->k,b->v);
+				}
+			}
+		}
+		return *this;
+	}
+
+	/**
+	 * Erase all entries
+	 */
+	inline void clear()
+	{
+		if (_s) {
+			for(unsigned long i=0;i<_bc;++i) {
+				_Bucket *b = _t[i];
+				while (b) {
+					_Bucket *const nb = b->next;
+					delete b;
+					b = nb;
+				}
+				_t[i] = (_Bucket *)0;
+			}
+			_s = 0;
+		}
+	}
+
+	/**
+	 * @return Vector of all keys
+	 */
+	inline std::vector<K> keys() const
+	{
+		std::vector<K> k;
+		if (_s) {
+			k.reserve(_s);
+			for(unsigned long i=0;i<_bc;++i) {
+				for(const _Bucket *b=_t[i];b;b=b->next)
+					k.push_back(b->k);
+			}
+		}
+		return k;
+	}
+
+	/**
+	 * @param k Key
+	 * @return Pointer to value or NULL if not found
+	 */
+	inline V *get(const K &k)
+	{
+		for(_Bucket *b=_t[_bidx(k)];b;b=b->next) {
+			if (b->k == k)
+				return &(b->v);
+		}
+		return (V *)0;
+	}
+	inline const V *get(const K &k) const { return const_cast<Hashtable *>(this)->get(k); }
+
+	/**
+	 * @param k Key
+	 * @return True if key is present
+	 */
+	inline bool contains(const K &k) const { return (this->get(k) != (const V *)0); }
+
+	/**
+	 * @param k Key
+	 * @return True if value was present and was erased
+	 */
+	inline bool erase(const K &k)
+	{
+		const unsigned long bidx = _bidx(k);
+		_Bucket *lastb = (_Bucket *)0;
+		for(_Bucket *b=_t[bidx];b;b=b->next) {
+			if (b->k == k) {
+				if (lastb)
+					lastb->next = b->next;
+				else _t[bidx] = b->next;
+				delete b;
+				--_s;
+				return true;
+			}
+			lastb = b;
+		}
+		return false;
+	}
+
+	/**
+	 * @param k Key
+	 * @param v Value
+	 * @return Reference to value in table
+	 */
+	inline V &set(const K &k,const V &v)
+	{
+		V *const ev = this->get(k);
+		if (ev) {
+			*ev = v;
+			return *ev;
+		}
+		if (_s >= _bc)
+			_grow();
+		const unsigned long bidx = _bidx(k);
+		_Bucket *b = new _Bucket(k,v);
+		b->next = _t[bidx];
+		_t[bidx] = b;
+		++_s;
+		return b->v;
+	}
+
+	/**
+	 * @param k Key
+	 * @return Value, possibly newly created with its default constructor
+	 */
+	inline V &operator[](const K &k)
+	{
+		V *const ev = this->get(k);
+		if (ev)
+			return *ev;
+		if (_s >= _bc)
+			_grow();
+		const unsigned long bidx = _bidx(k);
+		_Bucket *b = new _Bucket(k);
+		b->next = _t[bidx];
+		_t[bidx] = b;
+		++_s;
+		return b->v;
+	}
+
+	/**
+	 * @return Number of entries
+	 */
+	inline unsigned long size() const throw() { return _s; }
+
+	/**
+	 * @return True if table is empty
+	 */
+	inline bool empty() const throw() { return (_s == 0); }
+
+private:
+	template<typename O>
+	static inline unsigned long _hc(const O &obj) { return obj.hashCode(); }
+	static inline unsigned long _hc(const uint64_t i) { return (unsigned long)(i ^ (i >> 32)); }
+	static inline unsigned long _hc(const uint32_t i) { return (unsigned long)i; }
+	static inline unsigned long _hc(const unsigned short i) { return (unsigned long)i; }
+	static inline unsigned long _hc(const int i) { return (unsigned long)i; }
+
+	// Fibonacci hashing mixes poorly distributed keys like MACs and IPs
+	inline unsigned long _bidx(const K &k) const
+	{
+		unsigned long h = _hc(k);
+		h ^= (h >> 16);
+		h *= 0x9e3779b1UL;
+		h ^= (h >> 15);
+		return (h & (_bc - 1));
+	}
+
+	static inline unsigned long _pow2(unsigned long n)
+	{
+		unsigned long p = 1;
+		while (p < n)
+			p <<= 1;
+		return p;
+	}
+
+	inline void _grow()
+	{
+		const unsigned long oldbc = _bc;
+		_Bucket **const oldt = _t;
+		_Bucket **nt = (_Bucket **)::malloc(sizeof(_Bucket *) * (oldbc * 2));
+		if (!nt)
+			return; // table will just get slower
+		memset(nt,0,sizeof(_Bucket *) * (oldbc * 2));
+		_t = nt;
+		_bc = oldbc * 2;
+		for(unsigned long i=0;i<oldbc;++i) {
+			_Bucket *b = oldt[i];
+			while (b) {
+				_Bucket *const nb = b->next;
+				const unsigned long bidx = _bidx(b->k);
+				b->next = _t[bidx];
+				_t[bidx] = b;
+				b = nb;
+			}
+		}
+		::free(oldt);
+	}
+
+	_Bucket **_t;
+	unsigned long _bc;
+	unsigned long _s;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 
 #ifdef __WINDOWS__
 #include <WinSock2.h>
@@ -41,325 +42,772 @@
 
 #ifdef __UNIX_LIKE__
 #include <unistd.h>
-#include <signal.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <netdb.h>
 #include <sys/select.h>
 #include <sys/types.h>
-#include <sys/stat.h>
 #include <sys/socket.h>
-#include <sys/wait.h>
+#include <netinet/in.h>
 #endif // __UNIX_LIKE__
 
 #include <vector>
 #include <utility>
 #include <algorithm>
+#include <stdexcept>
 
 #include "HttpClient.hpp"
+#include "InetAddress.hpp"
 #include "Thread.hpp"
 #include "Utils.hpp"
 #include "NonCopyable.hpp"
-#include "Defaults.hpp"
 
 namespace ZeroTier {
 
 #ifdef __UNIX_LIKE__
 
-// The *nix implementation calls 'curl' externally rather than linking to it.
-// This makes it an optional dependency that can be avoided in tiny systems
-// provided you don't want to have automatic software updates... or want to
-// do them via another method.
+// Largest status line plus headers we'll accept
+#define ZT_HTTPCLIENT_MAX_HEADER_LENGTH 65536
 
-#ifdef __APPLE__
-// TODO: get proxy configuration
-#endif
+// Idle keep-alive connections kept per host and port
+#define ZT_HTTPCLIENT_MAX_IDLE_PER_HOST 2
 
-// Paths where "curl" may be found on the system
-#define NUM_CURL_PATHS 6
-static const char *CURL_PATHS[NUM_CURL_PATHS] = { "/usr/bin/curl","/bin/curl","/usr/local/bin/curl","/usr/sbin/curl","/sbin/curl","/usr/libexec/curl" };
+// Longest the event loop sleeps in select() without anything to wake it
+#define ZT_HTTPCLIENT_MAX_POLL_INTERVAL 1000
 
-// Maximum message length
-#define CURL_MAX_MESSAGE_LENGTH (1024 * 1024 * 64)
+#ifdef MSG_NOSIGNAL
+#define ZT_HTTPCLIENT_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define ZT_HTTPCLIENT_SEND_FLAGS 0
+#endif
 
-// Internal private thread class that performs request, notifies handler,
-// and then commits suicide by deleting itself.
+// One request and the connection it is using, touched only by the event
+// loop thread except for _cancelled.
 class HttpClient_Private_Request : NonCopyable
 {
 public:
-	HttpClient_Private_Request(HttpClient *parent,const char *method,const std::string &url,const std::map<std::string,std::string> &headers,unsigned int timeout,void (*handler)(void *,int,const std::string &,const std::string &),void *arg) :
+	enum State
+	{
+		STATE_CONNECTING,
+		STATE_SENDING,
+		STATE_HEADERS,
+		STATE_BODY,
+		STATE_CHUNK_SIZE,
+		STATE_CHUNK_DATA,
+		STATE_CHUNK_END,
+		STATE_TRAILERS,
+		STATE_DONE
+	};
+
+	// Result of handing received data to _feed()
+	enum FeedResult
+	{
+		FEED_MORE,
+		FEED_COMPLETE,
+		FEED_ERROR
+	};
+
+	HttpClient_Private_Request(HttpClient *parent,const char *method,const std::string &url,const std::map<std::string,std::string> &headers,unsigned int timeout,bool (*sink)(void *,const void *,unsigned int),void (*handler)(void *,int,const std::string &,const std::string &),void *arg) :
+		_method(method),
 		_url(url),
 		_headers(headers),
 		_timeout(timeout),
+		_sink(sink),
 		_handler(handler),
 		_arg(arg),
 		_parent(parent),
-		_pid(0),
-		_cancelled(false)
+		_cancelled(false),
+		_state(STATE_CONNECTING),
+		_port(80),
+		_addrIdx(0),
+		_fd(-1),
+		_reused(false),
+		_received(false),
+		_outPtr(0),
+		_status(0),
+		_keepAlive(false),
+		_untilClose(false),
+		_remaining(0),
+		_connectDeadline(0),
+		_timesOutAt(0)
 	{
-		_myThread = Thread::start(this);
 	}
 
 	~HttpClient_Private_Request()
 	{
-		Mutex::Lock _l(_parent->_requests_m);
-		_parent->_requests.erase((HttpClient::Request)this);
+		if (_fd >= 0)
+			::close(_fd);
 	}
 
-	void threadMain()
+	// Parses URL and builds request, returns error message or NULL
+	inline const char *prepare()
 	{
-		char *curlArgs[1024];
-		char buf[16384];
-		fd_set readfds,writefds,errfds;
-		struct timeval tv;
+		if (_url.substr(0,7) != "http://")
+			return "only 'http' scheme is supported";
+		std::string::size_type slash = _url.find('/',7);
+		std::string hostPort(_url.substr(7,(slash == std::string::npos) ? std::string::npos : (slash - 7)));
+		_path = (slash == std::string::npos) ? std::string("/") : _url.substr(slash);
+		std::string::size_type hash = _path.find('#');
+		if (hash != std::string::npos)
+			_path.resize(hash);
+
+		std::string::size_type colon = hostPort.rfind(':');
+		if ((colon != std::string::npos)&&(hostPort.find(']',colon) == std::string::npos)) {
+			_port = Utils::strToUInt(hostPort.c_str() + colon + 1);
+			_host = hostPort.substr(0,colon);
+		} else _host = hostPort;
+		if ((_host.length() > 2)&&(_host[0] == '[')&&(_host[_host.length() - 1] == ']'))
+			_host = _host.substr(1,_host.length() - 2); // IPv6 literal
+		if ((!_host.length())||(!_port)||(_port > 0xffff))
+			return "invalid URL";
+
+		char portStr[16];
+		Utils::snprintf(portStr,sizeof(portStr),"%u",_port);
+		_key = _host;
+		_key.push_back('/');
+		_key.append(portStr);
+
+		_out = _method;
+		_out.push_back(' ');
+		_out.append(_path);
+		_out.append(" HTTP/1.1\r\nHost: ");
+		_out.append(hostPort);
+		_out.append("\r\nUser-Agent: ZeroTier One HttpClient/1.0\r\nAccept: */*\r\n");
+		for(std::map<std::string,std::string>::const_iterator h(_headers.begin());h!=_headers.end();++h) {
+			_out.append(h->first);
+			_out.append(": ");
+			_out.append(h->second);
+			_out.append("\r\n");
+		}
+		_out.append("\r\n");
+
+		return (const char *)0;
+	}
+
+	// Resolves host name (blocks the event loop), returns error message or NULL
+	inline const char *resolve()
+	{
+		struct addrinfo hints,*res = (struct addrinfo *)0;
+		char portStr[16];
+		memset(&hints,0,sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		Utils::snprintf(portStr,sizeof(portStr),"%u",_port);
+		if ((getaddrinfo(_host.c_str(),portStr,&hints,&res))||(!res))
+			return "unable to resolve host name";
+		for(struct addrinfo *a=res;a;a=a->ai_next) {
+			if ((a->ai_family == AF_INET)||(a->ai_family == AF_INET6))
+				_addrs.push_back(InetAddress(a->ai_addr));
+		}
+		freeaddrinfo(res);
+		return ((_addrs.empty()) ? "unable to resolve host name" : (const char *)0);
+	}
 
-		std::string curlPath;
-		for(int i=0;i<NUM_CURL_PATHS;++i) {
-			if (Utils::fileExists(CURL_PATHS[i])) {
-				curlPath = CURL_PATHS[i];
-				break;
+	// Starts a non-blocking connect to the next resolved address, returns false if none are left
+	inline bool connectNext(uint64_t now)
+	{
+		while (_addrIdx < _addrs.size()) {
+			const InetAddress &a = _addrs[_addrIdx++];
+			int s = ::socket(a.isV4() ? AF_INET : AF_INET6,SOCK_STREAM,0);
+			if (s < 0)
+				continue;
+			if (s >= FD_SETSIZE) {
+				::close(s);
+				return false;
 			}
+			fcntl(s,F_SETFL,O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+			{ int f = 1; setsockopt(s,SOL_SOCKET,SO_NOSIGPIPE,(void *)&f,sizeof(f)); }
+#endif
+			if (::connect(s,a.saddr(),a.saddrLen())) {
+				if (errno != EINPROGRESS) {
+					::close(s);
+					continue;
+				}
+				_state = STATE_CONNECTING;
+			} else _state = STATE_SENDING;
+			_fd = s;
+			_reused = false;
+			_connectDeadline = now + ((uint64_t)std::min(_parent->_connectTimeout,_timeout) * 1000ULL);
+			return true;
 		}
+		return false;
+	}
 
-		if (!curlPath.length()) {
-			_doH(_arg,-1,_url,"unable to locate 'curl' binary in /usr/bin, /bin, /usr/local/bin, /usr/sbin, or /sbin");
-			delete this;
-			return;
+	// Takes over an idle kept-alive connection
+	inline void reuse(int fd)
+	{
+		_fd = fd;
+		_reused = true;
+		_state = STATE_SENDING;
+	}
+
+	// Closes connection and starts over on a fresh one, e.g. after a kept-alive connection turned out to be closed
+	inline bool restart(uint64_t now)
+	{
+		::close(_fd);
+		_fd = -1;
+		_outPtr = 0;
+		_head = std::string();
+		_addrIdx = 0;
+		if ((_addrs.empty())&&(resolve()))
+			return false;
+		return connectNext(now);
+	}
+
+	// Handles received data, setting _error on FEED_ERROR
+	inline FeedResult feed(const char *data,unsigned int len)
+	{
+		std::string rest;
+		while (len) {
+			switch(_state) {
+				case STATE_HEADERS: {
+					const std::string::size_type searchFrom = (_head.length() > 3) ? (_head.length() - 3) : 0;
+					_head.append(data,len);
+					std::string::size_type e = _head.find("\r\n\r\n",searchFrom);
+					if (e != std::string::npos) {
+						e += 4;
+					} else if ((e = _head.find("\n\n",searchFrom)) != std::string::npos) {
+						e += 2;
+					} else {
+						if (_head.length() > ZT_HTTPCLIENT_MAX_HEADER_LENGTH) {
+							_error = "invalid HTTP response (headers too long)";
+							return FEED_ERROR;
+						}
+						return FEED_MORE;
+					}
+					rest = _head.substr(e);
+					_head.resize(e);
+					data = rest.data();
+					len = (unsigned int)rest.length();
+					if (!_parseHeaders())
+						return FEED_ERROR;
+					if (_state == STATE_DONE)
+						return ((len) ? _extraData() : FEED_COMPLETE);
+				}	break;
+
+				case STATE_BODY: {
+					const unsigned int n = (_untilClose) ? len : (unsigned int)std::min((uint64_t)len,_remaining);
+					if (!_body(data,n))
+						return FEED_ERROR;
+					data += n;
+					len -= n;
+					if (!_untilClose) {
+						if (!(_remaining -= n)) {
+							_state = STATE_DONE;
+							return ((len) ? _extraData() : FEED_COMPLETE);
+						}
+					}
+				}	break;
+
+				case STATE_CHUNK_SIZE:
+				case STATE_CHUNK_END:
+				case STATE_TRAILERS: {
+					const char *eol = (const char *)memchr(data,'\n',len);
+					const unsigned int n = (eol) ? (unsigned int)(eol - data) : len;
+					_line.append(data,n);
+					if (_line.length() > 1024) {
+						_error = "invalid HTTP response (bad chunked encoding)";
+						return FEED_ERROR;
+					}
+					if (!eol)
+						return FEED_MORE;
+					data += n + 1;
+					len -= n + 1;
+					if ((_line.length())&&(_line[_line.length() - 1] == '\r'))
+						_line.resize(_line.length() - 1);
+					if (_state == STATE_CHUNK_SIZE) {
+						if ((!_line.length())||(!isxdigit((unsigned char)_line[0]))) {
+							_error = "invalid HTTP response (bad chunked encoding)";
+							return FEED_ERROR;
+						}
+						_remaining = Utils::hexStrToU64(_line.c_str()); // stops at any ;extension
+						_state = (_remaining) ? STATE_CHUNK_DATA : STATE_TRAILERS;
+					} else if (_state == STATE_CHUNK_END) {
+						if (_line.length()) {
+							_error = "invalid HTTP response (bad chunked encoding)";
+							return FEED_ERROR;
+						}
+						_state = STATE_CHUNK_SIZE;
+					} else if (!_line.length()) {
+						_state = STATE_DONE;
+						return ((len) ? _extraData() : FEED_COMPLETE);
+					}
+					_line = std::string();
+				}	break;
+
+				case STATE_CHUNK_DATA: {
+					const unsigned int n = (unsigned int)std::min((uint64_t)len,_remaining);
+					if (!_body(data,n))
+						return FEED_ERROR;
+					data += n;
+					len -= n;
+					if (!(_remaining -= n))
+						_state = STATE_CHUNK_END;
+				}	break;
+
+				default:
+					return _extraData();
+			}
 		}
-		if (!_url.length()) {
-			_doH(_arg,-1,_url,"cannot fetch empty URL");
-			delete this;
-			return;
+		return FEED_MORE;
+	}
+
+	// Handles the server closing the connection, returns same as feed()
+	inline FeedResult closed()
+	{
+		if ((_state == STATE_BODY)&&(_untilClose)) {
+			_state = STATE_DONE;
+			return FEED_COMPLETE;
 		}
+		_error = "connection closed before response was complete";
+		return FEED_ERROR;
+	}
 
-		curlArgs[0] = const_cast <char *>(curlPath.c_str());
-		curlArgs[1] = const_cast <char *>("-D");
-		curlArgs[2] = const_cast <char *>("-"); // append headers before output
-		int argPtr = 3;
-		std::vector<std::string> headerArgs;
-		for(std::map<std::string,std::string>::const_iterator h(_headers.begin());h!=_headers.end();++h) {
-			headerArgs.push_back(h->first);
-			headerArgs.back().append(": ");
-			headerArgs.back().append(h->second);
+	// Calls handler unless cancelled
+	inline void finish(int code,const std::string &body)
+	{
+		_state = STATE_DONE;
+		Mutex::Lock _l(_parent->_handler_m);
+		try {
+			if ((!_cancelled)&&(_handler))
+				_handler(_arg,code,_url,body);
+		} catch ( ... ) {}
+	}
+
+	// Calls handler with the outcome of a complete response
+	inline void succeed()
+	{
+		if (_status == 200)
+			finish(200,(_sink) ? std::string() : _data);
+		else if (_statusMessage.length())
+			finish((int)_status,_statusMessage);
+		else finish((int)_status,"(no status message from server)");
+	}
+
+	const std::string _method;
+	const std::string _url;
+	const std::map<std::string,std::string> _headers;
+	const unsigned int _timeout;
+	bool (*_sink)(void *,const void *,unsigned int);
+	void (*_handler)(void *,int,const std::string &,const std::string &);
+	void *_arg;
+	HttpClient *_parent;
+	volatile bool _cancelled;
+
+	State _state;
+	std::string _host;
+	unsigned int _port;
+	std::string _key; // host/port for keep-alive connection pool
+	std::string _path;
+	std::vector<InetAddress> _addrs;
+	unsigned int _addrIdx;
+	int _fd;
+	bool _reused; // connection was kept alive from an earlier request
+	bool _received; // anything has been received on this connection
+	std::string _out;
+	unsigned int _outPtr;
+	std::string _head;
+	std::string _line;
+	unsigned int _status;
+	std::string _statusMessage;
+	bool _keepAlive;
+	bool _untilClose; // body ends when server closes connection
+	uint64_t _remaining; // in body or current chunk
+	std::string _data; // body if no sink
+	std::string _error;
+	uint64_t _connectDeadline;
+	uint64_t _timesOutAt;
+
+private:
+	inline bool _parseHeaders()
+	{
+		std::vector<std::string> lines;
+		lines.push_back(std::string());
+		for(std::string::const_iterator c(_head.begin());c!=_head.end();++c) {
+			if (*c == '\n') {
+				if (lines.back().length())
+					lines.push_back(std::string());
+			} else if (*c != '\r')
+				lines.back().push_back(*c);
+		}
+		if (!lines.back().length())
+			lines.pop_back();
+		_head = std::string();
+
+		if ((lines.empty())||(lines.front().substr(0,5) != "HTTP/")) {
+			_error = "invalid HTTP response (no status line)";
+			return false;
+		}
+		std::string::size_type scPos = lines.front().find(' ');
+		if (scPos == std::string::npos) {
+			_error = "invalid HTTP response (no status line)";
+			return false;
+		}
+		++scPos;
+		_status = Utils::strToUInt(lines.front().substr(scPos,3).c_str());
+		if ((_status < 100)||(_status > 999)) {
+			_error = "invalid HTTP response (invalid response code)";
+			return false;
 		}
-		for(std::vector<std::string>::iterator h(headerArgs.begin());h!=headerArgs.end();++h) {
-			if (argPtr >= (1024 - 4)) // leave room for terminating NULL and URL
-				break;
-			curlArgs[argPtr++] = const_cast <char *>("-H");
-			curlArgs[argPtr++] = const_cast <char *>(h->c_str());
+		_statusMessage = ((scPos + 4) < lines.front().length()) ? lines.front().substr(scPos + 4) : std::string();
+		if ((_status >= 100)&&(_status < 200))
+			return true; // interim response, wait for the real one
+
+		_keepAlive = (lines.front().substr(0,8) != "HTTP/1.0");
+		bool chunked = false,haveLength = false;
+		uint64_t length = 0;
+		for(std::vector<std::string>::iterator l(lines.begin() + 1);l!=lines.end();++l) {
+			std::string::size_type colon = l->find(':');
+			if (colon == std::string::npos)
+				continue;
+			std::string name(l->substr(0,colon));
+			for(std::string::iterator c(name.begin());c!=name.end();++c)
+				*c = (char)tolower((unsigned char)*c);
+			std::string value(Utils::trim(l->substr(colon + 1)));
+			for(std::string::iterator c(value.begin());c!=value.end();++c)
+				*c = (char)tolower((unsigned char)*c);
+			if (name == "connection") {
+				if (value.find("close") != std::string::npos)
+					_keepAlive = false;
+				else if (value.find("keep-alive") != std::string::npos)
+					_keepAlive = true;
+			} else if (name == "content-length") {
+				length = Utils::strToU64(value.c_str());
+				haveLength = true;
+			} else if (name == "transfer-encoding") {
+				chunked = (value.find("chunked") != std::string::npos);
+			}
 		}
-		curlArgs[argPtr++] = const_cast <char *>(_url.c_str());
-		curlArgs[argPtr] = (char *)0;
 
-		if (_cancelled) {
-			delete this;
-			return;
+		if ((_method == "HEAD")||(_status == 204)||(_status == 304)) {
+			_state = STATE_DONE;
+		} else if (chunked) {
+			_state = STATE_CHUNK_SIZE;
+		} else if (haveLength) {
+			_remaining = length;
+			_state = (length) ? STATE_BODY : STATE_DONE;
+		} else {
+			_untilClose = true;
+			_keepAlive = false;
+			_state = STATE_BODY;
 		}
+		if ((_status == 200)&&(!_sink)&&(haveLength)&&(length > ZT_HTTPCLIENT_MAX_BODY_LENGTH)) {
+			_error = "response too long";
+			return false;
+		}
+		return true;
+	}
 
-		int curlStdout[2];
-		int curlStderr[2];
-		::pipe(curlStdout);
-		::pipe(curlStderr);
-
-		_pid = (long)vfork();
-		if (_pid < 0) {
-			// fork() failed
-			::close(curlStdout[0]);
-			::close(curlStdout[1]);
-			::close(curlStderr[0]);
-			::close(curlStderr[1]);
-			_doH(_arg,-1,_url,"unable to fork()");
-			delete this;
-			return;
-		} else if (_pid > 0) {
-			// fork() succeeded, in parent process
-			::close(curlStdout[1]);
-			::close(curlStderr[1]);
-			fcntl(curlStdout[0],F_SETFL,O_NONBLOCK);
-			fcntl(curlStderr[0],F_SETFL,O_NONBLOCK);
-
-			int exitCode = -1;
-			unsigned long long timesOutAt = Utils::now() + ((unsigned long long)_timeout * 1000ULL);
-			bool timedOut = false;
-			bool tooLong = false;
-
-			while (!_cancelled) {
-				FD_ZERO(&readfds);
-				FD_ZERO(&writefds);
-				FD_ZERO(&errfds);
-				FD_SET(curlStdout[0],&readfds);
-				FD_SET(curlStderr[0],&readfds);
-				FD_SET(curlStdout[0],&errfds);
-				FD_SET(curlStderr[0],&errfds);
-				tv.tv_sec = 1;
-				tv.tv_usec = 0;
-				select(std::max(curlStdout[0],curlStderr[0])+1,&readfds,&writefds,&errfds,&tv);
-
-				if (FD_ISSET(curlStdout[0],&readfds)) {
-					int n = (int)::read(curlStdout[0],buf,sizeof(buf));
-					if (n > 0) {
-						_body.append(buf,n);
-						// Reset timeout when data is read...
-						timesOutAt = Utils::now() + ((unsigned long long)_timeout * 1000ULL);
-					} else if (n < 0)
-						break;
-					if (_body.length() > CURL_MAX_MESSAGE_LENGTH) {
-						tooLong = true;
-						break;
-					}
-				}
+	inline bool _body(const char *data,unsigned int len)
+	{
+		if ((_status != 200)||(!len))
+			return true; // bodies of other responses are read and discarded
+		if (_sink) {
+			bool more = false;
+			{
+				Mutex::Lock _l(_parent->_handler_m);
+				try {
+					more = ((_cancelled)||(_sink(_arg,data,len)));
+				} catch ( ... ) {}
+			}
+			if (!more) {
+				_error = "aborted by sink";
+				return false;
+			}
+		} else {
+			_data.append(data,len);
+			if (_data.length() > ZT_HTTPCLIENT_MAX_BODY_LENGTH) {
+				_error = "response too long";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// We never pipeline, so anything after the response means the connection can't be reused
+	inline FeedResult _extraData()
+	{
+		_keepAlive = false;
+		return FEED_COMPLETE;
+	}
+};
+
+// Event loop thread multiplexing all of a client's requests with select()
+class HttpClient_Private_Loop : NonCopyable
+{
+public:
+	HttpClient_Private_Loop(HttpClient *parent) :
+		_parent(parent),
+		_run(true)
+	{
+		int tmpfds[2];
+		if (::pipe(tmpfds))
+			throw std::runtime_error("pipe() failed");
+		_wakeSendPipe = tmpfds[1];
+		_wakeReceivePipe = tmpfds[0];
+		fcntl(_wakeReceivePipe,F_SETFL,O_NONBLOCK);
+		_thread = Thread::start(this);
+	}
 
-				if (FD_ISSET(curlStderr[0],&readfds))
-					::read(curlStderr[0],buf,sizeof(buf));
+	~HttpClient_Private_Loop()
+	{
+		_run = false;
+		wake();
+		Thread::join(_thread);
+		for(std::vector<HttpClient_Private_Request *>::iterator r(_new.begin());r!=_new.end();++r)
+			_active.push_back(*r);
+		for(std::vector<HttpClient_Private_Request *>::iterator r(_active.begin());r!=_active.end();++r)
+			_delete(*r);
+		for(std::multimap<std::string,_Idle>::iterator i(_idle.begin());i!=_idle.end();++i)
+			::close(i->second.fd);
+		::close(_wakeSendPipe);
+		::close(_wakeReceivePipe);
+	}
 
-				if (FD_ISSET(curlStdout[0],&errfds)||FD_ISSET(curlStderr[0],&errfds))
-					break;
+	// Hands a new request to the loop (any thread)
+	inline void add(HttpClient_Private_Request *r)
+	{
+		{
+			Mutex::Lock _l(_new_m);
+			_new.push_back(r);
+		}
+		wake();
+	}
 
-				if (Utils::now() >= timesOutAt) {
-					timedOut = true;
-					break;
-				}
+	inline void wake()
+	{
+		::write(_wakeSendPipe,(const void *)this,1); // data is arbitrary, just send a byte
+	}
 
-				if (waitpid(_pid,&exitCode,WNOHANG) > 0) {
-					for(;;) {
-						// Drain output...
-						int n = (int)::read(curlStdout[0],buf,sizeof(buf));
-						if (n <= 0)
-							break;
-						else {
-							_body.append(buf,n);
-							if (_body.length() > CURL_MAX_MESSAGE_LENGTH) {
-								tooLong = true;
-								break;
-							}
-						}
-					}
-					_pid = 0;
-					break;
-				}
-			}
+	void threadMain()
+		throw()
+	{
+		fd_set rfds,wfds;
+		struct timeval tv;
+		char buf[16384];
+		std::vector<HttpClient_Private_Request *> started;
+
+		while (_run) {
+			uint64_t now = Utils::now();
 
-			if (_pid > 0) {
-				::kill(_pid,SIGKILL);
-				waitpid(_pid,&exitCode,0);
+			{
+				Mutex::Lock _l(_new_m);
+				started.swap(_new);
 			}
-			_pid = 0;
-
-			::close(curlStdout[0]);
-			::close(curlStderr[0]);
-
-			if (timedOut)
-				_doH(_arg,-1,_url,"connection timed out");
-			else if (tooLong)
-				_doH(_arg,-1,_url,"response too long");
-			else if (exitCode)
-				_doH(_arg,-1,_url,"connection failed (curl returned non-zero exit code)");
-			else {
-				unsigned long idx = 0;
-
-				// Grab status line and headers, which will prefix output on
-				// success and will end with an empty line.
-				std::vector<std::string> headers;
-				headers.push_back(std::string());
-				while (idx < _body.length()) {
-					char c = _body[idx++];
-					if (c == '\n') {
-						if (!headers.back().length()) {
-							headers.pop_back();
-							break;
-						} else headers.push_back(std::string());
-					} else if (c != '\r')
-						headers.back().push_back(c);
+			for(std::vector<HttpClient_Private_Request *>::iterator r(started.begin());r!=started.end();++r) {
+				_active.push_back(*r);
+				_start(*r,now);
+			}
+			started.clear();
+
+			// Build descriptor sets, expiring anything that has timed out
+			int nfds = _wakeReceivePipe;
+			uint64_t wakeAt = now + ZT_HTTPCLIENT_MAX_POLL_INTERVAL;
+			FD_ZERO(&rfds);
+			FD_ZERO(&wfds);
+			FD_SET(_wakeReceivePipe,&rfds);
+			for(std::multimap<std::string,_Idle>::iterator i(_idle.begin());i!=_idle.end();) {
+				if ((now - i->second.since) >= ((uint64_t)_parent->_keepaliveTimeout * 1000ULL)) {
+					::close(i->second.fd);
+					_idle.erase(i++);
+				} else {
+					FD_SET(i->second.fd,&rfds); // readable means closed by server
+					nfds = std::max(nfds,i->second.fd);
+					wakeAt = std::min(wakeAt,(uint64_t)(i->second.since + ((uint64_t)_parent->_keepaliveTimeout * 1000ULL)));
+					++i;
 				}
-				if (headers.empty()||(!headers.front().length())) {
-					_doH(_arg,-1,_url,"HTTP response empty");
-					delete this;
-					return;
+			}
+			for(std::vector<HttpClient_Private_Request *>::iterator ri(_active.begin());ri!=_active.end();++ri) {
+				HttpClient_Private_Request *r = *ri;
+				if ((r->_state == HttpClient_Private_Request::STATE_DONE)||(r->_fd < 0))
+					continue;
+				if (r->_cancelled) {
+					r->_state = HttpClient_Private_Request::STATE_DONE;
+					continue;
 				}
-
-				// Parse first line -- HTTP status code and response
-				size_t scPos = headers.front().find(' ');
-				if (scPos == std::string::npos) {
-					_doH(_arg,-1,_url,"invalid HTTP response (no status line)");
-					delete this;
-					return;
+				if ((r->_state == HttpClient_Private_Request::STATE_CONNECTING)&&(now >= r->_connectDeadline)) {
+					r->finish(-1,"connection timed out");
+					continue;
 				}
-				++scPos;
-				unsigned int rcode = Utils::strToUInt(headers.front().substr(scPos,3).c_str());
-				if ((!rcode)||(rcode > 999)) {
-					_doH(_arg,-1,_url,"invalid HTTP response (invalid response code)");
-					delete this;
-					return;
+				if (now >= r->_timesOutAt) {
+					r->finish(-1,"request timed out");
+					continue;
 				}
+				if ((r->_state == HttpClient_Private_Request::STATE_CONNECTING)||(r->_state == HttpClient_Private_Request::STATE_SENDING))
+					FD_SET(r->_fd,&wfds);
+				else FD_SET(r->_fd,&rfds);
+				nfds = std::max(nfds,r->_fd);
+				wakeAt = std::min(wakeAt,(r->_state == HttpClient_Private_Request::STATE_CONNECTING) ? std::min(r->_connectDeadline,r->_timesOutAt) : r->_timesOutAt);
+			}
+			_reap();
+
+			const uint64_t ms = (wakeAt > now) ? (wakeAt - now) : 0;
+			tv.tv_sec = (long)(ms / 1000);
+			tv.tv_usec = (long)((ms % 1000) * 1000);
+			if (select(nfds + 1,&rfds,&wfds,(fd_set *)0,&tv) <= 0)
+				continue;
+			now = Utils::now();
+
+			if (FD_ISSET(_wakeReceivePipe,&rfds)) {
+				while (::read(_wakeReceivePipe,buf,sizeof(buf)) > 0) {}
+			}
 
-				// Serve up the resulting data to the handler
-				if (rcode == 200)
-					_doH(_arg,rcode,_url,_body.substr(idx));
-				else if ((scPos + 4) < headers.front().length())
-					_doH(_arg,rcode,_url,headers.front().substr(scPos+4));
-				else _doH(_arg,rcode,_url,"(no status message from server)");
+			for(std::multimap<std::string,_Idle>::iterator i(_idle.begin());i!=_idle.end();) {
+				if (FD_ISSET(i->second.fd,&rfds)) {
+					::close(i->second.fd);
+					_idle.erase(i++);
+				} else ++i;
 			}
 
-			delete this;
+			// Requests started above may have been handed fds that weren't in the sets
+			for(std::vector<HttpClient_Private_Request *>::iterator ri(_active.begin());ri!=_active.end();++ri) {
+				HttpClient_Private_Request *r = *ri;
+				if ((r->_state == HttpClient_Private_Request::STATE_DONE)||(r->_fd < 0)||(r->_fd > nfds))
+					continue;
+
+				if (FD_ISSET(r->_fd,&wfds)) {
+					if (r->_state == HttpClient_Private_Request::STATE_CONNECTING) {
+						int err = 0;
+						socklen_t errlen = sizeof(err);
+						if ((getsockopt(r->_fd,SOL_SOCKET,SO_ERROR,(void *)&err,&errlen))||(err)) {
+							::close(r->_fd);
+							r->_fd = -1;
+							if (!r->connectNext(now))
+								r->finish(-1,"connection failed");
+							continue;
+						}
+						r->_state = HttpClient_Private_Request::STATE_SENDING;
+					}
+					if (r->_state == HttpClient_Private_Request::STATE_SENDING) {
+						const int n = (int)::send(r->_fd,r->_out.data() + r->_outPtr,(unsigned int)r->_out.length() - r->_outPtr,ZT_HTTPCLIENT_SEND_FLAGS);
+						if (n > 0) {
+							if ((r->_outPtr += (unsigned int)n) >= (unsigned int)r->_out.length())
+								r->_state = HttpClient_Private_Request::STATE_HEADERS;
+						} else if ((n < 0)&&(errno != EAGAIN)&&(errno != EWOULDBLOCK)&&(errno != EINTR)) {
+							_retryOrFail(r,now,"connection failed");
+						}
+					}
+				} else if (FD_ISSET(r->_fd,&rfds)) {
+					const int n = (int)::recv(r->_fd,buf,sizeof(buf),0);
+					HttpClient_Private_Request::FeedResult fr;
+					if (n > 0) {
+						r->_received = true;
+						r->_timesOutAt = now + ((uint64_t)r->_timeout * 1000ULL);
+						fr = r->feed(buf,(unsigned int)n);
+					} else if ((n < 0)&&((errno == EAGAIN)||(errno == EWOULDBLOCK)||(errno == EINTR))) {
+						continue;
+					} else if (!r->_received) {
+						_retryOrFail(r,now,"connection closed before response was complete");
+						continue;
+					} else fr = r->closed();
+
+					if (fr == HttpClient_Private_Request::FEED_COMPLETE) {
+						if ((r->_keepAlive)&&(_parent->_keepaliveTimeout > 0)&&(_idle.count(r->_key) < ZT_HTTPCLIENT_MAX_IDLE_PER_HOST)) {
+							_Idle &i = _idle.insert(std::pair<std::string,_Idle>(r->_key,_Idle()))->second;
+							i.fd = r->_fd;
+							i.since = now;
+							r->_fd = -1;
+						}
+						r->succeed();
+					} else if (fr == HttpClient_Private_Request::FEED_ERROR) {
+						r->finish(-1,r->_error);
+					}
+				}
+			}
+			_reap();
+		}
+	}
+
+private:
+	struct _Idle
+	{
+		int fd;
+		uint64_t since;
+	};
+
+	inline void _start(HttpClient_Private_Request *r,uint64_t now)
+	{
+		if (r->_cancelled) {
+			r->_state = HttpClient_Private_Request::STATE_DONE;
+			return;
+		}
+		r->_timesOutAt = now + ((uint64_t)r->_timeout * 1000ULL);
+		const char *err = r->prepare();
+		if (err) {
+			r->finish(-1,err);
+			return;
+		}
+		std::multimap<std::string,_Idle>::iterator i(_idle.find(r->_key));
+		if (i != _idle.end()) {
+			r->reuse(i->second.fd);
+			_idle.erase(i);
+			return;
+		}
+		if ((err = r->resolve())) {
+			r->finish(-1,err);
 			return;
-		} else {
-			// fork() succeeded, in child process
-			::dup2(curlStdout[1],STDOUT_FILENO);
-			::close(curlStdout[1]);
-			::dup2(curlStderr[1],STDERR_FILENO);
-			::close(curlStderr[1]);
-			::execv(curlPath.c_str(),curlArgs);
-			::exit(-1); // only reached if execv() fails
 		}
+		if (!r->connectNext(now))
+			r->finish(-1,"connection failed");
 	}
 
-	inline void cancel()
-	{ 
-		{
-			Mutex::Lock _l(_cancelled_m);
-			_cancelled = true;
-			if (_pid > 0)
-				::kill(_pid,SIGKILL);
+	// A kept-alive connection may have been closed by the server just as we
+	// reused it, so requests that fail on one before any response get one
+	// more try on a fresh connection.
+	inline void _retryOrFail(HttpClient_Private_Request *r,uint64_t now,const char *err)
+	{
+		if ((r->_reused)&&(!r->_received)) {
+			if (!r->restart(now))
+				r->finish(-1,"connection failed");
+		} else r->finish(-1,err);
+	}
+
+	// Deletes finished requests
+	inline void _reap()
+	{
+		for(std::vector<HttpClient_Private_Request *>::iterator r(_active.begin());r!=_active.end();) {
+			if ((*r)->_state == HttpClient_Private_Request::STATE_DONE) {
+				_delete(*r);
+				r = _active.erase(r);
+			} else ++r;
 		}
-		Thread::join(_myThread);
 	}
 
-private:
-	inline void _doH(void *arg,int code,const std::string &url,const std::string &body)
+	inline void _delete(HttpClient_Private_Request *r)
 	{
-		Mutex::Lock _l(_cancelled_m);
-		try {
-			if ((!_cancelled)&&(_handler))
-				_handler(arg,code,url,body);
-		} catch ( ... ) {}
+		{
+			Mutex::Lock _l(_parent->_requests_m);
+			_parent->_requests.erase((HttpClient::Request)r);
+		}
+		delete r;
 	}
 
-	const std::string _url;
-	std::string _body;
-	std::map<std::string,std::string> _headers;
-	unsigned int _timeout;
-	void (*_handler)(void *,int,const std::string &,const std::string &);
-	void *_arg;
 	HttpClient *_parent;
-	long _pid;
-	volatile bool _cancelled;
-	Mutex _cancelled_m;
-	Thread _myThread;
+	int _wakeSendPipe;
+	int _wakeReceivePipe;
+	std::vector<HttpClient_Private_Request *> _new;
+	Mutex _new_m;
+	std::vector<HttpClient_Private_Request *> _active; // loop thread only
+	std::multimap<std::string,_Idle> _idle; // loop thread only
+	volatile bool _run;
+	Thread _thread;
 };
 
 #endif // __UNIX_LIKE__
 
 #ifdef __WINDOWS__
 
-#define WIN_MAX_MESSAGE_LENGTH (1024 * 1024 * 64)
-
 // Internal private thread class that performs request, notifies handler,
 // and then commits suicide by deleting itself.
 class HttpClient_Private_Request : NonCopyable
 {
 public:
-	HttpClient_Private_Request(HttpClient *parent,const char *method,const std::string &url,const std::map<std::string,std::string> &headers,unsigned int timeout,void (*handler)(void *,int,const std::string &,const std::string &),void *arg) :
+	HttpClient_Private_Request(HttpClient *parent,const char *method,const std::string &url,const std::map<std::string,std::string> &headers,unsigned int timeout,bool (*sink)(void *,const void *,unsigned int),void (*handler)(void *,int,const std::string &,const std::string &),void *arg) :
 		_url(url),
 		_headers(headers),
 		_timeout(timeout),
+		_sink(sink),
 		_handler(handler),
 		_arg(arg),
 		_parent(parent),
@@ -387,7 +835,8 @@ public:
 				goto closeAndReturnFromHttp;
 			}
 			int timeoutMs = (int)_timeout * 1000;
-			WinHttpSetTimeouts(hSession,timeoutMs,timeoutMs,timeoutMs,timeoutMs);
+			int connectTimeoutMs = (int)_parent->_connectTimeout * 1000;
+			WinHttpSetTimeouts(hSession,connectTimeoutMs,connectTimeoutMs,timeoutMs,timeoutMs);
 
 			std::wstring_convert< std::codecvt_utf8<wchar_t> > wcconv;
 			std::wstring wurl(wcconv.from_bytes(_url));
@@ -473,9 +922,18 @@ public:
 							goto closeAndReturnFromHttp;
 						}
 
+						if ((_sink)&&(dwStatusCode == 200)) {
+							const bool more = ((dwRead == 0)||(_sink(_arg,outBuffer,dwRead)));
+							delete [] outBuffer;
+							if (!more) {
+								_handler(_arg,-1,_url,"aborted by sink");
+								goto closeAndReturnFromHttp;
+							}
+							continue;
+						}
 						_body.append(outBuffer,dwRead);
 						delete [] outBuffer;
-						if (_body.length() > WIN_MAX_MESSAGE_LENGTH) {
+						if (_body.length() > ZT_HTTPCLIENT_MAX_BODY_LENGTH) {
 							_handler(_arg,-1,_url,"result too large");
 							goto closeAndReturnFromHttp;
 						}
@@ -489,7 +947,7 @@ public:
 						goto closeAndReturnFromHttp;
 					}
 
-					_handler(_arg,dwStatusCode,_url,_body);
+					_handler(_arg,dwStatusCode,_url,((_sink)&&(dwStatusCode == 200)) ? std::string() : _body);
 				}
 			} else {
 				_handler(_arg,-1,_url,"receive response failed");
@@ -527,6 +985,7 @@ closeAndReturnFromHttp:
 	std::string _body;
 	std::map<std::string,std::string> _headers;
 	unsigned int _timeout;
+	bool (*_sink)(void *,const void *,unsigned int);
 	void (*_handler)(void *,int,const std::string &,const std::string &);
 	void *_arg;
 	HttpClient *_parent;
@@ -539,12 +998,21 @@ closeAndReturnFromHttp:
 
 const std::map<std::string,std::string> HttpClient::NO_HEADERS;
 
-HttpClient::HttpClient()
+HttpClient::HttpClient(unsigned int connectTimeout,unsigned int keepaliveTimeout) :
+	_connectTimeout(connectTimeout),
+	_keepaliveTimeout(keepaliveTimeout),
+	_loop((HttpClient_Private_Loop *)0)
 {
+#ifdef __UNIX_LIKE__
+	_loop = new HttpClient_Private_Loop(this);
+#endif
 }
 
 HttpClient::~HttpClient()
 {
+#ifdef __UNIX_LIKE__
+	delete _loop; // deletes outstanding requests without calling their handlers
+#else
 	std::set<Request> reqs;
 	{
 		Mutex::Lock _l(_requests_m);
@@ -564,14 +1032,27 @@ HttpClient::~HttpClient()
 			Thread::sleep(250);
 		}
 	}
+#endif
 }
 
 void HttpClient::cancel(HttpClient::Request req)
 {
+#ifdef __UNIX_LIKE__
+	{
+		Mutex::Lock _l(_requests_m);
+		if (_requests.count(req) == 0)
+			return;
+		((HttpClient_Private_Request *)req)->_cancelled = true;
+	}
+	_handler_m.lock(); // wait out a sink or handler that's already running
+	_handler_m.unlock();
+	_loop->wake();
+#else
 	Mutex::Lock _l(_requests_m);
 	if (_requests.count(req) == 0)
 		return;
 	((HttpClient_Private_Request *)req)->cancel();
+#endif
 }
 
 HttpClient::Request HttpClient::_do(
@@ -579,13 +1060,19 @@ HttpClient::Request HttpClient::_do(
 	const std::string &url,
 	const std::map<std::string,std::string> &headers,
 	unsigned int timeout,
+	bool (*sink)(void *,const void *,unsigned int),
 	void (*handler)(void *,int,const std::string &,const std::string &),
 	void *arg)
 {
-	HttpClient::Request r = (HttpClient::Request)(new HttpClient_Private_Request(this,method,url,headers,timeout,handler,arg));
-	Mutex::Lock _l(_requests_m);
-	_requests.insert(r);
-	return r;
+	HttpClient_Private_Request *r = new HttpClient_Private_Request(this,method,url,headers,timeout,sink,handler,arg);
+	{
+		Mutex::Lock _l(_requests_m);
+		_requests.insert((HttpClient::Request)r);
+	}
+#ifdef __UNIX_LIKE__
+	_loop->add(r);
+#endif
+	return (HttpClient::Request)r;
 }
 
 } // namespace ZeroTier
@@ -35,34 +35,60 @@
 #include "Constants.hpp"
 #include "Mutex.hpp"
 
+/**
+ * Default seconds to wait for a connection to be established
+ */
+#define ZT_HTTPCLIENT_DEFAULT_CONNECT_TIMEOUT 10
+
+/**
+ * Default seconds an idle keep-alive connection is kept for reuse
+ */
+#define ZT_HTTPCLIENT_DEFAULT_KEEPALIVE_TIMEOUT 30
+
+/**
+ * Maximum length of a response body collected into a string (sinks have no limit)
+ */
+#define ZT_HTTPCLIENT_MAX_BODY_LENGTH (1024 * 1024 * 64)
+
 namespace ZeroTier {
 
 class HttpClient_Private_Request;
+class HttpClient_Private_Loop;
 
 /**
  * HTTP client that does queries in the background
  *
  * The handler method takes the following arguments: an arbitrary pointer, an
- * HTTP response code, the URL queried, whether or not the message body was
- * stored on disk, and the message body.
+ * HTTP response code, the URL queried, and the message body. If an error
+ * occurs, the response code will be negative and the body will be the error
+ * message. For responses other than 200 the body is the server's status
+ * message.
  *
- * If stored on disk, the body string contains the path and the file must be
- * moved or deleted by the receiver when it's done. If an error occurs, the
- * response code will be negative and the body will be the error message.
+ * Requests can instead stream the body of a 200 response to a sink as it
+ * arrives. The sink takes the arbitrary pointer, a piece of the body, and
+ * its length, and returns false to abort the request. The handler is still
+ * called when the request completes, with an empty body on success.
  *
- * All headers in the returned headers map will have their header names
- * converted to lower case, e.g. "content-type".
+ * On *nix systems requests are HTTP/1.1 over plain sockets, multiplexed on
+ * a single background thread per client with select(). Connections to the
+ * same host and port are kept alive and reused. Handlers and sinks are
+ * called from that thread, so they should not block for long. On Windows
+ * each request runs in its own thread using WinHTTP.
  *
- * Currently only the "http" transport is guaranteed to be supported on all
- * platforms.
+ * Only the "http" transport is supported.
  */
 class HttpClient
 {
 public:
 	friend class HttpClient_Private_Request;
+	friend class HttpClient_Private_Loop;
 	typedef void * Request;
 
-	HttpClient();
+	/**
+	 * @param connectTimeout Seconds to wait for a connection to be established
+	 * @param keepaliveTimeout Seconds to keep idle connections open for reuse (0 to disable reuse)
+	 */
+	HttpClient(unsigned int connectTimeout = ZT_HTTPCLIENT_DEFAULT_CONNECT_TIMEOUT,unsigned int keepaliveTimeout = ZT_HTTPCLIENT_DEFAULT_KEEPALIVE_TIMEOUT);
 	~HttpClient();
 
 	/**
@@ -72,24 +98,52 @@ public:
 
 	/**
 	 * Request a URL using the GET method
+	 *
+	 * @param url URL to fetch
+	 * @param headers Additional request headers
+	 * @param timeout Seconds without receiving anything before the request fails
+	 * @param handler Result handler
+	 * @param arg First argument to handler
+	 * @return Request that can be passed to cancel()
+	 */
+	inline Request GET(
+		const std::string &url,
+		const std::map<std::string,std::string> &headers,
+		unsigned int timeout,
+		void (*handler)(void *,int,const std::string &,const std::string &),
+		void *arg)
+	{
+		return _do("GET",url,headers,timeout,(bool (*)(void *,const void *,unsigned int))0,handler,arg);
+	}
+
+	/**
+	 * Request a URL using the GET method, streaming the body to a sink
+	 *
+	 * @param url URL to fetch
+	 * @param headers Additional request headers
+	 * @param timeout Seconds without receiving anything before the request fails
+	 * @param sink Body sink, called only for a 200 response
+	 * @param handler Result handler
+	 * @param arg First argument to sink and handler
+	 * @return Request that can be passed to cancel()
 	 */
 	inline Request GET(
 		const std::string &url,
 		const std::map<std::string,std::string> &headers,
 		unsigned int timeout,
+		bool (*sink)(void *,const void *,unsigned int),
 		void (*handler)(void *,int,const std::string &,const std::string &),
 		void *arg)
 	{
-		return _do("GET",url,headers,timeout,handler,arg);
+		return _do("GET",url,headers,timeout,sink,handler,arg);
 	}
 
 	/**
 	 * Cancel a request
 	 *
-	 * If the request is not active, this does nothing. This may take some time
-	 * depending on HTTP implementation. It may also not kill instantly, but
-	 * it will prevent the handler function from ever being called and cause the
-	 * request to die silently when complete.
+	 * If the request is not active, this does nothing. Once this returns the
+	 * request's sink and handler will not be called again. This must not be
+	 * called from a sink or handler.
 	 */
 	void cancel(Request req);
 
@@ -99,11 +153,16 @@ private:
 		const std::string &url,
 		const std::map<std::string,std::string> &headers,
 		unsigned int timeout,
+		bool (*sink)(void *,const void *,unsigned int),
 		void (*handler)(void *,int,const std::string &,const std::string &),
 		void *arg);
 
 	std::set<Request> _requests;
 	Mutex _requests_m;
+	Mutex _handler_m; // held while a sink or handler is running
+	unsigned int _connectTimeout;
+	unsigned int _keepaliveTimeout;
+	HttpClient_Private_Loop *_loop; // *nix only
 };
 
 } // namespace ZeroTier
@@ -30,8 +30,12 @@
 #include <string.h>
 #include <stdint.h>
 
+#include <vector>
+
 #include "Constants.hpp"
 #include "Identity.hpp"
+#include "Mutex.hpp"
+#include "Thread.hpp"
 #include "SHA512.hpp"
 #include "Salsa20.hpp"
 #include "Utils.hpp"
@@ -40,7 +44,6 @@
 // parameters of the hashcash hashing/searching algorithm.
 
 #define ZT_IDENTITY_GEN_HASHCASH_FIRST_BYTE_LESS_THAN 17
-#define ZT_IDENTITY_GEN_MEMORY 2097152
 #define ZT_IDENTITY_GEN_SALSA20_ROUNDS 20
 
 namespace ZeroTier {
@@ -53,8 +56,10 @@ static inline void _computeMemoryHardHash(const void *publicKey,unsigned int pub
 
 	// Initialize genmem[] using Salsa20 in a CBC-like configuration since
 	// ordinary Salsa20 is randomly seekable. This is good for a cipher
-	// but is not what we want for sequential memory-harndess.
-	memset(genmem,0,ZT_IDENTITY_GEN_MEMORY);
+	// but is not what we want for sequential memory-harndess. Only the
+	// first block needs zeroing: every block after it is overwritten with
+	// the block before it prior to being read.
+	memset(genmem,0,64);
 	Salsa20 s20(digest,256,(char *)digest + 32,ZT_IDENTITY_GEN_SALSA20_ROUNDS);
 	s20.encrypt((char *)genmem,(char *)genmem,64);
 	for(unsigned long i=64;i<ZT_IDENTITY_GEN_MEMORY;i+=64) {
@@ -82,49 +87,139 @@ static inline void _computeMemoryHardHash(const void *publicKey,unsigned int pub
 }
 
 // Hashcash generation halting condition -- halt when first byte is less than
-// threshold value.
+// threshold value, or when another generator thread has already won.
 struct _Identity_generate_cond
 {
 	_Identity_generate_cond() throw() {}
-	_Identity_generate_cond(unsigned char *sb,char *gm) throw() : digest(sb),genmem(gm) {}
+	_Identity_generate_cond(unsigned char *sb,char *gm,uint64_t *t,volatile bool *s) throw() : digest(sb),genmem(gm),tried(t),stop(s) {}
 	inline bool operator()(const C25519::Pair &kp) const
 		throw()
 	{
+		if (*stop)
+			return true;
+		++*tried;
 		_computeMemoryHardHash(kp.pub.data,(unsigned int)kp.pub.size(),digest,genmem);
 		return (digest[0] < ZT_IDENTITY_GEN_HASHCASH_FIRST_BYTE_LESS_THAN);
 	}
 	unsigned char *digest;
 	char *genmem;
+	uint64_t *tried;
+	volatile bool *stop;
+};
+
+// One of possibly several threads searching for a key pair, each with its
+// own scratch memory. The first to find one publishes it and stops the rest.
+class _IdentityGenerator
+{
+public:
+	_IdentityGenerator() :
+		genmem(new char[ZT_IDENTITY_GEN_MEMORY]),
+		tried(0),
+		done((volatile bool *)0),
+		result((C25519::Pair *)0),
+		resultAddress((Address *)0),
+		resultLock((Mutex *)0)
+	{
+	}
+
+	~_IdentityGenerator() { delete [] genmem; }
+
+	void threadMain()
+		throw()
+	{
+		unsigned char digest[64];
+		while (!*done) {
+			C25519::Pair kp(C25519::generateSatisfying(_Identity_generate_cond(digest,genmem,&tried,done)));
+			if (*done)
+				break;
+			Address a(digest + 59,ZT_ADDRESS_LENGTH); // last 5 bytes are address
+			if (a.isReserved())
+				continue;
+			Mutex::Lock _l(*resultLock);
+			if (!*done) {
+				*result = kp;
+				*resultAddress = a;
+				*done = true;
+			}
+		}
+	}
+
+	char *const genmem;
+	uint64_t tried;
+	volatile bool *done;
+	C25519::Pair *result;
+	Address *resultAddress;
+	Mutex *resultLock;
 };
 
 void Identity::generate()
 {
-	unsigned char digest[64];
-	char *genmem = new char[ZT_IDENTITY_GEN_MEMORY];
+	generate(1);
+}
+
+uint64_t Identity::generate(unsigned int threads)
+{
+	if (!threads)
+		threads = 1;
 
+	volatile bool done = false;
 	C25519::Pair kp;
-	do {
-		kp = C25519::generateSatisfying(_Identity_generate_cond(digest,genmem));
-		_address.setTo(digest + 59,ZT_ADDRESS_LENGTH); // last 5 bytes are address
-	} while (_address.isReserved());
+	Mutex resultLock;
+
+	std::vector<_IdentityGenerator *> gens;
+	std::vector<Thread> gthreads;
+	for(unsigned int i=0;i<threads;++i) {
+		_IdentityGenerator *g = new _IdentityGenerator();
+		g->done = &done;
+		g->result = &kp;
+		g->resultAddress = &_address;
+		g->resultLock = &resultLock;
+		gens.push_back(g);
+	}
+
+	// The calling thread is always one of the generators
+	for(unsigned int i=1;i<threads;++i) {
+		try {
+			gthreads.push_back(Thread::start(gens[i]));
+		} catch ( ... ) {
+			break; // go with what we've got
+		}
+	}
+	gens[0]->threadMain();
+
+	uint64_t tried = 0;
+	for(std::vector<Thread>::iterator t(gthreads.begin());t!=gthreads.end();++t)
+		Thread::join(*t);
+	for(std::vector<_IdentityGenerator *>::iterator g(gens.begin());g!=gens.end();++g) {
+		tried += (*g)->tried;
+		delete *g;
+	}
 
 	_publicKey = kp.pub;
 	if (!_privateKey)
 		_privateKey = new C25519::Private();
 	*_privateKey = kp.priv;
 
-	delete [] genmem;
+	return tried;
 }
 
 bool Identity::locallyValidate() const
+{
+	if (_address.isReserved())
+		return false;
+	char *genmem = new char[ZT_IDENTITY_GEN_MEMORY];
+	const bool r = locallyValidate(genmem);
+	delete [] genmem;
+	return r;
+}
+
+bool Identity::locallyValidate(void *genmem) const
 {
 	if (_address.isReserved())
 		return false;
 
 	unsigned char digest[64];
-	char *genmem = new char[ZT_IDENTITY_GEN_MEMORY];
 	_computeMemoryHardHash(_publicKey.data,(unsigned int)_publicKey.size(),digest,genmem);
-	delete [] genmem;
 
 	unsigned char addrb[5];
 	_address.copyTo(addrb,5);
@@ -38,9 +38,17 @@
 #include "Address.hpp"
 #include "C25519.hpp"
 #include "Buffer.hpp"
+#include "SHA512.hpp"
 
 #define ZT_IDENTITY_MAX_BINARY_SERIALIZED_LENGTH (ZT_ADDRESS_LENGTH + 1 + ZT_C25519_PUBLIC_KEY_LEN + 1 + ZT_C25519_PRIVATE_KEY_LEN)
 
+/**
+ * Size of scratch memory used by the memory-hard hash in generate() and locallyValidate()
+ *
+ * This can't be changed without a new identity type.
+ */
+#define ZT_IDENTITY_GEN_MEMORY 2097152
+
 namespace ZeroTier {
 
 /**
@@ -127,6 +135,18 @@ public:
 	 */
 	void generate();
 
+	/**
+	 * Generate a new identity using several threads
+	 *
+	 * Each thread searches independently with its own scratch memory, and
+	 * the first to find an acceptable key pair wins. The calling thread is
+	 * one of the searchers, so threads == 1 spawns no new threads.
+	 *
+	 * @param threads Number of threads to search with (0 is treated as 1)
+	 * @return Number of candidate key pairs tried across all threads
+	 */
+	uint64_t generate(unsigned int threads);
+
 	/**
 	 * Check the validity of this identity's pairing of key to address
 	 *
@@ -134,6 +154,18 @@ public:
 	 */
 	bool locallyValidate() const;
 
+	/**
+	 * Check the validity of this identity using caller-supplied scratch memory
+	 *
+	 * Validation needs ZT_IDENTITY_GEN_MEMORY bytes of scratch. Callers that
+	 * validate often should keep a buffer around and use this instead of
+	 * paying for a fresh allocation every time.
+	 *
+	 * @param genmem Scratch memory of at least ZT_IDENTITY_GEN_MEMORY bytes
+	 * @return True if validation check passes
+	 */
+	bool locallyValidate(void *genmem) const;
+
 	/**
 	 * @return True if this identity contains a private key
 	 */
@@ -201,6 +233,23 @@ public:
 		return false;
 	}
 
+	/**
+	 * Compute a SHA-512 hash of this identity's private key
+	 *
+	 * This is used to derive keys for encrypting local state at rest.
+	 *
+	 * @param sha Buffer to receive 64-byte hash
+	 * @return True if this identity has a private key
+	 */
+	inline bool sha512PrivateKey(void *sha) const
+	{
+		if (_privateKey) {
+			SHA512::hash(sha,_privateKey->data,(unsigned int)_privateKey->size());
+			return true;
+		}
+		return false;
+	}
+
 	/**
 	 * @return Identity type
 	 */
@@ -211,6 +260,11 @@ public:
 	 */
 	inline const Address &address() const throw() { return _address; }
 
+	/**
+	 * @return This identity's public key
+	 */
+	inline const C25519::Public &publicKey() const throw() { return _publicKey; }
+
 	/**
 	 * Serialize this identity (binary)
 	 * 
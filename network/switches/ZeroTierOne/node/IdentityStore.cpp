@@ -0,0 +1,528 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#include "Constants.hpp"
+#include "IdentityStore.hpp"
+#include "Buffer.hpp"
+#include "Utils.hpp"
+
+#ifndef __WINDOWS__
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+// Serialized public identity: address, type, public key, private key length (0)
+#define ZT_IDENTITY_STORE_IDENTITY_LENGTH (ZT_ADDRESS_LENGTH + 1 + ZT_C25519_PUBLIC_KEY_LEN + 1)
+#define ZT_IDENTITY_STORE_IDX_FLAGS ZT_IDENTITY_STORE_IDENTITY_LENGTH
+#define ZT_IDENTITY_STORE_IDX_CHECKSUM (ZT_IDENTITY_STORE_IDX_FLAGS + 1)
+#define ZT_IDENTITY_STORE_FLAG_VALID 0x01
+
+static const unsigned char ZT_IDENTITY_STORE_MAGIC[8] = { 'Z','T','I','D','S','T','R',0x01 };
+
+namespace ZeroTier {
+
+IdentityStore::IdentityStore() :
+	_path(),
+#ifdef __WINDOWS__
+	_fh(INVALID_HANDLE_VALUE),
+	_mh(NULL),
+#else
+	_fd(-1),
+#endif
+	_data((unsigned char *)0),
+	_capacity(0),
+	_end(0),
+	_ixKeys((uint64_t *)0),
+	_ixRecs((uint32_t *)0),
+	_ixCapacity(0),
+	_ixCount(0),
+	_compactThread(),
+	_compacting(false)
+{
+}
+
+IdentityStore::~IdentityStore()
+{
+	if (_compactThread)
+		Thread::join(_compactThread);
+	Mutex::Lock _l(_lock);
+	_closeFile();
+	_ixClear();
+}
+
+bool IdentityStore::open(const char *path)
+{
+	Mutex::Lock _l(_lock);
+	_closeFile();
+	_path = path;
+	return _openFile();
+}
+
+Identity IdentityStore::get(const Address &a) const
+{
+	Buffer<ZT_IDENTITY_MAX_BINARY_SERIALIZED_LENGTH> b;
+	{
+		Mutex::Lock _l(_lock);
+		if (!_data)
+			return Identity();
+		const uint32_t *r = _ixFind(a);
+		if (!r)
+			return Identity();
+		b.copyFrom(_rec(*r),ZT_IDENTITY_STORE_IDENTITY_LENGTH);
+	}
+	try {
+		return Identity(b);
+	} catch ( ... ) {} // should not happen since records are checksummed
+	return Identity();
+}
+
+bool IdentityStore::put(const Identity &id)
+{
+	if (!id)
+		return false;
+
+	Buffer<ZT_IDENTITY_MAX_BINARY_SERIALIZED_LENGTH> b;
+	id.serialize(b,false);
+	if (b.size() != ZT_IDENTITY_STORE_IDENTITY_LENGTH)
+		return false;
+
+	unsigned char rec[ZT_IDENTITY_STORE_RECORD_SIZE];
+	memset(rec,0,sizeof(rec));
+	memcpy(rec,b.data(),ZT_IDENTITY_STORE_IDENTITY_LENGTH);
+	rec[ZT_IDENTITY_STORE_IDX_FLAGS] = ZT_IDENTITY_STORE_FLAG_VALID;
+	const uint64_t cs = Utils::hton(_checksum(rec));
+	memcpy(rec + ZT_IDENTITY_STORE_IDX_CHECKSUM,&cs,8);
+
+	Mutex::Lock _l(_lock);
+	if (!_data)
+		return false;
+	const uint32_t *r = _ixFind(id.address());
+	if ((r)&&(!memcmp(_rec(*r),rec,ZT_IDENTITY_STORE_IDENTITY_LENGTH)))
+		return false;
+	return _append(rec);
+}
+
+unsigned long IdentityStore::importDirectory(const char *path)
+{
+	unsigned long n = 0;
+	std::map<std::string,bool> files(Utils::listDirectory(path));
+	for(std::map<std::string,bool>::iterator f(files.begin());f!=files.end();++f) {
+		if ((f->second)||(f->first.length() != ZT_ADDRESS_LENGTH_HEX))
+			continue;
+		std::string ids;
+		if (Utils::readFile((std::string(path) + ZT_PATH_SEPARATOR_S + f->first).c_str(),ids)) {
+			Identity id;
+			if ((id.fromString(Utils::trim(ids).c_str()))&&(id.address().toString() == f->first)) {
+				if (put(id))
+					++n;
+			}
+		}
+	}
+	return n;
+}
+
+bool IdentityStore::compactInBackground()
+{
+	{
+		Mutex::Lock _l(_lock);
+		if ((!_data)||(_compacting))
+			return false;
+		const unsigned long dead = (unsigned long)(_end - 1) - _ixCount;
+		if ((dead < ZT_IDENTITY_STORE_COMPACT_MIN_DEAD)||(dead <= _ixCount))
+			return false;
+		_compacting = true;
+	}
+
+	if (_compactThread)
+		Thread::join(_compactThread); // previous run has finished, reap it
+	try {
+		_compactThread = Thread::start(this);
+	} catch ( ... ) {
+		_compactThread = Thread();
+		_compacting = false;
+		return false;
+	}
+	return true;
+}
+
+void IdentityStore::threadMain()
+	throw()
+{
+	try {
+		_compact();
+	} catch ( ... ) {}
+	_compacting = false;
+}
+
+bool IdentityStore::compact()
+{
+	{
+		Mutex::Lock _l(_lock);
+		if (_compacting)
+			return false;
+		_compacting = true;
+	}
+	const bool r = _compact();
+	_compacting = false;
+	return r;
+}
+
+bool IdentityStore::_compact()
+{
+	std::vector<uint32_t> live;
+	uint32_t snapEnd;
+	{
+		Mutex::Lock _l(_lock);
+		if (!_data)
+			return false;
+		snapEnd = _end;
+		live.reserve(_ixCount);
+		for(unsigned long i=0;i<_ixCapacity;++i) {
+			if (_ixKeys[i])
+				live.push_back(_ixRecs[i]);
+		}
+	}
+	std::sort(live.begin(),live.end()); // keep original order, and sequential reads
+
+	std::string tmpPath(_path + ".compact");
+	FILE *f = fopen(tmpPath.c_str(),"wb");
+	if (!f)
+		return false;
+
+	unsigned char hdr[ZT_IDENTITY_STORE_RECORD_SIZE];
+	memset(hdr,0,sizeof(hdr));
+	memcpy(hdr,ZT_IDENTITY_STORE_MAGIC,8);
+	bool ok = (fwrite(hdr,sizeof(hdr),1,f) == 1);
+
+	// Copy live records in chunks so lookups and appends can run in between.
+	// Records never move while the file is open, but the mapping itself may
+	// be replaced when it grows, so _data is only used under the lock.
+	for(unsigned long i=0;((ok)&&(i<live.size()));i+=ZT_IDENTITY_STORE_COMPACT_CHUNK) {
+		Mutex::Lock _l(_lock);
+		if (!_data) {
+			ok = false;
+			break;
+		}
+		const unsigned long e = std::min((unsigned long)live.size(),i + ZT_IDENTITY_STORE_COMPACT_CHUNK);
+		for(unsigned long j=i;((ok)&&(j<e));++j)
+			ok = (fwrite(_rec(live[j]),ZT_IDENTITY_STORE_RECORD_SIZE,1,f) == 1);
+	}
+
+	Mutex::Lock _l(_lock);
+
+	// Anything appended since the snapshot goes after the copied records. If
+	// it replaces one of them the later record wins on open, as usual.
+	if (!_data)
+		ok = false;
+	for(uint32_t n=snapEnd;((ok)&&(n<_end));++n)
+		ok = (fwrite(_rec(n),ZT_IDENTITY_STORE_RECORD_SIZE,1,f) == 1);
+
+	if (ok)
+		ok = (fflush(f) == 0);
+#ifndef __WINDOWS__
+	if (ok)
+		ok = (fsync(fileno(f)) == 0);
+#endif
+	fclose(f);
+	if (!ok) {
+		Utils::rm(tmpPath);
+		return false;
+	}
+
+	_closeFile();
+#ifdef __WINDOWS__
+	ok = (MoveFileExA(tmpPath.c_str(),_path.c_str(),MOVEFILE_REPLACE_EXISTING) != FALSE);
+#else
+	ok = (rename(tmpPath.c_str(),_path.c_str()) == 0);
+#endif
+	if (!ok)
+		Utils::rm(tmpPath);
+
+	return ((_openFile())&&(ok));
+}
+
+void IdentityStore::sync()
+{
+	Mutex::Lock _l(_lock);
+	if (!_data)
+		return;
+#ifdef __WINDOWS__
+	FlushViewOfFile(_data,(SIZE_T)((uint64_t)_end * ZT_IDENTITY_STORE_RECORD_SIZE));
+#else
+	msync(_data,(size_t)((uint64_t)_end * ZT_IDENTITY_STORE_RECORD_SIZE),MS_ASYNC);
+#endif
+}
+
+uint64_t IdentityStore::_checksum(const unsigned char *rec)
+{
+	// 64-bit FNV-1a, enough to catch torn or garbage records
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for(unsigned int i=0;i<ZT_IDENTITY_STORE_IDX_CHECKSUM;++i) {
+		h ^= (uint64_t)rec[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+bool IdentityStore::_openFile()
+{
+	uint64_t fileSize = 0;
+	unsigned char hdr[ZT_IDENTITY_STORE_RECORD_SIZE];
+	memset(hdr,0,sizeof(hdr));
+
+#ifdef __WINDOWS__
+	_fh = CreateFileA(_path.c_str(),GENERIC_READ|GENERIC_WRITE,FILE_SHARE_READ,NULL,OPEN_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+	if (_fh == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fs;
+	if (!GetFileSizeEx(_fh,&fs)) {
+		_closeFile();
+		return false;
+	}
+	fileSize = (uint64_t)fs.QuadPart;
+	if (fileSize >= sizeof(hdr)) {
+		DWORD n = 0;
+		if ((!ReadFile(_fh,hdr,sizeof(hdr),&n,NULL))||(n != sizeof(hdr))) {
+			_closeFile();
+			return false;
+		}
+	}
+#else
+	_fd = ::open(_path.c_str(),O_RDWR|O_CREAT,0600);
+	if (_fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(_fd,&st)) {
+		_closeFile();
+		return false;
+	}
+	fileSize = (uint64_t)st.st_size;
+	if ((fileSize >= sizeof(hdr))&&(pread(_fd,hdr,sizeof(hdr),0) != (ssize_t)sizeof(hdr))) {
+		_closeFile();
+		return false;
+	}
+#endif
+
+	if (fileSize >= sizeof(hdr)) {
+		if (memcmp(hdr,ZT_IDENTITY_STORE_MAGIC,8)) {
+			_closeFile(); // not ours, leave it alone
+			return false;
+		}
+	} else fileSize = 0; // new, or too short to have been written by us
+
+	uint64_t records = fileSize / ZT_IDENTITY_STORE_RECORD_SIZE;
+	if (records < ZT_IDENTITY_STORE_GROW_RECORDS)
+		records = ZT_IDENTITY_STORE_GROW_RECORDS;
+	if ((records > 0xffffffffULL)||(!_map(records))) {
+		_closeFile();
+		return false;
+	}
+
+	if (!fileSize)
+		memcpy(_data,ZT_IDENTITY_STORE_MAGIC,8);
+
+	_scan();
+	return true;
+}
+
+void IdentityStore::_closeFile()
+{
+	_unmap();
+#ifdef __WINDOWS__
+	if (_fh != INVALID_HANDLE_VALUE) {
+		CloseHandle(_fh);
+		_fh = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (_fd >= 0) {
+		::close(_fd);
+		_fd = -1;
+	}
+#endif
+	_end = 0;
+	_ixClear();
+}
+
+bool IdentityStore::_map(uint64_t records)
+{
+	const uint64_t bytes = records * ZT_IDENTITY_STORE_RECORD_SIZE;
+#ifdef __WINDOWS__
+	// Creating a mapping larger than the file extends it with zeroes
+	_mh = CreateFileMappingA(_fh,NULL,PAGE_READWRITE,(DWORD)(bytes >> 32),(DWORD)(bytes & 0xffffffffULL),NULL);
+	if (_mh == NULL)
+		return false;
+	void *p = MapViewOfFile(_mh,FILE_MAP_ALL_ACCESS,0,0,(SIZE_T)bytes);
+	if (!p) {
+		CloseHandle(_mh);
+		_mh = NULL;
+		return false;
+	}
+#else
+	struct stat st;
+	if (fstat(_fd,&st))
+		return false;
+	if (((uint64_t)st.st_size < bytes)&&(ftruncate(_fd,(off_t)bytes))) // extends with zeroes
+		return false;
+	void *p = mmap((void *)0,(size_t)bytes,PROT_READ|PROT_WRITE,MAP_SHARED,_fd,0);
+	if (p == MAP_FAILED)
+		return false;
+#endif
+	_data = (unsigned char *)p;
+	_capacity = (uint32_t)records;
+	return true;
+}
+
+void IdentityStore::_unmap()
+{
+	if (_data) {
+#ifdef __WINDOWS__
+		FlushViewOfFile(_data,0);
+		UnmapViewOfFile(_data);
+		CloseHandle(_mh);
+		_mh = NULL;
+#else
+		msync(_data,(size_t)((uint64_t)_capacity * ZT_IDENTITY_STORE_RECORD_SIZE),MS_ASYNC);
+		munmap(_data,(size_t)((uint64_t)_capacity * ZT_IDENTITY_STORE_RECORD_SIZE));
+#endif
+		_data = (unsigned char *)0;
+	}
+	_capacity = 0;
+}
+
+void IdentityStore::_scan()
+{
+	_ixClear();
+	uint32_t n = 1;
+	for(;n<_capacity;++n) {
+		const unsigned char *rec = _rec(n);
+		if (rec[ZT_IDENTITY_STORE_IDX_FLAGS] != ZT_IDENTITY_STORE_FLAG_VALID)
+			break;
+		uint64_t cs;
+		memcpy(&cs,rec + ZT_IDENTITY_STORE_IDX_CHECKSUM,8);
+		if (Utils::ntoh(cs) != _checksum(rec))
+			break;
+		_ixSet(Address(rec,ZT_ADDRESS_LENGTH),n);
+	}
+	_end = n;
+}
+
+bool IdentityStore::_append(const unsigned char *rec)
+{
+	if (_end >= _capacity) {
+		const uint64_t oldCap = _capacity;
+		const uint64_t newCap = oldCap + std::max((uint64_t)ZT_IDENTITY_STORE_GROW_RECORDS,oldCap / 2);
+		if (newCap > 0xffffffffULL)
+			return false;
+		_unmap();
+		if (!_map(newCap)) {
+			if (!_map(oldCap))
+				_closeFile(); // can't happen unless we're out of address space
+			return false;
+		}
+	}
+
+	// Checksum goes in last so a torn write is never taken as valid
+	unsigned char *const dest = _rec(_end);
+	memcpy(dest,rec,ZT_IDENTITY_STORE_IDX_CHECKSUM);
+	memcpy(dest + ZT_IDENTITY_STORE_IDX_CHECKSUM,rec + ZT_IDENTITY_STORE_IDX_CHECKSUM,8);
+
+	_ixSet(Address(rec,ZT_ADDRESS_LENGTH),_end++);
+	return true;
+}
+
+uint32_t *IdentityStore::_ixFind(const Address &a) const
+{
+	if (!_ixCapacity)
+		return (uint32_t *)0;
+	const uint64_t k = a.toInt() + 1;
+	const unsigned long mask = _ixCapacity - 1;
+	for(unsigned long i=(unsigned long)(k ^ (k >> 29)) & mask;(_ixKeys[i]);i=((i + 1) & mask)) {
+		if (_ixKeys[i] == k)
+			return &(_ixRecs[i]);
+	}
+	return (uint32_t *)0;
+}
+
+void IdentityStore::_ixSet(const Address &a,uint32_t rec)
+{
+	uint32_t *r = _ixFind(a);
+	if (r) {
+		*r = rec;
+		return;
+	}
+
+	if (((_ixCount + 1) * 2) > _ixCapacity) {
+		const unsigned long newCap = (_ixCapacity) ? (_ixCapacity * 2) : 1024;
+		uint64_t *const oldKeys = _ixKeys;
+		uint32_t *const oldRecs = _ixRecs;
+		const unsigned long oldCap = _ixCapacity;
+		_ixKeys = new uint64_t[newCap];
+		_ixRecs = new uint32_t[newCap];
+		memset(_ixKeys,0,sizeof(uint64_t) * newCap);
+		_ixCapacity = newCap;
+		_ixCount = 0;
+		for(unsigned long i=0;i<oldCap;++i) {
+			if (oldKeys[i])
+				_ixSet(Address(oldKeys[i] - 1),oldRecs[i]);
+		}
+		delete [] oldKeys;
+		delete [] oldRecs;
+	}
+
+	const uint64_t k = a.toInt() + 1;
+	const unsigned long mask = _ixCapacity - 1;
+	unsigned long i = (unsigned long)(k ^ (k >> 29)) & mask;
+	while (_ixKeys[i])
+		i = (i + 1) & mask;
+	_ixKeys[i] = k;
+	_ixRecs[i] = rec;
+	++_ixCount;
+}
+
+void IdentityStore::_ixClear()
+{
+	delete [] _ixKeys;
+	delete [] _ixRecs;
+	_ixKeys = (uint64_t *)0;
+	_ixRecs = (uint32_t *)0;
+	_ixCapacity = 0;
+	_ixCount = 0;
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,219 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+#ifndef ZT_IDENTITYSTORE_HPP
+#define ZT_IDENTITYSTORE_HPP
+
+#include <stdint.h>
+
+#include <string>
+
+#include "Constants.hpp"
+#include "Identity.hpp"
+#include "Address.hpp"
+#include "Mutex.hpp"
+#include "Thread.hpp"
+#include "NonCopyable.hpp"
+
+#ifdef __WINDOWS__
+#include <WinSock2.h>
+#include <Windows.h>
+#endif
+
+/**
+ * Size of one identity record (and of the file header)
+ *
+ * A record is a public identity as serialized by Identity::serialize()
+ * (71 bytes), a flags byte, and a 64-bit checksum of the preceding bytes.
+ */
+#define ZT_IDENTITY_STORE_RECORD_SIZE 80
+
+/**
+ * Minimum number of records the file grows by when full
+ */
+#define ZT_IDENTITY_STORE_GROW_RECORDS 4096
+
+/**
+ * Compact when there are at least this many superseded records and more of them than live ones
+ */
+#define ZT_IDENTITY_STORE_COMPACT_MIN_DEAD 4096
+
+/**
+ * Records copied per lock acquisition during compaction
+ */
+#define ZT_IDENTITY_STORE_COMPACT_CHUNK 4096
+
+namespace ZeroTier {
+
+/**
+ * Persistent public identity cache in a single memory-mapped file
+ *
+ * The file is a header followed by fixed-size records and is only ever
+ * appended to. An in-memory open addressing index maps each address to
+ * its most recent record, so a lookup is a hash probe and a copy out of
+ * mapped memory. Records replaced by a newer identity for the same
+ * address stay in the file until compaction rewrites it.
+ *
+ * The file is grown ahead of use in zero-filled chunks, and the end of
+ * valid data is found on open by scanning for the first record that is
+ * unused or fails its checksum. A write torn by a crash is overwritten by
+ * the next append.
+ *
+ * If the file can't be opened, the store is inert: get() finds nothing
+ * and put() does nothing.
+ */
+class IdentityStore : NonCopyable
+{
+public:
+	IdentityStore();
+	~IdentityStore();
+
+	/**
+	 * Open or create the store
+	 *
+	 * @param path Path to store file
+	 * @return True if store is open and usable
+	 */
+	bool open(const char *path);
+
+	/**
+	 * @param a Address to look up
+	 * @return Identity or NULL identity if not found
+	 */
+	Identity get(const Address &a) const;
+
+	/**
+	 * Store an identity's public portion
+	 *
+	 * Nothing is written if the same identity is already stored.
+	 *
+	 * @param id Identity to store
+	 * @return True if a new record was appended
+	 */
+	bool put(const Identity &id);
+
+	/**
+	 * Import a directory of identity files named by address (the old iddb.d format)
+	 *
+	 * Files are assumed to contain identities that were validated before
+	 * being saved, so they are parsed but not re-validated.
+	 *
+	 * @param path Directory path
+	 * @return Number of identities imported
+	 */
+	unsigned long importDirectory(const char *path);
+
+	/**
+	 * Start compaction in a background thread if enough records are superseded
+	 *
+	 * Lookups and appends continue while compaction copies live records
+	 * to a new file. The store is only locked for each chunk of copying
+	 * and for the final swap.
+	 *
+	 * @return True if compaction was started
+	 */
+	bool compactInBackground();
+
+	/**
+	 * Compact now in the calling thread, regardless of thresholds
+	 *
+	 * @return True on success, false on failure or if compaction is already running
+	 */
+	bool compact();
+
+	/**
+	 * Write mapped pages back to disk
+	 */
+	void sync();
+
+	/**
+	 * @return Number of distinct identities stored
+	 */
+	inline unsigned long size() const
+	{
+		Mutex::Lock _l(_lock);
+		return _ixCount;
+	}
+
+	/**
+	 * @return Number of superseded records awaiting compaction
+	 */
+	inline unsigned long superseded() const
+	{
+		Mutex::Lock _l(_lock);
+		return ((_end > 1) ? ((unsigned long)(_end - 1) - _ixCount) : 0);
+	}
+
+	// Background compaction thread main
+	void threadMain()
+		throw();
+
+private:
+	static uint64_t _checksum(const unsigned char *rec);
+	bool _compact();
+
+	// Caller must hold _lock for all of these
+	bool _openFile();
+	void _closeFile();
+	bool _map(uint64_t records);
+	void _unmap();
+	void _scan();
+	bool _append(const unsigned char *rec);
+	uint32_t *_ixFind(const Address &a) const;
+	void _ixSet(const Address &a,uint32_t rec);
+	void _ixClear();
+
+	inline unsigned char *_rec(uint32_t n) const throw() { return (_data + ((uint64_t)n * ZT_IDENTITY_STORE_RECORD_SIZE)); }
+
+	std::string _path;
+
+#ifdef __WINDOWS__
+	HANDLE _fh;
+	HANDLE _mh;
+#else
+	int _fd;
+#endif
+	unsigned char *_data; // mapped file, NULL if not open
+	uint32_t _capacity; // records (including header) mapped
+	uint32_t _end; // index of first unused record
+
+	// Open addressing index: key is address + 1 (0 is empty), value is record number
+	uint64_t *_ixKeys;
+	uint32_t *_ixRecs;
+	unsigned long _ixCapacity; // power of two
+	unsigned long _ixCount;
+
+	Mutex _lock;
+
+	Thread _compactThread;
+	volatile bool _compacting;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+#include "IdentityValidator.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "Switch.hpp"
+
+namespace ZeroTier {
+
+IdentityValidator::IdentityValidator(const RuntimeEnvironment *renv,unsigned int threads) :
+	RR(renv),
+	_cache(1024),
+	_cacheOrder(ZT_IDENTITY_VALIDATION_CACHE_SIZE),
+	_cachePtr(0),
+	_pending(64),
+	_run(true)
+{
+	try {
+		for(unsigned int i=0;i<threads;++i) {
+			_Worker *w = new _Worker(this);
+			_workers.push_back(w);
+			w->thread = Thread::start(w);
+		}
+	} catch ( ... ) {
+		_shutdown();
+		throw;
+	}
+}
+
+IdentityValidator::~IdentityValidator()
+{
+	_shutdown();
+}
+
+bool IdentityValidator::validate(const Identity &id)
+{
+	bool valid = false;
+	if (_lookup(id,valid))
+		return valid;
+
+	char *genmem = (char *)0;
+	{
+		Mutex::Lock _l(_scratch_m);
+		if (!_scratch.empty()) {
+			genmem = _scratch.back();
+			_scratch.pop_back();
+		}
+	}
+	if (!genmem)
+		genmem = new char[ZT_IDENTITY_GEN_MEMORY];
+
+	valid = id.locallyValidate(genmem);
+
+	{
+		Mutex::Lock _l(_scratch_m);
+		_scratch.push_back(genmem);
+	}
+
+	_remember(id,valid);
+	return valid;
+}
+
+IdentityValidator::Result IdentityValidator::validateAsync(const Identity &id)
+{
+	bool valid = false;
+	if (_lookup(id,valid))
+		return (valid ? VALID : INVALID);
+
+	if (_workers.empty())
+		return (validate(id) ? VALID : INVALID);
+
+	{
+		Mutex::Lock _l(_queue_m);
+		if (_pending.contains(id.address()))
+			return PENDING;
+		if (_pending.size() >= ZT_IDENTITY_VALIDATION_MAX_QUEUE)
+			return INVALID;
+		_pending.set(id.address(),true);
+		_queue.push_back(id);
+	}
+	_queueCond.signal();
+
+	return PENDING;
+}
+
+void IdentityValidator::_shutdown()
+{
+	{
+		Mutex::Lock _l(_queue_m);
+		_run = false;
+	}
+	_queueCond.signal(); // each exiting worker signals the next
+	for(std::vector<_Worker *>::iterator w(_workers.begin());w!=_workers.end();++w) {
+		Thread::join((*w)->thread);
+		delete *w;
+	}
+	_workers.clear();
+
+	for(std::vector<char *>::iterator s(_scratch.begin());s!=_scratch.end();++s)
+		delete [] *s;
+	_scratch.clear();
+}
+
+bool IdentityValidator::_lookup(const Identity &id,bool &valid) const
+{
+	Mutex::Lock _l(_cache_m);
+	const _CacheEntry *e = _cache.get(id.address());
+	if ((e)&&(e->pub == id.publicKey())) {
+		valid = e->valid;
+		return true;
+	}
+	return false;
+}
+
+void IdentityValidator::_remember(const Identity &id,bool valid)
+{
+	Mutex::Lock _l(_cache_m);
+	_CacheEntry *e = _cache.get(id.address());
+	if (!e) {
+		Address &slot = _cacheOrder[_cachePtr];
+		if (slot)
+			_cache.erase(slot);
+		slot = id.address();
+		_cachePtr = (_cachePtr + 1) % ZT_IDENTITY_VALIDATION_CACHE_SIZE;
+		e = &(_cache[id.address()]);
+	}
+	e->pub = id.publicKey();
+	e->valid = valid;
+}
+
+IdentityValidator::_Worker::_Worker(IdentityValidator *p) :
+	parent(p),
+	genmem(new char[ZT_IDENTITY_GEN_MEMORY]),
+	thread()
+{
+}
+
+IdentityValidator::_Worker::~_Worker()
+{
+	delete [] genmem;
+}
+
+void IdentityValidator::_Worker::threadMain()
+	throw()
+{
+	for(;;) {
+		Identity id;
+		bool more = false;
+		{
+			Mutex::Lock _l(parent->_queue_m);
+			if (!parent->_run)
+				break;
+			if (!parent->_queue.empty()) {
+				id = parent->_queue.front();
+				parent->_queue.pop_front();
+				more = !parent->_queue.empty();
+			}
+		}
+
+		if (!id) {
+			parent->_queueCond.wait();
+			continue;
+		}
+		if (more)
+			parent->_queueCond.signal(); // signals don't stack, so pass the baton
+
+		parent->_remember(id,id.locallyValidate(genmem));
+		{
+			Mutex::Lock _l(parent->_queue_m);
+			parent->_pending.erase(id.address());
+		}
+
+		// Packets that got PENDING are sitting in the Switch's receive queue
+		const RuntimeEnvironment *RR = parent->RR;
+		if ((RR)&&(RR->sw)) {
+			try {
+				RR->sw->retryReceiveQueue();
+			} catch ( ... ) {}
+		}
+	}
+	parent->_queueCond.signal();
+}
+
+} // namespace ZeroTier
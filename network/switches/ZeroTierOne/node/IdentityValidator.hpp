@@ -0,0 +1,162 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+#ifndef ZT_IDENTITYVALIDATOR_HPP
+#define ZT_IDENTITYVALIDATOR_HPP
+
+#include <vector>
+#include <list>
+
+#include "Constants.hpp"
+#include "Identity.hpp"
+#include "Address.hpp"
+#include "C25519.hpp"
+#include "Hashtable.hpp"
+#include "Mutex.hpp"
+#include "Condition.hpp"
+#include "Thread.hpp"
+#include "NonCopyable.hpp"
+
+namespace ZeroTier {
+
+class RuntimeEnvironment;
+
+/**
+ * Caching, optionally multithreaded front end to Identity::locallyValidate()
+ *
+ * Validating an identity costs a pass of the memory-hard hash over
+ * ZT_IDENTITY_GEN_MEMORY bytes of scratch. Results are remembered by
+ * address and public key in a bounded cache so repeated HELLOs from the
+ * same identity are cheap, and scratch memory is reused instead of being
+ * allocated per call.
+ *
+ * Background threads can take validation off the packet processing path.
+ * When one finishes, it asks the Switch to retry its receive queue so that
+ * packets waiting on the result get processed.
+ */
+class IdentityValidator : NonCopyable
+{
+public:
+	enum Result
+	{
+		VALID = 0,
+		INVALID = 1,
+		PENDING = 2
+	};
+
+	/**
+	 * @param renv Runtime environment (RR->sw is notified when async validations finish, if set)
+	 * @param threads Number of background validation threads, 0 for none
+	 */
+	IdentityValidator(const RuntimeEnvironment *renv,unsigned int threads);
+
+	~IdentityValidator();
+
+	/**
+	 * Validate an identity now, using the cache if possible
+	 *
+	 * @param id Identity to validate
+	 * @return True if identity is valid
+	 */
+	bool validate(const Identity &id);
+
+	/**
+	 * Validate an identity if the result is cached, otherwise queue it
+	 *
+	 * If there are no background threads this validates synchronously. If
+	 * the queue is full, INVALID is returned and the caller should drop
+	 * whatever it was doing.
+	 *
+	 * @param id Identity to validate
+	 * @return VALID, INVALID, or PENDING if validation has been queued or is already in progress
+	 */
+	Result validateAsync(const Identity &id);
+
+	/**
+	 * @return Number of cached validation results
+	 */
+	inline unsigned long cacheSize() const
+	{
+		Mutex::Lock _l(_cache_m);
+		return _cache.size();
+	}
+
+	/**
+	 * @return Number of identities waiting for or undergoing background validation
+	 */
+	inline unsigned long pendingCount() const
+	{
+		Mutex::Lock _l(_queue_m);
+		return _pending.size();
+	}
+
+private:
+	struct _CacheEntry
+	{
+		C25519::Public pub;
+		bool valid;
+	};
+
+	class _Worker
+	{
+	public:
+		_Worker(IdentityValidator *p);
+		~_Worker();
+		void threadMain() throw();
+
+		IdentityValidator *const parent;
+		char *const genmem;
+		Thread thread;
+	};
+
+	void _shutdown();
+	bool _lookup(const Identity &id,bool &valid) const;
+	void _remember(const Identity &id,bool valid);
+
+	const RuntimeEnvironment *RR;
+
+	Hashtable< Address,_CacheEntry > _cache;
+	std::vector<Address> _cacheOrder; // ring buffer in insertion order for eviction
+	unsigned long _cachePtr;
+	Mutex _cache_m;
+
+	std::list<Identity> _queue;
+	Hashtable< Address,bool > _pending; // queued or being validated
+	Mutex _queue_m;
+	Condition _queueCond;
+	volatile bool _run;
+
+	std::vector<char *> _scratch; // genmem free list for synchronous callers
+	Mutex _scratch_m;
+
+	std::vector<_Worker *> _workers;
+};
+
+} // namespace ZeroTier
+
+#endif
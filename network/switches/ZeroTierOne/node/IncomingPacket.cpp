@@ -40,32 +40,55 @@
 #include "Peer.hpp"
 #include "NodeConfig.hpp"
 #include "Service.hpp"
+#include "NetconfCache.hpp"
 #include "SoftwareUpdater.hpp"
+#include "IdentityValidator.hpp"
+#include "Metrics.hpp"
 
 namespace ZeroTier {
 
 bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR)
+{
+	if (!_arrivalUs)
+		return _tryDecode(RR);
+
+	const bool done = _tryDecode(RR);
+	if (done) {
+		RR->metrics->latencySince(Metrics::STAGE_RX_QUEUE,_queuedUs);
+		RR->metrics->latencySince(Metrics::STAGE_RX_TOTAL,_arrivalUs);
+	} else if (!_queuedUs)
+		_queuedUs = Utils::nowMicros();
+	return done;
+}
+
+bool IncomingPacket::_tryDecode(const RuntimeEnvironment *RR)
 {
 	try {
 		if ((cipher() == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE)&&(verb() == Packet::VERB_HELLO)) {
 			// Unencrypted HELLOs are handled here since they are used to
 			// populate our identity cache in the first place. _doHELLO() is special
 			// in that it contains its own authentication logic.
+			RR->metrics->received(Packet::VERB_HELLO);
 			return _doHELLO(RR);
 		}
 
 		SharedPtr<Peer> peer = RR->topology->getPeer(source());
 		if (peer) {
+			const uint64_t decryptStart = (_arrivalUs) ? Utils::nowMicros() : 0;
 			if (!dearmor(peer->key())) {
 				TRACE("dropped packet from %s(%s), MAC authentication failed (size: %u)",source().toString().c_str(),_remoteAddress.toString().c_str(),size());
+				RR->metrics->inc(Metrics::COUNTER_AUTHENTICATION_FAILURES);
 				return true;
 			}
 			if (!uncompress()) {
 				TRACE("dropped packet from %s(%s), compressed data invalid",source().toString().c_str(),_remoteAddress.toString().c_str());
+				RR->metrics->inc(Metrics::COUNTER_DECOMPRESSION_FAILURES);
 				return true;
 			}
+			RR->metrics->latencySince(Metrics::STAGE_DECRYPT,decryptStart);
 
 			//TRACE("<< %s from %s(%s)",Packet::verbString(verb()),source().toString().c_str(),_remoteAddress.toString().c_str());
+			RR->metrics->received(verb());
 
 			switch(verb()) {
 				//case Packet::VERB_NOP:
@@ -133,8 +156,9 @@ bool IncomingPacket::_doERROR(const RuntimeEnvironment *RR,const SharedPtr<Peer>
 					if (nconf) {
 						Packet outp(peer->address(),RR->identity.address(),Packet::VERB_NETWORK_MEMBERSHIP_CERTIFICATE);
 						nconf->com().serialize(outp);
+						RR->metrics->sent(outp.verb());
 						outp.armor(peer->key(),true);
-						_fromSock->send(_remoteAddress,outp.data(),outp.size());
+						RR->metrics->wireSent(outp.size(),_fromSock->send(_remoteAddress,outp.data(),outp.size()));
 					}
 				}
 			}	break;
@@ -176,12 +200,28 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR)
 			return true;
 		}
 
-		if (!id.locallyValidate()) {
-			TRACE("dropped HELLO from %s(%s): identity invalid",source().toString().c_str(),_remoteAddress.toString().c_str());
-			return true;
+		SharedPtr<Peer> peer(RR->topology->getPeer(id.address()));
+		if ((!peer)||(peer->identity() != id)) {
+			// Unencrypted HELLOs haven't been touched by dearmor() yet, so they
+			// can wait in the receive queue while a background thread does
+			// the memory-hard validation. If a (rare) late result misses its
+			// retry, the sender's next HELLO will hit the validation cache.
+			if (cipher() == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE) {
+				switch(RR->idv->validateAsync(id)) {
+					case IdentityValidator::PENDING:
+						return false;
+					case IdentityValidator::INVALID:
+						TRACE("dropped HELLO from %s(%s): identity invalid or validation queue full",source().toString().c_str(),_remoteAddress.toString().c_str());
+						return true;
+					default:
+						break;
+				}
+			} else if (!RR->idv->validate(id)) {
+				TRACE("dropped HELLO from %s(%s): identity invalid",source().toString().c_str(),_remoteAddress.toString().c_str());
+				return true;
+			}
 		}
 
-		SharedPtr<Peer> peer(RR->topology->getPeer(id.address()));
 		if (peer) {
 			if (peer->identity() != id) {
 				unsigned char key[ZT_PEER_SECRET_KEY_LENGTH];
@@ -192,8 +232,9 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR)
 						outp.append((unsigned char)Packet::VERB_HELLO);
 						outp.append(packetId());
 						outp.append((unsigned char)Packet::ERROR_IDENTITY_COLLISION);
+						RR->metrics->sent(outp.verb());
 						outp.armor(key,true);
-						_fromSock->send(_remoteAddress,outp.data(),outp.size());
+						RR->metrics->wireSent(outp.size(),_fromSock->send(_remoteAddress,outp.data(),outp.size()));
 					} else {
 						LOG("rejected HELLO from %s(%s): packet failed authentication",source().toString().c_str(),_remoteAddress.toString().c_str());
 					}
@@ -230,8 +271,9 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR)
 		outp.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
 		outp.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
 		outp.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+		RR->metrics->sent(outp.verb());
 		outp.armor(peer->key(),true);
-		_fromSock->send(_remoteAddress,outp.data(),outp.size());
+		RR->metrics->wireSent(outp.size(),_fromSock->send(_remoteAddress,outp.data(),outp.size()));
 	} catch (std::exception &ex) {
 		TRACE("dropped HELLO from %s(%s): %s",source().toString().c_str(),_remoteAddress.toString().c_str(),ex.what());
 	} catch ( ... ) {
@@ -281,7 +323,7 @@ bool IncomingPacket::_doOK(const RuntimeEnvironment *RR,const SharedPtr<Peer> &p
 				// kind of trust mechanism.
 				if (RR->topology->isSupernode(source())) {
 					Identity id(*this,ZT_PROTO_VERB_WHOIS__OK__IDX_IDENTITY);
-					if (id.locallyValidate())
+					if (RR->idv->validate(id))
 						RR->sw->doAnythingWaitingForPeer(RR->topology->addPeer(SharedPtr<Peer>(new Peer(RR->identity,id))));
 				}
 			} break;
@@ -292,9 +334,8 @@ bool IncomingPacket::_doOK(const RuntimeEnvironment *RR,const SharedPtr<Peer> &p
 					// OK(NETWORK_CONFIG_REQUEST) is only accepted from a network's
 					// controller.
 					unsigned int dictlen = at<uint16_t>(ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST__OK__IDX_DICT_LEN);
-					std::string dict((const char *)field(ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST__OK__IDX_DICT,dictlen),dictlen);
-					if (dict.length()) {
-						nw->setConfiguration(Dictionary(dict));
+					if (dictlen) {
+						nw->setConfiguration(field(ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST__OK__IDX_DICT,dictlen),dictlen);
 						TRACE("got network configuration for network %.16llx from %s",(unsigned long long)nw->id(),source().toString().c_str());
 					}
 				}
@@ -358,16 +399,18 @@ bool IncomingPacket::_doWHOIS(const RuntimeEnvironment *RR,const SharedPtr<Peer>
 				outp.append((unsigned char)Packet::VERB_WHOIS);
 				outp.append(packetId());
 				queried->identity().serialize(outp,false);
+				RR->metrics->sent(outp.verb());
 				outp.armor(peer->key(),true);
-				_fromSock->send(_remoteAddress,outp.data(),outp.size());
+				RR->metrics->wireSent(outp.size(),_fromSock->send(_remoteAddress,outp.data(),outp.size()));
 			} else {
 				Packet outp(peer->address(),RR->identity.address(),Packet::VERB_ERROR);
 				outp.append((unsigned char)Packet::VERB_WHOIS);
 				outp.append(packetId());
 				outp.append((unsigned char)Packet::ERROR_OBJ_NOT_FOUND);
 				outp.append(payload(),ZT_ADDRESS_LENGTH);
+				RR->metrics->sent(outp.verb());
 				outp.armor(peer->key(),true);
-				_fromSock->send(_remoteAddress,outp.data(),outp.size());
+				RR->metrics->wireSent(outp.size(),_fromSock->send(_remoteAddress,outp.data(),outp.size()));
 			}
 		} else {
 			TRACE("dropped WHOIS from %s(%s): missing or invalid address",source().toString().c_str(),_remoteAddress.toString().c_str());
@@ -636,6 +679,7 @@ bool IncomingPacket::_doP5_MULTICAST_FRAME(const RuntimeEnvironment *RR,const Sh
 				setDestination(sn->address());
 				setSource(RR->identity.address());
 				compress();
+				RR->metrics->sent(verb());
 				armor(sn->key(),true);
 				sn->send(RR,data(),size(),Utils::now());
 			}
@@ -700,9 +744,29 @@ bool IncomingPacket::_doNETWORK_CONFIG_REQUEST(const RuntimeEnvironment *RR,cons
 			char tmp[128];
 			unsigned int dictLen = at<uint16_t>(ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST_IDX_DICT_LEN);
 
+			std::string meta;
+			if (dictLen)
+				meta.assign((const char *)field(ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST_IDX_DICT,dictLen),dictLen);
+
+			std::string netconf;
+			if (RR->netconfCache->lookup(nwid,peer->address(),meta,Utils::now(),netconf)) {
+				// Same request as last time and nothing pushed since, so skip the service
+				RR->metrics->inc(Metrics::COUNTER_NETCONF_CACHE_HITS);
+				Packet outp(peer->address(),RR->identity.address(),Packet::VERB_OK);
+				outp.append((unsigned char)Packet::VERB_NETWORK_CONFIG_REQUEST);
+				outp.append(packetId());
+				outp.append(nwid);
+				outp.append((uint16_t)netconf.length());
+				outp.append(netconf.data(),(unsigned int)netconf.length());
+				outp.compress();
+				RR->sw->send(outp,true);
+				peer->received(RR,_fromSock,_remoteAddress,hops(),packetId(),Packet::VERB_NETWORK_CONFIG_REQUEST,0,Packet::VERB_NOP,Utils::now());
+				return true;
+			}
+
 			Dictionary request;
 			if (dictLen)
-				request["meta"] = std::string((const char *)field(ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST_IDX_DICT,dictLen),dictLen);
+				request["meta"] = meta;
 			request["type"] = "netconf-request";
 			request["peerId"] = peer->identity().toString(false);
 			Utils::snprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)nwid);
@@ -712,7 +776,20 @@ bool IncomingPacket::_doNETWORK_CONFIG_REQUEST(const RuntimeEnvironment *RR,cons
 			if (!hops())
 				request["from"] = _remoteAddress.toString();
 			//TRACE("to netconf:\n%s",request.toString().c_str());
-			RR->netconfService->send(request);
+			Utils::snprintf(tmp,sizeof(tmp),"%.10llx-%.16llx",(unsigned long long)peer->address().toInt(),(unsigned long long)nwid);
+			switch(RR->netconfService->request(std::string(tmp),request)) {
+				case Service::REQUEST_QUEUED:
+					RR->metrics->inc(Metrics::COUNTER_NETCONF_REQUESTS);
+					break;
+				case Service::REQUEST_COALESCED:
+					RR->metrics->inc(Metrics::COUNTER_NETCONF_REQUESTS_COALESCED);
+					break;
+				case Service::REQUEST_REFUSED:
+					RR->metrics->inc(Metrics::COUNTER_NETCONF_REQUESTS_REFUSED);
+					TRACE("dropped NETWORK_CONFIG_REQUEST from %s(%s): netconf service busy or not running",source().toString().c_str(),_remoteAddress.toString().c_str());
+					break;
+			}
+			RR->metrics->set(Metrics::GAUGE_NETCONF_REQUESTS_IN_FLIGHT,RR->netconfService->inFlight());
 		} else {
 #endif // !__WINDOWS__
 
@@ -724,8 +801,9 @@ bool IncomingPacket::_doNETWORK_CONFIG_REQUEST(const RuntimeEnvironment *RR,cons
 			outp.append(packetId());
 			outp.append((unsigned char)Packet::ERROR_UNSUPPORTED_OPERATION);
 			outp.append(nwid);
+			RR->metrics->sent(outp.verb());
 			outp.armor(peer->key(),true);
-			_fromSock->send(_remoteAddress,outp.data(),outp.size());
+			RR->metrics->wireSent(outp.size(),_fromSock->send(_remoteAddress,outp.data(),outp.size()));
 
 #ifndef __WINDOWS__
 		}
@@ -778,8 +856,9 @@ bool IncomingPacket::_doMULTICAST_GATHER(const RuntimeEnvironment *RR,const Shar
 			mg.mac().appendTo(outp);
 			outp.append((uint32_t)mg.adi());
 			if (RR->mc->gather(peer->address(),nwid,mg,outp,gatherLimit)) {
+				RR->metrics->sent(outp.verb());
 				outp.armor(peer->key(),true);
-				_fromSock->send(_remoteAddress,outp.data(),outp.size());
+				RR->metrics->wireSent(outp.size(),_fromSock->send(_remoteAddress,outp.data(),outp.size()));
 			}
 		}
 
@@ -869,8 +948,9 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,const Share
 				outp.append((uint32_t)to.adi());
 				outp.append((unsigned char)0x02); // flag 0x02 = contains gather results
 				if (RR->mc->gather(peer->address(),nwid,to,outp,gatherLimit)) {
+					RR->metrics->sent(outp.verb());
 					outp.armor(peer->key(),true);
-					_fromSock->send(_remoteAddress,outp.data(),outp.size());
+					RR->metrics->wireSent(outp.size(),_fromSock->send(_remoteAddress,outp.data(),outp.size()));
 				}
 			}
 		} // else ignore -- not a member of this network
@@ -891,8 +971,9 @@ void IncomingPacket::_sendErrorNeedCertificate(const RuntimeEnvironment *RR,cons
 	outp.append(packetId());
 	outp.append((unsigned char)Packet::ERROR_NEED_MEMBERSHIP_CERTIFICATE);
 	outp.append(nwid);
+	RR->metrics->sent(outp.verb());
 	outp.armor(peer->key(),true);
-	_fromSock->send(_remoteAddress,outp.data(),outp.size());
+	RR->metrics->wireSent(outp.size(),_fromSock->send(_remoteAddress,outp.data(),outp.size()));
 }
 
 } // namespace ZeroTier
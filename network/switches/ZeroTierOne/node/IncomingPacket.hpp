@@ -82,6 +82,8 @@ public:
  		throw(std::out_of_range) :
  		Packet(b),
  		_receiveTime(Utils::now()),
+ 		_arrivalUs(0),
+ 		_queuedUs(0),
  		_fromSock(fromSock),
  		_remoteAddress(remoteAddress),
  		__refCount()
@@ -97,6 +99,9 @@ public:
 	 * Once true is returned, this must not be called again. The packet's state
 	 * may no longer be valid.
 	 *
+	 * If the packet was stamped, time to completion and time spent waiting
+	 * to be retried are recorded in RR->metrics.
+	 *
 	 * @param RR Runtime environment
 	 * @return True if decoding and processing is complete, false if caller should try again
 	 * @throws std::out_of_range Range error processing packet (should be discarded)
@@ -109,7 +114,16 @@ public:
 	 */
 	inline uint64_t receiveTime() const throw() { return _receiveTime; }
 
+	/**
+	 * Start timing this packet's pipeline stages
+	 *
+	 * @param us Arrival time from Utils::nowMicros()
+	 */
+	inline void stamp(uint64_t us) throw() { _arrivalUs = us; }
+
 private:
+	bool _tryDecode(const RuntimeEnvironment *RR);
+
 	// These are called internally to handle packet contents once it has
 	// been authenticated, decrypted, decompressed, and classified.
 	bool _doERROR(const RuntimeEnvironment *RR,const SharedPtr<Peer> &peer);
@@ -131,6 +145,8 @@ private:
 	void _sendErrorNeedCertificate(const RuntimeEnvironment *RR,const SharedPtr<Peer> &peer,uint64_t nwid);
 
 	uint64_t _receiveTime;
+	uint64_t _arrivalUs; // 0 if stages aren't being timed
+	uint64_t _queuedUs; // time of first decode attempt that had to wait
 	SharedPtr<Socket> _fromSock;
 	InetAddress _remoteAddress;
 	AtomicCounter __refCount;
@@ -0,0 +1,166 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "KeepaliveScheduler.hpp"
+
+namespace ZeroTier {
+
+KeepaliveScheduler::KeepaliveScheduler() :
+	_heap(),
+	_peers(1024),
+	_supernodeInterval(ZT_KEEPALIVE_SUPERNODE_INTERVAL),
+	_activeInterval(ZT_KEEPALIVE_ACTIVE_INTERVAL),
+	_idleInterval(ZT_KEEPALIVE_IDLE_INTERVAL),
+	_lastRun(0),
+	_second(0),
+	_pingsThisSecond(0)
+{
+	memset(&_stats,0,sizeof(_stats));
+}
+
+void KeepaliveScheduler::setIntervals(unsigned long supernode,unsigned long active,unsigned long idle)
+{
+	Mutex::Lock _l(_lock);
+	_supernodeInterval = supernode;
+	_activeInterval = active;
+	_idleInterval = idle;
+}
+
+void KeepaliveScheduler::add(const SharedPtr<Peer> &peer,bool supernode,uint64_t now)
+{
+	Mutex::Lock _l(_lock);
+	_State &s = _peers[peer->address()];
+	const bool reschedule = ((!s.peer)||(s.supernode != supernode));
+	s.peer = peer;
+	s.supernode = supernode;
+	if (reschedule)
+		_schedule(peer->address(),s,now + (uint64_t)(_prng.next32() % ZT_PING_CHECK_DELAY));
+}
+
+void KeepaliveScheduler::remove(const Address &addr)
+{
+	Mutex::Lock _l(_lock);
+	_peers.erase(addr); // its heap entry goes stale and is skipped by due()
+}
+
+unsigned long KeepaliveScheduler::due(uint64_t now,bool amSupernode,std::vector< SharedPtr<Peer> > &ping)
+{
+	Mutex::Lock _l(_lock);
+
+	if ((now - _lastRun) < ZT_KEEPALIVE_TICK_INTERVAL)
+		return (unsigned long)(ZT_KEEPALIVE_TICK_INTERVAL - (now - _lastRun));
+	_lastRun = now;
+
+	unsigned int n = 0;
+	while (!_heap.empty()) {
+		const _Deadline top(_heap.front());
+		if (top.when > now)
+			return (unsigned long)(top.when - now);
+
+		_State *s = _peers.get(top.address);
+		if ((!s)||(s->when != top.when)) { // stale
+			std::pop_heap(_heap.begin(),_heap.end());
+			_heap.pop_back();
+			continue;
+		}
+
+		const Peer &p = *(s->peer);
+		unsigned long interval;
+		if (s->supernode)
+			interval = _supernodeInterval;
+		else if (amSupernode)
+			interval = 0;
+		else if ((now - p.lastFrame()) < ZT_PEER_PATH_ACTIVITY_TIMEOUT)
+			interval = _activeInterval;
+		else interval = _idleInterval;
+
+		if (!interval) {
+			std::pop_heap(_heap.begin(),_heap.end());
+			_heap.pop_back();
+			_schedule(top.address,*s,now + ZT_KEEPALIVE_IDLE_RECHECK_INTERVAL - _jitter(ZT_KEEPALIVE_IDLE_RECHECK_INTERVAL));
+			continue;
+		}
+
+		// Deadlines are jittered early by up to interval/ZT_KEEPALIVE_JITTER_DIVISOR,
+		// so anything inside that window counts as due.
+		const uint64_t lr = p.lastDirectReceive();
+		const uint64_t dueAt = lr + interval - (interval / ZT_KEEPALIVE_JITTER_DIVISOR);
+		if (dueAt > now) {
+			// Heard from it since this deadline was set
+			std::pop_heap(_heap.begin(),_heap.end());
+			_heap.pop_back();
+			_schedule(top.address,*s,lr + interval - _jitter(interval));
+			continue;
+		}
+
+		if (n >= ZT_KEEPALIVE_MAX_PER_TICK) {
+			++_stats.pingsDeferred;
+			return ZT_KEEPALIVE_TICK_INTERVAL;
+		}
+		ping.push_back(s->peer);
+		++n;
+		_countPing(now);
+
+		std::pop_heap(_heap.begin(),_heap.end());
+		_heap.pop_back();
+		_schedule(top.address,*s,now + ZT_PING_CHECK_DELAY - _jitter(ZT_PING_CHECK_DELAY));
+	}
+
+	return ZT_PING_CHECK_DELAY;
+}
+
+void KeepaliveScheduler::_schedule(const Address &a,_State &s,uint64_t when)
+{
+	s.when = when;
+	_heap.push_back(_Deadline(when,a));
+	std::push_heap(_heap.begin(),_heap.end());
+}
+
+void KeepaliveScheduler::_countPing(uint64_t now)
+{
+	const uint64_t sec = now / 1000;
+	if (sec != _second) {
+		if (_pingsThisSecond) {
+			unsigned int b = 0;
+			while (((_pingsThisSecond >> (b + 1)) != 0)&&(b < (ZT_KEEPALIVE_HISTOGRAM_BUCKETS - 1)))
+				++b;
+			++_stats.pingsPerSecondHistogram[b];
+		}
+		_second = sec;
+		_pingsThisSecond = 0;
+	}
+	++_stats.pingsSent;
+	if (++_pingsThisSecond > _stats.peakPingsPerSecond)
+		_stats.peakPingsPerSecond = _pingsThisSecond;
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,180 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+#ifndef ZT_KEEPALIVESCHEDULER_HPP
+#define ZT_KEEPALIVESCHEDULER_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "Constants.hpp"
+#include "Address.hpp"
+#include "Peer.hpp"
+#include "SharedPtr.hpp"
+#include "Hashtable.hpp"
+#include "CMWC4096.hpp"
+#include "Mutex.hpp"
+#include "NonCopyable.hpp"
+
+namespace ZeroTier {
+
+/**
+ * Decides when to send keepalive pings to peers
+ *
+ * Each peer has a deadline in a min-heap, so a run only looks at peers
+ * that are due instead of walking all of them. Deadlines are moved
+ * earlier by a random amount of up to 1/ZT_KEEPALIVE_JITTER_DIVISOR of the
+ * interval, so peers learned in a burst drift apart instead of being
+ * pinged in a burst forever. Runs are at least ZT_KEEPALIVE_TICK_INTERVAL
+ * apart and return at most ZT_KEEPALIVE_MAX_PER_TICK peers, so the rest
+ * wait for the next run.
+ *
+ * Supernodes, active peers (frames exchanged within the path activity
+ * timeout) and idle peers each have their own interval. A peer is pinged
+ * when nothing has been received from it directly for its interval. If it
+ * doesn't answer, it's pinged again ZT_PING_CHECK_DELAY later.
+ *
+ * Peers stay scheduled until remove() is called. Topology does that when
+ * it drops a peer in clean(), so the two never disagree about who exists.
+ *
+ * The scheduler only picks peers. Sending the pings is up to the caller,
+ * which should do it after due() returns since no lock is held then.
+ */
+class KeepaliveScheduler : NonCopyable
+{
+public:
+	struct Stats
+	{
+		uint64_t pingsSent;
+		uint64_t pingsDeferred; // runs that hit ZT_KEEPALIVE_MAX_PER_TICK with pings still due
+		unsigned long peakPingsPerSecond;
+		uint64_t pingsPerSecondHistogram[ZT_KEEPALIVE_HISTOGRAM_BUCKETS]; // seconds per bucket, see ZT_KEEPALIVE_HISTOGRAM_BUCKETS
+	};
+
+	KeepaliveScheduler();
+
+	/**
+	 * Set keepalive intervals in ms (0 means don't ping that kind of peer)
+	 *
+	 * New intervals apply from each peer's next deadline.
+	 *
+	 * @param supernode Interval for supernodes
+	 * @param active Interval for peers with recent frames
+	 * @param idle Interval for other peers
+	 */
+	void setIntervals(unsigned long supernode,unsigned long active,unsigned long idle);
+
+	/**
+	 * Add a peer to the schedule or update it
+	 *
+	 * New peers are first looked at within ZT_PING_CHECK_DELAY, at a random
+	 * point so a burst of new peers is spread out. Adding a peer that's
+	 * already scheduled replaces its Peer object and supernode flag but
+	 * keeps its deadline, unless the flag changed.
+	 *
+	 * @param peer Peer
+	 * @param supernode True if peer is a supernode
+	 * @param now Current time
+	 */
+	void add(const SharedPtr<Peer> &peer,bool supernode,uint64_t now);
+
+	/**
+	 * Remove a peer from the schedule
+	 *
+	 * @param addr Peer address
+	 */
+	void remove(const Address &addr);
+
+	/**
+	 * Get peers that need a keepalive now
+	 *
+	 * @param now Current time
+	 * @param amSupernode If true, only supernodes are pinged
+	 * @param ping Peers to ping are appended here
+	 * @return Milliseconds until this should be called again
+	 */
+	unsigned long due(uint64_t now,bool amSupernode,std::vector< SharedPtr<Peer> > &ping);
+
+	/**
+	 * @return Number of peers in schedule
+	 */
+	inline unsigned long size() const
+	{
+		Mutex::Lock _l(_lock);
+		return _peers.size();
+	}
+
+	/**
+	 * @return Keepalive statistics
+	 */
+	inline Stats stats() const
+	{
+		Mutex::Lock _l(_lock);
+		return _stats;
+	}
+
+private:
+	struct _Deadline
+	{
+		_Deadline() : when(0),address() {}
+		_Deadline(uint64_t w,const Address &a) : when(w),address(a) {}
+		uint64_t when;
+		Address address;
+		// Inverted, since std heap functions build a max-heap
+		inline bool operator<(const _Deadline &d) const throw() { return (when > d.when); }
+	};
+
+	struct _State
+	{
+		_State() : peer(),when(0),supernode(false) {}
+		SharedPtr<Peer> peer;
+		uint64_t when; // heap entries with any other time are stale
+		bool supernode;
+	};
+
+	void _schedule(const Address &a,_State &s,uint64_t when);
+	inline unsigned long _jitter(unsigned long interval) { return ((interval >= ZT_KEEPALIVE_JITTER_DIVISOR) ? (unsigned long)(_prng.next32() % (interval / ZT_KEEPALIVE_JITTER_DIVISOR)) : 0); }
+	void _countPing(uint64_t now);
+
+	std::vector<_Deadline> _heap;
+	Hashtable< Address,_State > _peers;
+	unsigned long _supernodeInterval;
+	unsigned long _activeInterval;
+	unsigned long _idleInterval;
+	uint64_t _lastRun;
+	uint64_t _second;
+	unsigned long _pingsThisSecond;
+	Stats _stats;
+	CMWC4096 _prng;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -33,24 +33,45 @@
 
 #include "Constants.hpp"
 #include "Logger.hpp"
+#include "Utils.hpp"
 
 namespace ZeroTier {
 
-Logger::Logger(const char *p,const char *prefix,unsigned long maxLogSize) :
+Logger::Logger(const char *p,const char *prefix,unsigned long maxLogSize,bool async) :
 	_path((p) ? p : ""),
 	_prefix((prefix) ? (std::string(prefix) + " ") : ""),
 	_maxLogSize(maxLogSize),
 	_log_m(),
-	_log((FILE *)0)
+	_log((FILE *)0),
+	_ring((MPSCQueue<_Record> *)0),
+	_droppedReported(0),
+	_run(true)
 {
 	if (_path.length())
 		_log = fopen(_path.c_str(),"a");
 	else _log = stdout;
+
+	if ((async)&&(_log)) {
+		_ring = new MPSCQueue<_Record>(ZT_LOGGER_ASYNC_RING_SIZE);
+		try {
+			_thread = Thread::start(this);
+		} catch ( ... ) {
+			delete _ring; // fall back to synchronous logging
+			_ring = (MPSCQueue<_Record> *)0;
+		}
+	}
 }
 
 Logger::~Logger()
 {
-	fflush(_log);
+	if (_ring) {
+		_run = false;
+		_wake.signal();
+		Thread::join(_thread);
+		delete _ring;
+	}
+	if (_log)
+		fflush(_log);
 	if ((_log)&&(_log != stdout)&&(_log != stderr))
 		fclose(_log);
 }
@@ -60,6 +81,13 @@ void Logger::log(const char *fmt,...)
 	va_list ap;
 	char tmp[128];
 
+	if (_ring) {
+		va_start(ap,fmt);
+		_enqueue((const char *)0,0,fmt,ap);
+		va_end(ap);
+		return;
+	}
+
 	if (_log) {
 		Mutex::Lock _l(_log_m);
 		_rotateIfNeeded();
@@ -101,6 +129,13 @@ void Logger::trace(const char *module,unsigned int line,const char *fmt,...)
 	va_list ap;
 	char tmp[128];
 
+	if (_ring) {
+		va_start(ap,fmt);
+		_enqueue(module,line,fmt,ap);
+		va_end(ap);
+		return;
+	}
+
 	if (_log) {
 		Mutex::Lock _l(_log_m);
 		_rotateIfNeeded();
@@ -137,6 +172,92 @@ void Logger::trace(const char *module,unsigned int line,const char *fmt,...)
 }
 #endif
 
+void Logger::threadMain()
+	throw()
+{
+	for(;;) {
+		const bool run = _run;
+		unsigned int n = _drain();
+		const unsigned long d = _ring->overflows();
+		if (d != _droppedReported) {
+			char msg[128];
+			Utils::snprintf(msg,sizeof(msg),"%lu log messages dropped (log ring full)",d - _droppedReported);
+			_droppedReported = d;
+			_write(time(0),(const char *)0,0,msg);
+			++n;
+		}
+		if (n)
+			fflush(_log);
+		if (!run)
+			break; // everything queued before ~Logger() has now been written
+		_wake.wait(ZT_LOGGER_ASYNC_FLUSH_INTERVAL);
+	}
+}
+
+void Logger::_enqueue(const char *module,unsigned int line,const char *fmt,va_list ap)
+{
+	unsigned int ticket;
+	_Record *const r = _ring->claim(ticket);
+	if (!r)
+		return; // counted by the ring and reported by the writer
+
+	r->timestamp = time(0);
+	r->module = module;
+	r->line = line;
+	if (vsnprintf(r->msg,sizeof(r->msg),fmt,ap) < 0)
+		r->msg[0] = (char)0;
+	r->msg[sizeof(r->msg) - 1] = (char)0;
+	_ring->publish(ticket);
+
+	// Don't wait for the next flush interval if we're filling up
+	if ((ticket & ((ZT_LOGGER_ASYNC_RING_SIZE / 2) - 1)) == 0)
+		_wake.signal();
+}
+
+unsigned int Logger::_drain()
+{
+	unsigned int n = 0;
+	_Record *r;
+	while ((r = _ring->front())) {
+		_write(r->timestamp,r->module,r->line,r->msg);
+		_ring->pop();
+		++n;
+	}
+	return n;
+}
+
+void Logger::_write(time_t timestamp,const char *module,unsigned int line,const char *msg)
+{
+	char tmp[128];
+
+	_rotateIfNeeded();
+	if (!_log)
+		return;
+
+#ifdef __WINDOWS__
+	ctime_s(tmp,sizeof(tmp),&timestamp);
+	char *nowstr = tmp;
+#else
+	char *nowstr = ctime_r(&timestamp,tmp);
+#endif
+	for(char *c=nowstr;*c;++c) {
+		if (*c == '\n')
+			*c = '\0';
+	}
+
+	if (_prefix.length())
+		fwrite(_prefix.data(),1,_prefix.length(),_log);
+
+	if (module)
+		fprintf(_log,"[%s] TRACE/%s:%u %s",nowstr,module,line,msg);
+	else fprintf(_log,"[%s] %s",nowstr,msg);
+#ifdef _WIN32
+	fwrite("\r\n",1,2,_log);
+#else
+	fwrite("\n",1,1,_log);
+#endif
+}
+
 void Logger::_rotateIfNeeded()
 {
 	if ((_maxLogSize)&&(_log != stdout)&&(_log != stderr)) {
@@ -29,12 +29,18 @@
 #define ZT_LOGGER_HPP
 
 #include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
 
 #include <string>
 #include <stdexcept>
 
+#include "Constants.hpp"
 #include "NonCopyable.hpp"
 #include "Mutex.hpp"
+#include "Condition.hpp"
+#include "Thread.hpp"
+#include "MPSCQueue.hpp"
 
 #undef LOG
 #define LOG(f,...) if (RR->log) RR->log->log(f,##__VA_ARGS__)
@@ -50,6 +56,13 @@ namespace ZeroTier {
 
 /**
  * Utility for outputting logs to a file or stdout/stderr
+ *
+ * In async mode, log() and trace() only format the message into a slot in
+ * a bounded lock-free ring (MPSCQueue), so callers never take a lock or
+ * touch the file. A background thread adds timestamps and
+ * prefixes, handles rotation, and writes whatever has queued up with one
+ * flush per batch. If the ring is full the message is dropped and counted,
+ * and the count is logged once there's room again.
  */
 class Logger : NonCopyable
 {
@@ -64,8 +77,9 @@ public:
 	 * @param p Path to log to or NULL to use stdout
 	 * @param prefix Prefix to prepend to log lines or NULL for none
 	 * @param maxLogSize Maximum log size (0 for no limit)
+	 * @param async If true, write from a background thread (see class description)
 	 */
-	Logger(const char *p,const char *prefix,unsigned long maxLogSize);
+	Logger(const char *p,const char *prefix,unsigned long maxLogSize,bool async = false);
 	~Logger();
 
 	void log(const char *fmt,...);
@@ -76,7 +90,30 @@ public:
 	inline void trace(const char *module,unsigned int line,const char *fmt,...) {}
 #endif
 
+	/**
+	 * @return Number of messages dropped in async mode because the ring was full
+	 */
+	inline unsigned long dropped() const throw() { return ((_ring) ? _ring->overflows() : 0); }
+
+	/**
+	 * Background thread main loop (async mode only)
+	 */
+	void threadMain()
+		throw();
+
 private:
+	// Fixed-size record in the async ring
+	struct _Record
+	{
+		time_t timestamp;
+		const char *module; // __FILE__ of TRACE, NULL for log()
+		unsigned int line;
+		char msg[ZT_LOGGER_ASYNC_MAX_MESSAGE];
+	};
+
+	void _enqueue(const char *module,unsigned int line,const char *fmt,va_list ap);
+	unsigned int _drain();
+	void _write(time_t timestamp,const char *module,unsigned int line,const char *msg);
 	void _rotateIfNeeded();
 
 	std::string _path;
@@ -84,6 +121,13 @@ private:
 	unsigned long _maxLogSize;
 	Mutex _log_m;
 	FILE *_log;
+
+	// Async mode state, unused if _ring is NULL
+	MPSCQueue<_Record> *_ring;
+	unsigned long _droppedReported;
+	Condition _wake;
+	volatile bool _run;
+	Thread _thread;
 };
 
 } // namespace ZeroTier
@@ -243,6 +243,11 @@ public:
 	 */
 	inline unsigned int size() const throw() { return 6; }
 
+	/**
+	 * @return Hash code for use with Hashtable
+	 */
+	inline unsigned long hashCode() const throw() { return (unsigned long)_m; }
+
 	inline MAC &operator=(const MAC &m)
 		throw()
 	{
@@ -0,0 +1,317 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+#ifndef ZT_MPSCQUEUE_HPP
+#define ZT_MPSCQUEUE_HPP
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+#include "Condition.hpp"
+
+#ifdef __WINDOWS__
+#include <WinSock2.h>
+#include <Windows.h>
+#endif
+
+namespace ZeroTier {
+
+/**
+ * Bounded lock-free multiple producer, single consumer queue
+ *
+ * Entries live in a fixed ring of preallocated cells, so the ring is its
+ * own buffer pool: producers claim() a cell, fill it in place, and
+ * publish() it, and the consumer reads entries in place with front() or
+ * drain() before handing the cell back. Nothing is allocated or copied
+ * after construction unless push() or pop(T &) are used for convenience.
+ *
+ * Producers claim cells with compare-and-swap and never block. If the
+ * ring is full claim() fails and the failure is counted in overflows().
+ * Each cell's sequence number tells producers whether the consumer is
+ * done with it and tells the consumer whether a producer has finished
+ * filling it, so a slow producer only holds up entries behind its own.
+ *
+ * Only one thread at a time may call the consumer methods: front(),
+ * pop(), drain(), and wait().
+ *
+ * @tparam T Entry type (must be default constructable and assignable)
+ */
+template<typename T>
+class MPSCQueue : NonCopyable
+{
+public:
+	/**
+	 * @param capacity Minimum number of entries (rounded up to a power of two)
+	 */
+	MPSCQueue(unsigned int capacity) :
+		_cells((_Cell *)0),
+		_mask(0),
+		_tail(0),
+		_head(0),
+		_overflows(0),
+		_sleeping(0)
+	{
+		unsigned int s = 1;
+		while (s < capacity)
+			s <<= 1;
+		_cells = new _Cell[s];
+		_mask = s - 1;
+		for(unsigned int i=0;i<s;++i)
+			_cells[i].seq = i;
+	}
+
+	~MPSCQueue()
+	{
+		delete [] _cells;
+	}
+
+	/**
+	 * @return Number of cells in ring
+	 */
+	inline unsigned int capacity() const throw() { return (_mask + 1); }
+
+	/**
+	 * @return Number of entries refused because the ring was full
+	 */
+	inline unsigned long overflows() const throw() { return _overflows; }
+
+	/**
+	 * Claim a free cell to fill in place (any thread)
+	 *
+	 * The cell still holds whatever entry last occupied it. It must be
+	 * handed to publish() once filled.
+	 *
+	 * @param ticket Result parameter set to ticket to pass to publish()
+	 * @return Pointer to cell's entry or NULL if ring is full
+	 */
+	inline T *claim(unsigned int &ticket)
+		throw()
+	{
+		unsigned int pos = _tail;
+		for(;;) {
+			_Cell &c = _cells[pos & _mask];
+			const int dif = (int)(c.seq - pos);
+			if (dif == 0) {
+				if (_cas(&_tail,pos,pos + 1)) {
+					ticket = pos;
+					return &(c.value);
+				}
+			} else if (dif < 0) {
+#ifdef __WINDOWS__
+				InterlockedIncrement((volatile LONG *)&_overflows);
+#else
+				__sync_add_and_fetch(&_overflows,1);
+#endif
+				return (T *)0;
+			}
+			pos = _tail;
+		}
+	}
+
+	/**
+	 * Make a filled cell visible to the consumer and wake it if waiting
+	 *
+	 * @param ticket Ticket from claim()
+	 */
+	inline void publish(unsigned int ticket)
+		throw()
+	{
+		_barrier();
+		_cells[ticket & _mask].seq = ticket + 1;
+		_barrier();
+		if (_sleeping)
+			_wake.signal();
+	}
+
+	/**
+	 * Copy an entry into the queue (any thread)
+	 *
+	 * @param v Entry
+	 * @return False if ring was full
+	 */
+	inline bool push(const T &v)
+	{
+		unsigned int ticket;
+		T *const e = claim(ticket);
+		if (!e)
+			return false;
+		*e = v;
+		publish(ticket);
+		return true;
+	}
+
+	/**
+	 * @return Next entry in place or NULL if none is ready (consumer only)
+	 */
+	inline T *front()
+		throw()
+	{
+		_Cell &c = _cells[_head & _mask];
+		if (c.seq != (_head + 1))
+			return (T *)0; // empty, or next cell still being filled
+		_barrier();
+		return &(c.value);
+	}
+
+	/**
+	 * Return the cell holding the entry returned by front() to the ring (consumer only)
+	 */
+	inline void pop()
+		throw()
+	{
+		_barrier();
+		_cells[_head & _mask].seq = _head + _mask + 1;
+		++_head;
+	}
+
+	/**
+	 * Copy out and remove the next entry (consumer only)
+	 *
+	 * @param v Result parameter set to entry
+	 * @return False if no entry was ready
+	 */
+	inline bool pop(T &v)
+	{
+		T *const e = front();
+		if (!e)
+			return false;
+		v = *e;
+		pop();
+		return true;
+	}
+
+	/**
+	 * Hand every ready entry in place to a function or function object (consumer only)
+	 *
+	 * The function is called as f(T &) and must not call consumer methods.
+	 *
+	 * @param f Function or function object
+	 * @param max Maximum number of entries to handle
+	 * @return Number of entries handled
+	 * @tparam F Function or function object type (specify a reference type to avoid a copy)
+	 */
+	template<typename F>
+	inline unsigned int drain(F f,unsigned int max = 0xffffffff)
+	{
+		unsigned int n = 0;
+		T *e;
+		while ((n < max)&&((e = front()))) {
+			f(*e);
+			pop();
+			++n;
+		}
+		return n;
+	}
+
+	/**
+	 * @return True if no entry is ready (consumer only)
+	 */
+	inline bool empty()
+		throw()
+	{
+		return (front() == (T *)0);
+	}
+
+	/**
+	 * Wait until an entry is ready or wake() is called (consumer only)
+	 *
+	 * This may also return early for no reason, so callers should loop.
+	 */
+	inline void wait()
+		throw()
+	{
+		_sleeping = 1;
+		_barrier();
+		if (!front())
+			_wake.wait();
+		_sleeping = 0;
+	}
+
+	/**
+	 * Wait until an entry is ready, wake() is called, or a timeout expires (consumer only)
+	 *
+	 * This may also return early for no reason, so callers should loop.
+	 *
+	 * @param ms Maximum time to wait in milliseconds
+	 */
+	inline void wait(unsigned long ms)
+		throw()
+	{
+		_sleeping = 1;
+		_barrier();
+		if (!front())
+			_wake.wait(ms);
+		_sleeping = 0;
+	}
+
+	/**
+	 * Wake a consumer blocked in wait() (any thread)
+	 */
+	inline void wake()
+		throw()
+	{
+		_wake.signal();
+	}
+
+private:
+	struct _Cell
+	{
+		volatile unsigned int seq; // == position + 1 when full, position + capacity when free
+		T value;
+	};
+
+	static inline bool _cas(volatile unsigned int *p,unsigned int oldv,unsigned int newv)
+		throw()
+	{
+#ifdef __WINDOWS__
+		return ((unsigned int)InterlockedCompareExchange((volatile LONG *)p,(LONG)newv,(LONG)oldv) == oldv);
+#else
+		return __sync_bool_compare_and_swap(p,oldv,newv);
+#endif
+	}
+
+	static inline void _barrier()
+		throw()
+	{
+#ifdef __WINDOWS__
+		MemoryBarrier();
+#else
+		__sync_synchronize();
+#endif
+	}
+
+	_Cell *_cells;
+	unsigned int _mask;
+	volatile unsigned int _tail; // next position producers will claim
+	unsigned int _head; // next position the consumer will read
+	volatile unsigned long _overflows;
+	volatile int _sleeping;
+	Condition _wake;
+};
+
+} // namespace ZeroTier
+
+#endif
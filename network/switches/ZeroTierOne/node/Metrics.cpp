@@ -0,0 +1,376 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+#include <stdio.h>
+
+#include "Metrics.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "Topology.hpp"
+#include "Peer.hpp"
+#include "Packet.hpp"
+#include "Utils.hpp"
+
+namespace ZeroTier {
+
+static const char *_COUNTER_NAMES[Metrics::COUNTER__COUNT] = {
+	"wire_messages_received",
+	"wire_bytes_received",
+	"wire_messages_sent",
+	"wire_bytes_sent",
+	"wire_send_failures",
+	"fragments_received",
+	"packets_relayed",
+	"relay_hops_exceeded",
+	"authentication_failures",
+	"decompression_failures",
+	"defrag_timeouts",
+	"rx_queue_timeouts",
+	"tx_queue_timeouts",
+	"whois_sent",
+	"whois_timeouts",
+	"multicasts_sent",
+	"netconf_requests",
+	"netconf_requests_coalesced",
+	"netconf_requests_refused",
+	"netconf_cache_hits"
+};
+
+static const char *_COUNTER_HELP[Metrics::COUNTER__COUNT] = {
+	"UDP/TCP messages received",
+	"UDP/TCP bytes received",
+	"UDP/TCP messages sent",
+	"UDP/TCP bytes sent",
+	"UDP/TCP messages the socket layer refused",
+	"Fragments (other than heads) received",
+	"Packets and fragments relayed for other peers",
+	"Packets and fragments dropped for exceeding the relay hop limit",
+	"Packets dropped due to failed MAC authentication",
+	"Packets dropped due to invalid compressed data",
+	"Fragmented packets discarded before all fragments arrived",
+	"Received packets discarded while waiting for WHOIS",
+	"Outgoing packets discarded while waiting for WHOIS",
+	"WHOIS requests sent, including retries",
+	"WHOIS requests abandoned after all retries",
+	"Multicast frames sent",
+	"Network config requests passed to netconf.service",
+	"Network config requests merged with an identical pending request",
+	"Network config requests dropped because netconf.service was busy or down",
+	"Network config requests answered from the controller's config cache"
+};
+
+static const char *_GAUGE_NAMES[Metrics::GAUGE__COUNT] = {
+	"rx_queue_depth",
+	"tx_queue_depth",
+	"defrag_queue_depth",
+	"whois_queue_depth",
+	"netconf_requests_in_flight"
+};
+
+static const char *_GAUGE_HELP[Metrics::GAUGE__COUNT] = {
+	"Received packets waiting for WHOIS",
+	"Outgoing packets waiting for WHOIS",
+	"Fragmented packets being reassembled",
+	"Outstanding WHOIS requests",
+	"Network config requests queued for or awaiting netconf.service"
+};
+
+static const char *_HISTOGRAM_NAMES[Metrics::HISTOGRAM__COUNT] = {
+	"wire_message_received_bytes",
+	"wire_message_sent_bytes",
+	"multicast_fanout_recipients",
+	"netconf_response_milliseconds"
+};
+
+static const char *_HISTOGRAM_HELP[Metrics::HISTOGRAM__COUNT] = {
+	"Size of UDP/TCP messages received",
+	"Size of UDP/TCP messages sent",
+	"Recipients per multicast frame sent",
+	"Time from network config request to netconf.service reply"
+};
+
+static const char *_STAGE_NAMES[Metrics::STAGE__COUNT] = {
+	"rx_total",
+	"rx_queue",
+	"defrag",
+	"decrypt",
+	"encrypt",
+	"tx_queue",
+	"tap_write"
+};
+
+Metrics::Metrics() :
+	_latency((_LatencyShard *)0)
+{
+	memset(_shards,0,sizeof(_shards));
+	for(unsigned int i=0;i<GAUGE__COUNT;++i)
+		_gauges[i] = 0;
+}
+
+Metrics::~Metrics()
+{
+	delete [] _latency;
+}
+
+void Metrics::enableLatency()
+{
+	if (_latency)
+		return;
+	_LatencyShard *l = new _LatencyShard[ZT_METRICS_SHARDS];
+	memset(l,0,sizeof(_LatencyShard) * ZT_METRICS_SHARDS);
+	_latency = l;
+}
+
+Metrics::LatencySummary Metrics::latencySummary(Stage s) const
+	throw()
+{
+	LatencySummary ls;
+	memset(&ls,0,sizeof(ls));
+	const _LatencyShard *const l = _latency;
+	if (!l)
+		return ls;
+
+	uint64_t buckets[ZT_METRICS_LATENCY_BUCKETS];
+	memset(buckets,0,sizeof(buckets));
+	for(unsigned int sh=0;sh<ZT_METRICS_SHARDS;++sh) {
+		for(unsigned int b=0;b<ZT_METRICS_LATENCY_BUCKETS;++b)
+			buckets[b] += l[sh].buckets[(unsigned int)s][b];
+		ls.sum += l[sh].sums[(unsigned int)s];
+	}
+	for(unsigned int b=0;b<ZT_METRICS_LATENCY_BUCKETS;++b) {
+		if (buckets[b]) {
+			ls.count += buckets[b];
+			ls.max = latencyBucketMax(b);
+		}
+	}
+	if (!ls.count)
+		return ls;
+
+	// Rank of each percentile, rounded up so e.g. p999 of 10 samples is the largest
+	const uint64_t r50 = (ls.count * 500 + 999) / 1000;
+	const uint64_t r99 = (ls.count * 990 + 999) / 1000;
+	const uint64_t r999 = (ls.count * 999 + 999) / 1000;
+	uint64_t seen = 0;
+	for(unsigned int b=0;b<ZT_METRICS_LATENCY_BUCKETS;++b) {
+		if (!buckets[b])
+			continue;
+		seen += buckets[b];
+		const uint64_t v = latencyBucketMax(b);
+		if ((!ls.p50)&&(seen >= r50)) ls.p50 = v;
+		if ((!ls.p99)&&(seen >= r99)) ls.p99 = v;
+		if ((!ls.p999)&&(seen >= r999)) {
+			ls.p999 = v;
+			break;
+		}
+	}
+
+	return ls;
+}
+
+const char *Metrics::stageName(Stage s)
+	throw()
+{
+	return _STAGE_NAMES[(unsigned int)s];
+}
+
+uint64_t Metrics::counter(Counter c) const
+	throw()
+{
+	uint64_t n = 0;
+	for(unsigned int s=0;s<ZT_METRICS_SHARDS;++s)
+		n += _shards[s].counters[(unsigned int)c];
+	return n;
+}
+
+uint64_t Metrics::verbReceived(unsigned int verb) const
+	throw()
+{
+	uint64_t n = 0;
+	for(unsigned int s=0;s<ZT_METRICS_SHARDS;++s)
+		n += _shards[s].verbsReceived[verb & (ZT_METRICS_VERBS - 1)];
+	return n;
+}
+
+uint64_t Metrics::verbSent(unsigned int verb) const
+	throw()
+{
+	uint64_t n = 0;
+	for(unsigned int s=0;s<ZT_METRICS_SHARDS;++s)
+		n += _shards[s].verbsSent[verb & (ZT_METRICS_VERBS - 1)];
+	return n;
+}
+
+uint64_t Metrics::histogram(Histogram h,uint64_t *buckets) const
+	throw()
+{
+	uint64_t sum = 0;
+	memset(buckets,0,sizeof(uint64_t) * ZT_METRICS_HISTOGRAM_BUCKETS);
+	for(unsigned int s=0;s<ZT_METRICS_SHARDS;++s) {
+		for(unsigned int b=0;b<ZT_METRICS_HISTOGRAM_BUCKETS;++b)
+			buckets[b] += _shards[s].histograms[(unsigned int)h][b];
+		sum += _shards[s].histogramSums[(unsigned int)h];
+	}
+	return sum;
+}
+
+const char *Metrics::counterName(Counter c)
+	throw()
+{
+	return _COUNTER_NAMES[(unsigned int)c];
+}
+
+static void _header(std::string &out,const char *name,const char *suffix,const char *help,const char *type)
+{
+	char tmp[512];
+	Utils::snprintf(tmp,sizeof(tmp),"# HELP zt_%s%s %s\n# TYPE zt_%s%s %s\n",name,suffix,help,name,suffix,type);
+	out.append(tmp);
+}
+
+// Appends per-peer and per-path series; run with Topology::eachPeer()
+struct _PrometheusPeerSeries
+{
+	_PrometheusPeerSeries(std::string &pr,std::string &ps,std::string &hr,std::string &hs,std::string &l) :
+		peerReceived(pr),
+		peerSent(ps),
+		pathReceived(hr),
+		pathSent(hs),
+		latency(l) {}
+
+	inline void operator()(Topology &t,const SharedPtr<Peer> &p)
+	{
+		char tmp[256];
+		const std::string a(p->address().toString());
+
+		Utils::snprintf(tmp,sizeof(tmp),"zt_peer_packets_received_total{peer=\"%s\"} %llu\n",a.c_str(),(unsigned long long)p->packetsReceived());
+		peerReceived.append(tmp);
+		Utils::snprintf(tmp,sizeof(tmp),"zt_peer_packets_sent_total{peer=\"%s\"} %llu\n",a.c_str(),(unsigned long long)p->packetsSent());
+		peerSent.append(tmp);
+		if (p->latency()) {
+			Utils::snprintf(tmp,sizeof(tmp),"zt_peer_latency_ms{peer=\"%s\"} %u\n",a.c_str(),p->latency());
+			latency.append(tmp);
+		}
+
+		std::vector<Path> paths(p->paths());
+		for(std::vector<Path>::const_iterator path(paths.begin());path!=paths.end();++path) {
+			const std::string pa(path->address().toString());
+			const char *type = (path->type() == Path::PATH_TYPE_UDP) ? "udp" : ((path->type() == Path::PATH_TYPE_TCP_OUT) ? "tcp_out" : "tcp_in");
+			Utils::snprintf(tmp,sizeof(tmp),"zt_path_packets_received_total{peer=\"%s\",path=\"%s\",type=\"%s\"} %llu\n",a.c_str(),pa.c_str(),type,(unsigned long long)path->packetsReceived());
+			pathReceived.append(tmp);
+			Utils::snprintf(tmp,sizeof(tmp),"zt_path_packets_sent_total{peer=\"%s\",path=\"%s\",type=\"%s\"} %llu\n",a.c_str(),pa.c_str(),type,(unsigned long long)path->packetsSent());
+			pathSent.append(tmp);
+		}
+	}
+
+	std::string &peerReceived;
+	std::string &peerSent;
+	std::string &pathReceived;
+	std::string &pathSent;
+	std::string &latency;
+};
+
+std::string Metrics::toPrometheus(const RuntimeEnvironment *RR) const
+{
+	std::string out;
+	char tmp[256];
+
+	for(unsigned int c=0;c<COUNTER__COUNT;++c) {
+		_header(out,_COUNTER_NAMES[c],"_total",_COUNTER_HELP[c],"counter");
+		Utils::snprintf(tmp,sizeof(tmp),"zt_%s_total %llu\n",_COUNTER_NAMES[c],(unsigned long long)counter((Counter)c));
+		out.append(tmp);
+	}
+
+	for(unsigned int g=0;g<GAUGE__COUNT;++g) {
+		_header(out,_GAUGE_NAMES[g],"",_GAUGE_HELP[g],"gauge");
+		Utils::snprintf(tmp,sizeof(tmp),"zt_%s %llu\n",_GAUGE_NAMES[g],(unsigned long long)gauge((Gauge)g));
+		out.append(tmp);
+	}
+
+	_header(out,"packets_received","_total","Authenticated packets received by verb","counter");
+	for(unsigned int v=0;v<ZT_METRICS_VERBS;++v) {
+		const uint64_t n = verbReceived(v);
+		if ((n)||(strcmp(Packet::verbString((Packet::Verb)v),"(unknown)"))) {
+			Utils::snprintf(tmp,sizeof(tmp),"zt_packets_received_total{verb=\"%s\"} %llu\n",Packet::verbString((Packet::Verb)v),(unsigned long long)n);
+			out.append(tmp);
+		}
+	}
+	_header(out,"packets_sent","_total","Packets sent by verb","counter");
+	for(unsigned int v=0;v<ZT_METRICS_VERBS;++v) {
+		const uint64_t n = verbSent(v);
+		if ((n)||(strcmp(Packet::verbString((Packet::Verb)v),"(unknown)"))) {
+			Utils::snprintf(tmp,sizeof(tmp),"zt_packets_sent_total{verb=\"%s\"} %llu\n",Packet::verbString((Packet::Verb)v),(unsigned long long)n);
+			out.append(tmp);
+		}
+	}
+
+	for(unsigned int h=0;h<HISTOGRAM__COUNT;++h) {
+		uint64_t buckets[ZT_METRICS_HISTOGRAM_BUCKETS];
+		const uint64_t sum = histogram((Histogram)h,buckets);
+		_header(out,_HISTOGRAM_NAMES[h],"",_HISTOGRAM_HELP[h],"histogram");
+		uint64_t cumulative = 0;
+		for(unsigned int b=0;b<(ZT_METRICS_HISTOGRAM_BUCKETS - 1);++b) {
+			cumulative += buckets[b];
+			Utils::snprintf(tmp,sizeof(tmp),"zt_%s_bucket{le=\"%llu\"} %llu\n",_HISTOGRAM_NAMES[h],(unsigned long long)((1ULL << b) - 1ULL),(unsigned long long)cumulative);
+			out.append(tmp);
+		}
+		cumulative += buckets[ZT_METRICS_HISTOGRAM_BUCKETS - 1];
+		Utils::snprintf(tmp,sizeof(tmp),"zt_%s_bucket{le=\"+Inf\"} %llu\nzt_%s_sum %llu\nzt_%s_count %llu\n",_HISTOGRAM_NAMES[h],(unsigned long long)cumulative,_HISTOGRAM_NAMES[h],(unsigned long long)sum,_HISTOGRAM_NAMES[h],(unsigned long long)cumulative);
+		out.append(tmp);
+	}
+
+	if (latencyEnabled()) {
+		_header(out,"stage_latency_us","","Time spent in each packet pipeline stage, in microseconds","summary");
+		for(unsigned int s=0;s<STAGE__COUNT;++s) {
+			const LatencySummary ls(latencySummary((Stage)s));
+			Utils::snprintf(tmp,sizeof(tmp),"zt_stage_latency_us{stage=\"%s\",quantile=\"0.5\"} %llu\n",_STAGE_NAMES[s],(unsigned long long)ls.p50);
+			out.append(tmp);
+			Utils::snprintf(tmp,sizeof(tmp),"zt_stage_latency_us{stage=\"%s\",quantile=\"0.99\"} %llu\n",_STAGE_NAMES[s],(unsigned long long)ls.p99);
+			out.append(tmp);
+			Utils::snprintf(tmp,sizeof(tmp),"zt_stage_latency_us{stage=\"%s\",quantile=\"0.999\"} %llu\n",_STAGE_NAMES[s],(unsigned long long)ls.p999);
+			out.append(tmp);
+			Utils::snprintf(tmp,sizeof(tmp),"zt_stage_latency_us_sum{stage=\"%s\"} %llu\nzt_stage_latency_us_count{stage=\"%s\"} %llu\n",_STAGE_NAMES[s],(unsigned long long)ls.sum,_STAGE_NAMES[s],(unsigned long long)ls.count);
+			out.append(tmp);
+		}
+	}
+
+	if (RR->topology) {
+		std::string peerReceived,peerSent,pathReceived,pathSent,latency;
+		RR->topology->eachPeer(_PrometheusPeerSeries(peerReceived,peerSent,pathReceived,pathSent,latency));
+		_header(out,"peer_packets_received","_total","Packets received from each peer, direct or relayed","counter");
+		out.append(peerReceived);
+		_header(out,"peer_packets_sent","_total","Messages sent over direct paths to each peer","counter");
+		out.append(peerSent);
+		_header(out,"peer_latency_ms","","Smoothed latency to each peer","gauge");
+		out.append(latency);
+		_header(out,"path_packets_received","_total","Packets received over each direct path","counter");
+		out.append(pathReceived);
+		_header(out,"path_packets_sent","_total","Messages sent over each direct path","counter");
+		out.append(pathSent);
+	}
+
+	return out;
+}
+
+} // namespace ZeroTier
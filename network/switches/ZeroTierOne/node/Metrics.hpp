@@ -0,0 +1,451 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+#ifndef ZT_METRICS_HPP
+#define ZT_METRICS_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+#include "Utils.hpp"
+
+#ifdef __WINDOWS__
+#include <WinSock2.h>
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/**
+ * Number of counter shards (must be a power of two)
+ */
+#define ZT_METRICS_SHARDS 16
+
+/**
+ * Number of verb slots in per-verb counters (verbs are 5 bits)
+ */
+#define ZT_METRICS_VERBS 32
+
+/**
+ * Number of power-of-two histogram buckets
+ */
+#define ZT_METRICS_HISTOGRAM_BUCKETS 24
+
+/**
+ * Linear sub-buckets per power of two in latency histograms (power of two)
+ *
+ * 8 gives a worst case error of 12.5% in reported percentiles.
+ */
+#define ZT_METRICS_LATENCY_SUB_BUCKETS 8
+
+/**
+ * Number of latency histogram buckets (covers up to 2^32 microseconds)
+ */
+#define ZT_METRICS_LATENCY_BUCKETS (ZT_METRICS_LATENCY_SUB_BUCKETS * 30)
+
+namespace ZeroTier {
+
+class RuntimeEnvironment;
+
+/**
+ * Registry of counters, gauges and histograms for the packet pipeline
+ *
+ * Metrics are enumerated at compile time so updating one is an array index
+ * and an atomic add. Counters are split into shards chosen by a hash of the
+ * calling thread's ID, so threads that update the same counter usually
+ * touch different cache lines. Reads sum all shards and may be slightly
+ * stale, which is fine for monitoring.
+ *
+ * Per-peer and per-path packet counts live in Peer and Path and are
+ * collected from Topology when exporting.
+ *
+ * Latency histograms for stages of the packet pipeline are off by default
+ * and are allocated by enableLatency(). Their buckets are log-linear in
+ * the style of HdrHistogram: each power of two is split into
+ * ZT_METRICS_LATENCY_SUB_BUCKETS linear buckets, so percentiles have
+ * bounded relative error at any scale. Code that times a stage should
+ * check latencyEnabled() before reading the clock.
+ */
+class Metrics : NonCopyable
+{
+public:
+	enum Counter
+	{
+		COUNTER_WIRE_MESSAGES_RECEIVED = 0, // UDP/TCP messages handed to Switch
+		COUNTER_WIRE_BYTES_RECEIVED,
+		COUNTER_WIRE_MESSAGES_SENT, // UDP/TCP messages the socket layer accepted
+		COUNTER_WIRE_BYTES_SENT,
+		COUNTER_WIRE_SEND_FAILURES,
+		COUNTER_FRAGMENTS_RECEIVED,
+		COUNTER_PACKETS_RELAYED,
+		COUNTER_RELAY_HOPS_EXCEEDED,
+		COUNTER_AUTHENTICATION_FAILURES, // MAC check failed in dearmor()
+		COUNTER_DECOMPRESSION_FAILURES,
+		COUNTER_DEFRAG_TIMEOUTS,
+		COUNTER_RX_QUEUE_TIMEOUTS,
+		COUNTER_TX_QUEUE_TIMEOUTS,
+		COUNTER_WHOIS_SENT,
+		COUNTER_WHOIS_TIMEOUTS,
+		COUNTER_MULTICASTS_SENT,
+		COUNTER_NETCONF_REQUESTS, // passed to netconf.service
+		COUNTER_NETCONF_REQUESTS_COALESCED, // merged with an identical pending request
+		COUNTER_NETCONF_REQUESTS_REFUSED, // netconf.service queue full or not running
+		COUNTER_NETCONF_CACHE_HITS, // answered from NetconfCache
+		COUNTER__COUNT
+	};
+
+	enum Gauge
+	{
+		GAUGE_RX_QUEUE_DEPTH = 0, // packets waiting on WHOIS to decode
+		GAUGE_TX_QUEUE_DEPTH, // packets waiting on WHOIS to send
+		GAUGE_DEFRAG_QUEUE_DEPTH,
+		GAUGE_WHOIS_QUEUE_DEPTH,
+		GAUGE_NETCONF_REQUESTS_IN_FLIGHT, // queued for or awaiting netconf.service
+		GAUGE__COUNT
+	};
+
+	enum Histogram
+	{
+		HISTOGRAM_WIRE_BYTES_RECEIVED = 0, // size of each message received
+		HISTOGRAM_WIRE_BYTES_SENT, // size of each message sent
+		HISTOGRAM_MULTICAST_FANOUT, // recipients per multicast send
+		HISTOGRAM_NETCONF_RESPONSE_TIME, // ms from request to netconf.service reply
+		HISTOGRAM__COUNT
+	};
+
+	enum Stage
+	{
+		STAGE_RX_TOTAL = 0, // arrival to end of processing (including any wait for WHOIS)
+		STAGE_RX_QUEUE, // waiting in RX queue for sender's identity
+		STAGE_DEFRAG, // first fragment or head to reassembly
+		STAGE_DECRYPT, // MAC check, decryption and decompression
+		STAGE_ENCRYPT, // encryption and MAC of outgoing packets
+		STAGE_TX_QUEUE, // waiting in TX queue for recipient's identity
+		STAGE_TAP_WRITE, // writing a frame to the tap device
+		STAGE__COUNT
+	};
+
+	/**
+	 * Latency percentiles for one stage
+	 */
+	struct LatencySummary
+	{
+		uint64_t count;
+		uint64_t sum; // microseconds
+		uint64_t p50;
+		uint64_t p99;
+		uint64_t p999;
+		uint64_t max; // upper bound of highest non-empty bucket
+	};
+
+	Metrics();
+	~Metrics();
+
+	/**
+	 * @param c Counter to increment
+	 * @param n Amount to add
+	 */
+	inline void inc(Counter c,uint64_t n = 1) throw() { _add(&(_shards[_shardIndex()].counters[(unsigned int)c]),n); }
+
+	/**
+	 * @param g Gauge to set
+	 * @param v New value
+	 */
+	inline void set(Gauge g,uint64_t v) throw() { _gauges[(unsigned int)g] = v; }
+
+	/**
+	 * @param h Histogram to record a sample in
+	 * @param v Sample value
+	 */
+	inline void observe(Histogram h,uint64_t v) throw()
+	{
+		_Shard &s = _shards[_shardIndex()];
+		_add(&(s.histograms[(unsigned int)h][bucket(v)]),1);
+		_add(&(s.histogramSums[(unsigned int)h]),v);
+	}
+
+	/**
+	 * Count a packet that authenticated, by verb
+	 *
+	 * @param verb Packet verb
+	 */
+	inline void received(unsigned int verb) throw() { _add(&(_shards[_shardIndex()].verbsReceived[verb & (ZT_METRICS_VERBS - 1)]),1); }
+
+	/**
+	 * Count a packet being armored for sending, by verb
+	 *
+	 * This must be called before armor() since the verb is encrypted.
+	 *
+	 * @param verb Packet verb
+	 */
+	inline void sent(unsigned int verb) throw() { _add(&(_shards[_shardIndex()].verbsSent[verb & (ZT_METRICS_VERBS - 1)]),1); }
+
+	/**
+	 * Count a message handed to the socket layer
+	 *
+	 * @param len Message length in bytes
+	 * @param ok Result of the socket send
+	 * @return ok (for convenience in return statements)
+	 */
+	inline bool wireSent(unsigned int len,bool ok) throw()
+	{
+		_Shard &s = _shards[_shardIndex()];
+		if (ok) {
+			_add(&(s.counters[COUNTER_WIRE_MESSAGES_SENT]),1);
+			_add(&(s.counters[COUNTER_WIRE_BYTES_SENT]),len);
+			_add(&(s.histograms[HISTOGRAM_WIRE_BYTES_SENT][bucket(len)]),1);
+			_add(&(s.histogramSums[HISTOGRAM_WIRE_BYTES_SENT]),len);
+		} else _add(&(s.counters[COUNTER_WIRE_SEND_FAILURES]),1);
+		return ok;
+	}
+
+	/**
+	 * Count a message received from the socket layer
+	 *
+	 * @param len Message length in bytes
+	 */
+	inline void wireReceived(unsigned int len) throw()
+	{
+		_Shard &s = _shards[_shardIndex()];
+		_add(&(s.counters[COUNTER_WIRE_MESSAGES_RECEIVED]),1);
+		_add(&(s.counters[COUNTER_WIRE_BYTES_RECEIVED]),len);
+		_add(&(s.histograms[HISTOGRAM_WIRE_BYTES_RECEIVED][bucket(len)]),1);
+		_add(&(s.histogramSums[HISTOGRAM_WIRE_BYTES_RECEIVED]),len);
+	}
+
+	/**
+	 * Allocate latency histograms and start recording
+	 *
+	 * This should be called once during startup before there's traffic.
+	 */
+	void enableLatency();
+
+	/**
+	 * @return True if stages should be timed
+	 */
+	inline bool latencyEnabled() const throw() { return (_latency != (_LatencyShard *)0); }
+
+	/**
+	 * Record time spent in a stage
+	 *
+	 * This does nothing if latency recording isn't enabled.
+	 *
+	 * @param s Stage
+	 * @param us Elapsed microseconds
+	 */
+	inline void latency(Stage s,uint64_t us) throw()
+	{
+		_LatencyShard *const l = _latency;
+		if (l) {
+			_LatencyShard &ls = l[_shardIndex()];
+			_add(&(ls.buckets[(unsigned int)s][latencyBucket(us)]),1);
+			_add(&(ls.sums[(unsigned int)s]),us);
+		}
+	}
+
+	/**
+	 * Record time since a start timestamp from Utils::nowMicros()
+	 *
+	 * @param s Stage
+	 * @param startUs Start time, or 0 if it wasn't recorded (nothing is recorded)
+	 */
+	inline void latencySince(Stage s,uint64_t startUs) throw()
+	{
+		if (startUs) {
+			const uint64_t now = Utils::nowMicros();
+			latency(s,(now > startUs) ? (now - startUs) : 0);
+		}
+	}
+
+	/**
+	 * @param s Stage
+	 * @return Percentiles, all zero if latency recording isn't enabled
+	 */
+	LatencySummary latencySummary(Stage s) const throw();
+
+	/**
+	 * @return Name of stage for use in labels
+	 */
+	static const char *stageName(Stage s) throw();
+
+	/**
+	 * @param c Counter
+	 * @return Sum across all shards
+	 */
+	uint64_t counter(Counter c) const throw();
+
+	/**
+	 * @param g Gauge
+	 * @return Last value set
+	 */
+	inline uint64_t gauge(Gauge g) const throw() { return _gauges[(unsigned int)g]; }
+
+	/**
+	 * @param verb Packet verb
+	 * @return Packets received with this verb
+	 */
+	uint64_t verbReceived(unsigned int verb) const throw();
+
+	/**
+	 * @param verb Packet verb
+	 * @return Packets sent with this verb
+	 */
+	uint64_t verbSent(unsigned int verb) const throw();
+
+	/**
+	 * @param h Histogram
+	 * @param buckets Array of ZT_METRICS_HISTOGRAM_BUCKETS to fill with sample counts
+	 * @return Sum of all samples
+	 */
+	uint64_t histogram(Histogram h,uint64_t *buckets) const throw();
+
+	/**
+	 * Format all metrics in the Prometheus text exposition format
+	 *
+	 * Peers and paths are included if RR has a topology.
+	 *
+	 * @param RR Runtime environment
+	 * @return Prometheus text
+	 */
+	std::string toPrometheus(const RuntimeEnvironment *RR) const;
+
+	/**
+	 * Bucket for a histogram sample
+	 *
+	 * Bucket 0 holds zero, and bucket i>0 holds [2^(i-1),2^i). The last
+	 * bucket holds everything larger.
+	 *
+	 * @param v Sample value
+	 * @return Bucket index
+	 */
+	static inline unsigned int bucket(uint64_t v) throw()
+	{
+		unsigned int b = 0;
+		while ((v)&&(b < (ZT_METRICS_HISTOGRAM_BUCKETS - 1))) {
+			v >>= 1;
+			++b;
+		}
+		return b;
+	}
+
+	/**
+	 * Bucket for a latency sample
+	 *
+	 * Values below 2 * ZT_METRICS_LATENCY_SUB_BUCKETS get a bucket each.
+	 * Above that each power of two gets ZT_METRICS_LATENCY_SUB_BUCKETS.
+	 *
+	 * @param us Microseconds
+	 * @return Bucket index
+	 */
+	static inline unsigned int latencyBucket(uint64_t us) throw()
+	{
+		if (us < (2 * ZT_METRICS_LATENCY_SUB_BUCKETS))
+			return (unsigned int)us;
+		unsigned int e = 0;
+		while (us >= (2 * ZT_METRICS_LATENCY_SUB_BUCKETS)) {
+			us >>= 1;
+			++e;
+		}
+		const unsigned int b = ((e + 1) * ZT_METRICS_LATENCY_SUB_BUCKETS) + (unsigned int)(us - ZT_METRICS_LATENCY_SUB_BUCKETS);
+		return ((b < ZT_METRICS_LATENCY_BUCKETS) ? b : (ZT_METRICS_LATENCY_BUCKETS - 1));
+	}
+
+	/**
+	 * @param b Latency bucket index
+	 * @return Largest value that falls in this bucket
+	 */
+	static inline uint64_t latencyBucketMax(unsigned int b) throw()
+	{
+		if (b < (2 * ZT_METRICS_LATENCY_SUB_BUCKETS))
+			return b;
+		const unsigned int e = (b / ZT_METRICS_LATENCY_SUB_BUCKETS) - 1;
+		const uint64_t m = ZT_METRICS_LATENCY_SUB_BUCKETS + (b % ZT_METRICS_LATENCY_SUB_BUCKETS);
+		return (((m + 1) << e) - 1);
+	}
+
+	/**
+	 * @return Name of counter (without zt_ prefix or _total suffix)
+	 */
+	static const char *counterName(Counter c) throw();
+
+private:
+	struct _Shard
+	{
+		uint64_t counters[COUNTER__COUNT];
+		uint64_t verbsReceived[ZT_METRICS_VERBS];
+		uint64_t verbsSent[ZT_METRICS_VERBS];
+		uint64_t histograms[HISTOGRAM__COUNT][ZT_METRICS_HISTOGRAM_BUCKETS];
+		uint64_t histogramSums[HISTOGRAM__COUNT];
+		char pad[64]; // keep neighboring shards off each other's cache lines
+	};
+
+	struct _LatencyShard
+	{
+		uint64_t buckets[STAGE__COUNT][ZT_METRICS_LATENCY_BUCKETS];
+		uint64_t sums[STAGE__COUNT];
+		char pad[64];
+	};
+
+	static inline unsigned int _shardIndex() throw()
+	{
+#ifdef __WINDOWS__
+		uint64_t t = (uint64_t)GetCurrentThreadId();
+#else
+		// pthread_t is an integer or pointer on every platform we support
+		uint64_t t = 0;
+		const pthread_t self = pthread_self();
+		memcpy(&t,&self,(sizeof(self) < sizeof(t)) ? sizeof(self) : sizeof(t));
+#endif
+		t *= 0x9e3779b97f4a7c15ULL;
+		return (unsigned int)((t >> 40) & (ZT_METRICS_SHARDS - 1));
+	}
+
+	static inline void _add(uint64_t *v,uint64_t n) throw()
+	{
+#ifdef __GNUC__
+		__sync_fetch_and_add(v,n);
+#else
+#ifdef __WINDOWS__
+		InterlockedExchangeAdd64((volatile LONGLONG *)v,(LONGLONG)n);
+#else
+		*v += n; // may lose an occasional update, but this is just stats
+#endif
+#endif
+	}
+
+	_Shard _shards[ZT_METRICS_SHARDS];
+	volatile uint64_t _gauges[GAUGE__COUNT];
+	_LatencyShard *volatile _latency; // NULL unless enableLatency() was called
+};
+
+} // namespace ZeroTier
+
+#endif
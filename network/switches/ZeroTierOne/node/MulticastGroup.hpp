@@ -125,7 +125,7 @@ public:
 		char hex[17];
 		unsigned int hexlen = 0;
 		while ((*s)&&(*s != '/')&&(hexlen < (sizeof(hex) - 1)))
-			hex[hexlen++] = *s;
+			hex[hexlen++] = *(s++);
 		hex[hexlen] = (char)0;
 		_mac.fromString(hex);
 		_adi = (*s == '/') ? (uint32_t)Utils::hexStrToULong(s + 1) : (uint32_t)0;
@@ -141,6 +141,11 @@ public:
 	 */
 	inline uint32_t adi() const throw() { return _adi; }
 
+	/**
+	 * @return Hash code for use with Hashtable
+	 */
+	inline unsigned long hashCode() const throw() { return (_mac.hashCode() ^ (unsigned long)_adi); }
+
 	inline bool operator==(const MulticastGroup &g) const throw() { return ((_mac == g._mac)&&(_adi == g._adi)); }
 	inline bool operator!=(const MulticastGroup &g) const throw() { return ((_mac != g._mac)||(_adi != g._adi)); }
 	inline bool operator<(const MulticastGroup &g) const throw()
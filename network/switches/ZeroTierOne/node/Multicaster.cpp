@@ -40,6 +40,7 @@
 #include "NodeConfig.hpp"
 #include "CertificateOfMembership.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
 
 namespace ZeroTier {
 
@@ -50,27 +51,31 @@ Multicaster::Multicaster(const RuntimeEnvironment *renv) :
 
 Multicaster::~Multicaster()
 {
+	for(unsigned int si=0;si<ZT_MULTICAST_GROUP_SHARDS;++si)
+		delete _shards[si].fanout;
 }
 
 void Multicaster::addMultiple(uint64_t now,uint64_t nwid,const MulticastGroup &mg,const Address &learnedFrom,const void *addresses,unsigned int count,unsigned int totalKnown)
 {
 	const unsigned char *p = (const unsigned char *)addresses;
 	const unsigned char *e = p + (5 * count);
-	Mutex::Lock _l(_groups_m);
-	MulticastGroupStatus &gs = _groups[std::pair<uint64_t,MulticastGroup>(nwid,mg)];
+	GroupShard &shard = _shard(nwid,mg);
+	Mutex::Lock _l(shard.lock);
+	MulticastGroupStatus &gs = shard.groups[std::pair<uint64_t,MulticastGroup>(nwid,mg)];
+	MulticastFanoutBatch *const batch = _fanout(shard);
 	while (p != e) {
-		_add(now,nwid,mg,gs,learnedFrom,Address(p,5));
+		_add(now,nwid,mg,gs,learnedFrom,Address(p,5),batch);
 		p += 5;
 	}
+	batch->flush(RR,now);
 	if (RR->topology->isSupernode(learnedFrom))
 		gs.totalKnownMembers = totalKnown;
 }
 
 unsigned int Multicaster::gather(const Address &queryingPeer,uint64_t nwid,const MulticastGroup &mg,Packet &appendTo,unsigned int limit) const
 {
-	unsigned char *p;
-	unsigned int added = 0,i,k,rptr,totalKnown = 0;
-	uint64_t a,picked[(ZT_PROTO_MAX_PACKET_LENGTH / 5) + 2];
+	unsigned char qa[ZT_ADDRESS_LENGTH];
+	unsigned int added = 0,totalKnown = 0;
 
 	if (!limit)
 		return 0;
@@ -91,37 +96,51 @@ unsigned int Multicaster::gather(const Address &queryingPeer,uint64_t nwid,const
 		}
 	}
 
-	Mutex::Lock _l(_groups_m);
-
-	std::map< std::pair<uint64_t,MulticastGroup>,MulticastGroupStatus >::const_iterator gs(_groups.find(std::pair<uint64_t,MulticastGroup>(nwid,mg)));
-	if ((gs != _groups.end())&&(!gs->second.members.empty())) {
-		totalKnown += (unsigned int)gs->second.members.size();
-
-		// Members are returned in random order so that repeated gather queries
-		// will return different subsets of a large multicast group.
-		k = 0;
-		while ((added < limit)&&(k < gs->second.members.size())&&((appendTo.size() + ZT_ADDRESS_LENGTH) <= ZT_UDP_DEFAULT_PAYLOAD_MTU)) {
-			rptr = (unsigned int)RR->prng->next32();
+	SharedPtr<MemberBlock> blk;
+	unsigned int blkCount = 0;
+	{
+		const GroupShard &shard = _shard(nwid,mg);
+		Mutex::Lock _l(shard.lock);
+		GroupMap::const_iterator gs(shard.groups.find(std::pair<uint64_t,MulticastGroup>(nwid,mg)));
+		if ((gs != shard.groups.end())&&(gs->second.memberBlock)) {
+			blk = gs->second.memberBlock;
+			blkCount = blk->count;
+		}
+	}
 
-restart_member_scan:
-			a = gs->second.members[rptr % (unsigned int)gs->second.members.size()].address.toInt();
-			for(i=0;i<k;++i) {
-				if (picked[i] == a) {
-					++rptr;
-					goto restart_member_scan;
+	if (blkCount) {
+		totalKnown += blkCount;
+
+		// Copy a window of the block starting at a random member so that
+		// repeated gather queries return different subsets of a large group.
+		unsigned int n = std::min(std::min(limit - added,(ZT_UDP_DEFAULT_PAYLOAD_MTU - std::min(appendTo.size(),(unsigned int)ZT_UDP_DEFAULT_PAYLOAD_MTU)) / ZT_ADDRESS_LENGTH),blkCount);
+		if (n) {
+			const unsigned int start = RR->prng->next32() % blkCount;
+			const unsigned int first = std::min(n,blkCount - start);
+			const unsigned int windowAt = appendTo.size();
+			memcpy(appendTo.appendField(first * ZT_ADDRESS_LENGTH),blk->data + (start * ZT_ADDRESS_LENGTH),first * ZT_ADDRESS_LENGTH);
+			if (first < n)
+				memcpy(appendTo.appendField((n - first) * ZT_ADDRESS_LENGTH),blk->data,(n - first) * ZT_ADDRESS_LENGTH);
+
+			// Do not return the peer that is making the request as a result. If
+			// it's in the window replace it with the next member after the
+			// window, or drop it if the window already covers the whole group.
+			queryingPeer.copyTo(qa,ZT_ADDRESS_LENGTH);
+			unsigned char *const w = (unsigned char *)appendTo.field(windowAt,n * ZT_ADDRESS_LENGTH);
+			for(unsigned int i=0;i<n;++i) {
+				if (!memcmp(w + (i * ZT_ADDRESS_LENGTH),qa,ZT_ADDRESS_LENGTH)) {
+					if (n < blkCount)
+						memcpy(w + (i * ZT_ADDRESS_LENGTH),blk->data + (((start + n) % blkCount) * ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
+					else {
+						memmove(w + (i * ZT_ADDRESS_LENGTH),w + ((n - 1) * ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
+						appendTo.setSize(appendTo.size() - ZT_ADDRESS_LENGTH);
+						--n;
+					}
+					break;
 				}
 			}
-			picked[k++] = a;
-
-			if (queryingPeer.toInt() != a) { // do not return the peer that is making the request as a result
-				p = (unsigned char *)appendTo.appendField(ZT_ADDRESS_LENGTH);
-				*(p++) = (unsigned char)((a >> 32) & 0xff);
-				*(p++) = (unsigned char)((a >> 24) & 0xff);
-				*(p++) = (unsigned char)((a >> 16) & 0xff);
-				*(p++) = (unsigned char)((a >> 8) & 0xff);
-				*p = (unsigned char)(a & 0xff);
-				++added;
-			}
+
+			added += n;
 		}
 	}
 
@@ -136,9 +155,10 @@ restart_member_scan:
 std::vector<Address> Multicaster::getMembers(uint64_t nwid,const MulticastGroup &mg,unsigned int limit) const
 {
 	std::vector<Address> ls;
-	Mutex::Lock _l(_groups_m);
-	std::map< std::pair<uint64_t,MulticastGroup>,MulticastGroupStatus >::const_iterator gs(_groups.find(std::pair<uint64_t,MulticastGroup>(nwid,mg)));
-	if (gs == _groups.end())
+	const GroupShard &shard = _shard(nwid,mg);
+	Mutex::Lock _l(shard.lock);
+	GroupMap::const_iterator gs(shard.groups.find(std::pair<uint64_t,MulticastGroup>(nwid,mg)));
+	if (gs == shard.groups.end())
 		return ls;
 	for(std::vector<MulticastGroupMember>::const_reverse_iterator m(gs->second.members.rbegin());m!=gs->second.members.rend();++m) {
 		ls.push_back(m->address);
@@ -160,8 +180,12 @@ void Multicaster::send(
 	const void *data,
 	unsigned int len)
 {
-	Mutex::Lock _l(_groups_m);
-	MulticastGroupStatus &gs = _groups[std::pair<uint64_t,MulticastGroup>(nwid,mg)];
+	GroupShard &shard = _shard(nwid,mg);
+	Mutex::Lock _l(shard.lock);
+	MulticastGroupStatus &gs = shard.groups[std::pair<uint64_t,MulticastGroup>(nwid,mg)];
+	MulticastFanoutBatch *const batch = _fanout(shard);
+
+	RR->metrics->inc(Metrics::COUNTER_MULTICASTS_SENT);
 
 	if (gs.members.size() >= limit) {
 		// If we already have enough members, just send and we're done. We can
@@ -191,7 +215,7 @@ void Multicaster::send(
 					continue;
 			}
 
-			out.sendOnly(RR,*ast);
+			out.sendOnly(RR,*ast,batch);
 			if (++count >= limit)
 				break;
 		}
@@ -205,12 +229,14 @@ void Multicaster::send(
 				}
 
 				if (std::find(alwaysSendTo.begin(),alwaysSendTo.end(),m->address) == alwaysSendTo.end()) {
-					out.sendOnly(RR,m->address);
+					out.sendOnly(RR,m->address,batch);
 					if (++count >= limit)
 						break;
 				}
 			}
 		}
+
+		RR->metrics->observe(Metrics::HISTOGRAM_MULTICAST_FANOUT,count);
 	} else {
 		unsigned int gatherLimit = (limit - (unsigned int)gs.members.size()) + 1;
 
@@ -226,6 +252,7 @@ void Multicaster::send(
 				mg.mac().appendTo(outp);
 				outp.append((uint32_t)mg.adi());
 				outp.append((uint32_t)gatherLimit); // +1 just means we'll have an extra in the queue if available
+				RR->metrics->sent(outp.verb());
 				outp.armor(sn->key(),true);
 				sn->send(RR,outp.data(),outp.size(),now);
 			}
@@ -257,7 +284,7 @@ void Multicaster::send(
 					continue;
 			}
 
-			out.sendAndLog(RR,*ast);
+			out.sendAndLog(RR,*ast,batch);
 			if (++count >= limit)
 				break;
 		}
@@ -271,14 +298,18 @@ void Multicaster::send(
 				}
 
 				if (std::find(alwaysSendTo.begin(),alwaysSendTo.end(),m->address) == alwaysSendTo.end()) {
-					out.sendAndLog(RR,m->address);
+					out.sendAndLog(RR,m->address,batch);
 					if (++count >= limit)
 						break;
 				}
 			}
 		}
+
+		RR->metrics->observe(Metrics::HISTOGRAM_MULTICAST_FANOUT,count);
 	}
 
+	batch->flush(RR,now);
+
 	// DEPRECATED / LEGACY / TODO:
 	// Currently we also always send a legacy P5_MULTICAST_FRAME packet to our
 	// supernode. Our supernode then takes care of relaying it down to <1.0.0
@@ -318,6 +349,7 @@ void Multicaster::send(
 			if (com) com->serialize(outp);
 
 			outp.compress();
+			RR->metrics->sent(outp.verb());
 			outp.armor(sn->key(),true);
 			sn->send(RR,outp.data(),outp.size(),now);
 		}
@@ -326,87 +358,104 @@ void Multicaster::send(
 
 void Multicaster::clean(uint64_t now)
 {
-	Mutex::Lock _l(_groups_m);
-	for(std::map< std::pair<uint64_t,MulticastGroup>,MulticastGroupStatus >::iterator mm(_groups.begin());mm!=_groups.end();) {
-		// Remove expired outgoing multicasts from multicast TX queue
-		for(std::list<OutboundMulticast>::iterator tx(mm->second.txQueue.begin());tx!=mm->second.txQueue.end();) {
-			if ((tx->expired(now))||(tx->atLimit()))
-				mm->second.txQueue.erase(tx++);
-			else ++tx;
-		}
+	for(unsigned int si=0;si<ZT_MULTICAST_GROUP_SHARDS;++si) {
+		GroupShard &shard = _shards[si];
+		Mutex::Lock _l(shard.lock);
+		for(GroupMap::iterator mm(shard.groups.begin());mm!=shard.groups.end();) {
+			// Remove expired outgoing multicasts from multicast TX queue
+			for(std::list<OutboundMulticast>::iterator tx(mm->second.txQueue.begin());tx!=mm->second.txQueue.end();) {
+				if ((tx->expired(now))||(tx->atLimit()))
+					mm->second.txQueue.erase(tx++);
+				else ++tx;
+			}
 
-		// Remove expired members from membership list, and update rank
-		// so that remaining members can be sorted in ascending order of
-		// transmit priority.
-		std::vector<MulticastGroupMember>::iterator reader(mm->second.members.begin());
-		std::vector<MulticastGroupMember>::iterator writer(reader);
-		unsigned int count = 0;
-		while (reader != mm->second.members.end()) {
-			if ((now - reader->timestamp) < ZT_MULTICAST_LIKE_EXPIRE) {
-				*writer = *reader;
-
-				/* We rank in ascending order of most recent relevant activity. For peers we've learned
-				 * about by direct LIKEs, we do this in order of their own activity. For indirectly
-				 * acquired peers we do this minus a constant to place these categorically below directly
-				 * learned peers. For peers with no active Peer record, we use the time we last learned
-				 * about them minus one day (a large constant) to put these at the bottom of the list.
-				 * List is sorted in ascending order of rank and multicasts are sent last-to-first. */
-				if (writer->learnedFrom != writer->address) {
-					SharedPtr<Peer> p(RR->topology->getPeer(writer->learnedFrom));
-					if (p)
-						writer->rank = (RR->topology->amSupernode() ? p->lastDirectReceive() : p->lastUnicastFrame()) - ZT_MULTICAST_LIKE_EXPIRE;
-					else writer->rank = writer->timestamp - (86400000 + ZT_MULTICAST_LIKE_EXPIRE);
-				} else {
-					SharedPtr<Peer> p(RR->topology->getPeer(writer->address));
-					if (p)
-						writer->rank = (RR->topology->amSupernode() ? p->lastDirectReceive() : p->lastUnicastFrame());
-					else writer->rank = writer->timestamp - 86400000;
+			// Remove expired members from membership list, and update rank
+			// so that remaining members can be sorted in ascending order of
+			// transmit priority.
+			std::vector<MulticastGroupMember>::iterator reader(mm->second.members.begin());
+			std::vector<MulticastGroupMember>::iterator writer(reader);
+			unsigned int count = 0;
+			while (reader != mm->second.members.end()) {
+				if ((now - reader->timestamp) < ZT_MULTICAST_LIKE_EXPIRE) {
+					*writer = *reader;
+
+					/* We rank in ascending order of most recent relevant activity. For peers we've learned
+					 * about by direct LIKEs, we do this in order of their own activity. For indirectly
+					 * acquired peers we do this minus a constant to place these categorically below directly
+					 * learned peers. For peers with no active Peer record, we use the time we last learned
+					 * about them minus one day (a large constant) to put these at the bottom of the list.
+					 * List is sorted in ascending order of rank and multicasts are sent last-to-first. */
+					if (writer->learnedFrom != writer->address) {
+						SharedPtr<Peer> p(RR->topology->getPeer(writer->learnedFrom));
+						if (p)
+							writer->rank = (RR->topology->amSupernode() ? p->lastDirectReceive() : p->lastUnicastFrame()) - ZT_MULTICAST_LIKE_EXPIRE;
+						else writer->rank = writer->timestamp - (86400000 + ZT_MULTICAST_LIKE_EXPIRE);
+					} else {
+						SharedPtr<Peer> p(RR->topology->getPeer(writer->address));
+						if (p)
+							writer->rank = (RR->topology->amSupernode() ? p->lastDirectReceive() : p->lastUnicastFrame());
+						else writer->rank = writer->timestamp - 86400000;
+					}
+
+					++writer;
+					++count;
 				}
-
-				++writer;
-				++count;
+				++reader;
 			}
-			++reader;
-		}
 
-		if (count) {
-			// There are remaining members, so re-sort them by rank and resize the vector
-			std::sort(mm->second.members.begin(),writer); // sorts in ascending order of rank
-			mm->second.members.resize(count); // trim off the ones we cut, after writer
-			++mm;
-		} else if (mm->second.txQueue.empty()) {
-			// There are no remaining members and no pending multicasts, so erase the entry
-			_groups.erase(mm++);
-		} else {
-			mm->second.members.clear();
-			++mm;
+			mm->second.memberIndex.clear();
+			if (count) {
+				// There are remaining members, so re-sort them by rank, resize the vector,
+				// and rebuild the address index since positions have changed.
+				std::sort(mm->second.members.begin(),writer); // sorts in ascending order of rank
+				mm->second.members.resize(count); // trim off the ones we cut, after writer
+				for(unsigned long i=0;i<(unsigned long)count;++i)
+					mm->second.memberIndex.set(mm->second.members[i].address,i);
+				_rebuildMemberBlock(mm->second);
+				++mm;
+			} else if (mm->second.txQueue.empty()) {
+				// There are no remaining members and no pending multicasts, so erase the entry
+				shard.groups.erase(mm++);
+			} else {
+				mm->second.members.clear();
+				mm->second.memberBlock.zero();
+				++mm;
+			}
 		}
 	}
 }
 
-void Multicaster::_add(uint64_t now,uint64_t nwid,const MulticastGroup &mg,MulticastGroupStatus &gs,const Address &learnedFrom,const Address &member)
+void Multicaster::_add(uint64_t now,uint64_t nwid,const MulticastGroup &mg,MulticastGroupStatus &gs,const Address &learnedFrom,const Address &member,MulticastFanoutBatch *batch)
 {
-	// assumes _groups_m is locked
+	// assumes shard lock for this group is held
 
 	// Do not add self -- even if someone else returns it
 	if (member == RR->identity.address())
 		return;
 
 	// Update timestamp and learnedFrom if existing
-	for(std::vector<MulticastGroupMember>::iterator m(gs.members.begin());m!=gs.members.end();++m) {
-		if (m->address == member) {
-			if (m->learnedFrom != member) // once we learn it directly, remember this forever
-				m->learnedFrom = learnedFrom;
-			m->timestamp = now;
-			return;
-		}
+	const unsigned long *const idx = gs.memberIndex.get(member);
+	if (idx) {
+		MulticastGroupMember &m = gs.members[*idx];
+		if (m.learnedFrom != member) // once we learn it directly, remember this forever
+			m.learnedFrom = learnedFrom;
+		m.timestamp = now;
+		return;
 	}
 
 	// If not existing, add to end of list (highest priority) -- these will
 	// be resorted on next clean(). In the future we might want to insert
 	// this somewhere else but we'll try this for now.
+	gs.memberIndex.set(member,(unsigned long)gs.members.size());
 	gs.members.push_back(MulticastGroupMember(member,learnedFrom,now));
 
+	if ((!gs.memberBlock)||(gs.memberBlock->count >= gs.memberBlock->capacity))
+		_rebuildMemberBlock(gs); // rebuild includes the member just added
+	else {
+		member.copyTo(gs.memberBlock->data + (gs.memberBlock->count * ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
+		++gs.memberBlock->count;
+	}
+
 	//TRACE("..MC %s joined multicast group %.16llx/%s via %s",member.toString().c_str(),nwid,mg.toString().c_str(),((learnedFrom) ? learnedFrom.toString().c_str() : "(direct)"));
 
 	// Try to send to any outgoing multicasts that are waiting for more recipients
@@ -417,7 +466,7 @@ void Multicaster::_add(uint64_t now,uint64_t nwid,const MulticastGroup &mg,Multi
 			if (tx->atLimit())
 				gs.txQueue.erase(tx++);
 			else {
-				tx->sendIfNew(RR,member);
+				tx->sendIfNew(RR,member,batch);
 				if (tx->atLimit())
 					gs.txQueue.erase(tx++);
 				else ++tx;
@@ -426,4 +475,19 @@ void Multicaster::_add(uint64_t now,uint64_t nwid,const MulticastGroup &mg,Multi
 	}
 }
 
+void Multicaster::_rebuildMemberBlock(MulticastGroupStatus &gs)
+{
+	// assumes shard lock for this group is held
+	const unsigned int count = (unsigned int)gs.members.size();
+	if (!count) {
+		gs.memberBlock.zero();
+		return;
+	}
+	SharedPtr<MemberBlock> blk(new MemberBlock(count + (count / 2) + 8)); // room to append before next clean()
+	for(unsigned int i=0;i<count;++i)
+		gs.members[i].address.copyTo(blk->data + (i * ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
+	blk->count = count;
+	gs.memberBlock = blk;
+}
+
 } // namespace ZeroTier
@@ -29,11 +29,13 @@
 #define ZT_MULTICASTER_HPP
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <map>
 #include <vector>
 #include <list>
+#include <stdexcept>
 
 #include "Constants.hpp"
 #include "Address.hpp"
@@ -42,7 +44,10 @@
 #include "OutboundMulticast.hpp"
 #include "Utils.hpp"
 #include "Mutex.hpp"
+#include "Hashtable.hpp"
 #include "NonCopyable.hpp"
+#include "SharedPtr.hpp"
+#include "AtomicCounter.hpp"
 
 namespace ZeroTier {
 
@@ -70,14 +75,61 @@ private:
 		inline bool operator<(const MulticastGroupMember &m) const throw() { return (rank < m.rank); }
 	};
 
+	/**
+	 * Member addresses pre-serialized as 5-byte fields for GATHER replies
+	 *
+	 * Entries below count are never modified once written, so a reader can
+	 * grab a reference and a count under the shard lock and then copy from
+	 * the block after releasing it. New members are appended in place if
+	 * there's room. Otherwise, or when clean() removes or reorders members,
+	 * a new block replaces the old one and readers holding the old one are
+	 * unaffected.
+	 */
+	class MemberBlock : NonCopyable
+	{
+		friend class SharedPtr<MemberBlock>;
+
+	public:
+		MemberBlock(unsigned int cap) :
+			count(0),
+			capacity(cap)
+		{
+			if (!(data = (unsigned char *)::malloc(cap * ZT_ADDRESS_LENGTH)))
+				throw std::bad_alloc();
+		}
+
+		unsigned char *data;
+		volatile unsigned int count;
+		unsigned int capacity;
+
+	private:
+		~MemberBlock() { ::free(data); }
+
+		AtomicCounter __refCount;
+	};
+
 	struct MulticastGroupStatus
 	{
-		MulticastGroupStatus() : lastExplicitGather(0),totalKnownMembers(0) {}
+		MulticastGroupStatus() : lastExplicitGather(0),totalKnownMembers(0),memberIndex(8) {}
 
 		uint64_t lastExplicitGather;
 		unsigned int totalKnownMembers; // 0 if unknown
 		std::list<OutboundMulticast> txQueue; // pending outbound multicasts
-		std::vector<MulticastGroupMember> members; // members of this group
+		std::vector<MulticastGroupMember> members; // members of this group, ascending rank order as of last clean()
+		Hashtable< Address,unsigned long > memberIndex; // address -> index in members
+		SharedPtr<MemberBlock> memberBlock; // members serialized in the same order, NULL if none
+	};
+
+	typedef std::map< std::pair<uint64_t,MulticastGroup>,MulticastGroupStatus > GroupMap;
+
+	// Groups are split across shards, each with its own lock
+	struct GroupShard
+	{
+		GroupShard() : fanout((MulticastFanoutBatch *)0) {}
+
+		GroupMap groups;
+		MulticastFanoutBatch *fanout; // allocated on first use, guarded by lock
+		Mutex lock;
 	};
 
 public:
@@ -95,8 +147,11 @@ public:
 	 */
 	inline void add(uint64_t now,uint64_t nwid,const MulticastGroup &mg,const Address &learnedFrom,const Address &member)
 	{
-		Mutex::Lock _l(_groups_m);
-		_add(now,nwid,mg,_groups[std::pair<uint64_t,MulticastGroup>(nwid,mg)],learnedFrom,member);
+		GroupShard &gs = _shard(nwid,mg);
+		Mutex::Lock _l(gs.lock);
+		MulticastFanoutBatch *const batch = _fanout(gs);
+		_add(now,nwid,mg,gs.groups[std::pair<uint64_t,MulticastGroup>(nwid,mg)],learnedFrom,member,batch);
+		batch->flush(RR,now);
 	}
 
 	/**
@@ -117,6 +172,10 @@ public:
 	/**
 	 * Append gather results to a packet by choosing registered multicast recipients at random
 	 *
+	 * Results come from a pre-serialized block of member addresses, copied
+	 * starting at a random offset and wrapping around. The shard lock is held
+	 * only long enough to take a reference to that block.
+	 *
 	 * This appends the following fields to the packet:
 	 *   <[4] 32-bit total number of known members in this multicast group>
 	 *   <[2] 16-bit number of members enumerated in this packet>
@@ -171,17 +230,35 @@ public:
 	/**
 	 * Clean up and resort database
 	 *
-	 * @param RR Runtime environment
+	 * Shards are cleaned one at a time, so only groups in the shard being
+	 * cleaned are blocked while members are re-ranked.
+	 *
 	 * @param now Current time
 	 */
 	void clean(uint64_t now);
 
 private:
-	void _add(uint64_t now,uint64_t nwid,const MulticastGroup &mg,MulticastGroupStatus &gs,const Address &learnedFrom,const Address &member);
+	inline GroupShard &_shard(uint64_t nwid,const MulticastGroup &mg) const
+	{
+		unsigned long h = (unsigned long)(nwid ^ (nwid >> 32)) ^ mg.hashCode();
+		h ^= (h >> 16);
+		h ^= (h >> 8);
+		return const_cast<GroupShard &>(_shards[h & (ZT_MULTICAST_GROUP_SHARDS - 1)]);
+	}
+
+	// Caller must hold shard lock
+	inline MulticastFanoutBatch *_fanout(GroupShard &gs)
+	{
+		if (!gs.fanout)
+			gs.fanout = new MulticastFanoutBatch();
+		return gs.fanout;
+	}
+
+	void _add(uint64_t now,uint64_t nwid,const MulticastGroup &mg,MulticastGroupStatus &gs,const Address &learnedFrom,const Address &member,MulticastFanoutBatch *batch);
+	void _rebuildMemberBlock(MulticastGroupStatus &gs);
 
 	const RuntimeEnvironment *RR;
-	std::map< std::pair<uint64_t,MulticastGroup>,MulticastGroupStatus > _groups;
-	Mutex _groups_m;
+	GroupShard _shards[ZT_MULTICAST_GROUP_SHARDS];
 };
 
 } // namespace ZeroTier
@@ -0,0 +1,112 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+#include <vector>
+
+#include "NetconfCache.hpp"
+
+namespace ZeroTier {
+
+NetconfCache::NetconfCache(uint64_t ttl,unsigned long maxEntries) :
+	_ttl(ttl),
+	_maxEntries(maxEntries)
+{
+}
+
+bool NetconfCache::lookup(uint64_t nwid,const Address &peer,const std::string &meta,uint64_t now,std::string &netconf)
+{
+	Mutex::Lock _l(_lock);
+	const _Key k(nwid,peer);
+	_Entry *e = _entries.get(k);
+	if (e) {
+		if ((e->netconf.length())&&(e->meta == meta)&&((now - e->timestamp) < _ttl)) {
+			netconf = e->netconf;
+			return true;
+		}
+	} else {
+		if (_entries.size() >= _maxEntries) {
+			_clean(now);
+			if (_entries.size() >= _maxEntries)
+				return false; // still full, this one just won't be cached
+		}
+		e = &(_entries[k]);
+	}
+	e->meta = meta;
+	e->netconf = "";
+	e->timestamp = now;
+	return false;
+}
+
+void NetconfCache::put(uint64_t nwid,const Address &peer,const std::string &netconf,uint64_t now)
+{
+	Mutex::Lock _l(_lock);
+	_Entry *e = _entries.get(_Key(nwid,peer));
+	if (e) {
+		e->netconf = netconf;
+		e->timestamp = now;
+	}
+}
+
+bool NetconfCache::meta(uint64_t nwid,const Address &peer,std::string &meta)
+{
+	Mutex::Lock _l(_lock);
+	const _Entry *e = _entries.get(_Key(nwid,peer));
+	if (e) {
+		meta = e->meta;
+		return true;
+	}
+	return false;
+}
+
+void NetconfCache::invalidate(uint64_t nwid,const Address &peer)
+{
+	Mutex::Lock _l(_lock);
+	_entries.erase(_Key(nwid,peer));
+}
+
+void NetconfCache::clear()
+{
+	Mutex::Lock _l(_lock);
+	_entries.clear();
+}
+
+void NetconfCache::_clean(uint64_t now)
+{
+	std::vector<_Key> stale;
+	_Key *k = (_Key *)0;
+	_Entry *e = (_Entry *)0;
+	Hashtable< _Key,_Entry >::Iterator i(_entries);
+	while (i.next(k,e)) {
+		if ((now - e->timestamp) >= _ttl)
+			stale.push_back(*k);
+	}
+	for(std::vector<_Key>::iterator s(stale.begin());s!=stale.end();++s)
+		_entries.erase(*s);
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,151 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+#ifndef ZT_NETCONFCACHE_HPP
+#define ZT_NETCONFCACHE_HPP
+
+#include <stdint.h>
+
+#include <string>
+
+#include "Constants.hpp"
+#include "Address.hpp"
+#include "Hashtable.hpp"
+#include "Mutex.hpp"
+#include "NonCopyable.hpp"
+
+namespace ZeroTier {
+
+/**
+ * Cache of signed network configs in front of the netconf service
+ *
+ * Members re-request their config every ZT_NETWORK_AUTOCONF_DELAY, and
+ * almost always get back what they got last time. A network controller
+ * remembers the last netconf-response for each (network, member) pair and
+ * answers an identical request itself until the entry is older than the
+ * TTL or the netconf service pushes a change for that member.
+ *
+ * Requests are identical if they come from the same member for the same
+ * network with the same request meta-data, which is where a member's idea
+ * of its config revision would go. A miss records the meta-data so the
+ * service's response can be stored under it, and responses nobody asked
+ * for are not cached.
+ */
+class NetconfCache : NonCopyable
+{
+public:
+	/**
+	 * @param ttl Maximum age of cached configs in ms
+	 * @param maxEntries Maximum number of (network, member) pairs cached
+	 */
+	NetconfCache(uint64_t ttl = ZT_NETCONF_CACHE_TTL,unsigned long maxEntries = ZT_NETCONF_CACHE_MAX_ENTRIES);
+
+	/**
+	 * Look up a config, or note that a request is going to the service
+	 *
+	 * @param nwid Network ID
+	 * @param peer Requesting member
+	 * @param meta Request meta-data sent by member
+	 * @param now Current time
+	 * @param netconf Result parameter: cached netconf if found
+	 * @return True if netconf was found and may be sent
+	 */
+	bool lookup(uint64_t nwid,const Address &peer,const std::string &meta,uint64_t now,std::string &netconf);
+
+	/**
+	 * Cache a response from the netconf service
+	 *
+	 * @param nwid Network ID
+	 * @param peer Member the response is for
+	 * @param netconf Signed netconf
+	 * @param now Current time
+	 */
+	void put(uint64_t nwid,const Address &peer,const std::string &netconf,uint64_t now);
+
+	/**
+	 * Get the request meta-data recorded by lookup() for a member
+	 *
+	 * @param nwid Network ID
+	 * @param peer Member address
+	 * @param meta Result parameter: meta-data of member's last request
+	 * @return True if found
+	 */
+	bool meta(uint64_t nwid,const Address &peer,std::string &meta);
+
+	/**
+	 * Forget a member's config for a network, e.g. on netconf-push
+	 *
+	 * @param nwid Network ID
+	 * @param peer Member address
+	 */
+	void invalidate(uint64_t nwid,const Address &peer);
+
+	/**
+	 * Forget everything, e.g. on netconf service restart
+	 */
+	void clear();
+
+	/**
+	 * @return Number of entries (including requests awaiting a response)
+	 */
+	inline unsigned long size() const
+	{
+		Mutex::Lock _l(_lock);
+		return _entries.size();
+	}
+
+private:
+	struct _Key
+	{
+		_Key() : nwid(0),peer() {}
+		_Key(uint64_t n,const Address &p) : nwid(n),peer(p) {}
+		inline unsigned long hashCode() const throw() { return (unsigned long)(nwid ^ (nwid >> 32) ^ peer.toInt()); }
+		inline bool operator==(const _Key &k) const throw() { return ((nwid == k.nwid)&&(peer == k.peer)); }
+		uint64_t nwid;
+		Address peer;
+	};
+
+	struct _Entry
+	{
+		_Entry() : timestamp(0) {}
+		std::string meta;
+		std::string netconf; // empty while waiting on the service
+		uint64_t timestamp;
+	};
+
+	void _clean(uint64_t now);
+
+	const uint64_t _ttl;
+	const unsigned long _maxEntries;
+	Hashtable< _Key,_Entry > _entries;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -40,6 +40,7 @@
 #include "EthernetTap.hpp"
 #include "EthernetTapFactory.hpp"
 #include "RoutingTable.hpp"
+#include "Metrics.hpp"
 
 #define ZT_NETWORK_CERT_WRITE_BUF_SIZE 131072
 
@@ -130,6 +131,7 @@ public:
 			std::set<MulticastGroup> mgs(_network->multicastGroups());
 			for(std::set<MulticastGroup>::iterator mg(mgs.begin());mg!=mgs.end();++mg) {
 				if ((outp.size() + 18) > ZT_UDP_DEFAULT_PAYLOAD_MTU) {
+					RR->metrics->sent(outp.verb());
 					outp.armor(p->key(),true);
 					p->send(RR,outp.data(),outp.size(),_now);
 					outp.reset(p->address(),RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
@@ -142,6 +144,7 @@ public:
 			}
 
 			if (outp.size() > ZT_PROTO_MIN_PACKET_LENGTH) {
+				RR->metrics->sent(outp.verb());
 				outp.armor(p->key(),true);
 				p->send(RR,outp.data(),outp.size(),_now);
 			}
@@ -194,6 +197,15 @@ bool Network::rescanMulticastGroups()
 }
 
 bool Network::applyConfiguration(const SharedPtr<NetworkConfig> &conf)
+{
+	bool openTap = false;
+	const bool applied = _applyConfiguration(conf,openTap);
+	if (openTap)
+		threadMain(); // takes _lock itself
+	return applied;
+}
+
+bool Network::_applyConfiguration(const SharedPtr<NetworkConfig> &conf,bool &openTap)
 {
 	Mutex::Lock _l(_lock);
 
@@ -249,6 +261,8 @@ bool Network::applyConfiguration(const SharedPtr<NetworkConfig> &conf)
 
 				// ... IPs that were never controlled by static assignment are left
 				// alone, as these may be DHCP or user-configured.
+			} else if (RR->synchronous) {
+				openTap = true; // no tap creation thread in simulation
 			} else {
 				if (!_setupThread)
 					_setupThread = Thread::start<Network>(this);
@@ -267,14 +281,14 @@ bool Network::applyConfiguration(const SharedPtr<NetworkConfig> &conf)
 	return false;
 }
 
-bool Network::setConfiguration(const Dictionary &conf,bool saveToDisk)
+bool Network::setConfiguration(const void *conf,unsigned int len,bool saveToDisk)
 {
 	try {
-		SharedPtr<NetworkConfig> newConfig(new NetworkConfig(conf)); // throws if invalid
+		SharedPtr<NetworkConfig> newConfig(new NetworkConfig(conf,len)); // throws if invalid
 		if (applyConfiguration(newConfig)) {
 			if (saveToDisk) {
 				std::string confPath(RR->homePath + ZT_PATH_SEPARATOR_S + "networks.d" + ZT_PATH_SEPARATOR_S + idString() + ".conf");
-				if (!Utils::writeFile(confPath.c_str(),conf.toString())) {
+				if (!Utils::writeFile(confPath.c_str(),conf,len)) {
 					LOG("error: unable to write network configuration file at: %s",confPath.c_str());
 				} else {
 					Utils::lockDownFile(confPath.c_str(),false);
@@ -302,7 +316,11 @@ void Network::requestConfiguration()
 	TRACE("requesting netconf for network %.16llx from netconf master %s",(unsigned long long)_id,controller().toString().c_str());
 	Packet outp(controller(),RR->identity.address(),Packet::VERB_NETWORK_CONFIG_REQUEST);
 	outp.append((uint64_t)_id);
-	outp.append((uint16_t)0); // no meta-data
+	Dictionary meta;
+	meta[ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_BINARY] = "1"; // we can read binary configs
+	const std::string metas(meta.toString());
+	outp.append((uint16_t)metas.length());
+	outp.append(metas.data(),(unsigned int)metas.length());
 	RR->sw->send(outp,true);
 }
 
@@ -436,6 +454,19 @@ Network::Status Network::status() const
 	}
 }
 
+void Network::tapPut(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
+{
+	Mutex::Lock _l(_lock);
+	if (!_enabled)
+		return;
+	EthernetTap *t = _tap;
+	if (t) {
+		const uint64_t start = (RR->metrics->latencyEnabled()) ? Utils::nowMicros() : 0;
+		t->put(from,to,etherType,data,len);
+		RR->metrics->latencySince(Metrics::STAGE_TAP_WRITE,start);
+	}
+}
+
 void Network::learnBridgeRoute(const MAC &mac,const Address &addr)
 {
 	Mutex::Lock _l(_lock);
@@ -556,7 +587,8 @@ void Network::_restoreState()
 	std::string mcdbPath(RR->homePath + ZT_PATH_SEPARATOR_S + "networks.d" + ZT_PATH_SEPARATOR_S + idstr + ".mcerts");
 
 	if (_id == ZT_TEST_NETWORK_ID) {
-		applyConfiguration(NetworkConfig::createTestNetworkConfig(RR->identity.address()));
+		// testNetworkUnrestricted=1 in local.conf lifts bridging and multicast limits for benchmarks
+		applyConfiguration(NetworkConfig::createTestNetworkConfig(RR->identity.address(),(_nc->getLocalConfig("testNetworkUnrestricted") == "1")));
 
 		// "Touch" path to this ID to remember test network membership
 		FILE *tmp = fopen(confPath.c_str(),"w");
@@ -568,7 +600,7 @@ void Network::_restoreState()
 			if (Utils::readFile(confPath.c_str(),confs)) {
 				try {
 					if (confs.length())
-						setConfiguration(Dictionary(confs),false);
+						setConfiguration(confs.data(),(unsigned int)confs.length(),false);
 				} catch ( ... ) {} // ignore invalid config on disk, we will re-request from netconf master
 			} else {
 				// "Touch" path to remember membership in lieu of real config from netconf master
@@ -184,14 +184,16 @@ public:
 	/**
 	 * Set or update this network's configuration
 	 *
-	 * This decodes a network configuration in key=value dictionary form,
-	 * applies it if valid, and persists it to disk if saveToDisk is true.
+	 * This decodes a network configuration in key=value dictionary or
+	 * binary form, applies it if valid, and persists it to disk as is if
+	 * saveToDisk is true.
 	 *
-	 * @param conf Configuration in key/value dictionary form
+	 * @param conf Configuration in key/value dictionary or binary form
+	 * @param len Length of configuration
 	 * @param saveToDisk IF true (default), write config to disk
 	 * @return True if configuration was accepted
 	 */
-	bool setConfiguration(const Dictionary &conf,bool saveToDisk = true);
+	bool setConfiguration(const void *conf,unsigned int len,bool saveToDisk = true);
 
 	/**
 	 * Set netconf failure to 'access denied' -- called in IncomingPacket when netconf master reports this
@@ -322,15 +324,7 @@ public:
 	 * @param data Frame data
 	 * @param len Frame length
 	 */
-	inline void tapPut(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
-	{
-		Mutex::Lock _l(_lock);
-		if (!_enabled)
-			return;
-		EthernetTap *t = _tap;
-		if (t)
-			t->put(from,to,etherType,data,len);
-	}
+	void tapPut(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len);
 
 	/**
 	 * Call injectPacketFromHost() on tap if it exists
@@ -456,6 +450,7 @@ public:
 private:
 	static void _CBhandleTapData(void *arg,const MAC &from,const MAC &to,unsigned int etherType,const Buffer<4096> &data);
 
+	bool _applyConfiguration(const SharedPtr<NetworkConfig> &conf,bool &openTap);
 	void _restoreState();
 	void _dumpMembershipCerts();
 
@@ -26,6 +26,7 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 
 #include "NetworkConfig.hpp"
 #include "Utils.hpp"
@@ -36,7 +37,53 @@ namespace ZeroTier {
 // as a good default for your average network.
 const NetworkConfig::MulticastRate NetworkConfig::DEFAULT_MULTICAST_RATE(40000,60000,80);
 
-SharedPtr<NetworkConfig> NetworkConfig::createTestNetworkConfig(const Address &self)
+// Get a field that must be present
+static inline void _required(const DictionaryReader &d,const char *key,const char *&v,unsigned int &vlen)
+{
+	if (!d.get(key,v,vlen))
+		throw std::invalid_argument(std::string("missing required field: ") + key);
+}
+
+// Get the next comma-delimited field in [p,eof), skipping empty ones like Utils::split()
+static inline bool _nextField(const char *&p,const char *eof,const char *&f,unsigned int &flen)
+	throw()
+{
+	while ((p != eof)&&(*p == ','))
+		++p;
+	if (p == eof)
+		return false;
+	f = p;
+	while ((p != eof)&&(*p != ','))
+		++p;
+	flen = (unsigned int)(p - f);
+	return true;
+}
+
+// Static IPs must be V4 or V6 with a sensible netmask
+static inline bool _validStaticIp(const InetAddress &addr)
+	throw()
+{
+	switch(addr.type()) {
+		case InetAddress::TYPE_IPV4:
+			return ((addr.netmaskBits())&&(addr.netmaskBits() <= 32));
+		case InetAddress::TYPE_IPV6:
+			return ((addr.netmaskBits())&&(addr.netmaskBits() <= 128));
+		default: // ignore unrecognized address types or junk/empty fields
+			return false;
+	}
+}
+
+NetworkConfig::NetworkConfig(const void *conf,unsigned int len)
+{
+	if ((len)&&(((const unsigned char *)conf)[0] == 0)) {
+		_fromBinary(Buffer<ZT_NETWORKCONFIG_BINARY_MAX_LENGTH>(conf,len));
+	} else {
+		DictionaryReader d((const char *)conf,len);
+		_fromDictionary(d);
+	}
+}
+
+SharedPtr<NetworkConfig> NetworkConfig::createTestNetworkConfig(const Address &self,bool unrestricted)
 {
 	SharedPtr<NetworkConfig> nc(new NetworkConfig());
 
@@ -46,11 +93,14 @@ SharedPtr<NetworkConfig> NetworkConfig::createTestNetworkConfig(const Address &s
 	nc->_timestamp = Utils::now();
 	nc->_issuedTo = self;
 	nc->_multicastLimit = ZT_MULTICAST_DEFAULT_LIMIT;
-	nc->_allowPassiveBridging = false;
+	nc->_compressionAcceleration = 1;
+	nc->_allowPassiveBridging = unrestricted;
 	nc->_private = false;
 	nc->_enableBroadcast = true;
 	nc->_name = "ZT_TEST_NETWORK";
 	nc->_description = "Built-in dummy test network";
+	if (unrestricted)
+		nc->_multicastRates[MulticastGroup()] = MulticastRate(0xffffffff,0xffffffff,0xffffffff);
 
 	// Make up a V4 IP from 'self' in the 10.0.0.0/8 range -- no
 	// guarantee of uniqueness but collisions are unlikely.
@@ -96,86 +146,162 @@ const NetworkConfig::MulticastRate &NetworkConfig::multicastRate(const Multicast
 	return r->second;
 }
 
-void NetworkConfig::_fromDictionary(const Dictionary &d)
+void NetworkConfig::_fromDictionary(const DictionaryReader &d)
 {
-	static const std::string zero("0");
-	static const std::string one("1");
-
-	// NOTE: d.get(name) throws if not found, d.get(name,default) returns default
+	const char *v;
+	unsigned int vlen;
+	const char *f;
+	unsigned int flen;
 
 	memset(_etWhitelist,0,sizeof(_etWhitelist));
-	std::vector<std::string> ets(Utils::split(d.get(ZT_NETWORKCONFIG_DICT_KEY_ALLOWED_ETHERNET_TYPES).c_str(),",","",""));
-	for(std::vector<std::string>::const_iterator et(ets.begin());et!=ets.end();++et) {
-		unsigned int tmp = Utils::hexStrToUInt(et->c_str()) & 0xffff;
+	_required(d,ZT_NETWORKCONFIG_DICT_KEY_ALLOWED_ETHERNET_TYPES,v,vlen);
+	for(const char *p=v,*eof=v+vlen;_nextField(p,eof,f,flen);) {
+		unsigned int tmp = (unsigned int)Utils::hexStrToU64(f,flen) & 0xffff;
 		_etWhitelist[tmp >> 3] |= (1 << (tmp & 7));
 	}
 
-	_nwid = Utils::hexStrToU64(d.get(ZT_NETWORKCONFIG_DICT_KEY_NETWORK_ID).c_str());
+	_required(d,ZT_NETWORKCONFIG_DICT_KEY_NETWORK_ID,v,vlen);
+	_nwid = Utils::hexStrToU64(v,vlen);
 	if (!_nwid)
 		throw std::invalid_argument("configuration contains zero network ID");
 
-	_timestamp = Utils::hexStrToU64(d.get(ZT_NETWORKCONFIG_DICT_KEY_TIMESTAMP).c_str());
-	_issuedTo = Address(d.get(ZT_NETWORKCONFIG_DICT_KEY_ISSUED_TO));
-	_multicastLimit = Utils::hexStrToUInt(d.get(ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_LIMIT,zero).c_str());
+	_required(d,ZT_NETWORKCONFIG_DICT_KEY_TIMESTAMP,v,vlen);
+	_timestamp = Utils::hexStrToU64(v,vlen);
+	_required(d,ZT_NETWORKCONFIG_DICT_KEY_ISSUED_TO,v,vlen);
+	_issuedTo = Address(Utils::hexStrToU64(v,vlen));
+	_multicastLimit = (unsigned int)d.getHex(ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_LIMIT,0);
 	if (_multicastLimit == 0) _multicastLimit = ZT_MULTICAST_DEFAULT_LIMIT;
-	_allowPassiveBridging = (Utils::hexStrToUInt(d.get(ZT_NETWORKCONFIG_DICT_KEY_ALLOW_PASSIVE_BRIDGING,zero).c_str()) != 0);
-	_private = (Utils::hexStrToUInt(d.get(ZT_NETWORKCONFIG_DICT_KEY_PRIVATE,one).c_str()) != 0);
-	_enableBroadcast = (Utils::hexStrToUInt(d.get(ZT_NETWORKCONFIG_DICT_KEY_ENABLE_BROADCAST,one).c_str()) != 0);
-	_name = d.get(ZT_NETWORKCONFIG_DICT_KEY_NAME);
-	_description = d.get(ZT_NETWORKCONFIG_DICT_KEY_DESC,std::string());
+	_compressionAcceleration = (int)d.getHex(ZT_NETWORKCONFIG_DICT_KEY_COMPRESSION_ACCELERATION,1);
+	if (_compressionAcceleration < 1) _compressionAcceleration = 1;
+	else if (_compressionAcceleration > ZT_MAX_COMPRESSION_ACCELERATION) _compressionAcceleration = ZT_MAX_COMPRESSION_ACCELERATION;
+	_allowPassiveBridging = (d.getHex(ZT_NETWORKCONFIG_DICT_KEY_ALLOW_PASSIVE_BRIDGING,0) != 0);
+	_private = (d.getHex(ZT_NETWORKCONFIG_DICT_KEY_PRIVATE,1) != 0);
+	_enableBroadcast = (d.getHex(ZT_NETWORKCONFIG_DICT_KEY_ENABLE_BROADCAST,1) != 0);
+	_required(d,ZT_NETWORKCONFIG_DICT_KEY_NAME,v,vlen);
+	_name.assign(v,vlen);
+	if (d.get(ZT_NETWORKCONFIG_DICT_KEY_DESC,v,vlen))
+		_description.assign(v,vlen);
 
 	// In dictionary IPs are split into V4 and V6 addresses, but we don't really
 	// need that so merge them here.
-	std::string ipAddrs(d.get(ZT_NETWORKCONFIG_DICT_KEY_IPV4_STATIC,std::string()));
-	{
-		std::string v6s(d.get(ZT_NETWORKCONFIG_DICT_KEY_IPV6_STATIC,std::string()));
-		if (v6s.length()) {
-			if (ipAddrs.length())
-				ipAddrs.push_back(',');
-			ipAddrs.append(v6s);
+	static const char *const ipKeys[2] = { ZT_NETWORKCONFIG_DICT_KEY_IPV4_STATIC,ZT_NETWORKCONFIG_DICT_KEY_IPV6_STATIC };
+	for(unsigned int k=0;k<2;++k) {
+		if (!d.get(ipKeys[k],v,vlen))
+			continue;
+		for(const char *p=v,*eof=v+vlen;_nextField(p,eof,f,flen);) {
+			InetAddress addr(std::string(f,flen));
+			if (_validStaticIp(addr))
+				_staticIps.push_back(addr);
 		}
 	}
+	std::sort(_staticIps.begin(),_staticIps.end());
+	_staticIps.erase(std::unique(_staticIps.begin(),_staticIps.end()),_staticIps.end());
 
-	std::vector<std::string> ipAddrsSplit(Utils::split(ipAddrs.c_str(),",","",""));
-	for(std::vector<std::string>::const_iterator ipstr(ipAddrsSplit.begin());ipstr!=ipAddrsSplit.end();++ipstr) {
-		InetAddress addr(*ipstr);
-		switch(addr.type()) {
-			case InetAddress::TYPE_IPV4:
-				if ((!addr.netmaskBits())||(addr.netmaskBits() > 32))
-					continue;
-				break;
-			case InetAddress::TYPE_IPV6:
-				if ((!addr.netmaskBits())||(addr.netmaskBits() > 128))
-					continue;
-				break;
-			default: // ignore unrecognized address types or junk/empty fields
-				continue;
+	if (d.get(ZT_NETWORKCONFIG_DICT_KEY_ACTIVE_BRIDGES,v,vlen)) {
+		for(const char *p=v,*eof=v+vlen;_nextField(p,eof,f,flen);) {
+			if (flen == ZT_ADDRESS_LENGTH_HEX) { // ignore empty or garbage fields
+				Address tmp(Utils::hexStrToU64(f,flen));
+				if (!tmp.isReserved())
+					_activeBridges.push_back(tmp);
+			}
 		}
-		_staticIps.push_back(addr);
 	}
-	std::sort(_staticIps.begin(),_staticIps.end());
-	std::unique(_staticIps.begin(),_staticIps.end());
-
-	std::vector<std::string> activeBridgesSplit(Utils::split(d.get(ZT_NETWORKCONFIG_DICT_KEY_ACTIVE_BRIDGES,"").c_str(),",","",""));
-	for(std::vector<std::string>::const_iterator a(activeBridgesSplit.begin());a!=activeBridgesSplit.end();++a) {
-		if (a->length() == ZT_ADDRESS_LENGTH_HEX) { // ignore empty or garbage fields
-			Address tmp(*a);
-			if (!tmp.isReserved())
-				_activeBridges.push_back(tmp);
+	std::sort(_activeBridges.begin(),_activeBridges.end());
+	_activeBridges.erase(std::unique(_activeBridges.begin(),_activeBridges.end()),_activeBridges.end());
+
+	// Rates are a dictionary of MAC/ADI to preload,maxBalance,accrual in hex
+	if (d.get(ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_RATES,v,vlen)) {
+		DictionaryReader rates(v,vlen);
+		for(unsigned int i=0;i<rates.size();++i) {
+			unsigned int klen;
+			const char *k = rates.field(i,klen,v,vlen);
+
+			unsigned int slash = 0;
+			while ((slash < klen)&&(k[slash] != '/'))
+				++slash;
+			unsigned char mac[6];
+			memset(mac,0,sizeof(mac));
+			Utils::unhex(k,slash,mac,6);
+			const uint32_t adi = (slash < klen) ? (uint32_t)Utils::hexStrToU64(k + slash + 1,klen - slash - 1) : (uint32_t)0;
+
+			uint32_t params[3];
+			unsigned int n = 0;
+			for(const char *p=v,*eof=v+vlen;((n < 3)&&(_nextField(p,eof,f,flen)));)
+				params[n++] = (uint32_t)Utils::hexStrToU64(f,flen);
+			if (n == 3)
+				_multicastRates[MulticastGroup(MAC(mac,6),adi)] = MulticastRate(params[0],params[1],params[2]);
 		}
 	}
+
+	if (d.get(ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATE_OF_MEMBERSHIP,v,vlen))
+		_com.fromString(std::string(v,vlen));
+}
+
+void NetworkConfig::_fromBinary(const Buffer<ZT_NETWORKCONFIG_BINARY_MAX_LENGTH> &b)
+{
+	unsigned int p = 0;
+
+	if ((b[p++] != 0)||(b[p++] != ZT_NETWORKCONFIG_BINARY_VERSION))
+		throw std::invalid_argument("unrecognized binary network configuration version");
+
+	_nwid = b.at<uint64_t>(p); p += 8;
+	if (!_nwid)
+		throw std::invalid_argument("configuration contains zero network ID");
+	_timestamp = b.at<uint64_t>(p); p += 8;
+	_issuedTo.setTo(b.field(p,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); p += ZT_ADDRESS_LENGTH;
+	_multicastLimit = b.at<uint32_t>(p); p += 4;
+	if (_multicastLimit == 0) _multicastLimit = ZT_MULTICAST_DEFAULT_LIMIT;
+	_compressionAcceleration = (int)b[p++];
+	if (_compressionAcceleration < 1) _compressionAcceleration = 1;
+	else if (_compressionAcceleration > ZT_MAX_COMPRESSION_ACCELERATION) _compressionAcceleration = ZT_MAX_COMPRESSION_ACCELERATION;
+	const unsigned int flags = b[p++];
+	_private = ((flags & ZT_NETWORKCONFIG_BINARY_FLAG_PRIVATE) != 0);
+	_allowPassiveBridging = ((flags & ZT_NETWORKCONFIG_BINARY_FLAG_ALLOW_PASSIVE_BRIDGING) != 0);
+	_enableBroadcast = ((flags & ZT_NETWORKCONFIG_BINARY_FLAG_ENABLE_BROADCAST) != 0);
+
+	memset(_etWhitelist,0,sizeof(_etWhitelist));
+	unsigned int n = b.at<uint16_t>(p); p += 2;
+	for(unsigned int i=0;i<n;++i) {
+		unsigned int tmp = b.at<uint16_t>(p); p += 2;
+		_etWhitelist[tmp >> 3] |= (1 << (tmp & 7));
+	}
+
+	n = b.at<uint16_t>(p); p += 2;
+	_name.assign((const char *)b.field(p,n),n); p += n;
+	n = b.at<uint16_t>(p); p += 2;
+	_description.assign((const char *)b.field(p,n),n); p += n;
+
+	n = b.at<uint16_t>(p); p += 2;
+	_staticIps.reserve(n);
+	for(unsigned int i=0;i<n;++i) {
+		const unsigned int iplen = (b[p++] == 6) ? 16 : 4;
+		InetAddress addr(b.field(p,iplen),iplen,b[p + iplen]);
+		p += iplen + 1;
+		if (_validStaticIp(addr))
+			_staticIps.push_back(addr);
+	}
+	std::sort(_staticIps.begin(),_staticIps.end());
+	_staticIps.erase(std::unique(_staticIps.begin(),_staticIps.end()),_staticIps.end());
+
+	n = b.at<uint16_t>(p); p += 2;
+	_activeBridges.reserve(n);
+	for(unsigned int i=0;i<n;++i) {
+		Address tmp(b.field(p,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); p += ZT_ADDRESS_LENGTH;
+		if (!tmp.isReserved())
+			_activeBridges.push_back(tmp);
+	}
 	std::sort(_activeBridges.begin(),_activeBridges.end());
-	std::unique(_activeBridges.begin(),_activeBridges.end());
+	_activeBridges.erase(std::unique(_activeBridges.begin(),_activeBridges.end()),_activeBridges.end());
 
-	Dictionary multicastRateEntries(d.get(ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_RATES,std::string()));
-	for(Dictionary::const_iterator i(multicastRateEntries.begin());i!=multicastRateEntries.end();++i) {
-		std::vector<std::string> params(Utils::split(i->second.c_str(),",","",""));
-		if (params.size() >= 3)
-			_multicastRates[MulticastGroup(i->first)] = MulticastRate(Utils::hexStrToUInt(params[0].c_str()),Utils::hexStrToUInt(params[1].c_str()),Utils::hexStrToUInt(params[2].c_str()));
+	n = b.at<uint16_t>(p); p += 2;
+	for(unsigned int i=0;i<n;++i) {
+		MulticastGroup mg(MAC(b.field(p,6),6),b.at<uint32_t>(p + 6));
+		_multicastRates[mg] = MulticastRate(b.at<uint32_t>(p + 10),b.at<uint32_t>(p + 14),b.at<uint32_t>(p + 18));
+		p += 22;
 	}
 
-	_com.fromString(d.get(ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATE_OF_MEMBERSHIP,std::string()));
+	if (b[p++])
+		_com.deserialize(b,p);
 }
 
 } // namespace ZeroTier
-
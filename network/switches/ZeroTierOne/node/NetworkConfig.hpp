@@ -37,7 +37,8 @@
 #include <algorithm>
 
 #include "Constants.hpp"
-#include "Dictionary.hpp"
+#include "Buffer.hpp"
+#include "DictionaryReader.hpp"
 #include "InetAddress.hpp"
 #include "AtomicCounter.hpp"
 #include "SharedPtr.hpp"
@@ -64,11 +65,56 @@ namespace ZeroTier {
 #define ZT_NETWORKCONFIG_DICT_KEY_ENABLE_BROADCAST "eb"
 #define ZT_NETWORKCONFIG_DICT_KEY_ALLOW_PASSIVE_BRIDGING "pb"
 #define ZT_NETWORKCONFIG_DICT_KEY_ACTIVE_BRIDGES "ab"
+#define ZT_NETWORKCONFIG_DICT_KEY_COMPRESSION_ACCELERATION "ca"
+
+// Members put this key in NETWORK_CONFIG_REQUEST meta-data to ask for a
+// binary config in reply.
+#define ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_BINARY "b"
+
+// Binary configs start with a zero byte, which ends a string-serialized
+// dictionary before it begins, and then this version.
+#define ZT_NETWORKCONFIG_BINARY_VERSION 1
+
+// Maximum size of a binary config
+#define ZT_NETWORKCONFIG_BINARY_MAX_LENGTH 16384
+
+// Flags in binary configs
+#define ZT_NETWORKCONFIG_BINARY_FLAG_PRIVATE 0x01
+#define ZT_NETWORKCONFIG_BINARY_FLAG_ALLOW_PASSIVE_BRIDGING 0x02
+#define ZT_NETWORKCONFIG_BINARY_FLAG_ENABLE_BROADCAST 0x04
 
 /**
  * Network configuration received from netconf master nodes
  *
- * This is an immutable value object created from a dictionary received from netconf master.
+ * This is an immutable value object created from a dictionary received from
+ * netconf master, or from the binary form of one. Dictionaries are read in
+ * place with DictionaryReader. The binary form is what a controller sends
+ * to members that ask for it, since it is smaller and is read in a single
+ * pass with no text parsing.
+ *
+ * Binary format:
+ *   <[1] 0x00>
+ *   <[1] ZT_NETWORKCONFIG_BINARY_VERSION>
+ *   <[8] network ID>
+ *   <[8] timestamp>
+ *   <[5] issued to address>
+ *   <[4] multicast limit>
+ *   <[1] compression acceleration>
+ *   <[1] flags (ZT_NETWORKCONFIG_BINARY_FLAG_*)>
+ *   <[2] number of allowed ethernet types (0 in the list means all)>
+ *   <[2] ethernet type> ...
+ *   <[2] length of name>
+ *   <[...] name>
+ *   <[2] length of description>
+ *   <[...] description>
+ *   <[2] number of static IPs>
+ *   <[1] 4 or 6> <[4] or [16] IP> <[1] netmask bits> ...
+ *   <[2] number of active bridges>
+ *   <[5] address> ...
+ *   <[2] number of multicast rates>
+ *   <[6] MAC> <[4] ADI> <[4] preload> <[4] max balance> <[4] accrual> ...
+ *   <[1] 1 if certificate of membership follows, otherwise 0>
+ *  [<[...] binary certificate of membership>]
  */
 class NetworkConfig
 {
@@ -99,15 +145,79 @@ public:
 	 * "fake" network with no real netconf master and default options.
 	 *
 	 * @param self This node's ZT address
+	 * @param unrestricted If true, permit passive bridging and don't rate limit multicast (for benchmarking)
 	 * @return Configured instance of netconf for test network ID
 	 */
-	static SharedPtr<NetworkConfig> createTestNetworkConfig(const Address &self);
+	static SharedPtr<NetworkConfig> createTestNetworkConfig(const Address &self,bool unrestricted = false);
 
 	/**
-	 * @param d Dictionary containing configuration
+	 * @param conf String-serialized dictionary or binary configuration
+	 * @param len Length of configuration
 	 * @throws std::invalid_argument Invalid configuration
+	 * @throws std::out_of_range Truncated or oversized binary configuration
+	 */
+	NetworkConfig(const void *conf,unsigned int len);
+
+	/**
+	 * @param b Buffer to append binary configuration to
+	 * @throws std::out_of_range Buffer too small
 	 */
-	NetworkConfig(const Dictionary &d) { _fromDictionary(d); }
+	template<unsigned int C>
+	inline void serialize(Buffer<C> &b) const
+		throw(std::out_of_range)
+	{
+		b.append((unsigned char)0);
+		b.append((unsigned char)ZT_NETWORKCONFIG_BINARY_VERSION);
+		b.append(_nwid);
+		b.append(_timestamp);
+		_issuedTo.appendTo(b);
+		b.append((uint32_t)_multicastLimit);
+		b.append((unsigned char)_compressionAcceleration);
+		b.append((unsigned char)(
+			((_private) ? ZT_NETWORKCONFIG_BINARY_FLAG_PRIVATE : 0) |
+			((_allowPassiveBridging) ? ZT_NETWORKCONFIG_BINARY_FLAG_ALLOW_PASSIVE_BRIDGING : 0) |
+			((_enableBroadcast) ? ZT_NETWORKCONFIG_BINARY_FLAG_ENABLE_BROADCAST : 0)));
+
+		std::vector<unsigned int> ets(allowedEtherTypes());
+		b.append((uint16_t)ets.size());
+		for(std::vector<unsigned int>::const_iterator et(ets.begin());et!=ets.end();++et)
+			b.append((uint16_t)*et);
+
+		b.append((uint16_t)_name.length());
+		b.append(_name.data(),(unsigned int)_name.length());
+		b.append((uint16_t)_description.length());
+		b.append(_description.data(),(unsigned int)_description.length());
+
+		b.append((uint16_t)_staticIps.size());
+		for(std::vector<InetAddress>::const_iterator ip(_staticIps.begin());ip!=_staticIps.end();++ip) {
+			if (ip->isV4()) {
+				b.append((unsigned char)4);
+				b.append(ip->rawIpData(),4);
+			} else {
+				b.append((unsigned char)6);
+				b.append(ip->rawIpData(),16);
+			}
+			b.append((unsigned char)ip->netmaskBits());
+		}
+
+		b.append((uint16_t)_activeBridges.size());
+		for(std::vector<Address>::const_iterator a(_activeBridges.begin());a!=_activeBridges.end();++a)
+			a->appendTo(b);
+
+		b.append((uint16_t)_multicastRates.size());
+		for(std::map<MulticastGroup,MulticastRate>::const_iterator r(_multicastRates.begin());r!=_multicastRates.end();++r) {
+			r->first.mac().appendTo(b);
+			b.append((uint32_t)r->first.adi());
+			b.append((uint32_t)r->second.preload);
+			b.append((uint32_t)r->second.maxBalance);
+			b.append((uint32_t)r->second.accrual);
+		}
+
+		if (_com) {
+			b.append((unsigned char)1);
+			_com.serialize(b);
+		} else b.append((unsigned char)0);
+	}
 
 	/**
 	 * @param etherType Ethernet frame type to check
@@ -132,6 +242,7 @@ public:
 	inline uint64_t timestamp() const throw() { return _timestamp; }
 	inline const Address &issuedTo() const throw() { return _issuedTo; }
 	inline unsigned int multicastLimit() const throw() { return _multicastLimit; }
+	inline int compressionAcceleration() const throw() { return _compressionAcceleration; }
 	inline const std::map<MulticastGroup,MulticastRate> &multicastRates() const throw() { return _multicastRates; }
 	inline bool allowPassiveBridging() const throw() { return _allowPassiveBridging; }
 	inline bool isPublic() const throw() { return (!_private); }
@@ -163,13 +274,15 @@ private:
 	NetworkConfig() {}
 	~NetworkConfig() {}
 
-	void _fromDictionary(const Dictionary &d);
+	void _fromDictionary(const DictionaryReader &d);
+	void _fromBinary(const Buffer<ZT_NETWORKCONFIG_BINARY_MAX_LENGTH> &b);
 
 	unsigned char _etWhitelist[65536 / 8];
 	uint64_t _nwid;
 	uint64_t _timestamp;
 	Address _issuedTo;
 	unsigned int _multicastLimit;
+	int _compressionAcceleration;
 	bool _allowPassiveBridging;
 	bool _private;
 	bool _enableBroadcast;
@@ -68,15 +68,21 @@
 #include "CMWC4096.hpp"
 #include "NodeConfig.hpp"
 #include "Network.hpp"
+#include "NetworkConfig.hpp"
+#include "Dictionary.hpp"
+#include "DictionaryReader.hpp"
 #include "MulticastGroup.hpp"
 #include "Multicaster.hpp"
 #include "Mutex.hpp"
 #include "Service.hpp"
+#include "NetconfCache.hpp"
 #include "SoftwareUpdater.hpp"
 #include "Buffer.hpp"
 #include "AntiRecursion.hpp"
 #include "RoutingTable.hpp"
 #include "HttpClient.hpp"
+#include "IdentityValidator.hpp"
+#include "Metrics.hpp"
 
 namespace ZeroTier {
 
@@ -91,8 +97,27 @@ struct _NodeImpl
 	volatile bool running;
 	volatile bool resynchronize;
 	volatile bool disableRootTopologyUpdates;
+	volatile bool persistPeers;
+	volatile bool exportMetrics;
 	std::string overrideRootTopology;
 
+	// Core loop state, kept here so step() can pick up where it left off
+	std::string shutdownIfUnreadablePath;
+	std::string metricsPath;
+	uint64_t lastNetworkAutoconfCheck;
+	uint64_t lastClean;
+	uint64_t lastNetworkFingerprintCheck;
+	uint64_t lastMulticastCheck;
+	uint64_t lastSupernodePingCheck;
+	uint64_t lastBeacon;
+	uint64_t lastRootTopologyFetch;
+	uint64_t lastShutdownIfUnreadableCheck;
+	uint64_t lastPeerSnapshot;
+	uint64_t lastMetricsExport;
+	uint64_t networkConfigurationFingerprint;
+	long lastDelayDelta;
+	unsigned long keepaliveDelay;
+
 	// This function performs final node tear-down
 	inline Node::ReasonForTermination terminate()
 	{
@@ -103,14 +128,19 @@ struct _NodeImpl
 
 #ifndef __WINDOWS__
 		delete renv.netconfService;
+		delete renv.netconfCache;
 #endif
 		delete renv.updater;  renv.updater = (SoftwareUpdater *)0;
+		delete renv.idv;      renv.idv = (IdentityValidator *)0;    // stop validation threads before anything they touch
 		delete renv.nc;       renv.nc = (NodeConfig *)0;            // shut down all networks, close taps, etc.
+		if ((persistPeers)&&(renv.topology))
+			renv.topology->savePeers();                             // snapshot for warm restart
 		delete renv.topology; renv.topology = (Topology *)0;        // now we no longer need routing info
 		delete renv.mc;       renv.mc = (Multicaster *)0;
 		delete renv.antiRec;  renv.antiRec = (AntiRecursion *)0;
 		delete renv.sw;       renv.sw = (Switch *)0;                // order matters less from here down
 		delete renv.http;     renv.http = (HttpClient *)0;
+		delete renv.metrics;  renv.metrics = (Metrics *)0;
 		delete renv.prng;     renv.prng = (CMWC4096 *)0;
 		delete renv.log;      renv.log = (Logger *)0;               // but stop logging last of all
 
@@ -126,6 +156,17 @@ struct _NodeImpl
 };
 
 #ifndef __WINDOWS__ // "services" are not supported on Windows
+// Re-encode a netconf dictionary in binary form, or leave it be if it doesn't parse
+static void _binaryNetconf(std::string &netconf)
+{
+	try {
+		SharedPtr<NetworkConfig> nc(new NetworkConfig(netconf.data(),(unsigned int)netconf.length()));
+		Buffer<ZT_NETWORKCONFIG_BINARY_MAX_LENGTH> b;
+		nc->serialize(b);
+		netconf.assign((const char *)b.data(),b.size());
+	} catch ( ... ) {}
+}
+
 static void _netconfServiceMessageHandler(void *renv,Service &svc,const Dictionary &msg)
 {
 	if (!renv)
@@ -137,6 +178,7 @@ static void _netconfServiceMessageHandler(void *renv,Service &svc,const Dictiona
 		const std::string &type = msg.get("type");
 		if (type == "ready") {
 			LOG("received 'ready' from netconf.service, sending netconf-init with identity information...");
+			RR->netconfCache->clear(); // service (re)started, it may have new data
 			Dictionary initMessage;
 			initMessage["type"] = "netconf-init";
 			initMessage["netconfId"] = RR->identity.toString(true);
@@ -147,6 +189,13 @@ static void _netconfServiceMessageHandler(void *renv,Service &svc,const Dictiona
 			Address peerAddress(msg.get("peer").c_str());
 
 			if (peerAddress) {
+				char key[64];
+				Utils::snprintf(key,sizeof(key),"%.10llx-%.16llx",(unsigned long long)peerAddress.toInt(),(unsigned long long)nwid);
+				long t = svc.complete(std::string(key));
+				if (t >= 0)
+					RR->metrics->observe(Metrics::HISTOGRAM_NETCONF_RESPONSE_TIME,(uint64_t)t);
+				RR->metrics->set(Metrics::GAUGE_NETCONF_REQUESTS_IN_FLIGHT,svc.inFlight());
+
 				if (msg.contains("error")) {
 					Packet::ErrorCode errCode = Packet::ERROR_INVALID_REQUEST;
 					const std::string &err = msg.get("error");
@@ -162,8 +211,12 @@ static void _netconfServiceMessageHandler(void *renv,Service &svc,const Dictiona
 					outp.append(nwid);
 					RR->sw->send(outp,true);
 				} else if (msg.contains("netconf")) {
-					const std::string &netconf = msg.get("netconf");
+					std::string netconf(msg.get("netconf"));
+					std::string meta;
+					if ((RR->netconfCache->meta(nwid,peerAddress,meta))&&(DictionaryReader(meta.data(),(unsigned int)meta.length()).contains(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_BINARY)))
+						_binaryNetconf(netconf); // member reads binary configs, which are smaller and faster to parse
 					if (netconf.length() < 2048) { // sanity check
+						RR->netconfCache->put(nwid,peerAddress,netconf,Utils::now());
 						Packet outp(peerAddress,RR->identity.address(),Packet::VERB_OK);
 						outp.append((unsigned char)Packet::VERB_NETWORK_CONFIG_REQUEST);
 						outp.append(inRePacketId);
@@ -190,6 +243,7 @@ static void _netconfServiceMessageHandler(void *renv,Service &svc,const Dictiona
 						for(char *p=Utils::stok(const_cast<char *>(t->second.c_str()),",",&saveptr);(p);p=Utils::stok((char *)0,",",&saveptr)) {
 							uint64_t nwid = Utils::hexStrToU64(p);
 							if (nwid) {
+								RR->netconfCache->invalidate(nwid,ztaddr);
 								if ((outp.size() + sizeof(uint64_t)) >= ZT_UDP_DEFAULT_PAYLOAD_MTU) {
 									RR->sw->send(outp,true);
 									outp.reset(ztaddr,RR->identity.address(),Packet::VERB_NETWORK_CONFIG_REFRESH);
@@ -253,6 +307,8 @@ Node::Node(
 	impl->started = false;
 	impl->running = false;
 	impl->resynchronize = false;
+	impl->persistPeers = false;
+	impl->exportMetrics = false;
 
 	if (overrideRootTopology) {
 		impl->disableRootTopologyUpdates = true;
@@ -317,21 +373,112 @@ Node::ReasonForTermination Node::run()
 	_NodeImpl *impl = (_NodeImpl *)_impl;
 	RuntimeEnvironment *RR = (RuntimeEnvironment *)&(impl->renv);
 
+	ReasonForTermination r = _init(false);
+	if (r != NODE_RUNNING)
+		return r;
+
+	// Core I/O loop
+	while (impl->reasonForTermination == NODE_RUNNING) {
+		unsigned long delay = _doPeriodicTasks();
+		if (impl->reasonForTermination != NODE_RUNNING)
+			break;
+
+		// Sleep for loop interval or until something interesting happens.
+		try {
+			uint64_t start = Utils::now();
+			RR->sm->poll(delay,&_CBztTraffic,RR);
+			impl->lastDelayDelta = (long)(Utils::now() - start) - (long)delay; // used to detect sleep/wake
+		} catch (std::exception &exc) {
+			LOG("unexpected exception polling for traffic: %s",exc.what());
+		} catch ( ... ) {
+			LOG("unexpected exception polling for traffic: (unknown)");
+		}
+	}
+
+	return impl->terminate();
+}
+
+Node::ReasonForTermination Node::init()
+	throw()
+{
+	return _init(true);
+}
+
+unsigned long Node::step()
+	throw()
+{
+	_NodeImpl *impl = (_NodeImpl *)_impl;
+	RuntimeEnvironment *RR = (RuntimeEnvironment *)&(impl->renv);
+
+	if ((!impl->running)||(impl->reasonForTermination != NODE_RUNNING))
+		return ZT_MAX_SERVICE_LOOP_INTERVAL;
+
+	try {
+		RR->sm->poll(0,&_CBztTraffic,RR);
+	} catch (std::exception &exc) {
+		LOG("unexpected exception polling for traffic: %s",exc.what());
+	} catch ( ... ) {
+		LOG("unexpected exception polling for traffic: (unknown)");
+	}
+
+	return _doPeriodicTasks();
+}
+
+Node::ReasonForTermination Node::shutdown()
+	throw()
+{
+	_NodeImpl *impl = (_NodeImpl *)_impl;
+	if (!impl->running)
+		return impl->reasonForTermination;
+	if (impl->reasonForTermination == NODE_RUNNING) {
+		impl->reasonForTerminationStr = "shutdown";
+		impl->reasonForTermination = NODE_NORMAL_TERMINATION;
+	}
+	return impl->terminate();
+}
+
+Node::ReasonForTermination Node::_init(bool synchronous)
+	throw()
+{
+	_NodeImpl *impl = (_NodeImpl *)_impl;
+	RuntimeEnvironment *RR = (RuntimeEnvironment *)&(impl->renv);
+	unsigned int restoredPeers = 0;
+
 	impl->started = true;
 	impl->running = true;
+	RR->synchronous = synchronous;
 
 	try {
+		// Stepped nodes don't log since thousands of them may share one process.
+		if (!synchronous) {
+			// Logging is synchronous unless asyncLog=1 is in local.conf, so no
+			// line is ever dropped. Trace builds log enough to need async. This
+			// runs before NodeConfig exists, so local.conf is read directly.
+#ifdef ZT_TRACE
+			const bool asyncLog = true;
+#else
+			bool asyncLog = false;
+			{
+				std::string localConf;
+				if (Utils::readFile((RR->homePath + ZT_PATH_SEPARATOR_S + "local.conf").c_str(),localConf))
+					asyncLog = (Dictionary(localConf).get("asyncLog",std::string()) == "1");
+			}
+#endif
 #ifdef ZT_LOG_STDOUT
-		RR->log = new Logger((const char *)0,(const char *)0,0);
+			RR->log = new Logger((const char *)0,(const char *)0,0,asyncLog);
 #else
-		RR->log = new Logger((RR->homePath + ZT_PATH_SEPARATOR_S + "node.log").c_str(),(const char *)0,131072);
+			RR->log = new Logger((RR->homePath + ZT_PATH_SEPARATOR_S + "node.log").c_str(),(const char *)0,131072,asyncLog);
 #endif
+		}
 
 		LOG("starting version %s",versionString());
 
 		// Create non-crypto PRNG right away in case other code in init wants to use it
 		RR->prng = new CMWC4096();
 
+		// Metrics are updated from everywhere, so these come next
+		RR->metrics = new Metrics();
+
 		// Read identity public and secret, generating if not present
 		{
 			bool gotId = false;
@@ -374,15 +521,6 @@ Node::ReasonForTermination Node::run()
 			mkdir(networksDotD.c_str(),0700);
 #endif
 		}
-		// Make sure iddb.d exists (used by Topology to remember identities)
-		{
-			std::string iddbDotD(RR->homePath + ZT_PATH_SEPARATOR_S + "iddb.d");
-#ifdef __WINDOWS__
-			CreateDirectoryA(iddbDotD.c_str(),NULL);
-#else
-			mkdir(iddbDotD.c_str(),0700);
-#endif
-		}
 
 		RR->http = new HttpClient();
 		RR->sw = new Switch(RR);
@@ -395,13 +533,45 @@ Node::ReasonForTermination Node::run()
 			return impl->terminateBecause(Node::NODE_UNRECOVERABLE_ERROR,"unable to initialize IPC socket: is ZeroTier One already running?");
 		}
 		RR->node = this;
+		RR->idv = new IdentityValidator(RR,(synchronous) ? 0 : ZT_IDENTITY_VALIDATION_THREADS);
+
+		// Warm restart: pick up peers, keys and paths from our last run if
+		// enabled with persistPeers=1 in local.conf
+		impl->persistPeers = (RR->nc->getLocalConfig("persistPeers") == "1");
+		if (impl->persistPeers) {
+			restoredPeers = RR->topology->loadPeers();
+			if (restoredPeers)
+				LOG("restored %u peers from peer snapshot",restoredPeers);
+		}
+
+		// Periodically write metrics.prom for Prometheus' textfile collector
+		// if enabled with metricsExport=1 in local.conf
+		impl->exportMetrics = (RR->nc->getLocalConfig("metricsExport") == "1");
+
+		// Time packet pipeline stages if enabled with latencyMetrics=1
+		if (RR->nc->getLocalConfig("latencyMetrics") == "1")
+			RR->metrics->enableLatency();
+
+		// Keepalive intervals in ms can be overridden with keepaliveSupernodeInterval,
+		// keepaliveActiveInterval and keepaliveIdleInterval (0 disables that kind)
+		{
+			const std::string sni(RR->nc->getLocalConfig("keepaliveSupernodeInterval"));
+			const std::string aci(RR->nc->getLocalConfig("keepaliveActiveInterval"));
+			const std::string idi(RR->nc->getLocalConfig("keepaliveIdleInterval"));
+			RR->topology->setKeepaliveIntervals(
+				(sni.length()) ? Utils::strToULong(sni.c_str()) : (unsigned long)ZT_KEEPALIVE_SUPERNODE_INTERVAL,
+				(aci.length()) ? Utils::strToULong(aci.c_str()) : (unsigned long)ZT_KEEPALIVE_ACTIVE_INTERVAL,
+				(idi.length()) ? Utils::strToULong(idi.c_str()) : (unsigned long)ZT_KEEPALIVE_IDLE_INTERVAL);
+		}
 
 #ifdef ZT_AUTO_UPDATE
-		if (ZT_DEFAULTS.updateLatestNfoURL.length()) {
-			RR->updater = new SoftwareUpdater(RR);
-			RR->updater->cleanOldUpdates(); // clean out updates.d on startup
-		} else {
-			LOG("WARNING: unable to enable software updates: latest .nfo URL from ZT_DEFAULTS is empty (does this platform actually support software updates?)");
+		if (!synchronous) {
+			if (ZT_DEFAULTS.updateLatestNfoURL.length()) {
+				RR->updater = new SoftwareUpdater(RR);
+				RR->updater->cleanOldUpdates(); // clean out updates.d on startup
+			} else {
+				LOG("WARNING: unable to enable software updates: latest .nfo URL from ZT_DEFAULTS is empty (does this platform actually support software updates?)");
+			}
 		}
 #endif
 
@@ -442,6 +612,35 @@ Node::ReasonForTermination Node::run()
 
 		// Delete peers.persist if it exists -- legacy file, just takes up space
 		Utils::rm(std::string(RR->homePath + ZT_PATH_SEPARATOR_S + "peers.persist").c_str());
+
+		/* Shut down if this file exists but fails to open. This is used on Mac to
+		 * shut down automatically on .app deletion by symlinking this to the
+		 * Info.plist file inside the ZeroTier One application. This causes the
+		 * service to die when the user throws away the app, allowing uninstallation
+		 * in the natural Mac way. */
+		impl->shutdownIfUnreadablePath = RR->homePath + ZT_PATH_SEPARATOR_S + "shutdownIfUnreadable";
+
+		impl->lastNetworkAutoconfCheck = Utils::now() - 5000ULL; // check autoconf again after 5s for startup
+		impl->lastClean = Utils::now(); // don't need to do this immediately
+		impl->lastNetworkFingerprintCheck = 0;
+		impl->lastMulticastCheck = 0;
+		impl->lastSupernodePingCheck = 0;
+		impl->lastBeacon = 0;
+		impl->lastRootTopologyFetch = 0;
+		impl->lastShutdownIfUnreadableCheck = 0;
+		impl->lastPeerSnapshot = Utils::now();
+		impl->lastMetricsExport = 0;
+		impl->metricsPath = RR->homePath + ZT_PATH_SEPARATOR_S + "metrics.prom";
+		impl->lastDelayDelta = 0;
+		impl->keepaliveDelay = ZT_KEEPALIVE_TICK_INTERVAL;
+
+		impl->networkConfigurationFingerprint = 0;
+		if (restoredPeers) {
+			// Start from the current fingerprint so the first check doesn't
+			// resynchronize and throw away the paths we just restored.
+			impl->networkConfigurationFingerprint = RR->routingTable->networkEnvironmentFingerprint(RR->nc->networkTapDeviceNames());
+		}
+		RR->timeOfLastResynchronize = Utils::now();
 	} catch (std::bad_alloc &exc) {
 		return impl->terminateBecause(Node::NODE_UNRECOVERABLE_ERROR,"memory allocation failure");
 	} catch (std::runtime_error &exc) {
@@ -451,222 +650,228 @@ Node::ReasonForTermination Node::run()
 	}
 
 	// Start external service subprocesses, which is only used by special nodes
-	// right now and isn't available on Windows.
+	// right now and isn't available on Windows or in simulation.
 #ifndef __WINDOWS__
-	try {
-		std::string netconfServicePath(RR->homePath + ZT_PATH_SEPARATOR_S + "services.d" + ZT_PATH_SEPARATOR_S + "netconf.service");
-		if (Utils::fileExists(netconfServicePath.c_str())) {
-			LOG("netconf.d/netconf.service appears to exist, starting...");
-			RR->netconfService = new Service(RR,"netconf",netconfServicePath.c_str(),&_netconfServiceMessageHandler,RR);
-			Dictionary initMessage;
-			initMessage["type"] = "netconf-init";
-			initMessage["netconfId"] = RR->identity.toString(true);
-			RR->netconfService->send(initMessage);
+	if (!synchronous) {
+		try {
+			std::string netconfServicePath(RR->homePath + ZT_PATH_SEPARATOR_S + "services.d" + ZT_PATH_SEPARATOR_S + "netconf.service");
+			if (Utils::fileExists(netconfServicePath.c_str())) {
+				LOG("netconf.d/netconf.service appears to exist, starting...");
+				RR->netconfCache = new NetconfCache();
+				RR->netconfService = new Service(RR,"netconf",netconfServicePath.c_str(),&_netconfServiceMessageHandler,RR);
+				Dictionary initMessage;
+				initMessage["type"] = "netconf-init";
+				initMessage["netconfId"] = RR->identity.toString(true);
+				RR->netconfService->send(initMessage);
+			}
+		} catch ( ... ) {
+			LOG("unexpected exception attempting to start services");
 		}
-	} catch ( ... ) {
-		LOG("unexpected exception attempting to start services");
 	}
 #endif
 
-	// Core I/O loop
-	try {
-		/* Shut down if this file exists but fails to open. This is used on Mac to
-		 * shut down automatically on .app deletion by symlinking this to the
-		 * Info.plist file inside the ZeroTier One application. This causes the
-		 * service to die when the user throws away the app, allowing uninstallation
-		 * in the natural Mac way. */
-		std::string shutdownIfUnreadablePath(RR->homePath + ZT_PATH_SEPARATOR_S + "shutdownIfUnreadable");
-
-		uint64_t lastNetworkAutoconfCheck = Utils::now() - 5000ULL; // check autoconf again after 5s for startup
-		uint64_t lastPingCheck = 0;
-		uint64_t lastClean = Utils::now(); // don't need to do this immediately
-		uint64_t lastNetworkFingerprintCheck = 0;
-		uint64_t lastMulticastCheck = 0;
-		uint64_t lastSupernodePingCheck = 0;
-		uint64_t lastBeacon = 0;
-		uint64_t lastRootTopologyFetch = 0;
-		uint64_t lastShutdownIfUnreadableCheck = 0;
-		long lastDelayDelta = 0;
-
-		uint64_t networkConfigurationFingerprint = 0;
-		RR->timeOfLastResynchronize = Utils::now();
+	// We are up and running
+	RR->initialized = true;
+
+	return NODE_RUNNING;
+}
 
-		// We are up and running
-		RR->initialized = true;
+unsigned long Node::_doPeriodicTasks()
+	throw()
+{
+	_NodeImpl *impl = (_NodeImpl *)_impl;
+	RuntimeEnvironment *RR = (RuntimeEnvironment *)&(impl->renv);
 
-		while (impl->reasonForTermination == NODE_RUNNING) {
-			uint64_t now = Utils::now();
-			bool resynchronize = false;
+	try {
+		uint64_t now = Utils::now();
+		bool resynchronize = false;
 
-			/* This is how the service automatically shuts down when the OSX .app is
-			 * thrown in the trash. It's not used on any other platform for now but
-			 * could do similar things. It's disabled on Windows since it doesn't really
-			 * work there. */
+		/* This is how the service automatically shuts down when the OSX .app is
+		 * thrown in the trash. It's not used on any other platform for now but
+		 * could do similar things. It's disabled on Windows since it doesn't really
+		 * work there. */
 #ifdef __UNIX_LIKE__
-			if ((now - lastShutdownIfUnreadableCheck) > 10000) {
-				lastShutdownIfUnreadableCheck = now;
-				if (Utils::fileExists(shutdownIfUnreadablePath.c_str(),false)) {
-					int tmpfd = ::open(shutdownIfUnreadablePath.c_str(),O_RDONLY,0);
-					if (tmpfd < 0) {
-						return impl->terminateBecause(Node::NODE_NORMAL_TERMINATION,"shutdownIfUnreadable exists but is not readable");
-					} else ::close(tmpfd);
-				}
+		if ((now - impl->lastShutdownIfUnreadableCheck) > 10000) {
+			impl->lastShutdownIfUnreadableCheck = now;
+			if (Utils::fileExists(impl->shutdownIfUnreadablePath.c_str(),false)) {
+				int tmpfd = ::open(impl->shutdownIfUnreadablePath.c_str(),O_RDONLY,0);
+				if (tmpfd < 0) {
+					terminate(Node::NODE_NORMAL_TERMINATION,"shutdownIfUnreadable exists but is not readable");
+					return 0;
+				} else ::close(tmpfd);
 			}
+		}
 #endif
 
-			// If it looks like the computer slept and woke, resynchronize.
-			if (lastDelayDelta >= ZT_SLEEP_WAKE_DETECTION_THRESHOLD) {
-				resynchronize = true;
-				LOG("probable suspend/resume detected, pausing a moment for things to settle...");
-				Thread::sleep(ZT_SLEEP_WAKE_SETTLE_TIME);
-			}
-
-			// If our network environment looks like it changed, resynchronize.
-			if ((resynchronize)||((now - lastNetworkFingerprintCheck) >= ZT_NETWORK_FINGERPRINT_CHECK_DELAY)) {
-				lastNetworkFingerprintCheck = now;
-				uint64_t fp = RR->routingTable->networkEnvironmentFingerprint(RR->nc->networkTapDeviceNames());
-				if (fp != networkConfigurationFingerprint) {
-					LOG("netconf fingerprint change: %.16llx != %.16llx, resyncing with network",networkConfigurationFingerprint,fp);
-					networkConfigurationFingerprint = fp;
-					resynchronize = true;
-				}
-			}
-
-			// Supernodes do not resynchronize unless explicitly ordered via SIGHUP.
-			if ((resynchronize)&&(RR->topology->amSupernode()))
-				resynchronize = false;
+		// If it looks like the computer slept and woke, resynchronize.
+		if (impl->lastDelayDelta >= ZT_SLEEP_WAKE_DETECTION_THRESHOLD) {
+			resynchronize = true;
+			LOG("probable suspend/resume detected, pausing a moment for things to settle...");
+			Thread::sleep(ZT_SLEEP_WAKE_SETTLE_TIME);
+		}
 
-			// Check for SIGHUP / force resync.
-			if (impl->resynchronize) {
-				impl->resynchronize = false;
+		// If our network environment looks like it changed, resynchronize.
+		if ((resynchronize)||((now - impl->lastNetworkFingerprintCheck) >= ZT_NETWORK_FINGERPRINT_CHECK_DELAY)) {
+			impl->lastNetworkFingerprintCheck = now;
+			uint64_t fp = RR->routingTable->networkEnvironmentFingerprint(RR->nc->networkTapDeviceNames());
+			if (fp != impl->networkConfigurationFingerprint) {
+				LOG("netconf fingerprint change: %.16llx != %.16llx, resyncing with network",impl->networkConfigurationFingerprint,fp);
+				impl->networkConfigurationFingerprint = fp;
 				resynchronize = true;
-				LOG("resynchronize forced by user, syncing with network");
 			}
+		}
 
-			if (resynchronize) {
-				RR->tcpTunnelingEnabled = false; // turn off TCP tunneling master switch at first, will be reenabled on persistent UDP failure
-				RR->timeOfLastResynchronize = now;
-			}
+		// Supernodes do not resynchronize unless explicitly ordered via SIGHUP.
+		if ((resynchronize)&&(RR->topology->amSupernode()))
+			resynchronize = false;
 
-			/* Supernodes are pinged separately and more aggressively. The
-			 * ZT_STARTUP_AGGRO parameter sets a limit on how rapidly they are
-			 * tried, while PingSupernodesThatNeedPing contains the logic for
-			 * determining if they need PING. */
-			if ((now - lastSupernodePingCheck) >= ZT_STARTUP_AGGRO) {
-				lastSupernodePingCheck = now;
-
-				uint64_t lastReceiveFromAnySupernode = 0; // function object result paramter
-				RR->topology->eachSupernodePeer(Topology::FindMostRecentDirectReceiveTimestamp(lastReceiveFromAnySupernode));
-
-				// Turn on TCP tunneling master switch if we haven't heard anything since before
-				// the last resynchronize and we've been trying long enough.
-				uint64_t tlr = RR->timeOfLastResynchronize;
-				if ((lastReceiveFromAnySupernode < tlr)&&((now - tlr) >= ZT_TCP_TUNNEL_FAILOVER_TIMEOUT)) {
-					TRACE("network still unreachable after %u ms, TCP TUNNELING ENABLED",(unsigned int)ZT_TCP_TUNNEL_FAILOVER_TIMEOUT);
-					RR->tcpTunnelingEnabled = true;
-				}
+		// Check for SIGHUP / force resync.
+		if (impl->resynchronize) {
+			impl->resynchronize = false;
+			resynchronize = true;
+			LOG("resynchronize forced by user, syncing with network");
+		}
+
+		if (resynchronize) {
+			RR->tcpTunnelingEnabled = false; // turn off TCP tunneling master switch at first, will be reenabled on persistent UDP failure
+			RR->timeOfLastResynchronize = now;
+		}
 
-				RR->topology->eachSupernodePeer(Topology::PingSupernodesThatNeedPing(RR,now));
+		/* Supernodes are pinged separately and more aggressively. The
+		 * ZT_STARTUP_AGGRO parameter sets a limit on how rapidly they are
+		 * tried, while PingSupernodesThatNeedPing contains the logic for
+		 * determining if they need PING. */
+		if ((now - impl->lastSupernodePingCheck) >= ZT_STARTUP_AGGRO) {
+			impl->lastSupernodePingCheck = now;
+
+			uint64_t lastReceiveFromAnySupernode = 0; // function object result paramter
+			RR->topology->eachSupernodePeer(Topology::FindMostRecentDirectReceiveTimestamp(lastReceiveFromAnySupernode));
+
+			// Turn on TCP tunneling master switch if we haven't heard anything since before
+			// the last resynchronize and we've been trying long enough.
+			uint64_t tlr = RR->timeOfLastResynchronize;
+			if ((lastReceiveFromAnySupernode < tlr)&&((now - tlr) >= ZT_TCP_TUNNEL_FAILOVER_TIMEOUT)) {
+				TRACE("network still unreachable after %u ms, TCP TUNNELING ENABLED",(unsigned int)ZT_TCP_TUNNEL_FAILOVER_TIMEOUT);
+				RR->tcpTunnelingEnabled = true;
 			}
 
-			if (resynchronize) {
-				/* Send NOP to all peers on resynchronize, directly to supernodes and
-				 * indirectly to regular nodes (to trigger RENDEZVOUS). Also clear
-				 * learned paths since they're likely no longer valid, and close
-				 * TCP sockets since they're also likely invalid. */
-				RR->sm->closeTcpSockets();
-				RR->topology->eachPeer(Topology::ResetActivePeers(RR,now));
-			} else {
-				/* Periodically check for changes in our local multicast subscriptions
-				 * and broadcast those changes to directly connected peers. */
-				if ((now - lastMulticastCheck) >= ZT_MULTICAST_LOCAL_POLL_PERIOD) {
-					lastMulticastCheck = now;
-					try {
-						std::vector< SharedPtr<Network> > networks(RR->nc->networks());
-						for(std::vector< SharedPtr<Network> >::const_iterator nw(networks.begin());nw!=networks.end();++nw)
-							(*nw)->rescanMulticastGroups();
-					} catch (std::exception &exc) {
-						LOG("unexpected exception announcing multicast groups: %s",exc.what());
-					} catch ( ... ) {
-						LOG("unexpected exception announcing multicast groups: (unknown)");
-					}
-				}
+			RR->topology->eachSupernodePeer(Topology::PingSupernodesThatNeedPing(RR,now));
+		}
 
-				/* Periodically ping all our non-stale direct peers unless we're a supernode.
-				 * Supernodes only ping each other (which is done above). */
-				if ((!RR->topology->amSupernode())&&((now - lastPingCheck) >= ZT_PING_CHECK_DELAY)) {
-					lastPingCheck = now;
-					try {
-						RR->topology->eachPeer(Topology::PingPeersThatNeedPing(RR,now));
-					} catch (std::exception &exc) {
-						LOG("unexpected exception running ping check cycle: %s",exc.what());
-					} catch ( ... ) {
-						LOG("unexpected exception running ping check cycle: (unkonwn)");
-					}
+		if (resynchronize) {
+			/* Send NOP to all peers on resynchronize, directly to supernodes and
+			 * indirectly to regular nodes (to trigger RENDEZVOUS). Also clear
+			 * learned paths since they're likely no longer valid, and close
+			 * TCP sockets since they're also likely invalid. */
+			RR->sm->closeTcpSockets();
+			RR->topology->eachPeer(Topology::ResetActivePeers(RR,now));
+		} else {
+			/* Periodically check for changes in our local multicast subscriptions
+			 * and broadcast those changes to directly connected peers. */
+			if ((now - impl->lastMulticastCheck) >= ZT_MULTICAST_LOCAL_POLL_PERIOD) {
+				impl->lastMulticastCheck = now;
+				try {
+					std::vector< SharedPtr<Network> > networks(RR->nc->networks());
+					for(std::vector< SharedPtr<Network> >::const_iterator nw(networks.begin());nw!=networks.end();++nw)
+						(*nw)->rescanMulticastGroups();
+				} catch (std::exception &exc) {
+					LOG("unexpected exception announcing multicast groups: %s",exc.what());
+				} catch ( ... ) {
+					LOG("unexpected exception announcing multicast groups: (unknown)");
 				}
 			}
 
-			// Update network configurations when needed.
-			if ((resynchronize)||((now - lastNetworkAutoconfCheck) >= ZT_NETWORK_AUTOCONF_CHECK_DELAY)) {
-				lastNetworkAutoconfCheck = now;
-				std::vector< SharedPtr<Network> > nets(RR->nc->networks());
-				for(std::vector< SharedPtr<Network> >::iterator n(nets.begin());n!=nets.end();++n) {
-					if ((now - (*n)->lastConfigUpdate()) >= ZT_NETWORK_AUTOCONF_DELAY)
-						(*n)->requestConfiguration();
-				}
+			/* Send keepalives that are due. The scheduler spreads these out
+			 * and caps how many go out per run. Supernodes only ping each
+			 * other. */
+			try {
+				impl->keepaliveDelay = RR->topology->doKeepalives(now);
+			} catch (std::exception &exc) {
+				LOG("unexpected exception sending keepalives: %s",exc.what());
+			} catch ( ... ) {
+				LOG("unexpected exception sending keepalives: (unknown)");
 			}
+		}
 
-			// Do periodic tasks in submodules.
-			if ((now - lastClean) >= ZT_DB_CLEAN_PERIOD) {
-				lastClean = now;
-				RR->topology->clean(now);
-				RR->mc->clean(now);
-				RR->nc->clean();
-				if (RR->updater)
-					RR->updater->checkIfMaxIntervalExceeded(now);
+		// Update network configurations when needed.
+		if ((resynchronize)||((now - impl->lastNetworkAutoconfCheck) >= ZT_NETWORK_AUTOCONF_CHECK_DELAY)) {
+			impl->lastNetworkAutoconfCheck = now;
+			std::vector< SharedPtr<Network> > nets(RR->nc->networks());
+			for(std::vector< SharedPtr<Network> >::iterator n(nets.begin());n!=nets.end();++n) {
+				if ((now - (*n)->lastConfigUpdate()) >= ZT_NETWORK_AUTOCONF_DELAY)
+					(*n)->requestConfiguration();
 			}
+		}
 
-			// Send beacons to physical local LANs
-			if ((resynchronize)||((now - lastBeacon) >= ZT_BEACON_INTERVAL)) {
-				lastBeacon = now;
-				char bcn[ZT_PROTO_BEACON_LENGTH];
-				void *bcnptr = bcn;
-				*((uint32_t *)(bcnptr)) = RR->prng->next32();
-				bcnptr = bcn + 4;
-				*((uint32_t *)(bcnptr)) = RR->prng->next32();
-				RR->identity.address().copyTo(bcn + ZT_PROTO_BEACON_IDX_ADDRESS,ZT_ADDRESS_LENGTH);
-				TRACE("sending LAN beacon to %s",ZT_DEFAULTS.v4Broadcast.toString().c_str());
-				RR->antiRec->logOutgoingZT(bcn,ZT_PROTO_BEACON_LENGTH);
-				RR->sm->send(ZT_DEFAULTS.v4Broadcast,false,false,bcn,ZT_PROTO_BEACON_LENGTH);
-			}
+		// Do periodic tasks in submodules.
+		if ((now - impl->lastClean) >= ZT_DB_CLEAN_PERIOD) {
+			impl->lastClean = now;
+			RR->topology->clean(now);
+			RR->mc->clean(now);
+			RR->nc->clean();
+			if (RR->updater)
+				RR->updater->checkIfMaxIntervalExceeded(now);
+		}
 
-			// Check for updates to root topology (supernodes) periodically
-			if ((now - lastRootTopologyFetch) >= ZT_UPDATE_ROOT_TOPOLOGY_CHECK_INTERVAL) {
-				lastRootTopologyFetch = now;
-				if (!impl->disableRootTopologyUpdates) {
-					TRACE("fetching root topology from %s",ZT_DEFAULTS.rootTopologyUpdateURL.c_str());
-					RR->http->GET(ZT_DEFAULTS.rootTopologyUpdateURL,HttpClient::NO_HEADERS,60,&_cbHandleGetRootTopology,RR);
-				}
-			}
+		// Periodically snapshot peer state so a crash still restarts warm.
+		if ((impl->persistPeers)&&((now - impl->lastPeerSnapshot) >= ZT_PEER_SNAPSHOT_INTERVAL)) {
+			impl->lastPeerSnapshot = now;
+			if (!RR->topology->savePeers())
+				LOG("WARNING: unable to write peer snapshot");
+		}
 
-			// Sleep for loop interval or until something interesting happens.
-			try {
-				unsigned long delay = std::min((unsigned long)ZT_MAX_SERVICE_LOOP_INTERVAL,RR->sw->doTimerTasks());
-				uint64_t start = Utils::now();
-				RR->sm->poll(delay,&_CBztTraffic,RR);
-				lastDelayDelta = (long)(Utils::now() - start) - (long)delay; // used to detect sleep/wake
-			} catch (std::exception &exc) {
-				LOG("unexpected exception running Switch doTimerTasks: %s",exc.what());
-			} catch ( ... ) {
-				LOG("unexpected exception running Switch doTimerTasks: (unknown)");
+		// Write metrics to a temporary file and rename it into place so
+		// readers never see a partial file.
+		if ((impl->exportMetrics)&&((now - impl->lastMetricsExport) >= ZT_METRICS_EXPORT_INTERVAL)) {
+			impl->lastMetricsExport = now;
+			std::string tmpPath(impl->metricsPath + ".tmp");
+			if (Utils::writeFile(tmpPath.c_str(),RR->metrics->toPrometheus(RR))) {
+#ifdef __WINDOWS__
+				Utils::rm(impl->metricsPath);
+#endif
+				if (::rename(tmpPath.c_str(),impl->metricsPath.c_str()))
+					LOG("WARNING: unable to write %s",impl->metricsPath.c_str());
+			} else LOG("WARNING: unable to write %s",tmpPath.c_str());
+		}
+
+		// Send beacons to physical local LANs
+		if ((resynchronize)||((now - impl->lastBeacon) >= ZT_BEACON_INTERVAL)) {
+			impl->lastBeacon = now;
+			char bcn[ZT_PROTO_BEACON_LENGTH];
+			void *bcnptr = bcn;
+			*((uint32_t *)(bcnptr)) = RR->prng->next32();
+			bcnptr = bcn + 4;
+			*((uint32_t *)(bcnptr)) = RR->prng->next32();
+			RR->identity.address().copyTo(bcn + ZT_PROTO_BEACON_IDX_ADDRESS,ZT_ADDRESS_LENGTH);
+			TRACE("sending LAN beacon to %s",ZT_DEFAULTS.v4Broadcast.toString().c_str());
+			RR->antiRec->logOutgoingZT(bcn,ZT_PROTO_BEACON_LENGTH);
+			RR->metrics->wireSent(ZT_PROTO_BEACON_LENGTH,RR->sm->send(ZT_DEFAULTS.v4Broadcast,false,false,bcn,ZT_PROTO_BEACON_LENGTH));
+		}
+
+		// Check for updates to root topology (supernodes) periodically
+		if ((now - impl->lastRootTopologyFetch) >= ZT_UPDATE_ROOT_TOPOLOGY_CHECK_INTERVAL) {
+			impl->lastRootTopologyFetch = now;
+			if (!impl->disableRootTopologyUpdates) {
+				TRACE("fetching root topology from %s",ZT_DEFAULTS.rootTopologyUpdateURL.c_str());
+				RR->http->GET(ZT_DEFAULTS.rootTopologyUpdateURL,HttpClient::NO_HEADERS,60,&_cbHandleGetRootTopology,RR);
 			}
 		}
+
+		// Run Switch timers and see how long we can wait before coming back
+		try {
+			return std::min(std::min((unsigned long)ZT_MAX_SERVICE_LOOP_INTERVAL,impl->keepaliveDelay),RR->sw->doTimerTasks());
+		} catch (std::exception &exc) {
+			LOG("unexpected exception running Switch doTimerTasks: %s",exc.what());
+		} catch ( ... ) {
+			LOG("unexpected exception running Switch doTimerTasks: (unknown)");
+		}
 	} catch ( ... ) {
 		LOG("FATAL: unexpected exception in core loop: unknown exception");
-		return impl->terminateBecause(Node::NODE_UNRECOVERABLE_ERROR,"unexpected exception during outer main I/O loop");
+		terminate(Node::NODE_UNRECOVERABLE_ERROR,"unexpected exception during outer main I/O loop");
+		return 0;
 	}
 
-	return impl->terminate();
+	return ZT_MAX_SERVICE_LOOP_INTERVAL;
 }
 
 const char *Node::terminationMessage() const
@@ -704,7 +909,7 @@ bool Node::online()
 	std::vector< SharedPtr<Peer> > snp(RR->topology->supernodePeers());
 	for(std::vector< SharedPtr<Peer> >::const_iterator sn(snp.begin());sn!=snp.end();++sn) {
 		uint64_t lastRec = (*sn)->lastDirectReceive();
-		if ((lastRec)&&(lastRec > since)&&((now - lastRec) < ZT_PEER_PATH_ACTIVITY_TIMEOUT))
+		if ((lastRec)&&(lastRec >= since)&&((now - lastRec) < ZT_PEER_PATH_ACTIVITY_TIMEOUT))
 			return true;
 	}
 	return false;
@@ -804,6 +1009,37 @@ void Node::status(ZT1_Node_Status *status)
 		status->directLinkSuccessRate = (float)dlsr;
 	} else status->directLinkSuccessRate = 1.0f; // no connections to no active peers == 100% success at nothing
 
+	const CompressionPolicy::Stats cs(RR->sw->compressionPolicy().stats());
+	status->framesCompressed = cs.packetsCompressed;
+	status->framesIncompressible = cs.packetsIncompressible;
+	status->framesCompressionSkipped = cs.packetsSkipped;
+	status->compressionBytesSaved = cs.bytesSaved;
+	status->compressionBytesSkipped = cs.bytesSkipped;
+
+	const KeepaliveScheduler::Stats ks(RR->topology->keepaliveStats());
+	status->keepalivesSent = ks.pingsSent;
+	status->keepalivePeakPerSecond = ks.peakPingsPerSecond;
+	for(unsigned int i=0;((i<ZT1_NODE_KEEPALIVE_HISTOGRAM_BUCKETS)&&(i<ZT_KEEPALIVE_HISTOGRAM_BUCKETS));++i)
+		status->keepalivesPerSecondHistogram[i] = ks.pingsPerSecondHistogram[i];
+
+	status->latencyEnabled = RR->metrics->latencyEnabled();
+	if (status->latencyEnabled) {
+		for(unsigned int i=0;((i<ZT1_NODE_LATENCY_STAGES)&&(i<(unsigned int)Metrics::STAGE__COUNT));++i) {
+			const Metrics::LatencySummary ls(RR->metrics->latencySummary((Metrics::Stage)i));
+			Utils::scopy(status->latency[i].name,sizeof(status->latency[i].name),Metrics::stageName((Metrics::Stage)i));
+			status->latency[i].count = ls.count;
+			status->latency[i].p50 = (unsigned long)ls.p50;
+			status->latency[i].p99 = (unsigned long)ls.p99;
+			status->latency[i].p999 = (unsigned long)ls.p999;
+			status->latency[i].max = (unsigned long)ls.max;
+		}
+	}
+
+	for(unsigned int v=0;((v<ZT1_NODE_VERBS)&&(v<ZT_METRICS_VERBS));++v) {
+		status->packetsSentByVerb[v] = RR->metrics->verbSent(v);
+		status->packetsReceivedByVerb[v] = RR->metrics->verbReceived(v);
+	}
+
 	status->online = online();
 	status->running = impl->running;
 	status->initialized = true;
@@ -987,7 +1223,7 @@ ZT1_Node_NetworkList *Node::listNetworks()
 		_fillNetworkQueryResultBuffer(networks[i],nconfs[i],nbuf);
 
 		nbuf->ips = (ZT1_Node_PhysicalAddress *)buf;
-		buf += sizeof(ZT1_Node_PhysicalAddress);
+		buf += sizeof(ZT1_Node_PhysicalAddress) * ipsv[i].size();
 
 		nbuf->numIps = 0;
 		for(std::set<InetAddress>::iterator ip(ipsv[i].begin());ip!=ipsv[i].end();++ip) {
@@ -1007,6 +1243,27 @@ ZT1_Node_NetworkList *Node::listNetworks()
 	return nl;
 }
 
+char *Node::metrics()
+	throw()
+{
+	_NodeImpl *impl = (_NodeImpl *)_impl;
+	RuntimeEnvironment *RR = (RuntimeEnvironment *)&(impl->renv);
+
+	if ((!RR)||(!RR->initialized))
+		return (char *)0;
+
+	try {
+		const std::string m(RR->metrics->toPrometheus(RR));
+		char *buf = (char *)::malloc(m.length() + 1);
+		if (!buf)
+			return (char *)0;
+		memcpy(buf,m.c_str(),m.length() + 1);
+		return buf;
+	} catch ( ... ) {
+		return (char *)0;
+	}
+}
+
 void Node::freeQueryResult(void *qr)
 	throw()
 {
@@ -108,6 +108,35 @@ public:
 	ReasonForTermination run()
 		throw();
 
+	/**
+	 * Initialize node to be driven by step() instead of run()
+	 *
+	 * This is for discrete-event simulation. A stepped node starts no threads
+	 * of its own: there is no logging, identities are validated inline, taps
+	 * are opened inline, and no service subprocesses are launched. Its socket
+	 * manager's poll() must not block when given a timeout of zero.
+	 *
+	 * @return NODE_RUNNING on success or reason initialization failed
+	 */
+	ReasonForTermination init()
+		throw();
+
+	/**
+	 * Handle waiting packets and run any periodic tasks that are due
+	 *
+	 * @return Milliseconds until step() should be called again if nothing arrives first
+	 */
+	unsigned long step()
+		throw();
+
+	/**
+	 * Tear down a node started with init()
+	 *
+	 * @return Reason for termination
+	 */
+	ReasonForTermination shutdown()
+		throw();
+
 	/**
 	 * Obtain a human-readable reason for node termination
 	 *
@@ -141,13 +170,13 @@ public:
 		throw();
 
 	/**
-	 * @return True if run() has been called
+	 * @return True if run() or init() has been called
 	 */
 	bool started()
 		throw();
 
 	/**
-	 * @return True if run() has not yet returned
+	 * @return True if run() has not yet returned or node has not been shut down
 	 */
 	bool running()
 		throw();
@@ -210,6 +239,12 @@ public:
 	ZT1_Node_NetworkList *listNetworks()
 		throw();
 
+	/**
+	 * @return Counters, gauges and histograms in Prometheus text format (free with freeQueryResult()) or NULL on failure
+	 */
+	char *metrics()
+		throw();
+
 	/**
 	 * Free a query result buffer
 	 *
@@ -236,6 +271,11 @@ private:
 	Node(const Node&);
 	const Node& operator=(const Node&);
 
+	ReasonForTermination _init(bool synchronous)
+		throw();
+	unsigned long _doPeriodicTasks()
+		throw();
+
 	void *const _impl; // private implementation
 };
 
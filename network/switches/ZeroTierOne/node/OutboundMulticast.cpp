@@ -34,6 +34,10 @@
 #include "CertificateOfMembership.hpp"
 #include "Utils.hpp"
 #include "Logger.hpp"
+#include "Topology.hpp"
+#include "Peer.hpp"
+#include "AntiRecursion.hpp"
+#include "Metrics.hpp"
 
 namespace ZeroTier {
 
@@ -102,19 +106,80 @@ void OutboundMulticast::init(
 	} else _haveCom = false;
 }
 
-void OutboundMulticast::sendOnly(const RuntimeEnvironment *RR,const Address &toAddr)
+MulticastFanoutBatch::MulticastFanoutBatch() :
+	_count(0)
 {
+}
+
+MulticastFanoutBatch::~MulticastFanoutBatch()
+{
+}
+
+bool MulticastFanoutBatch::add(const RuntimeEnvironment *RR,const Packet &packet,const Address &toAddr,uint64_t now)
+{
+	if (packet.size() > ZT_UDP_DEFAULT_PAYLOAD_MTU)
+		return false; // needs fragmentation, let Switch handle it
+
+	SharedPtr<Peer> peer(RR->topology->getPeer(toAddr));
+	if ((!peer)||(!peer->hasActiveDirectPath(now)))
+		return false;
+
+	InetAddress udpAddr;
+	if (!peer->getBestUdpSendPath(RR,now,udpAddr))
+		return false;
+
+	if (_count >= ZT_MULTICAST_FANOUT_BATCH_SIZE)
+		flush(RR,now);
+
+	RR->metrics->sent(packet.verb());
+	packet.armorCopy(peer->key(),true,toAddr,_buf[_count]);
+	SocketManager::UdpBatchEntry &e = _entries[_count];
+	e.to = udpAddr;
+	e.msg = _buf[_count];
+	e.msglen = packet.size();
+	e.ok = false;
+	_peers[_count] = peer;
+	++_count;
+
+	return true;
+}
+
+void MulticastFanoutBatch::flush(const RuntimeEnvironment *RR,uint64_t now)
+{
+	if (!_count)
+		return;
+
+	for(unsigned int i=0;i<_count;++i)
+		RR->antiRec->logOutgoingZT(_entries[i].msg,_entries[i].msglen);
+
+	RR->sm->sendUdpBatch(_entries,_count);
+
+	for(unsigned int i=0;i<_count;++i) {
+		if (RR->metrics->wireSent(_entries[i].msglen,_entries[i].ok))
+			_peers[i]->sentViaUdp(_entries[i].to,now);
+		_peers[i].zero();
+	}
+	_count = 0;
+}
+
+void OutboundMulticast::sendOnly(const RuntimeEnvironment *RR,const Address &toAddr,MulticastFanoutBatch *batch)
+{
+	const uint64_t now = Utils::now();
 	if (_haveCom) {
 		SharedPtr<Network> network(RR->nc->network(_nwid));
-		if (network->peerNeedsOurMembershipCertificate(toAddr,Utils::now())) {
+		if (network->peerNeedsOurMembershipCertificate(toAddr,now)) {
+			//TRACE(">>MC %.16llx -> %s (with COM)",(unsigned long long)this,toAddr.toString().c_str());
+			if ((batch)&&(batch->add(RR,_packetWithCom,toAddr,now)))
+				return;
 			_packetWithCom.newInitializationVector();
 			_packetWithCom.setDestination(toAddr);
-			//TRACE(">>MC %.16llx -> %s (with COM)",(unsigned long long)this,toAddr.toString().c_str());
 			RR->sw->send(_packetWithCom,true);
 			return;
 		}
 	}
 	//TRACE(">>MC %.16llx -> %s (without COM)",(unsigned long long)this,toAddr.toString().c_str());
+	if ((batch)&&(batch->add(RR,_packetNoCom,toAddr,now)))
+		return;
 	_packetNoCom.newInitializationVector();
 	_packetNoCom.setDestination(toAddr);
 	RR->sw->send(_packetNoCom,true);
@@ -38,11 +38,67 @@
 #include "MulticastGroup.hpp"
 #include "Address.hpp"
 #include "Packet.hpp"
+#include "InetAddress.hpp"
+#include "SharedPtr.hpp"
+#include "SocketManager.hpp"
+#include "NonCopyable.hpp"
 
 namespace ZeroTier {
 
 class CertificateOfMembership;
 class RuntimeEnvironment;
+class Peer;
+
+/**
+ * Batch of armored multicast packets awaiting a single UDP send call
+ *
+ * Sending one multicast to many recipients means encrypting and MACing the
+ * same compressed payload once per recipient. Rather than copying the
+ * template packet and going through Switch for each, recipients with a
+ * direct UDP path get the packet armored straight into a slot here. Slots
+ * are then handed to the SocketManager together with sendUdpBatch().
+ *
+ * This object isn't guarded by a mutex; caller must synchronize access.
+ */
+class MulticastFanoutBatch : NonCopyable
+{
+public:
+	MulticastFanoutBatch();
+	~MulticastFanoutBatch();
+
+	/**
+	 * Armor a packet for a recipient into the next slot in this batch
+	 *
+	 * This flushes the batch first if it's full. If this returns false the
+	 * caller must send the packet some other way, e.g. via Switch.
+	 *
+	 * @param RR Runtime environment
+	 * @param packet Template packet (not modified)
+	 * @param toAddr Destination address
+	 * @param now Current time
+	 * @return True if packet was added, false if recipient has no direct UDP path or packet is too big
+	 */
+	bool add(const RuntimeEnvironment *RR,const Packet &packet,const Address &toAddr,uint64_t now);
+
+	/**
+	 * Send all packets in this batch and empty it
+	 *
+	 * @param RR Runtime environment
+	 * @param now Current time
+	 */
+	void flush(const RuntimeEnvironment *RR,uint64_t now);
+
+	/**
+	 * @return Number of packets waiting to be sent
+	 */
+	inline unsigned int count() const throw() { return _count; }
+
+private:
+	unsigned char _buf[ZT_MULTICAST_FANOUT_BATCH_SIZE][ZT_UDP_DEFAULT_PAYLOAD_MTU];
+	SocketManager::UdpBatchEntry _entries[ZT_MULTICAST_FANOUT_BATCH_SIZE];
+	SharedPtr<Peer> _peers[ZT_MULTICAST_FANOUT_BATCH_SIZE];
+	unsigned int _count;
+};
 
 /**
  * An outbound multicast packet
@@ -109,19 +165,21 @@ public:
 	 *
 	 * @param RR Runtime environment
 	 * @param toAddr Destination address
+	 * @param batch Batch to add to if possible (caller must flush), or NULL to send via Switch
 	 */
-	void sendOnly(const RuntimeEnvironment *RR,const Address &toAddr);
+	void sendOnly(const RuntimeEnvironment *RR,const Address &toAddr,MulticastFanoutBatch *batch = (MulticastFanoutBatch *)0);
 
 	/**
 	 * Just send and log but do not check sent log
 	 *
 	 * @param RR Runtime environment
 	 * @param toAddr Destination address
+	 * @param batch Batch to add to if possible (caller must flush), or NULL to send via Switch
 	 */
-	inline void sendAndLog(const RuntimeEnvironment *RR,const Address &toAddr)
+	inline void sendAndLog(const RuntimeEnvironment *RR,const Address &toAddr,MulticastFanoutBatch *batch = (MulticastFanoutBatch *)0)
 	{
 		_alreadySentTo.push_back(toAddr);
-		sendOnly(RR,toAddr);
+		sendOnly(RR,toAddr,batch);
 	}
 
 	/**
@@ -129,15 +187,16 @@ public:
 	 *
 	 * @param RR Runtime environment
 	 * @param toAddr Destination address
+	 * @param batch Batch to add to if possible (caller must flush), or NULL to send via Switch
 	 * @return True if address is new and packet was sent to switch, false if duplicate
 	 */
-	inline bool sendIfNew(const RuntimeEnvironment *RR,const Address &toAddr)
+	inline bool sendIfNew(const RuntimeEnvironment *RR,const Address &toAddr,MulticastFanoutBatch *batch = (MulticastFanoutBatch *)0)
 	{
 		for(std::vector<Address>::iterator a(_alreadySentTo.begin());a!=_alreadySentTo.end();++a) {
 			if (*a == toAddr)
 				return false;
 		}
-		sendAndLog(RR,toAddr);
+		sendAndLog(RR,toAddr,batch);
 		return true;
 	}
 
@@ -705,14 +705,17 @@ public:
 		 *
 		 * OK response payload:
 		 *   <[8] 64-bit network ID>
-		 *   <[2] 16-bit length of network configuration dictionary>
-		 *   <[...] network configuration dictionary>
+		 *   <[2] 16-bit length of network configuration>
+		 *   <[...] network configuration>
 		 *
 		 * OK returns a Dictionary (string serialized) containing the network's
 		 * configuration and IP address assignment information for the querying
 		 * node. It also contains a membership certificate that the querying
 		 * node can push to other peers to demonstrate its right to speak on
-		 * a given network.
+		 * a given network. If the request meta-data contains the key in
+		 * ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_BINARY, the configuration may
+		 * instead be in the binary form described in NetworkConfig.hpp, which
+		 * begins with a zero byte.
 		 *
 		 * ERROR response payload:
 		 *   <[8] 64-bit network ID>
@@ -1043,11 +1046,7 @@ public:
 	inline void setCipher(unsigned int c)
 	{
 		unsigned char &b = (*this)[ZT_PACKET_IDX_FLAGS];
-		b = (b & 0xc7) | (unsigned char)((c << 3) & 0x38);
-		// Set both the new cipher suite spec field and the old DEPRECATED "encrypted" flag as long as there's <1.0.0 peers online
-		if (c == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012)
-			b |= 0x80;
-		else b &= 0x7f;
+		b = _cipherFlags(b,c);
 	}
 
 	/**
@@ -1116,6 +1115,47 @@ public:
 		memcpy(field(ZT_PACKET_IDX_MAC,8),mac,8);
 	}
 
+	/**
+	 * Armor a copy of this packet for a given recipient into a separate buffer
+	 *
+	 * The header is copied with a new IV and the given destination, and the
+	 * payload is then encrypted (or just copied if not encrypting) straight
+	 * from this packet into the output buffer. This lets one composed and
+	 * compressed packet serve as a read-only template for many recipients,
+	 * with only the per-recipient key operations done for each. The copy is
+	 * never flagged as fragmented, so this must only be used for packets that
+	 * fit in a single datagram.
+	 *
+	 * @param key 32-byte key of recipient
+	 * @param encryptPayload If true, encrypt packet payload, else just MAC
+	 * @param dest Destination address to set in copy
+	 * @param out Output buffer, must have room for at least size() bytes
+	 */
+	inline void armorCopy(const void *key,bool encryptPayload,const Address &dest,void *out) const
+	{
+		unsigned char mangledKey[32];
+		unsigned char macKey[32];
+		unsigned char mac[16];
+		unsigned char *const o = (unsigned char *)out;
+		const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
+
+		memcpy(o,data(),ZT_PACKET_IDX_VERB);
+		Utils::getSecureRandom(o + ZT_PACKET_IDX_IV,8);
+		dest.copyTo(o + ZT_PACKET_IDX_DEST,ZT_ADDRESS_LENGTH);
+		o[ZT_PACKET_IDX_FLAGS] = _cipherFlags((unsigned char)(o[ZT_PACKET_IDX_FLAGS] & ~ZT_PROTO_FLAG_FRAGMENTED),encryptPayload ? ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012 : ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE);
+
+		_salsa20MangleKey((const unsigned char *)key,mangledKey,o,size());
+		Salsa20 s20(mangledKey,256,o + ZT_PACKET_IDX_IV,ZT_PROTO_SALSA20_ROUNDS);
+		s20.encrypt(ZERO_KEY,macKey,sizeof(macKey));
+
+		if (encryptPayload)
+			s20.encrypt(field(ZT_PACKET_IDX_VERB,payloadLen),o + ZT_PACKET_IDX_VERB,payloadLen);
+		else memcpy(o + ZT_PACKET_IDX_VERB,field(ZT_PACKET_IDX_VERB,payloadLen),payloadLen);
+
+		Poly1305::compute(mac,o + ZT_PACKET_IDX_VERB,payloadLen,macKey);
+		memcpy(o + ZT_PACKET_IDX_MAC,mac,8);
+	}
+
 	/**
 	 * Verify and (if encrypted) decrypt packet
 	 *
@@ -1156,15 +1196,23 @@ public:
 	 * set. The compressed flag in the verb is set if compression successfully
 	 * results in a size reduction. If no size reduction occurs, compression
 	 * is not done and the flag is left cleared.
+	 *
+	 * Output is limited to less than the original size, so LZ4 gives up as
+	 * soon as it's clear there will be no gain.
 	 * 
+	 * @param acceleration LZ4 acceleration (1 is default, higher is faster but compresses less)
+	 * @param lz4State LZ4 state of at least LZ4_sizeofState() bytes aligned to 4 bytes, or NULL to use stack
 	 * @return True if compression occurred
 	 */
-	inline bool compress()
+	inline bool compress(int acceleration = 1,void *lz4State = (void *)0)
 	{
-		unsigned char buf[ZT_PROTO_MAX_PACKET_LENGTH * 2];
+		unsigned char buf[ZT_PROTO_MAX_PACKET_LENGTH];
 		if ((!compressed())&&(size() > (ZT_PACKET_IDX_PAYLOAD + 32))) {
 			int pl = (int)(size() - ZT_PACKET_IDX_PAYLOAD);
-			int cl = LZ4_compress((const char *)field(ZT_PACKET_IDX_PAYLOAD,(unsigned int)pl),(char *)buf,pl);
+			int cl;
+			if (lz4State)
+				cl = LZ4_compress_fast_extState(lz4State,(const char *)field(ZT_PACKET_IDX_PAYLOAD,(unsigned int)pl),(char *)buf,pl,pl - 1,acceleration);
+			else cl = LZ4_compress_fast((const char *)field(ZT_PACKET_IDX_PAYLOAD,(unsigned int)pl),(char *)buf,pl,pl - 1,acceleration);
 			if ((cl > 0)&&(cl < pl)) {
 				(*this)[ZT_PACKET_IDX_VERB] |= (char)ZT_PROTO_VERB_FLAG_COMPRESSED;
 				setSize((unsigned int)cl + ZT_PACKET_IDX_PAYLOAD);
@@ -1204,6 +1252,16 @@ public:
 private:
 	static const unsigned char ZERO_KEY[32];
 
+	static inline unsigned char _cipherFlags(unsigned char b,unsigned int c)
+	{
+		b = (b & 0xc7) | (unsigned char)((c << 3) & 0x38);
+		// Set both the new cipher suite spec field and the old DEPRECATED "encrypted" flag as long as there's <1.0.0 peers online
+		if (c == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012)
+			b |= 0x80;
+		else b &= 0x7f;
+		return b;
+	}
+
 	/**
 	 * Deterministically mangle a 256-bit crypto key based on packet
 	 *
@@ -1217,8 +1275,10 @@ private:
 	 */
 	inline void _salsa20MangleKey(const unsigned char *in,unsigned char *out) const
 	{
-		const unsigned char *d = (const unsigned char *)data();
-
+		_salsa20MangleKey(in,out,(const unsigned char *)data(),size());
+	}
+	static inline void _salsa20MangleKey(const unsigned char *in,unsigned char *out,const unsigned char *d,unsigned int size)
+	{
 		// IV and source/destination addresses. Using the addresses divides the
 		// key space into two halves-- A->B and B->A (since order will change).
 		for(unsigned int i=0;i<18;++i) // 8 + (ZT_ADDRESS_LENGTH * 2) == 18
@@ -1231,8 +1291,8 @@ private:
 
 		// Raw packet size in bytes -- thus each packet size defines a new
 		// key space.
-		out[19] = in[19] ^ (unsigned char)(size() & 0xff);
-		out[20] = in[20] ^ (unsigned char)((size() >> 8) & 0xff); // little endian
+		out[19] = in[19] ^ (unsigned char)(size & 0xff);
+		out[20] = in[20] ^ (unsigned char)((size >> 8) & 0xff); // little endian
 
 		// Rest of raw key is used unchanged
 		for(unsigned int i=21;i<32;++i)
@@ -37,6 +37,7 @@
 #include "Constants.hpp"
 #include "InetAddress.hpp"
 #include "Utils.hpp"
+#include "Buffer.hpp"
 
 namespace ZeroTier {
 
@@ -61,6 +62,8 @@ public:
 		_lastSend(0),
 		_lastReceived(0),
 		_lastPing(0),
+		_packetsSent(0),
+		_packetsReceived(0),
 		_addr(),
 		_type(PATH_TYPE_NULL),
 		_fixed(false) {}
@@ -74,6 +77,8 @@ public:
 		_lastSend(0),
 		_lastReceived(0),
 		_lastPing(0),
+		_packetsSent(0),
+		_packetsReceived(0),
 		_addr(addr),
 		_type(t),
 		_fixed(fixed) {}
@@ -83,6 +88,8 @@ public:
 		_lastSend = 0;
 		_lastReceived = 0;
 		_lastPing = 0;
+		_packetsSent = 0;
+		_packetsReceived = 0;
 		_addr = addr;
 		_type = t;
 		_fixed = fixed;
@@ -104,11 +111,14 @@ public:
 	inline uint64_t lastReceived() const throw() { return _lastReceived; }
 	inline uint64_t lastPing() const throw() { return _lastPing; }
 
+	inline uint64_t packetsSent() const throw() { return _packetsSent; }
+	inline uint64_t packetsReceived() const throw() { return _packetsReceived; }
+
 	inline bool fixed() const throw() { return _fixed; }
 	inline void setFixed(bool f) throw() { _fixed = f; }
 
-	inline void sent(uint64_t t) throw() { _lastSend = t; }
-	inline void received(uint64_t t) throw() { _lastReceived = t; }
+	inline void sent(uint64_t t) throw() { _lastSend = t; ++_packetsSent; }
+	inline void received(uint64_t t) throw() { _lastReceived = t; ++_packetsReceived; }
 	inline void pinged(uint64_t t) throw() { _lastPing = t; }
 
 	/**
@@ -146,6 +156,70 @@ public:
 		return std::string(tmp);
 	}
 
+	/**
+	 * Serialize this path, including timestamps
+	 *
+	 * @param b Buffer to append to
+	 * @throws std::out_of_range Buffer too small
+	 */
+	template<unsigned int C>
+	inline void serialize(Buffer<C> &b) const
+	{
+		b.append((uint64_t)_lastSend);
+		b.append((uint64_t)_lastReceived);
+		b.append((uint64_t)_lastPing);
+		b.append((unsigned char)_type);
+		b.append((unsigned char)((_fixed) ? 1 : 0));
+		if (_addr.isV4()) {
+			b.append((unsigned char)4);
+			b.append(_addr.rawIpData(),4);
+		} else if (_addr.isV6()) {
+			b.append((unsigned char)6);
+			b.append(_addr.rawIpData(),16);
+		} else b.append((unsigned char)0);
+		b.append((uint16_t)_addr.port());
+	}
+
+	/**
+	 * Deserialize a path written by serialize()
+	 *
+	 * @param b Buffer to read from
+	 * @param startAt Index within buffer of serialized path
+	 * @return Length of serialized data read from buffer
+	 * @throws std::out_of_range Buffer too short
+	 * @throws std::invalid_argument Serialized data invalid
+	 */
+	template<unsigned int C>
+	inline unsigned int deserialize(const Buffer<C> &b,unsigned int startAt = 0)
+	{
+		unsigned int p = startAt;
+		_lastSend = b.template at<uint64_t>(p); p += 8;
+		_lastReceived = b.template at<uint64_t>(p); p += 8;
+		_lastPing = b.template at<uint64_t>(p); p += 8;
+		_packetsSent = 0;
+		_packetsReceived = 0;
+		switch(b[p++]) {
+			case PATH_TYPE_UDP: _type = PATH_TYPE_UDP; break;
+			case PATH_TYPE_TCP_OUT: _type = PATH_TYPE_TCP_OUT; break;
+			case PATH_TYPE_TCP_IN: _type = PATH_TYPE_TCP_IN; break;
+			default: throw std::invalid_argument("invalid path type");
+		}
+		_fixed = (b[p++] != 0);
+		switch(b[p++]) {
+			case 4: {
+				const unsigned char *ip = b.field(p,4); p += 4;
+				_addr.set(ip,4,b.template at<uint16_t>(p)); p += 2;
+			}	break;
+			case 6: {
+				const unsigned char *ip = b.field(p,16); p += 16;
+				_addr.set(ip,16,b.template at<uint16_t>(p)); p += 2;
+			}	break;
+			default:
+				throw std::invalid_argument("invalid path address");
+		}
+		return (p - startAt);
+	}
+
 	inline bool operator==(const Path &p) const throw() { return ((_addr == p._addr)&&(_type == p._type)); }
 	inline bool operator!=(const Path &p) const throw() { return ((_addr != p._addr)||(_type != p._type)); }
 	inline bool operator<(const Path &p) const
@@ -163,6 +237,8 @@ private:
 	volatile uint64_t _lastSend;
 	volatile uint64_t _lastReceived;
 	volatile uint64_t _lastPing;
+	volatile uint64_t _packetsSent; // not serialized
+	volatile uint64_t _packetsReceived;
 	InetAddress _addr;
 	Type _type;
 	bool _fixed;
@@ -32,6 +32,7 @@
 #include "Network.hpp"
 #include "NodeConfig.hpp"
 #include "AntiRecursion.hpp"
+#include "Metrics.hpp"
 
 #include <algorithm>
 
@@ -44,6 +45,8 @@ Peer::Peer(const Identity &myIdentity,const Identity &peerIdentity)
 	_lastUnicastFrame(0),
 	_lastMulticastFrame(0),
 	_lastAnnouncedTo(0),
+	_packetsReceived(0),
+	_packetsSent(0),
 	_vMajor(0),
 	_vMinor(0),
 	_vRevision(0),
@@ -71,6 +74,7 @@ void Peer::received(
 
 	// Global last receive time regardless of path
 	_lastReceive = now;
+	++_packetsReceived;
 
 	if (!hops) {
 		// Learn paths from direct packets (hops == 0)
@@ -125,8 +129,9 @@ void Peer::received(
 					std::set<MulticastGroup> mgs((*n)->multicastGroups());
 					for(std::set<MulticastGroup>::iterator mg(mgs.begin());mg!=mgs.end();++mg) {
 						if ((outp.size() + 18) > ZT_UDP_DEFAULT_PAYLOAD_MTU) {
+							RR->metrics->sent(outp.verb());
 							outp.armor(_key,true);
-							fromSock->send(remoteAddr,outp.data(),outp.size());
+							RR->metrics->wireSent(outp.size(),fromSock->send(remoteAddr,outp.data(),outp.size()));
 							outp.reset(_id.address(),RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
 						}
 
@@ -138,8 +143,9 @@ void Peer::received(
 				}
 			}
 			if (outp.size() > ZT_PROTO_MIN_PACKET_LENGTH) {
+				RR->metrics->sent(outp.verb());
 				outp.armor(_key,true);
-				fromSock->send(remoteAddr,outp.data(),outp.size());
+				RR->metrics->wireSent(outp.size(),fromSock->send(remoteAddr,outp.data(),outp.size()));
 			}
 		}
 	}
@@ -152,53 +158,15 @@ void Peer::received(
 
 Path::Type Peer::send(const RuntimeEnvironment *RR,const void *data,unsigned int len,uint64_t now)
 {
-	/* For sending ordinary packets, paths are divided into two categories:
-	 * "normal" and "TCP out." Normal includes UDP and incoming TCP. We want
-	 * to treat outbound TCP differently since if we use it it may end up
-	 * overriding UDP and UDP performs much better. We only want to initiate
-	 * TCP if it looks like UDP isn't available. */
-	Path *bestNormalPath = (Path *)0;
-	Path *bestTcpOutPath = (Path *)0;
-	uint64_t bestNormalPathLastReceived = 0;
-	uint64_t bestTcpOutPathLastReceived = 0;
-	for(unsigned int p=0,np=_numPaths;p<np;++p) {
-		uint64_t lr = _paths[p].lastReceived();
-		if (_paths[p].type() == Path::PATH_TYPE_TCP_OUT) {
-			if (lr >= bestTcpOutPathLastReceived) {
-				bestTcpOutPathLastReceived = lr;
-				bestTcpOutPath = &(_paths[p]);
-			}
-		} else {
-			if (lr >= bestNormalPathLastReceived) {
-				bestNormalPathLastReceived = lr;
-				bestNormalPath = &(_paths[p]);
-			}
-		}
-	}
-
-	Path *bestPath = (Path *)0;
-	if (bestTcpOutPath) { // we have a TCP out path
-		if (bestNormalPath) { // we have both paths, decide which to use
-			if (RR->tcpTunnelingEnabled) { // TCP tunneling is enabled, so use normal path only if it looks alive
-				if ((bestNormalPathLastReceived > RR->timeOfLastResynchronize)&&((now - bestNormalPathLastReceived) < ZT_PEER_PATH_ACTIVITY_TIMEOUT))
-					bestPath = bestNormalPath;
-				else bestPath = bestTcpOutPath;
-			} else { // TCP tunneling is disabled, use normal path
-				bestPath = bestNormalPath;
-			}
-		} else { // we only have a TCP_OUT path, so use it regardless
-			bestPath = bestTcpOutPath;
-		}
-	} else { // we only have a normal path (or none at all, that case is caught below)
-		bestPath = bestNormalPath;
-	}
+	Path *bestPath = _bestPath(RR,now);
 	if (!bestPath)
 		return Path::PATH_TYPE_NULL;
 
 	RR->antiRec->logOutgoingZT(data,len);
 
-	if (RR->sm->send(bestPath->address(),bestPath->tcp(),bestPath->type() == Path::PATH_TYPE_TCP_OUT,data,len)) {
+	if (RR->metrics->wireSent(len,RR->sm->send(bestPath->address(),bestPath->tcp(),bestPath->type() == Path::PATH_TYPE_TCP_OUT,data,len))) {
 		bestPath->sent(now);
+		++_packetsSent;
 		return bestPath->type();
 	}
 
@@ -232,6 +200,7 @@ bool Peer::sendPing(const RuntimeEnvironment *RR,uint64_t now)
 			_paths[p].pinged(now); // attempts to ping are logged whether they look successful or not
 			if (RR->sw->sendHELLO(self,_paths[p])) {
 				_paths[p].sent(now);
+				++_packetsSent;
 				sent = true;
 			}
 		}
@@ -311,4 +280,49 @@ void Peer::getBestActiveUdpPathAddresses(uint64_t now,InetAddress &v4,InetAddres
 	}
 }
 
+Path *Peer::_bestPath(const RuntimeEnvironment *RR,uint64_t now)
+{
+	/* For sending ordinary packets, paths are divided into two categories:
+	 * "normal" and "TCP out." Normal includes UDP and incoming TCP. We want
+	 * to treat outbound TCP differently since if we use it it may end up
+	 * overriding UDP and UDP performs much better. We only want to initiate
+	 * TCP if it looks like UDP isn't available. */
+	Path *bestNormalPath = (Path *)0;
+	Path *bestTcpOutPath = (Path *)0;
+	uint64_t bestNormalPathLastReceived = 0;
+	uint64_t bestTcpOutPathLastReceived = 0;
+	for(unsigned int p=0,np=_numPaths;p<np;++p) {
+		uint64_t lr = _paths[p].lastReceived();
+		if (_paths[p].type() == Path::PATH_TYPE_TCP_OUT) {
+			if (lr >= bestTcpOutPathLastReceived) {
+				bestTcpOutPathLastReceived = lr;
+				bestTcpOutPath = &(_paths[p]);
+			}
+		} else {
+			if (lr >= bestNormalPathLastReceived) {
+				bestNormalPathLastReceived = lr;
+				bestNormalPath = &(_paths[p]);
+			}
+		}
+	}
+
+	Path *bestPath = (Path *)0;
+	if (bestTcpOutPath) { // we have a TCP out path
+		if (bestNormalPath) { // we have both paths, decide which to use
+			if (RR->tcpTunnelingEnabled) { // TCP tunneling is enabled, so use normal path only if it looks alive
+				if ((bestNormalPathLastReceived > RR->timeOfLastResynchronize)&&((now - bestNormalPathLastReceived) < ZT_PEER_PATH_ACTIVITY_TIMEOUT))
+					bestPath = bestNormalPath;
+				else bestPath = bestTcpOutPath;
+			} else { // TCP tunneling is disabled, use normal path
+				bestPath = bestNormalPath;
+			}
+		} else { // we only have a TCP_OUT path, so use it regardless
+			bestPath = bestTcpOutPath;
+		}
+	} else { // we only have a normal path (or none at all, in which case this returns NULL)
+		bestPath = bestNormalPath;
+	}
+	return bestPath;
+}
+
 } // namespace ZeroTier
@@ -54,6 +54,16 @@
  */
 #define ZT_PEER_MAX_PATHS 8
 
+/**
+ * Current version of Peer::serialize() output
+ */
+#define ZT_PEER_SERIALIZATION_VERSION 1
+
+/**
+ * Buffer size sufficient for one serialized peer
+ */
+#define ZT_PEER_SUGGESTED_SERIALIZATION_BUFFER_SIZE (1 + ZT_IDENTITY_MAX_BINARY_SERIALIZED_LENGTH + ZT_PEER_SECRET_KEY_LENGTH + 32 + 8 + 4 + 2 + (ZT_PEER_MAX_PATHS * (24 + 3 + 16 + 2)))
+
 namespace ZeroTier {
 
 /**
@@ -146,6 +156,45 @@ public:
 	 */
 	Path::Type send(const RuntimeEnvironment *RR,const void *data,unsigned int len,uint64_t now);
 
+	/**
+	 * Get the address of the path send() would use if that path is UDP
+	 *
+	 * This is used to batch direct UDP sends to many peers at once. If the
+	 * best path is TCP or there is none, this returns false and the caller
+	 * should fall back to send().
+	 *
+	 * @param RR Runtime environment
+	 * @param now Current time
+	 * @param addr Set to best path's address if return value is true
+	 * @return True if best path is UDP and addr was set
+	 */
+	inline bool getBestUdpSendPath(const RuntimeEnvironment *RR,uint64_t now,InetAddress &addr)
+	{
+		const Path *bp = _bestPath(RR,now);
+		if ((bp)&&(bp->type() == Path::PATH_TYPE_UDP)) {
+			addr = bp->address();
+			return true;
+		}
+		return false;
+	}
+
+	/**
+	 * Record a send that was made outside send() via a UDP path
+	 *
+	 * @param addr Address of UDP path
+	 * @param now Current time
+	 */
+	inline void sentViaUdp(const InetAddress &addr,uint64_t now)
+	{
+		for(unsigned int p=0,np=_numPaths;p<np;++p) {
+			if ((_paths[p].type() == Path::PATH_TYPE_UDP)&&(_paths[p].address() == addr)) {
+				_paths[p].sent(now);
+				++_packetsSent;
+				return;
+			}
+		}
+	}
+
 	/**
 	 * Send HELLO to a peer via all direct paths available
 	 *
@@ -251,6 +300,16 @@ public:
 	 */
 	inline uint64_t lastAnnouncedTo() const throw() { return _lastAnnouncedTo; }
 
+	/**
+	 * @return Packets received from this peer, whether direct or relayed
+	 */
+	inline uint64_t packetsReceived() const throw() { return _packetsReceived; }
+
+	/**
+	 * @return Messages sent over direct paths to this peer, including ones it will relay
+	 */
+	inline uint64_t packetsSent() const throw() { return _packetsSent; }
+
 	/**
 	 * @param now Current time
 	 * @return True if peer has received something within ZT_PEER_ACTIVITY_TIMEOUT ms
@@ -375,14 +434,98 @@ public:
 		else return std::pair<InetAddress,InetAddress>();
 	}
 
+	/**
+	 * Serialize peer state for a warm restart snapshot
+	 *
+	 * This includes the secret key agreed with this peer, so it must only
+	 * be written somewhere encrypted. TCP paths are left out since their
+	 * connections won't survive a restart.
+	 *
+	 * @param b Buffer to append to
+	 * @throws std::out_of_range Buffer too small
+	 */
+	template<unsigned int C>
+	inline void serialize(Buffer<C> &b) const
+	{
+		b.append((unsigned char)ZT_PEER_SERIALIZATION_VERSION);
+		_id.serialize(b,false);
+		b.append(_key,sizeof(_key));
+		b.append((uint64_t)_lastUsed);
+		b.append((uint64_t)_lastReceive);
+		b.append((uint64_t)_lastUnicastFrame);
+		b.append((uint64_t)_lastMulticastFrame);
+		b.append((uint16_t)_vProto);
+		b.append((uint16_t)_vMajor);
+		b.append((uint16_t)_vMinor);
+		b.append((uint16_t)_vRevision);
+		b.append((uint32_t)_latency);
+
+		const unsigned int npptr = b.size();
+		b.addSize(2);
+		unsigned int np = 0;
+		for(unsigned int p=0,n=_numPaths;p<n;++p) {
+			if ((_paths[p].type() == Path::PATH_TYPE_UDP)&&(_paths[p].address())) {
+				_paths[p].serialize(b);
+				++np;
+			}
+		}
+		b.template setAt<uint16_t>(npptr,(uint16_t)np);
+	}
+
+	/**
+	 * Create a peer from state written by serialize()
+	 *
+	 * No key agreement is done. The key is restored as it was saved.
+	 *
+	 * @param b Buffer to read from
+	 * @param p Index of serialized peer in buffer, advanced past it on return
+	 * @return New peer
+	 * @throws std::out_of_range Buffer too short
+	 * @throws std::invalid_argument Serialized data invalid
+	 */
+	template<unsigned int C>
+	static inline SharedPtr<Peer> deserializeNew(const Buffer<C> &b,unsigned int &p)
+	{
+		if (b[p++] != ZT_PEER_SERIALIZATION_VERSION)
+			throw std::invalid_argument("unknown peer serialization version");
+
+		SharedPtr<Peer> np(new Peer());
+		p += np->_id.deserialize(b,p);
+		memcpy(np->_key,b.field(p,sizeof(np->_key)),sizeof(np->_key)); p += sizeof(np->_key);
+		np->_lastUsed = b.template at<uint64_t>(p); p += 8;
+		np->_lastReceive = b.template at<uint64_t>(p); p += 8;
+		np->_lastUnicastFrame = b.template at<uint64_t>(p); p += 8;
+		np->_lastMulticastFrame = b.template at<uint64_t>(p); p += 8;
+		np->_lastAnnouncedTo = 0; // re-announce multicast subscriptions after restart
+		np->_vProto = b.template at<uint16_t>(p); p += 2;
+		np->_vMajor = b.template at<uint16_t>(p); p += 2;
+		np->_vMinor = b.template at<uint16_t>(p); p += 2;
+		np->_vRevision = b.template at<uint16_t>(p); p += 2;
+		np->_latency = b.template at<uint32_t>(p); p += 4;
+
+		unsigned int npaths = b.template at<uint16_t>(p); p += 2;
+		np->_numPaths = 0;
+		for(unsigned int i=0;i<npaths;++i) {
+			Path path;
+			p += path.deserialize(b,p);
+			if (np->_numPaths < ZT_PEER_MAX_PATHS)
+				np->_paths[np->_numPaths++] = path;
+		}
+
+		return np;
+	}
+
 private:
 	void _announceMulticastGroups(const RuntimeEnvironment *RR,uint64_t now);
+	Path *_bestPath(const RuntimeEnvironment *RR,uint64_t now);
 
 	volatile uint64_t _lastUsed;
 	volatile uint64_t _lastReceive; // direct or indirect
 	volatile uint64_t _lastUnicastFrame;
 	volatile uint64_t _lastMulticastFrame;
 	volatile uint64_t _lastAnnouncedTo;
+	volatile uint64_t _packetsReceived;
+	volatile uint64_t _packetsSent;
 	volatile uint16_t _vProto;
 	volatile uint16_t _vMajor;
 	volatile uint16_t _vMinor;
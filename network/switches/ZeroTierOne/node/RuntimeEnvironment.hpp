@@ -40,7 +40,9 @@ class Logger;
 class Switch;
 class Topology;
 class CMWC4096;
+class Metrics;
 class Service;
+class NetconfCache;
 class Node;
 class SoftwareUpdater;
 class SocketManager;
@@ -49,6 +51,7 @@ class AntiRecursion;
 class EthernetTapFactory;
 class RoutingTable;
 class HttpClient;
+class IdentityValidator;
 
 /**
  * Holds global state for an instance of ZeroTier::Node
@@ -69,6 +72,7 @@ public:
 		homePath(),
 		identity(),
 		initialized(false),
+		synchronous(false),
 		tcpTunnelingEnabled(false),
 		timeOfLastResynchronize(0),
 		timeOfLastPacketReceived(0),
@@ -77,6 +81,7 @@ public:
 		sm((SocketManager *)0),
 		log((Logger *)0),
 		prng((CMWC4096 *)0),
+		metrics((Metrics *)0),
 		http((HttpClient *)0),
 		sw((Switch *)0),
 		mc((Multicaster *)0),
@@ -84,9 +89,11 @@ public:
 		topology((Topology *)0),
 		nc((NodeConfig *)0),
 		node((Node *)0),
+		idv((IdentityValidator *)0),
 		updater((SoftwareUpdater *)0)
 #ifndef __WINDOWS__
 		,netconfService((Service *)0)
+		,netconfCache((NetconfCache *)0)
 #endif
 	{
 	}
@@ -100,6 +107,9 @@ public:
 	// Are we initialized?
 	volatile bool initialized;
 
+	// Are we driven by Node::step() with no threads of our own? (simulation)
+	bool synchronous;
+
 	// Are we in outgoing TCP failover mode?
 	volatile bool tcpTunnelingEnabled;
 
@@ -125,6 +135,7 @@ public:
 
 	Logger *log; // null if logging is disabled
 	CMWC4096 *prng;
+	Metrics *metrics;
 	HttpClient *http;
 	Switch *sw;
 	Multicaster *mc;
@@ -132,9 +143,11 @@ public:
 	Topology *topology;
 	NodeConfig *nc;
 	Node *node;
+	IdentityValidator *idv;
 	SoftwareUpdater *updater; // null if software updates are not enabled
 #ifndef __WINDOWS__
 	Service *netconfService; // null if no netconf service running
+	NetconfCache *netconfCache; // null if no netconf service running
 #endif
 };
 
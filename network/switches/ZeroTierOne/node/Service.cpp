@@ -63,6 +63,10 @@ Service::Service(const RuntimeEnvironment *renv,const char *name,const char *pat
 	_childStderr(0),
 	_run(true)
 {
+	if (::pipe(_wakePipe))
+		throw std::runtime_error("pipe() failed");
+	fcntl(_wakePipe[0],F_SETFL,O_NONBLOCK);
+	fcntl(_wakePipe[1],F_SETFL,O_NONBLOCK);
 	_thread = Thread::start(this);
 }
 
@@ -85,16 +89,90 @@ Service::~Service()
 			waitpid(pid,&st,0);
 		}
 	}
+	_wake();
 	Thread::join(_thread);
+	::close(_wakePipe[0]);
+	::close(_wakePipe[1]);
 }
 
 bool Service::send(const Dictionary &msg)
 {
 	if (_childStdin <= 0)
 		return false;
-	std::string mser(msg.toString());
-	mser.append(ZT_EOL_S);
-	return ((long)::write(_childStdin,mser.data(),mser.length()) == (long)mser.length());
+	std::string data(msg.toString());
+	data.append(ZT_EOL_S);
+	{
+		Mutex::Lock _l(_lock);
+		if (!_enqueue(std::string(),data))
+			return false;
+	}
+	_wake();
+	return true;
+}
+
+Service::RequestResult Service::request(const std::string &key,const Dictionary &msg)
+{
+	if (_childStdin <= 0)
+		return REQUEST_REFUSED;
+	std::string data(msg.toString());
+	data.append(ZT_EOL_S);
+	{
+		// Lookup and insert under one lock so two callers can't both queue the same key
+		Mutex::Lock _l(_lock);
+		std::map<std::string,_Pending>::iterator p(_pending.find(key));
+		if (p != _pending.end()) {
+			if (p->second.queued) // not written yet, so send the newer message in its place
+				p->second.msg->data.swap(data);
+			return REQUEST_COALESCED;
+		}
+		if (!_enqueue(key,data))
+			return REQUEST_REFUSED;
+	}
+	_wake();
+	return REQUEST_QUEUED;
+}
+
+long Service::complete(const std::string &key)
+{
+	Mutex::Lock _l(_lock);
+	std::map<std::string,_Pending>::iterator p(_pending.find(key));
+	if (p == _pending.end())
+		return -1;
+	long t = (long)(Utils::now() - p->second.since);
+	if (p->second.queued) // answered before we wrote it, e.g. after a restart
+		_queue.erase(p->second.msg);
+	_pending.erase(p);
+	return t;
+}
+
+bool Service::_enqueue(const std::string &key,std::string &data)
+{
+	if (_queue.size() >= ZT_SERVICE_MAX_QUEUE)
+		return false;
+	_queue.push_back(_Message());
+	_queue.back().key = key;
+	_queue.back().data.swap(data);
+	if (key.length()) {
+		_Pending &p = _pending[key];
+		p.since = Utils::now();
+		p.queued = true;
+		p.msg = _queue.end();
+		--p.msg;
+	}
+	return true;
+}
+
+void Service::_wake()
+{
+	char c = 0;
+	if (::write(_wakePipe[1],&c,1) < 0) {} // pipe full means a wakeup is already pending
+}
+
+void Service::_reset()
+{
+	Mutex::Lock _l(_lock);
+	_queue.clear();
+	_pending.clear();
 }
 
 void Service::threadMain()
@@ -104,7 +182,7 @@ void Service::threadMain()
 	fd_set readfds,writefds,exceptfds;
 	struct timeval tv;
 	int eolsInARow = 0;
-	std::string stderrBuf,stdoutBuf;
+	std::string stderrBuf,stdoutBuf,writeBuf;
 
 	while (_run) {
 		if (_pid <= 0) {
@@ -128,6 +206,7 @@ void Service::threadMain()
 				_childStdin = in[1];
 				_childStdout = out[0];
 				_childStderr = err[0];
+				fcntl(_childStdin,F_SETFL,O_NONBLOCK);
 				fcntl(_childStdout,F_SETFL,O_NONBLOCK);
 				fcntl(_childStderr,F_SETFL,O_NONBLOCK);
 				_pid = pid;
@@ -153,6 +232,10 @@ void Service::threadMain()
 				if (_childStderr > 0) close(_childStderr);
 				_pid = 0;
 
+				// Whatever was queued or awaiting a reply died with the child
+				_reset();
+				writeBuf = "";
+
 				if (!_run)
 					return;
 
@@ -171,10 +254,17 @@ void Service::threadMain()
 
 		FD_SET(_childStdout,&readfds);
 		FD_SET(_childStderr,&readfds);
+		FD_SET(_wakePipe[0],&readfds);
+		if ((writeBuf.length())||(queued()))
+			FD_SET(_childStdin,&writefds);
 
 		tv.tv_sec = 1;
 		tv.tv_usec = 0;
-		::select(std::max(_childStdout,_childStderr)+1,&readfds,&writefds,&exceptfds,&tv);
+		::select(std::max(std::max((int)_childStdout,(int)_childStderr),std::max((int)_childStdin,_wakePipe[0]))+1,&readfds,&writefds,&exceptfds,&tv);
+
+		if (FD_ISSET(_wakePipe[0],&readfds)) {
+			while (::read(_wakePipe[0],buf,sizeof(buf)) > 0) {}
+		}
 
 		if (!_run) {
 			if (_childStdin > 0) ::close(_childStdin);
@@ -184,6 +274,36 @@ void Service::threadMain()
 			return;
 		}
 
+		for(;;) {
+			if (!writeBuf.length()) {
+				Mutex::Lock _l(_lock);
+				if (_queue.empty())
+					break;
+				writeBuf.swap(_queue.front().data);
+				if (_queue.front().key.length()) {
+					std::map<std::string,_Pending>::iterator p(_pending.find(_queue.front().key));
+					if (p != _pending.end())
+						p->second.queued = false;
+				}
+				_queue.pop_front();
+			}
+			long n = (long)::write(_childStdin,writeBuf.data(),writeBuf.length());
+			if (n <= 0)
+				break; // pipe is full (EAGAIN), wait for select() to say it's writable
+			writeBuf.erase(0,n);
+		}
+
+		{
+			// Forget requests that never got a reply so retries get through
+			uint64_t now = Utils::now();
+			Mutex::Lock _l(_lock);
+			for(std::map<std::string,_Pending>::iterator p(_pending.begin());p!=_pending.end();) {
+				if ((!p->second.queued)&&((now - p->second.since) > ZT_SERVICE_REQUEST_TIMEOUT))
+					_pending.erase(p++);
+				else ++p;
+			}
+		}
+
 		if ((_childStderr > 0)&&(FD_ISSET(_childStderr,&readfds))) {
 			int n = (int)::read(_childStderr,buf,sizeof(buf));
 			for(int i=0;i<n;++i) {
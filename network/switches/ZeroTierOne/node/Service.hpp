@@ -28,12 +28,17 @@
 #ifndef ZT_SERVICE_HPP
 #define ZT_SERVICE_HPP
 
+#include <stdint.h>
+
 #include <string>
 #include <stdexcept>
+#include <list>
+#include <map>
 
 #include "Constants.hpp"
 #include "Dictionary.hpp"
 #include "Thread.hpp"
+#include "Mutex.hpp"
 
 namespace ZeroTier {
 
@@ -53,6 +58,12 @@ class RuntimeEnvironment;
  * from its stdout. Messages printed by the subprocess on its stderr are
  * logged via the standard Logger instance. If the subprocess dies, an
  * attempt is made to restart it every second.
+ *
+ * Messages are queued and written by the service's own thread, so callers
+ * never block on a slow subprocess. The queue is bounded and send() fails
+ * when it is full. Messages sent with request() carry a key, and a request
+ * whose key is already queued or awaiting a reply is merged with it rather
+ * than sent again.
  */
 class Service
 {
@@ -82,6 +93,56 @@ public:
 	 */
 	bool send(const Dictionary &msg);
 
+	/**
+	 * Result of request()
+	 */
+	enum RequestResult
+	{
+		REQUEST_QUEUED = 0,
+		REQUEST_COALESCED = 1, // same key already queued or awaiting a reply
+		REQUEST_REFUSED = 2 // queue full or subprocess not running
+	};
+
+	/**
+	 * Send a message that expects a reply, merging it with any pending duplicate
+	 *
+	 * If a message with this key is still queued it is replaced by this one.
+	 * If one has been written and is awaiting a reply, this one is dropped.
+	 * A key stops being pending when complete() is called for it, when the
+	 * subprocess restarts, or after ZT_SERVICE_REQUEST_TIMEOUT.
+	 *
+	 * @param key Key identifying duplicate requests
+	 * @param msg Message in key/value dictionary form
+	 * @return Whether the request was queued, merged or refused
+	 */
+	RequestResult request(const std::string &key,const Dictionary &msg);
+
+	/**
+	 * Mark a request as answered
+	 *
+	 * @param key Key passed to request()
+	 * @return Milliseconds since request() was first called for key, or -1 if not pending
+	 */
+	long complete(const std::string &key);
+
+	/**
+	 * @return Number of messages waiting to be written to the subprocess
+	 */
+	inline unsigned long queued() const
+	{
+		Mutex::Lock _l(_lock);
+		return (unsigned long)_queue.size();
+	}
+
+	/**
+	 * @return Number of requests queued or awaiting a reply
+	 */
+	inline unsigned long inFlight() const
+	{
+		Mutex::Lock _l(_lock);
+		return (unsigned long)_pending.size();
+	}
+
 	/**
 	 * @return Name of service
 	 */
@@ -99,6 +160,22 @@ public:
 		throw();
 
 private:
+	struct _Message
+	{
+		std::string key; // empty for send()
+		std::string data;
+	};
+	struct _Pending
+	{
+		uint64_t since;
+		bool queued;
+		std::list<_Message>::iterator msg; // valid while queued
+	};
+
+	bool _enqueue(const std::string &key,std::string &data); // assumes _lock is held
+	void _wake();
+	void _reset();
+
 	const RuntimeEnvironment *RR;
 
 	Thread _thread;
@@ -114,6 +191,11 @@ private:
 	volatile int _childStderr;
 
 	volatile bool _run;
+
+	std::list<_Message> _queue;
+	std::map<std::string,_Pending> _pending;
+	Mutex _lock;
+	int _wakePipe[2];
 };
 #endif // __WINDOWS__
 
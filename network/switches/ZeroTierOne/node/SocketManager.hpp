@@ -79,6 +79,38 @@ public:
 		const void *msg,
 		unsigned int msglen) { return send(to,false,false,msg,msglen); }
 
+	/**
+	 * Entry in a batch of UDP messages for sendUdpBatch()
+	 */
+	struct UdpBatchEntry
+	{
+		InetAddress to;
+		const void *msg;
+		unsigned int msglen;
+		bool ok; // set by sendUdpBatch()
+	};
+
+	/**
+	 * Send a batch of UDP messages
+	 *
+	 * The default implementation just calls sendUdp() for each entry.
+	 * Implementations may override this with something that costs fewer
+	 * system calls, such as sendmmsg() on Linux.
+	 *
+	 * @param batch Array of messages to send, ok is set for each
+	 * @param count Number of entries in batch
+	 * @return Number of messages that appear to have been sent
+	 */
+	virtual unsigned int sendUdpBatch(UdpBatchEntry *batch,unsigned int count)
+	{
+		unsigned int n = 0;
+		for(unsigned int i=0;i<count;++i) {
+			if ((batch[i].ok = sendUdp(batch[i].to,batch[i].msg,batch[i].msglen)))
+				++n;
+		}
+		return n;
+	}
+
 	/**
 	 * Perform I/O polling operation (e.g. select())
 	 *
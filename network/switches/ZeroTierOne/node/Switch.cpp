@@ -49,6 +49,7 @@
 #include "NodeConfig.hpp"
 #include "CMWC4096.hpp"
 #include "AntiRecursion.hpp"
+#include "Metrics.hpp"
 
 #include "../version.h"
 
@@ -67,6 +68,7 @@ Switch::~Switch()
 void Switch::onRemotePacket(const SharedPtr<Socket> &fromSock,const InetAddress &fromAddr,Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> &data)
 {
 	try {
+		RR->metrics->wireReceived(data.size());
 		if (data.size() == ZT_PROTO_BEACON_LENGTH) {
 			_handleBeacon(fromSock,fromAddr,data);
 		} else if (data.size() > ZT_PROTO_MIN_FRAGMENT_LENGTH) {
@@ -187,7 +189,7 @@ void Switch::onLocalEthernet(const SharedPtr<Network> &network,const MAC &from,c
 				from.appendTo(outp);
 				outp.append((uint16_t)etherType);
 				outp.append(data);
-				outp.compress();
+				_compressionPolicy.compress(outp,toZT,etherType,nconf->compressionAcceleration());
 				send(outp,true);
 			} else {
 				// FRAME is a shorter version that can be used when there's no bridging and no COM
@@ -195,7 +197,7 @@ void Switch::onLocalEthernet(const SharedPtr<Network> &network,const MAC &from,c
 				outp.append(network->id());
 				outp.append((uint16_t)etherType);
 				outp.append(data);
-				outp.compress();
+				_compressionPolicy.compress(outp,toZT,etherType,nconf->compressionAcceleration());
 				send(outp,true);
 			}
 		} else {
@@ -251,7 +253,7 @@ void Switch::onLocalEthernet(const SharedPtr<Network> &network,const MAC &from,c
 			from.appendTo(outp);
 			outp.append((uint16_t)etherType);
 			outp.append(data);
-			outp.compress();
+			_compressionPolicy.compress(outp,bridges[b],etherType,nconf->compressionAcceleration());
 			send(outp,true);
 		}
 	}
@@ -266,7 +268,7 @@ void Switch::send(const Packet &packet,bool encrypt)
 
 	if (!_trySend(packet,encrypt)) {
 		Mutex::Lock _l(_txQueue_m);
-		_txQueue.insert(std::pair< Address,TXQueueEntry >(packet.destination(),TXQueueEntry(Utils::now(),packet,encrypt)));
+		_txQueue.insert(std::pair< Address,TXQueueEntry >(packet.destination(),TXQueueEntry(Utils::now(),(RR->metrics->latencyEnabled()) ? Utils::nowMicros() : 0,packet,encrypt)));
 	}
 }
 
@@ -292,9 +294,10 @@ bool Switch::sendHELLO(const SharedPtr<Peer> &dest,const Path &path)
 	outp.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
 	outp.append(now);
 	RR->identity.serialize(outp,false);
+	RR->metrics->sent(outp.verb());
 	outp.armor(dest->key(),false);
 	RR->antiRec->logOutgoingZT(outp.data(),outp.size());
-	return RR->sm->send(path.address(),path.tcp(),path.type() == Path::PATH_TYPE_TCP_OUT,outp.data(),outp.size());
+	return RR->metrics->wireSent(outp.size(),RR->sm->send(path.address(),path.tcp(),path.type() == Path::PATH_TYPE_TCP_OUT,outp.data(),outp.size()));
 }
 
 bool Switch::sendHELLO(const SharedPtr<Peer> &dest,const InetAddress &destUdp)
@@ -307,9 +310,10 @@ bool Switch::sendHELLO(const SharedPtr<Peer> &dest,const InetAddress &destUdp)
 	outp.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
 	outp.append(now);
 	RR->identity.serialize(outp,false);
+	RR->metrics->sent(outp.verb());
 	outp.armor(dest->key(),false);
 	RR->antiRec->logOutgoingZT(outp.data(),outp.size());
-	return RR->sm->send(destUdp,false,false,outp.data(),outp.size());
+	return RR->metrics->wireSent(outp.size(),RR->sm->send(destUdp,false,false,outp.data(),outp.size()));
 }
 
 bool Switch::unite(const Address &p1,const Address &p2,bool force)
@@ -376,6 +380,7 @@ bool Switch::unite(const Address &p1,const Address &p2,bool force)
 				outp.append((unsigned char)4);
 				outp.append(cg.first.rawIpData(),4);
 			}
+			RR->metrics->sent(outp.verb());
 			outp.armor(p1p->key(),true);
 			p1p->send(RR,outp.data(),outp.size(),now);
 		} else {
@@ -391,6 +396,7 @@ bool Switch::unite(const Address &p1,const Address &p2,bool force)
 				outp.append((unsigned char)4);
 				outp.append(cg.second.rawIpData(),4);
 			}
+			RR->metrics->sent(outp.verb());
 			outp.armor(p2p->key(),true);
 			p2p->send(RR,outp.data(),outp.size(),now);
 		}
@@ -445,26 +451,32 @@ void Switch::doAnythingWaitingForPeer(const SharedPtr<Peer> &peer)
 		_outstandingWhoisRequests.erase(peer->address());
 	}
 
-	{	// finish processing any packets waiting on peer's public key / identity
-		Mutex::Lock _l(_rxQueue_m);
-		for(std::list< SharedPtr<IncomingPacket> >::iterator rxi(_rxQueue.begin());rxi!=_rxQueue.end();) {
-			if ((*rxi)->tryDecode(RR))
-				_rxQueue.erase(rxi++);
-			else ++rxi;
-		}
-	}
+	// finish processing any packets waiting on peer's public key / identity
+	retryReceiveQueue();
 
 	{	// finish sending any packets waiting on peer's public key / identity
 		Mutex::Lock _l(_txQueue_m);
 		std::pair< std::multimap< Address,TXQueueEntry >::iterator,std::multimap< Address,TXQueueEntry >::iterator > waitingTxQueueItems(_txQueue.equal_range(peer->address()));
 		for(std::multimap< Address,TXQueueEntry >::iterator txi(waitingTxQueueItems.first);txi!=waitingTxQueueItems.second;) {
-			if (_trySend(txi->second.packet,txi->second.encrypt))
+			if (_trySend(txi->second.packet,txi->second.encrypt)) {
+				RR->metrics->latencySince(Metrics::STAGE_TX_QUEUE,txi->second.creationUs);
 				_txQueue.erase(txi++);
+			}
 			else ++txi;
 		}
 	}
 }
 
+void Switch::retryReceiveQueue()
+{
+	Mutex::Lock _l(_rxQueue_m);
+	for(std::list< SharedPtr<IncomingPacket> >::iterator rxi(_rxQueue.begin());rxi!=_rxQueue.end();) {
+		if ((*rxi)->tryDecode(RR))
+			_rxQueue.erase(rxi++);
+		else ++rxi;
+	}
+}
+
 unsigned long Switch::doTimerTasks()
 {
 	unsigned long nextDelay = ~((unsigned long)0); // big number, caller will cap return value
@@ -506,6 +518,7 @@ unsigned long Switch::doTimerTasks()
 			if (since >= ZT_WHOIS_RETRY_DELAY) {
 				if (i->second.retries >= ZT_MAX_WHOIS_RETRIES) {
 					TRACE("WHOIS %s timed out",i->first.toString().c_str());
+					RR->metrics->inc(Metrics::COUNTER_WHOIS_TIMEOUTS);
 					_outstandingWhoisRequests.erase(i++);
 					continue;
 				} else {
@@ -518,28 +531,38 @@ unsigned long Switch::doTimerTasks()
 			} else nextDelay = std::min(nextDelay,ZT_WHOIS_RETRY_DELAY - since);
 			++i;
 		}
+		RR->metrics->set(Metrics::GAUGE_WHOIS_QUEUE_DEPTH,_outstandingWhoisRequests.size());
 	}
 
 	{
 		Mutex::Lock _l(_txQueue_m);
 		for(std::multimap< Address,TXQueueEntry >::iterator i(_txQueue.begin());i!=_txQueue.end();) {
-			if (_trySend(i->second.packet,i->second.encrypt))
+			if (_trySend(i->second.packet,i->second.encrypt)) {
+				RR->metrics->latencySince(Metrics::STAGE_TX_QUEUE,i->second.creationUs);
 				_txQueue.erase(i++);
-			else if ((now - i->second.creationTime) > ZT_TRANSMIT_QUEUE_TIMEOUT) {
+			} else if ((now - i->second.creationTime) > ZT_TRANSMIT_QUEUE_TIMEOUT) {
 				TRACE("TX %s -> %s timed out",i->second.packet.source().toString().c_str(),i->second.packet.destination().toString().c_str());
+				RR->metrics->inc(Metrics::COUNTER_TX_QUEUE_TIMEOUTS);
 				_txQueue.erase(i++);
 			} else ++i;
 		}
+		RR->metrics->set(Metrics::GAUGE_TX_QUEUE_DEPTH,_txQueue.size());
 	}
 
 	{
 		Mutex::Lock _l(_rxQueue_m);
+		unsigned long depth = 0; // list::size() may be O(n)
 		for(std::list< SharedPtr<IncomingPacket> >::iterator i(_rxQueue.begin());i!=_rxQueue.end();) {
 			if ((now - (*i)->receiveTime()) > ZT_RECEIVE_QUEUE_TIMEOUT) {
 				TRACE("RX %s -> %s timed out",(*i)->source().toString().c_str(),(*i)->destination().toString().c_str());
+				RR->metrics->inc(Metrics::COUNTER_RX_QUEUE_TIMEOUTS);
 				_rxQueue.erase(i++);
-			} else ++i;
+			} else {
+				++depth;
+				++i;
+			}
 		}
+		RR->metrics->set(Metrics::GAUGE_RX_QUEUE_DEPTH,depth);
 	}
 
 	{
@@ -547,9 +570,11 @@ unsigned long Switch::doTimerTasks()
 		for(std::map< uint64_t,DefragQueueEntry >::iterator i(_defragQueue.begin());i!=_defragQueue.end();) {
 			if ((now - i->second.creationTime) > ZT_FRAGMENTED_PACKET_RECEIVE_TIMEOUT) {
 				TRACE("incomplete fragmented packet %.16llx timed out, fragments discarded",i->first);
+				RR->metrics->inc(Metrics::COUNTER_DEFRAG_TIMEOUTS);
 				_defragQueue.erase(i++);
 			} else ++i;
 		}
+		RR->metrics->set(Metrics::GAUGE_DEFRAG_QUEUE_DEPTH,_defragQueue.size());
 	}
 
 	return std::max(nextDelay,(unsigned long)10); // minimum delay
@@ -580,6 +605,7 @@ void Switch::_handleRemotePacketFragment(const SharedPtr<Socket> &fromSock,const
 		// Fragment is not for us, so try to relay it
 		if (fragment.hops() < ZT_RELAY_MAX_HOPS) {
 			fragment.incrementHops();
+			RR->metrics->inc(Metrics::COUNTER_PACKETS_RELAYED);
 
 			// Note: we don't bother initiating NAT-t for fragments, since heads will set that off.
 			// It wouldn't hurt anything, just redundant and unnecessary.
@@ -592,9 +618,11 @@ void Switch::_handleRemotePacketFragment(const SharedPtr<Socket> &fromSock,const
 			}
 		} else {
 			TRACE("dropped relay [fragment](%s) -> %s, max hops exceeded",fromAddr.toString().c_str(),destination.toString().c_str());
+			RR->metrics->inc(Metrics::COUNTER_RELAY_HOPS_EXCEEDED);
 		}
 	} else {
 		// Fragment looks like ours
+		RR->metrics->inc(Metrics::COUNTER_FRAGMENTS_RECEIVED);
 		uint64_t pid = fragment.packetId();
 		unsigned int fno = fragment.fragmentNumber();
 		unsigned int tf = fragment.totalFragments();
@@ -613,6 +641,7 @@ void Switch::_handleRemotePacketFragment(const SharedPtr<Socket> &fromSock,const
 
 				DefragQueueEntry &dq = _defragQueue[pid];
 				dq.creationTime = Utils::now();
+				dq.creationUs = (RR->metrics->latencyEnabled()) ? Utils::nowMicros() : 0;
 				dq.frags[fno - 1] = fragment;
 				dq.totalFragments = tf; // total fragment count is known
 				dq.haveFragments = 1 << fno; // we have only this fragment
@@ -631,6 +660,7 @@ void Switch::_handleRemotePacketFragment(const SharedPtr<Socket> &fromSock,const
 					SharedPtr<IncomingPacket> packet(dqe->second.frag0);
 					for(unsigned int f=1;f<tf;++f)
 						packet->append(dqe->second.frags[f - 1].payload(),dqe->second.frags[f - 1].payloadLength());
+					RR->metrics->latencySince(Metrics::STAGE_DEFRAG,dqe->second.creationUs);
 					_defragQueue.erase(dqe);
 
 					if (!packet->tryDecode(RR)) {
@@ -646,6 +676,8 @@ void Switch::_handleRemotePacketFragment(const SharedPtr<Socket> &fromSock,const
 void Switch::_handleRemotePacketHead(const SharedPtr<Socket> &fromSock,const InetAddress &fromAddr,const Buffer<4096> &data)
 {
 	SharedPtr<IncomingPacket> packet(new IncomingPacket(data,fromSock,fromAddr));
+	if (RR->metrics->latencyEnabled())
+		packet->stamp(Utils::nowMicros());
 
 	Address source(packet->source());
 	Address destination(packet->destination());
@@ -656,6 +688,7 @@ void Switch::_handleRemotePacketHead(const SharedPtr<Socket> &fromSock,const Ine
 		// Packet is not for us, so try to relay it
 		if (packet->hops() < ZT_RELAY_MAX_HOPS) {
 			packet->incrementHops();
+			RR->metrics->inc(Metrics::COUNTER_PACKETS_RELAYED);
 
 			SharedPtr<Peer> relayTo = RR->topology->getPeer(destination);
 			Path::Type relayedVia;
@@ -673,6 +706,7 @@ void Switch::_handleRemotePacketHead(const SharedPtr<Socket> &fromSock,const Ine
 			}
 		} else {
 			TRACE("dropped relay %s(%s) -> %s, max hops exceeded",packet->source().toString().c_str(),fromAddr.toString().c_str(),destination.toString().c_str());
+			RR->metrics->inc(Metrics::COUNTER_RELAY_HOPS_EXCEEDED);
 		}
 	} else if (packet->fragmented()) {
 		// Packet is the head of a fragmented packet series
@@ -685,6 +719,7 @@ void Switch::_handleRemotePacketHead(const SharedPtr<Socket> &fromSock,const Ine
 			// If we have no other fragments yet, create an entry and save the head
 			DefragQueueEntry &dq = _defragQueue[pid];
 			dq.creationTime = Utils::now();
+			dq.creationUs = (RR->metrics->latencyEnabled()) ? Utils::nowMicros() : 0;
 			dq.frag0 = packet;
 			dq.totalFragments = 0; // 0 == unknown, waiting for Packet::Fragment
 			dq.haveFragments = 1; // head is first bit (left to right)
@@ -698,6 +733,7 @@ void Switch::_handleRemotePacketHead(const SharedPtr<Socket> &fromSock,const Ine
 				// packet already contains head, so append fragments
 				for(unsigned int f=1;f<dqe->second.totalFragments;++f)
 					packet->append(dqe->second.frags[f - 1].payload(),dqe->second.frags[f - 1].payloadLength());
+				RR->metrics->latencySince(Metrics::STAGE_DEFRAG,dqe->second.creationUs);
 				_defragQueue.erase(dqe);
 
 				if (!packet->tryDecode(RR)) {
@@ -744,6 +780,8 @@ Address Switch::_sendWhoisRequest(const Address &addr,const Address *peersAlread
 	if (supernode) {
 		Packet outp(supernode->address(),RR->identity.address(),Packet::VERB_WHOIS);
 		addr.appendTo(outp);
+		RR->metrics->inc(Metrics::COUNTER_WHOIS_SENT);
+		RR->metrics->sent(outp.verb());
 		outp.armor(supernode->key(),true);
 		uint64_t now = Utils::now();
 		if (supernode->send(RR,outp.data(),outp.size(),now) != Path::PATH_TYPE_NULL)
@@ -773,7 +811,10 @@ bool Switch::_trySend(const Packet &packet,bool encrypt)
 		unsigned int chunkSize = std::min(tmp.size(),(unsigned int)ZT_UDP_DEFAULT_PAYLOAD_MTU);
 		tmp.setFragmented(chunkSize < tmp.size());
 
+		RR->metrics->sent(tmp.verb());
+		const uint64_t encryptStart = (RR->metrics->latencyEnabled()) ? Utils::nowMicros() : 0;
 		tmp.armor(peer->key(),encrypt);
+		RR->metrics->latencySince(Metrics::STAGE_ENCRYPT,encryptStart);
 
 		if (via->send(RR,tmp.data(),chunkSize,now) != Path::PATH_TYPE_NULL) {
 			if (chunkSize < tmp.size()) {
@@ -46,6 +46,7 @@
 #include "SharedPtr.hpp"
 #include "IncomingPacket.hpp"
 #include "Socket.hpp"
+#include "CompressionPolicy.hpp"
 
 /* Ethernet frame types that might be relevant to us */
 #define ZT_ETHERTYPE_IPV4 0x0800
@@ -188,6 +189,14 @@ public:
 	 */
 	void doAnythingWaitingForPeer(const SharedPtr<Peer> &peer);
 
+	/**
+	 * Try again to decode packets in the receive queue
+	 *
+	 * Called when something they might be waiting on other than a new peer,
+	 * such as a background identity validation, has completed.
+	 */
+	void retryReceiveQueue();
+
 	/**
 	 * Perform retries and other periodic timer tasks
 	 * 
@@ -195,6 +204,11 @@ public:
 	 */
 	unsigned long doTimerTasks();
 
+	/**
+	 * @return Adaptive compression policy for outgoing frames
+	 */
+	inline const CompressionPolicy &compressionPolicy() const throw() { return _compressionPolicy; }
+
 	/**
 	 * @param etherType Ethernet type ID
 	 * @return Human-readable name
@@ -233,6 +247,7 @@ private:
 	struct DefragQueueEntry
 	{
 		uint64_t creationTime;
+		uint64_t creationUs; // for timing, 0 if not timed
 		SharedPtr<IncomingPacket> frag0;
 		Packet::Fragment frags[ZT_MAX_PACKET_FRAGMENTS - 1];
 		unsigned int totalFragments; // 0 if only frag0 received, waiting for frags
@@ -249,12 +264,14 @@ private:
 	struct TXQueueEntry
 	{
 		TXQueueEntry() {}
-		TXQueueEntry(uint64_t ct,const Packet &p,bool enc) :
+		TXQueueEntry(uint64_t ct,uint64_t cus,const Packet &p,bool enc) :
 			creationTime(ct),
+			creationUs(cus),
 			packet(p),
 			encrypt(enc) {}
 
 		uint64_t creationTime;
+		uint64_t creationUs; // for timing, 0 if not timed
 		Packet packet; // unencrypted/untagged for TX queue
 		bool encrypt;
 	};
@@ -280,6 +297,9 @@ private:
 	};
 	std::list<ContactQueueEntry> _contactQueue;
 	Mutex _contactQueue_m;
+
+	// Decides whether FRAME and EXT_FRAME payloads are worth compressing
+	CompressionPolicy _compressionPolicy;
 };
 
 } // namespace ZeroTier
@@ -31,6 +31,8 @@
 #include "NodeConfig.hpp"
 #include "CMWC4096.hpp"
 #include "Dictionary.hpp"
+#include "Salsa20.hpp"
+#include "Poly1305.hpp"
 
 #define ZT_PEER_WRITE_BUF_SIZE 131072
 
@@ -38,9 +40,23 @@ namespace ZeroTier {
 
 Topology::Topology(const RuntimeEnvironment *renv) :
 	RR(renv),
-	_idCacheBase(renv->homePath + ZT_PATH_SEPARATOR_S + "iddb.d"),
 	_amSupernode(false)
 {
+	std::string idsPath(RR->homePath + ZT_PATH_SEPARATOR_S + "identities.db");
+	const bool existed = Utils::fileExists(idsPath.c_str());
+	if (_ids.open(idsPath.c_str())) {
+		if (!existed) {
+			// One-time import from the old one-file-per-peer cache
+			std::string iddbDotD(RR->homePath + ZT_PATH_SEPARATOR_S + "iddb.d");
+			if (Utils::fileExists(iddbDotD.c_str(),false)) {
+				unsigned long n = _ids.importDirectory(iddbDotD.c_str());
+				_ids.sync();
+				LOG("imported %lu identities from %s into %s (%s is no longer used and may be deleted)",n,iddbDotD.c_str(),idsPath.c_str(),iddbDotD.c_str());
+			}
+		}
+	} else {
+		LOG("WARNING: unable to open identity store %s, peer identities will not be remembered across restarts",idsPath.c_str());
+	}
 }
 
 Topology::~Topology()
@@ -54,19 +70,25 @@ void Topology::setSupernodes(const std::map< Identity,std::vector< std::pair<Ine
 	if (_supernodes == sn)
 		return; // no change
 
+	uint64_t now = Utils::now();
+	for(std::vector< SharedPtr<Peer> >::const_iterator p(_supernodePeers.begin());p!=_supernodePeers.end();++p)
+		_keepalive.add(*p,false,now); // re-added below if still a supernode
+
 	_supernodes = sn;
 	_supernodeAddresses.clear();
 	_supernodePeers.clear();
-	uint64_t now = Utils::now();
 
 	for(std::map< Identity,std::vector< std::pair<InetAddress,bool> > >::const_iterator i(sn.begin());i!=sn.end();++i) {
 		if (i->first != RR->identity) { // do not add self as a peer
 			SharedPtr<Peer> &p = _activePeers[i->first.address()];
-			if (!p)
+			if (!p) {
 				p = SharedPtr<Peer>(new Peer(RR->identity,i->first));
+				_peerSnapshot.zero();
+			}
 			for(std::vector< std::pair<InetAddress,bool> >::const_iterator j(i->second.begin());j!=i->second.end();++j)
 				p->addPath(Path(j->first,(j->second) ? Path::PATH_TYPE_TCP_OUT : Path::PATH_TYPE_UDP,true));
 			p->use(now);
+			_keepalive.add(p,true,now);
 			_supernodePeers.push_back(p);
 		}
 		_supernodeAddresses.push_back(i->first.address());
@@ -109,9 +131,14 @@ SharedPtr<Peer> Topology::addPeer(const SharedPtr<Peer> &peer)
 	uint64_t now = Utils::now();
 	Mutex::Lock _l(_lock);
 
-	SharedPtr<Peer> p(_activePeers.insert(std::pair< Address,SharedPtr<Peer> >(peer->address(),peer)).first->second);
+	std::pair< std::map< Address,SharedPtr<Peer> >::iterator,bool > ins(_activePeers.insert(std::pair< Address,SharedPtr<Peer> >(peer->address(),peer)));
+	SharedPtr<Peer> p(ins.first->second);
+	if (ins.second) {
+		_peerSnapshot.zero();
+		_keepalive.add(p,false,now);
+	}
 	p->use(now);
-	_saveIdentity(p->identity());
+	_ids.put(p->identity());
 
 	return p;
 }
@@ -133,11 +160,13 @@ SharedPtr<Peer> Topology::getPeer(const Address &zta)
 		return ap;
 	}
 
-	Identity id(_getIdentity(zta));
+	Identity id(_ids.get(zta));
 	if (id) {
 		try {
 			ap = SharedPtr<Peer>(new Peer(RR->identity,id));
 			ap->use(now);
+			_peerSnapshot.zero();
+			_keepalive.add(ap,false,now);
 			return ap;
 		} catch ( ... ) {} // invalid identity?
 	}
@@ -250,12 +279,176 @@ void Topology::clean(uint64_t now)
 	Mutex::Lock _l(_lock);
 	for(std::map< Address,SharedPtr<Peer> >::iterator p(_activePeers.begin());p!=_activePeers.end();) {
 		if (((now - p->second->lastUsed()) >= ZT_PEER_IN_MEMORY_EXPIRATION)&&(std::find(_supernodeAddresses.begin(),_supernodeAddresses.end(),p->first) == _supernodeAddresses.end())) {
+			_keepalive.remove(p->first);
 			_activePeers.erase(p++);
+			_peerSnapshot.zero();
 		} else {
 			p->second->clean(now);
 			++p;
 		}
 	}
+	_ids.sync();
+	if (!RR->synchronous) // simulated nodes never accumulate enough to need it
+		_ids.compactInBackground();
+}
+
+unsigned long Topology::doKeepalives(uint64_t now)
+{
+	std::vector< SharedPtr<Peer> > ping;
+	const unsigned long next = _keepalive.due(now,_amSupernode,ping);
+	for(std::vector< SharedPtr<Peer> >::const_iterator p(ping.begin());p!=ping.end();++p)
+		(*p)->sendPing(RR,now);
+	return next;
+}
+
+// Peer snapshot file format:
+//   <[8] magic, last byte is format version>
+//   <[8] random IV>
+//   <[16] Poly1305 MAC of everything after this field>
+//   <[...] Salsa20-encrypted series of: <[2] length> <[...] serialized peer>>
+static const unsigned char ZT_PEER_SNAPSHOT_MAGIC[8] = { 'Z','T','P','E','E','R','S',0x01 };
+#define ZT_PEER_SNAPSHOT_HEADER_SIZE 32
+
+// Salsa20 key is the first 32 bytes of SHA-512(our private key), and as in
+// Packet the Poly1305 key is the first 32 bytes of the key stream.
+static bool _peerSnapshotCipher(const Identity &id,const unsigned char *iv,Salsa20 &s20,unsigned char *macKey)
+{
+	static const unsigned char zero[32] = { 0 };
+	unsigned char sha[64];
+	if (!id.sha512PrivateKey(sha))
+		return false;
+	s20.init(sha,256,iv,ZT_PROTO_SALSA20_ROUNDS);
+	s20.encrypt(zero,macKey,32);
+	Utils::burn(sha,sizeof(sha));
+	return true;
+}
+
+bool Topology::savePeers()
+{
+	SharedPtr<_PeerSnapshot> snapshot(_snapshot());
+	const std::vector< SharedPtr<Peer> > &peers = snapshot->peers;
+
+	// Reserve the most we could need so appending never reallocates and
+	// leaves plaintext copies of peer keys behind in freed memory.
+	std::string snap;
+	snap.reserve(ZT_PEER_SNAPSHOT_HEADER_SIZE + (peers.size() * (ZT_PEER_SUGGESTED_SERIALIZATION_BUFFER_SIZE + 2)));
+	snap.append((const char *)ZT_PEER_SNAPSHOT_MAGIC,8);
+	snap.append(ZT_PEER_SNAPSHOT_HEADER_SIZE - 8,(char)0);
+	Utils::getSecureRandom(&(snap[8]),8);
+
+	Buffer<ZT_PEER_SUGGESTED_SERIALIZATION_BUFFER_SIZE + 2> b;
+	for(std::vector< SharedPtr<Peer> >::const_iterator p(peers.begin());p!=peers.end();++p) {
+		try {
+			b.clear();
+			b.addSize(2);
+			(*p)->serialize(b);
+			b.setAt<uint16_t>(0,(uint16_t)(b.size() - 2));
+			snap.append((const char *)b.data(),b.size());
+		} catch ( ... ) {} // skip any that don't fit, should not happen
+	}
+	b.burn();
+
+	Salsa20 s20;
+	unsigned char macKey[32];
+	const unsigned int len = (unsigned int)(snap.length() - ZT_PEER_SNAPSHOT_HEADER_SIZE);
+	unsigned char *const payload = (unsigned char *)&(snap[ZT_PEER_SNAPSHOT_HEADER_SIZE]);
+	if (!_peerSnapshotCipher(RR->identity,(const unsigned char *)snap.data() + 8,s20,macKey)) {
+		Utils::burn(payload,len);
+		return false;
+	}
+	if (len)
+		s20.encrypt(payload,payload,len);
+	Poly1305::compute(&(snap[16]),payload,len,macKey);
+	Utils::burn(macKey,sizeof(macKey));
+
+	// Write to a locked down temporary file and rename it into place, so
+	// a crash mid-write can't leave a truncated snapshot behind.
+	std::string path(RR->homePath + ZT_PATH_SEPARATOR_S + "peers.persist");
+	std::string tmpPath(path + ".tmp");
+	bool ok = Utils::writeFile(tmpPath.c_str(),snap);
+	Utils::burn(&(snap[0]),(unsigned int)snap.length());
+	if (ok) {
+		Utils::lockDownFile(tmpPath.c_str(),false);
+#ifdef __WINDOWS__
+		ok = (MoveFileExA(tmpPath.c_str(),path.c_str(),MOVEFILE_REPLACE_EXISTING) != FALSE);
+#else
+		ok = (rename(tmpPath.c_str(),path.c_str()) == 0);
+#endif
+	}
+	if (!ok)
+		Utils::rm(tmpPath);
+	return ok;
+}
+
+unsigned int Topology::loadPeers()
+{
+	std::string path(RR->homePath + ZT_PATH_SEPARATOR_S + "peers.persist");
+	std::string snap;
+	if (!Utils::readFile(path.c_str(),snap))
+		return 0;
+	if ((snap.length() < ZT_PEER_SNAPSHOT_HEADER_SIZE)||(memcmp(snap.data(),ZT_PEER_SNAPSHOT_MAGIC,8)))
+		return 0;
+
+	Salsa20 s20;
+	unsigned char macKey[32],mac[16];
+	if (!_peerSnapshotCipher(RR->identity,(const unsigned char *)snap.data() + 8,s20,macKey))
+		return 0;
+	const unsigned int len = (unsigned int)(snap.length() - ZT_PEER_SNAPSHOT_HEADER_SIZE);
+	unsigned char *const payload = (unsigned char *)&(snap[ZT_PEER_SNAPSHOT_HEADER_SIZE]);
+	Poly1305::compute(mac,payload,len,macKey);
+	Utils::burn(macKey,sizeof(macKey));
+	if (!Utils::secureEq(mac,snap.data() + 16,16)) {
+		LOG("peer snapshot %s failed authentication, ignoring",path.c_str());
+		return 0;
+	}
+	if (len)
+		s20.encrypt(payload,payload,len);
+
+	unsigned int count = 0;
+	const uint64_t now = Utils::now();
+	Buffer<ZT_PEER_SUGGESTED_SERIALIZATION_BUFFER_SIZE> b;
+	for(unsigned int ptr=0;(ptr + 2)<=len;) {
+		const unsigned int plen = ((unsigned int)payload[ptr] << 8) | (unsigned int)payload[ptr + 1];
+		ptr += 2;
+		if ((ptr + plen) > len)
+			break;
+		try {
+			b.copyFrom(payload + ptr,plen);
+			unsigned int bp = 0;
+			SharedPtr<Peer> p(Peer::deserializeNew(b,bp));
+			if (p->address() != RR->identity.address()) {
+				Mutex::Lock _l(_lock);
+				SharedPtr<Peer> &ap = _activePeers[p->address()];
+				if (!ap) {
+					ap = p;
+					ap->use(now);
+					_peerSnapshot.zero();
+					_keepalive.add(ap,(std::find(_supernodeAddresses.begin(),_supernodeAddresses.end(),ap->address()) != _supernodeAddresses.end()),now);
+					++count;
+				}
+			}
+		} catch ( ... ) {} // skip bad entries
+		ptr += plen;
+	}
+	Utils::burn(payload,len);
+	b.burn();
+
+	return count;
+}
+
+SharedPtr<Topology::_PeerSnapshot> Topology::_snapshot()
+{
+	Mutex::Lock _l(_lock);
+	if (!_peerSnapshot) {
+		SharedPtr<_PeerSnapshot> snap(new _PeerSnapshot());
+		snap->peers.reserve(_activePeers.size());
+		for(std::map< Address,SharedPtr<Peer> >::const_iterator p(_activePeers.begin());p!=_activePeers.end();++p) {
+			if (p->second)
+				snap->peers.push_back(p->second);
+		}
+		_peerSnapshot = snap;
+	}
+	return _peerSnapshot;
 }
 
 bool Topology::authenticateRootTopology(const Dictionary &rt)
@@ -276,24 +469,4 @@ bool Topology::authenticateRootTopology(const Dictionary &rt)
 	}
 }
 
-Identity Topology::_getIdentity(const Address &zta)
-{
-	std::string idcPath(_idCacheBase + ZT_PATH_SEPARATOR_S + zta.toString());
-	std::string ids;
-	if (Utils::readFile(idcPath.c_str(),ids)) {
-		try {
-			return Identity(ids);
-		} catch ( ... ) {} // ignore invalid IDs
-	}
-	return Identity();
-}
-
-void Topology::_saveIdentity(const Identity &id)
-{
-	if (id) {
-		std::string idcPath(_idCacheBase + ZT_PATH_SEPARATOR_S + id.address().toString());
-		Utils::writeFile(idcPath.c_str(),id.toString(false));
-	}
-}
-
 } // namespace ZeroTier
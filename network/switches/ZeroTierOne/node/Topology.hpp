@@ -40,8 +40,13 @@
 
 #include "Address.hpp"
 #include "Identity.hpp"
+#include "IdentityStore.hpp"
+#include "KeepaliveScheduler.hpp"
 #include "Peer.hpp"
 #include "Mutex.hpp"
+#include "SharedPtr.hpp"
+#include "AtomicCounter.hpp"
+#include "NonCopyable.hpp"
 #include "InetAddress.hpp"
 #include "Utils.hpp"
 #include "Packet.hpp"
@@ -169,91 +174,98 @@ public:
 	 */
 	void clean(uint64_t now);
 
+	/**
+	 * Send keepalive pings that are due
+	 *
+	 * @param now Current time
+	 * @return Milliseconds until this should be called again
+	 */
+	unsigned long doKeepalives(uint64_t now);
+
+	/**
+	 * Set keepalive intervals in ms (0 disables pings for that kind of peer)
+	 *
+	 * @param supernode Interval for supernodes
+	 * @param active Interval for peers with recent frames
+	 * @param idle Interval for other peers
+	 */
+	inline void setKeepaliveIntervals(unsigned long supernode,unsigned long active,unsigned long idle) { _keepalive.setIntervals(supernode,active,idle); }
+
+	/**
+	 * @return Keepalive scheduler statistics
+	 */
+	inline KeepaliveScheduler::Stats keepaliveStats() const { return _keepalive.stats(); }
+
+	/**
+	 * Write an encrypted snapshot of all known peers for warm restart
+	 *
+	 * The snapshot holds each peer's identity, derived secret key, UDP
+	 * paths, remote version and latency. It's encrypted and authenticated
+	 * with a key derived from this node's private key.
+	 *
+	 * @return True if snapshot was written
+	 */
+	bool savePeers();
+
+	/**
+	 * Restore peers from a snapshot written by savePeers()
+	 *
+	 * Peers already in memory are not replaced. A snapshot that fails
+	 * authentication (corrupt, or written under a different identity) is
+	 * ignored.
+	 *
+	 * @return Number of peers restored
+	 */
+	unsigned int loadPeers();
+
 	/**
 	 * Apply a function or function object to all peers
 	 *
+	 * This iterates over a snapshot of the peer set taken when it's called,
+	 * and _lock is not held while f runs. So f may call other methods of
+	 * Topology, and may send packets without blocking getPeer(). Peers added
+	 * or removed during iteration may or may not be seen.
+	 *
 	 * Note: explicitly template this by reference if you want the object
 	 * passed by reference instead of copied.
 	 *
-	 * Warning: be careful not to use features in these that call any other
-	 * methods of Topology that may lock _lock, otherwise a recursive lock
-	 * and deadlock or lock corruption may occur.
-	 *
 	 * @param f Function to apply
 	 * @tparam F Function or function object type
 	 */
 	template<typename F>
 	inline void eachPeer(F f)
 	{
-		Mutex::Lock _l(_lock);
-		for(std::map< Address,SharedPtr<Peer> >::const_iterator p(_activePeers.begin());p!=_activePeers.end();++p)
-			f(*this,p->second);
+		SharedPtr<_PeerSnapshot> snap(_snapshot());
+		for(std::vector< SharedPtr<Peer> >::const_iterator p(snap->peers.begin());p!=snap->peers.end();++p)
+			f(*this,*p);
 	}
 
 	/**
 	 * Apply a function or function object to all supernode peers
 	 *
+	 * Like eachPeer(), this iterates over a copy and does not hold _lock
+	 * while f runs.
+	 *
 	 * Note: explicitly template this by reference if you want the object
 	 * passed by reference instead of copied.
 	 *
-	 * Warning: be careful not to use features in these that call any other
-	 * methods of Topology that may lock _lock, otherwise a recursive lock
-	 * and deadlock or lock corruption may occur.
-	 *
 	 * @param f Function to apply
 	 * @tparam F Function or function object type
 	 */
 	template<typename F>
 	inline void eachSupernodePeer(F f)
 	{
-		Mutex::Lock _l(_lock);
-		for(std::vector< SharedPtr<Peer> >::const_iterator p(_supernodePeers.begin());p!=_supernodePeers.end();++p)
+		std::vector< SharedPtr<Peer> > snp(supernodePeers());
+		for(std::vector< SharedPtr<Peer> >::const_iterator p(snp.begin());p!=snp.end();++p)
 			f(*this,*p);
 	}
 
 	/**
-	 * Pings all peers that need a ping sent, excluding supernodes
+	 * Ping supernodes we've lost touch with
 	 *
-	 * Ordinary peers are pinged if we haven't heard from them recently. Receive
-	 * time rather than send time as OK is returned on success and we want to
-	 * keep trying if a packet is lost. Ordinary peers are subject to a frame
-	 * inactivity timeout. We give up if we haven't actually transferred any
-	 * data to them recently, and eventually Topology purges them from memory.
-	 */
-	class PingPeersThatNeedPing
-	{
-	public:
-		PingPeersThatNeedPing(const RuntimeEnvironment *renv,uint64_t now) throw() :
-			_now(now),
-			_supernodeAddresses(renv->topology->supernodeAddresses()),
-			RR(renv) {}
-
-		inline void operator()(Topology &t,const SharedPtr<Peer> &p)
-		{
-			/* For ordinary nodes we ping if they've sent us a frame recently,
-			 * otherwise they are stale and we let the link die.
-			 *
-			 * Note that we measure ping time from time of last receive rather
-			 * than time of last send in order to only count full round trips. */
-			if ( (std::find(_supernodeAddresses.begin(),_supernodeAddresses.end(),p->address()) == _supernodeAddresses.end()) &&
-			     ((_now - p->lastFrame()) < ZT_PEER_PATH_ACTIVITY_TIMEOUT) &&
-			     ((_now - p->lastDirectReceive()) >= ZT_PEER_DIRECT_PING_DELAY) ) {
-				p->sendPing(RR,_now);
-			}
-		}
-
-	private:
-		uint64_t _now;
-		std::vector<Address> _supernodeAddresses;
-		const RuntimeEnvironment *RR;
-	};
-
-	/**
-	 * Ping peers that need ping according to supernode rules
-	 *
-	 * Supernodes ping aggressively if a ping is unanswered and they are not
-	 * subject to the activity timeout. In other words: we assume they are
-	 * always there and always try to reach them.
+	 * Supernodes ping aggressively after a resynchronize or if a ping is
+	 * unanswered. In other words: we assume they are always there and always
+	 * try to reach them. Routine keepalives are left to doKeepalives().
 	 *
 	 * The ultimate rate limit for this is controlled up in the Node main loop.
 	 */
@@ -273,7 +285,7 @@ public:
 			uint64_t lp = 0;
 			uint64_t lr = 0;
 			p->lastPingAndDirectReceive(lp,lr);
-			if ( (lr < RR->timeOfLastResynchronize) || ((lr < lp)&&((lp - lr) >= ZT_PING_UNANSWERED_AFTER)) || ((_now - lr) >= ZT_PEER_DIRECT_PING_DELAY) )
+			if ( (lr < RR->timeOfLastResynchronize) || ((lr < lp)&&((lp - lr) >= ZT_PING_UNANSWERED_AFTER)) )
 				p->sendPing(RR,_now);
 		}
 
@@ -362,14 +374,36 @@ public:
 	static bool authenticateRootTopology(const Dictionary &rt);
 
 private:
-	Identity _getIdentity(const Address &zta);
-	void _saveIdentity(const Identity &id);
+	/**
+	 * Immutable copy of the peers in _activePeers, shared by iterators
+	 *
+	 * It's rebuilt on the next eachPeer() after a peer is added or removed,
+	 * so while the peer set is stable, repeated iterations share one copy.
+	 */
+	class _PeerSnapshot : NonCopyable
+	{
+		friend class SharedPtr<_PeerSnapshot>;
+
+	public:
+		_PeerSnapshot() {}
+
+		std::vector< SharedPtr<Peer> > peers;
+
+	private:
+		~_PeerSnapshot() {}
+
+		AtomicCounter __refCount;
+	};
+
+	SharedPtr<_PeerSnapshot> _snapshot();
 
 	const RuntimeEnvironment *RR;
 
-	std::string _idCacheBase;
+	IdentityStore _ids; // public identities of peers we've seen
 
 	std::map< Address,SharedPtr<Peer> > _activePeers;
+	SharedPtr<_PeerSnapshot> _peerSnapshot; // NULL if _activePeers changed since last built
+	KeepaliveScheduler _keepalive; // peers are added when they enter _activePeers
 	std::map< Identity,std::vector< std::pair<InetAddress,bool> > > _supernodes;
 	std::vector< Address > _supernodeAddresses;
 	std::vector< SharedPtr<Peer> > _supernodePeers;
@@ -54,6 +54,11 @@ namespace ZeroTier {
 
 const char Utils::HEXCHARS[16] = { '0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f' };
 
+#ifdef ZT_SIMULATION
+uint64_t Utils::_simulatedTime = 0;
+static uint64_t _simulatedRandomState = 0;
+#endif
+
 #ifdef __UNIX_LIKE__
 bool Utils::redirectUnixOutputs(const char *stdoutPath,const char *stderrPath)
 	throw()
@@ -206,8 +211,34 @@ unsigned int Utils::unhex(const char *hex,unsigned int maxlen,void *buf,unsigned
 	return l;
 }
 
+#ifdef ZT_SIMULATION
+void Utils::simulate(uint64_t seed,uint64_t startTime)
+{
+	_simulatedRandomState = seed;
+	_simulatedTime = startTime;
+}
+#endif
+
 void Utils::getSecureRandom(void *buf,unsigned int bytes)
 {
+#ifdef ZT_SIMULATION
+	if (_simulatedTime) {
+		// splitmix64, single-threaded use only
+		uint64_t r = 0;
+		for(unsigned int i=0;i<bytes;++i) {
+			if (!(i & 7)) {
+				r = (_simulatedRandomState += 0x9e3779b97f4a7c15ULL);
+				r = (r ^ (r >> 30)) * 0xbf58476d1ce4e5b9ULL;
+				r = (r ^ (r >> 27)) * 0x94d049bb133111ebULL;
+				r ^= (r >> 31);
+			}
+			((unsigned char *)buf)[i] = (unsigned char)r;
+			r >>= 8;
+		}
+		return;
+	}
+#endif // ZT_SIMULATION
+
 #ifdef __WINDOWS__
 
 	static HCRYPTPROV cryptProvider = NULL;
@@ -178,7 +178,9 @@ public:
 	 * Generate secure random bytes
 	 *
 	 * This will try to use whatever OS sources of entropy are available. It's
-	 * guarded by an internal mutex so it's thread-safe.
+	 * guarded by an internal mutex so it's thread-safe. In ZT_SIMULATION
+	 * builds, after simulate() this is instead a deterministic stream and is
+	 * not secure.
 	 *
 	 * @param buf Buffer to fill
 	 * @param bytes Number of random bytes to generate
@@ -220,12 +222,51 @@ public:
 	 */
 	static int64_t getFileSize(const char *path);
 
+#ifdef ZT_SIMULATION
+	/**
+	 * Switch to a simulated clock and deterministic random numbers
+	 *
+	 * This is for single-threaded discrete-event simulation (see testnet)
+	 * and exists only in ZT_SIMULATION builds, which are never shipped.
+	 * From here on now(), nowf() and nowMicros() return the time last set
+	 * with setSimulatedTime() and getSecureRandom() returns a repeatable
+	 * stream derived from the seed. There is no way back.
+	 *
+	 * @param seed Random number stream seed
+	 * @param startTime Initial simulated time in ms since epoch (must be nonzero)
+	 */
+	static void simulate(uint64_t seed,uint64_t startTime);
+
+	/**
+	 * @param t New simulated time in ms since epoch (must not go backwards)
+	 */
+	static inline void setSimulatedTime(uint64_t t) throw() { _simulatedTime = t; }
+
+	/**
+	 * @return True if simulate() has been called
+	 */
+	static inline bool simulating() throw() { return (_simulatedTime != 0); }
+#endif // ZT_SIMULATION
+
 	/**
 	 * @return Current time in milliseconds since epoch
 	 */
 	static inline uint64_t now()
 		throw()
 	{
+#ifdef ZT_SIMULATION
+		if (_simulatedTime)
+			return _simulatedTime;
+#endif
+		return nowReal();
+	}
+
+	/**
+	 * @return Current wall clock time in milliseconds since epoch, even when simulating
+	 */
+	static inline uint64_t nowReal()
+		throw()
+	{
 #ifdef __WINDOWS__
 		FILETIME ft;
 		SYSTEMTIME st;
@@ -248,6 +289,10 @@ public:
 	static inline double nowf()
 		throw()
 	{
+#ifdef ZT_SIMULATION
+		if (_simulatedTime)
+			return ((double)_simulatedTime / 1000.0);
+#endif
 #ifdef __WINDOWS__
 		FILETIME ft;
 		SYSTEMTIME st;
@@ -264,6 +309,30 @@ public:
 #endif
 	}
 
+	/**
+	 * @return Current time in microseconds since epoch (for measuring short intervals)
+	 */
+	static inline uint64_t nowMicros()
+		throw()
+	{
+#ifdef ZT_SIMULATION
+		if (_simulatedTime)
+			return (_simulatedTime * 1000ULL);
+#endif
+#ifdef __WINDOWS__
+		FILETIME ft;
+		ULARGE_INTEGER tmp;
+		GetSystemTimeAsFileTime(&ft);
+		tmp.LowPart = ft.dwLowDateTime;
+		tmp.HighPart = ft.dwHighDateTime;
+		return ((tmp.QuadPart - 116444736000000000ULL) / 10ULL);
+#else
+		struct timeval tv;
+		gettimeofday(&tv,(struct timezone *)0);
+		return ( (1000000ULL * (uint64_t)tv.tv_sec) + (uint64_t)tv.tv_usec );
+#endif
+	}
+
 	/**
 	 * Read the full contents of a file into a string buffer
 	 *
@@ -395,6 +464,37 @@ public:
 		return strtoull(s,(char **)0,16);
 #endif
 	}
+
+	/**
+	 * Parse hex digits from a buffer that need not be null-terminated
+	 *
+	 * Like hexStrToU64(s) this skips leading spaces and stops at the first
+	 * non-hex character, but it never reads more than len characters.
+	 *
+	 * @param s Hex characters
+	 * @param len Maximum number of characters to read
+	 * @return Parsed value or 0 if none
+	 */
+	static inline unsigned long long hexStrToU64(const char *s,unsigned int len)
+		throw()
+	{
+		const char *const eof = s + len;
+		while ((s != eof)&&((*s == ' ')||(*s == '\t')))
+			++s;
+		unsigned long long v = 0;
+		while (s != eof) {
+			const char c = *(s++);
+			if ((c >= '0')&&(c <= '9'))
+				v = (v << 4) | (unsigned long long)(c - '0');
+			else if ((c >= 'a')&&(c <= 'f'))
+				v = (v << 4) | (unsigned long long)(c - ('a' - 10));
+			else if ((c >= 'A')&&(c <= 'F'))
+				v = (v << 4) | (unsigned long long)(c - ('A' - 10));
+			else break;
+		}
+		return v;
+	}
+
 	static inline long long hexStrTo64(const char *s)
 		throw()
 	{
@@ -614,6 +714,11 @@ public:
 	 * Hexadecimal characters 0-f
 	 */
 	static const char HEXCHARS[16];
+
+#ifdef ZT_SIMULATION
+private:
+	static uint64_t _simulatedTime;
+#endif
 };
 
 } // namespace ZeroTier
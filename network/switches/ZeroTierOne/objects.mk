@@ -1,4 +1,5 @@
 OBJS=\
+	control/ControlStream.o \
 	control/IpcConnection.o \
 	control/IpcListener.o \
 	control/NodeControlClient.o \
@@ -9,12 +10,18 @@ OBJS=\
 	node/CertificateOfMembership.o \
 	node/Defaults.o \
 	node/Dictionary.o \
+	node/DictionaryReader.o \
 	node/HttpClient.o \
 	node/Identity.o \
+	node/IdentityStore.o \
+	node/IdentityValidator.o \
 	node/IncomingPacket.o \
 	node/InetAddress.o \
+	node/KeepaliveScheduler.o \
 	node/Logger.o \
+	node/Metrics.o \
 	node/Multicaster.o \
+	node/NetconfCache.o \
 	node/Network.o \
 	node/NetworkConfig.o \
 	node/Node.o \
@@ -49,6 +49,13 @@
 #include <netinet/tcp.h>
 #endif // !__WINDOWS__
 
+#ifdef __LINUX__
+#include <sys/uio.h>
+#endif
+
+// Maximum number of messages handed to sendmmsg() at once
+#define ZT_NATIVE_SOCKET_MANAGER_MAX_SENDMMSG 64
+
 // Uncomment to turn off TCP Nagle
 //#define ZT_TCP_NODELAY
 
@@ -702,6 +709,74 @@ bool NativeSocketManager::send(const InetAddress &to,bool tcp,bool autoConnectTc
 	return false;
 }
 
+#ifdef __LINUX__
+// Sends a run of UDP messages on one socket with as few sendmmsg() calls as possible
+static unsigned int _sendmmsgAll(int fd,SocketManager::UdpBatchEntry **ents,unsigned int n)
+{
+	struct mmsghdr msgs[ZT_NATIVE_SOCKET_MANAGER_MAX_SENDMMSG];
+	struct iovec iovs[ZT_NATIVE_SOCKET_MANAGER_MAX_SENDMMSG];
+	unsigned int sent = 0;
+
+	memset(msgs,0,sizeof(struct mmsghdr) * n);
+	for(unsigned int i=0;i<n;++i) {
+		iovs[i].iov_base = const_cast<void *>(ents[i]->msg);
+		iovs[i].iov_len = ents[i]->msglen;
+		msgs[i].msg_hdr.msg_name = const_cast<struct sockaddr *>(ents[i]->to.saddr());
+		msgs[i].msg_hdr.msg_namelen = ents[i]->to.saddrLen();
+		msgs[i].msg_hdr.msg_iov = &(iovs[i]);
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	unsigned int i = 0;
+	while (i < n) {
+		int r = ::sendmmsg(fd,msgs + i,n - i,0);
+		if (r <= 0) {
+			// The message at i failed; skip it and keep going with the rest
+			if ((r < 0)&&(errno == EINTR))
+				continue;
+			ents[i++]->ok = false;
+			continue;
+		}
+		for(int k=0;k<r;++k,++i) {
+			if ((ents[i]->ok = (msgs[i].msg_len == ents[i]->msglen)))
+				++sent;
+		}
+	}
+
+	return sent;
+}
+
+unsigned int NativeSocketManager::sendUdpBatch(UdpBatchEntry *batch,unsigned int count)
+{
+	UdpBatchEntry *ents[ZT_NATIVE_SOCKET_MANAGER_MAX_SENDMMSG];
+	unsigned int sent = 0;
+
+	for(int v6=0;v6<2;++v6) {
+		SharedPtr<Socket> sock(v6 ? _udpV6Socket : _udpV4Socket);
+		const int fd = (sock) ? ((NativeUdpSocket *)sock.ptr())->_sock : -1;
+		unsigned int n = 0;
+		for(unsigned int i=0;i<count;++i) {
+			if (v6 ? batch[i].to.isV6() : batch[i].to.isV4()) {
+				if (fd < 0) {
+					batch[i].ok = false;
+					continue;
+				}
+				ents[n++] = &(batch[i]);
+				if (n == ZT_NATIVE_SOCKET_MANAGER_MAX_SENDMMSG) {
+					sent += _sendmmsgAll(fd,ents,n);
+					n = 0;
+				}
+			} else if ((v6)&&(!batch[i].to.isV4()))
+				batch[i].ok = false;
+		}
+		if (n)
+			sent += _sendmmsgAll(fd,ents,n);
+	}
+
+	return sent;
+}
+#endif // __LINUX__
+
 void NativeSocketManager::poll(unsigned long timeout,void (*handler)(const SharedPtr<Socket> &,void *,const InetAddress &,Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> &),void *arg)
 {
 	fd_set rfds,wfds,efds;
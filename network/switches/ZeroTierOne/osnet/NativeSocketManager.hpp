@@ -70,6 +70,9 @@ public:
 	virtual ~NativeSocketManager();
 
 	virtual bool send(const InetAddress &to,bool tcp,bool autoConnectTcp,const void *msg,unsigned int msglen);
+#ifdef __LINUX__
+	virtual unsigned int sendUdpBatch(UdpBatchEntry *batch,unsigned int count);
+#endif
 	virtual void poll(unsigned long timeout,void (*handler)(const SharedPtr<Socket> &,void *,const InetAddress &,Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> &),void *arg);
 	virtual void whack();
 	virtual void closeTcpSockets();
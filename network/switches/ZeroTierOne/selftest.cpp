@@ -34,18 +34,34 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <map>
 
 #include "node/Constants.hpp"
 #include "node/RuntimeEnvironment.hpp"
 #include "node/InetAddress.hpp"
 #include "node/Utils.hpp"
 #include "node/Identity.hpp"
+#include "node/IdentityValidator.hpp"
+#include "node/IdentityStore.hpp"
 #include "node/Packet.hpp"
 #include "node/Salsa20.hpp"
 #include "node/MAC.hpp"
 #include "node/Peer.hpp"
+#include "node/Topology.hpp"
+#include "node/KeepaliveScheduler.hpp"
+#include "node/Multicaster.hpp"
+#include "node/MulticastGroup.hpp"
+#include "node/CMWC4096.hpp"
+#include "node/Logger.hpp"
+#include "node/Metrics.hpp"
+#include "node/MPSCQueue.hpp"
+#include "node/Thread.hpp"
 #include "node/NodeConfig.hpp"
 #include "node/Dictionary.hpp"
+#include "node/DictionaryReader.hpp"
+#include "node/NetworkConfig.hpp"
+#include "node/Hashtable.hpp"
+#include "node/CompressionPolicy.hpp"
 #include "node/EthernetTap.hpp"
 #include "node/SHA512.hpp"
 #include "node/C25519.hpp"
@@ -54,9 +70,19 @@
 #include "node/HttpClient.hpp"
 #include "node/Defaults.hpp"
 #include "node/Node.hpp"
+#include "node/Service.hpp"
+#include "node/NetconfCache.hpp"
+
+#include "control/ControlStream.hpp"
 
 #ifdef __WINDOWS__
 #include <tchar.h>
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #endif
 
 using namespace ZeroTier;
@@ -151,8 +177,187 @@ static void testHttpHandler(void *arg,int code,const std::string &url,const std:
 	webDone = true;
 }
 
+#ifdef __UNIX_LIKE__
+// Minimal HTTP server on 127.0.0.1 for testing HttpClient without a network
+struct HttpTestServer
+{
+	HttpTestServer() : listenSocket(-1),port(0),accepted(0),run(true) {}
+	void threadMain()
+		throw()
+	{
+		while (run) {
+			int s = accept(listenSocket,(struct sockaddr *)0,(socklen_t *)0);
+			if (s < 0)
+				continue;
+			++accepted;
+			struct timeval tv;
+			tv.tv_sec = 2; // so a client that wrongly opens a second connection fails instead of hanging
+			tv.tv_usec = 0;
+			setsockopt(s,SOL_SOCKET,SO_RCVTIMEO,(const void *)&tv,sizeof(tv));
+			std::string in;
+			for(;;) {
+				std::string::size_type e = in.find("\r\n\r\n");
+				if (e == std::string::npos) {
+					char buf[4096];
+					int n = (int)recv(s,buf,sizeof(buf),0);
+					if (n <= 0)
+						break;
+					in.append(buf,n);
+					continue;
+				}
+				const std::string path(in.substr(4,in.find(' ',4) - 4));
+				in = in.substr(e + 4);
+				char tmp[64];
+				std::string resp;
+				bool closeAfter = false;
+				if (path == "/fixed") {
+					Utils::snprintf(tmp,sizeof(tmp),"%u",(unsigned int)body.length());
+					resp = std::string("HTTP/1.1 200 OK\r\nContent-Length: ") + tmp + "\r\n\r\n" + body;
+				} else if (path == "/chunked") {
+					resp = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+					for(unsigned int p=0,i=0;p<body.length();++i) {
+						const unsigned int n = std::min((unsigned int)body.length() - p,1 + ((i * 997) % 5000));
+						Utils::snprintf(tmp,sizeof(tmp),"%x\r\n",n);
+						resp.append(tmp);
+						resp.append(body,p,n);
+						resp.append("\r\n");
+						p += n;
+					}
+					resp.append("0\r\n\r\n");
+				} else if (path == "/close") {
+					resp = std::string("HTTP/1.0 200 OK\r\n\r\n") + body;
+					closeAfter = true;
+				} else resp = "HTTP/1.1 404 Not Found\r\nContent-Length: 9\r\n\r\nnot found";
+				for(unsigned int p=0;p<resp.length();) {
+#ifdef MSG_NOSIGNAL
+					int n = (int)send(s,resp.data() + p,(unsigned int)resp.length() - p,MSG_NOSIGNAL); // client may hang up early
+#else
+					int n = (int)send(s,resp.data() + p,(unsigned int)resp.length() - p,0);
+#endif
+					if (n <= 0)
+						break;
+					p += (unsigned int)n;
+				}
+				if (closeAfter)
+					break;
+			}
+			close(s);
+		}
+	}
+	int listenSocket;
+	unsigned int port;
+	volatile unsigned int accepted;
+	volatile bool run;
+	std::string body;
+};
+
+static volatile bool localHttpDone = false;
+static int localHttpCode = 0;
+static std::string localHttpBody;
+static std::string localHttpSunk;
+static void localHttpHandler(void *arg,int code,const std::string &url,const std::string &body)
+{
+	localHttpCode = code;
+	localHttpBody = body;
+	localHttpDone = true;
+}
+static bool localHttpSink(void *arg,const void *data,unsigned int len)
+{
+	localHttpSunk.append((const char *)data,len);
+	return (arg == (void *)0);
+}
+
+static bool localHttpGet(HttpClient &http,const HttpTestServer &srv,const char *path,bool sink,bool rejectInSink = false)
+{
+	char url[128];
+	Utils::snprintf(url,sizeof(url),"http://127.0.0.1:%u%s",srv.port,path);
+	localHttpDone = false;
+	localHttpCode = 0;
+	localHttpBody = "";
+	localHttpSunk = "";
+	if (sink)
+		http.GET(url,HttpClient::NO_HEADERS,10,&localHttpSink,&localHttpHandler,(rejectInSink) ? (void *)&http : (void *)0);
+	else http.GET(url,HttpClient::NO_HEADERS,10,&localHttpHandler,(void *)0);
+	for(unsigned int i=0;((!localHttpDone)&&(i<1000));++i)
+		Thread::sleep(10);
+	return localHttpDone;
+}
+
+static int testLocalHttp()
+{
+	HttpTestServer srv;
+	for(unsigned int i=0;i<100000;++i)
+		srv.body.push_back((char)('a' + ((i * 7919) % 26)));
+
+	srv.listenSocket = (int)socket(AF_INET,SOCK_STREAM,0);
+	struct sockaddr_in sin;
+	memset(&sin,0,sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t sinlen = sizeof(sin);
+	if ((srv.listenSocket < 0)||(bind(srv.listenSocket,(const struct sockaddr *)&sin,sizeof(sin)))||(listen(srv.listenSocket,4))||(getsockname(srv.listenSocket,(struct sockaddr *)&sin,&sinlen))) {
+		std::cout << "[http] unable to start local test server, skipping local tests" << std::endl;
+		if (srv.listenSocket >= 0)
+			close(srv.listenSocket);
+		return 0;
+	}
+	srv.port = ntohs(sin.sin_port);
+	Thread th(Thread::start(&srv));
+
+	int r = 0;
+	{
+		HttpClient http;
+
+		std::cout << "[http] local: Content-Length, chunked, and 404 responses over one kept-alive connection... "; std::cout.flush();
+		if ((!localHttpGet(http,srv,"/fixed",false))||(localHttpCode != 200)||(localHttpBody != srv.body)) {
+			std::cout << "FAIL (fixed: " << localHttpCode << " " << localHttpBody.length() << " bytes)" << std::endl;
+			r = -1;
+		} else if ((!localHttpGet(http,srv,"/chunked",false))||(localHttpCode != 200)||(localHttpBody != srv.body)) {
+			std::cout << "FAIL (chunked: " << localHttpCode << " " << localHttpBody.length() << " bytes)" << std::endl;
+			r = -1;
+		} else if ((!localHttpGet(http,srv,"/missing",false))||(localHttpCode != 404)||(localHttpBody != "Not Found")) {
+			std::cout << "FAIL (missing: " << localHttpCode << " " << localHttpBody << ")" << std::endl;
+			r = -1;
+		} else if ((!localHttpGet(http,srv,"/fixed",false))||(localHttpCode != 200)||(localHttpBody != srv.body)||(srv.accepted != 1)) {
+			std::cout << "FAIL (" << srv.accepted << " connections)" << std::endl;
+			r = -1;
+		} else std::cout << "PASS" << std::endl;
+
+		if (!r) {
+			std::cout << "[http] local: body ended by close, streaming sink, sink abort... "; std::cout.flush();
+			if ((!localHttpGet(http,srv,"/close",false))||(localHttpCode != 200)||(localHttpBody != srv.body)) {
+				std::cout << "FAIL (close: " << localHttpCode << " " << localHttpBody.length() << " bytes)" << std::endl;
+				r = -1;
+			} else if ((!localHttpGet(http,srv,"/chunked",true))||(localHttpCode != 200)||(localHttpBody.length())||(localHttpSunk != srv.body)) {
+				std::cout << "FAIL (sink: " << localHttpCode << " " << localHttpSunk.length() << " bytes)" << std::endl;
+				r = -1;
+			} else if ((!localHttpGet(http,srv,"/fixed",true,true))||(localHttpCode != -1)) {
+				std::cout << "FAIL (sink abort: " << localHttpCode << ")" << std::endl;
+				r = -1;
+			} else std::cout << "PASS (" << srv.accepted << " connections)" << std::endl;
+		}
+	}
+
+	srv.run = false;
+	{
+		int s = (int)socket(AF_INET,SOCK_STREAM,0); // unblock accept()
+		connect(s,(const struct sockaddr *)&sin,sizeof(sin));
+		close(s);
+	}
+	Thread::join(th);
+	close(srv.listenSocket);
+
+	return r;
+}
+#endif // __UNIX_LIKE__
+
 static int testHttp()
 {
+#ifdef __UNIX_LIKE__
+	if (testLocalHttp())
+		return -1;
+#endif
+
 	HttpClient http;
 
 	webSha512ShouldBe = "221b348c8278ad2063c158fb15927c35dc6bb42880daf130d0574025f88ec350811c34fae38a014b576d3ef5c98af32bb540e68204810db87a51fa9b239ea567";
@@ -418,6 +623,21 @@ static int testIdentity()
 		}
 	}
 
+	for(unsigned int threads=2;threads<=4;threads+=2) {
+		std::cout << "[identity] Generate identity with " << threads << " threads... "; std::cout.flush();
+		uint64_t genstart = Utils::now();
+		uint64_t tried = id.generate(threads);
+		uint64_t genend = Utils::now();
+		std::cout << "(took " << (genend - genstart) << "ms, " << tried << " keys tried): " << id.address().toString() << std::endl;
+		std::cout << "[identity] Locally validate identity: ";
+		if ((tried)&&(id.locallyValidate())) {
+			std::cout << "PASS" << std::endl;
+		} else {
+			std::cout << "FAIL" << std::endl;
+			return -1;
+		}
+	}
+
 	{
 		Identity id2;
 		buf.clear();
@@ -470,9 +690,591 @@ static int testIdentity()
 		}
 	}
 
+	{
+		RuntimeEnvironment renv; // no Switch, so finished validations notify nobody
+		Identity good,bad;
+		good.fromString(KNOWN_GOOD_IDENTITY);
+		bad.fromString(KNOWN_BAD_IDENTITY);
+
+		std::cout << "[identity] IdentityValidator (sync, cached): "; std::cout.flush();
+		{
+			IdentityValidator idv(&renv,0);
+			if ((!idv.validate(good))||(idv.validate(bad))||(!idv.validate(good))||(idv.validate(bad))||(idv.cacheSize() != 2)||(idv.validateAsync(good) != IdentityValidator::VALID)) {
+				std::cout << "FAIL" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+
+		std::cout << "[identity] IdentityValidator (async): "; std::cout.flush();
+		{
+			IdentityValidator idv(&renv,2);
+			IdentityValidator::Result gr = IdentityValidator::PENDING,br = IdentityValidator::PENDING;
+			for(unsigned int i=0;((i<1000)&&((gr == IdentityValidator::PENDING)||(br == IdentityValidator::PENDING)));++i) {
+				gr = idv.validateAsync(good);
+				br = idv.validateAsync(bad);
+				Thread::sleep(5);
+			}
+			if ((gr != IdentityValidator::VALID)||(br != IdentityValidator::INVALID)||(idv.pendingCount())) {
+				std::cout << "FAIL" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+
+		// Each HELLO from a new identity costs one validation
+		std::cout << "[identity] Benchmarking HELLO identity validation..." << std::endl;
+		const unsigned int bench = 64;
+		char *genmem = new char[ZT_IDENTITY_GEN_MEMORY];
+		IdentityValidator idv(&renv,0);
+		for(int mode=0;mode<3;++mode) {
+			const unsigned int n = ((mode == 2) ? (bench * 1000) : bench);
+			bool ok = true;
+			uint64_t start = Utils::now();
+			for(unsigned int i=0;i<n;++i) {
+				switch(mode) {
+					case 0: ok &= good.locallyValidate(); break;
+					case 1: ok &= good.locallyValidate(genmem); break;
+					case 2: ok &= idv.validate(good); break;
+				}
+			}
+			uint64_t end = Utils::now();
+			if (!ok) {
+				std::cout << "FAIL" << std::endl;
+				delete [] genmem;
+				return -1;
+			}
+			static const char *modeNames[3] = { "fresh scratch each call","reused scratch","validation cache" };
+			std::cout << "[identity]   " << modeNames[mode] << ": " << ((double)n / ((double)(end - start + 1) / 1000.0)) << " HELLOs/sec" << std::endl;
+		}
+		delete [] genmem;
+	}
+
+	std::cout << "[identity] Testing Peer serialize/deserialize for warm restart... "; std::cout.flush();
+	{
+		Identity self;
+		self.fromString(KNOWN_GOOD_IDENTITY);
+		SharedPtr<Peer> p1(new Peer(self,self));
+		p1->use(12345);
+		Path udp4(InetAddress("10.1.2.3",9993),Path::PATH_TYPE_UDP,true);
+		udp4.received(1000); udp4.sent(2000); udp4.pinged(3000);
+		p1->addPath(udp4);
+		p1->addPath(Path(InetAddress("fd00::1234",9993),Path::PATH_TYPE_UDP,false));
+		p1->addPath(Path(InetAddress("10.9.9.9",443),Path::PATH_TYPE_TCP_OUT,false));
+
+		Buffer<ZT_PEER_SUGGESTED_SERIALIZATION_BUFFER_SIZE> b;
+		p1->serialize(b);
+		unsigned int ptr = 0;
+		SharedPtr<Peer> p2(Peer::deserializeNew(b,ptr));
+		std::vector<Path> paths(p2->paths());
+		if ((ptr != b.size())||(p2->identity() != self)||(memcmp(p2->key(),p1->key(),ZT_PEER_SECRET_KEY_LENGTH))||(p2->lastUsed() != 12345)) {
+			std::cout << "FAIL (peer)" << std::endl;
+			return -1;
+		}
+		if ((paths.size() != 2)||(paths[0] != udp4)||(!paths[0].fixed())||(paths[0].lastReceived() != 1000)||(paths[0].lastSend() != 2000)||(paths[0].lastPing() != 3000)||(paths[1].address() != InetAddress("fd00::1234",9993))) {
+			std::cout << "FAIL (paths)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	return 0;
+}
+
+// Identities with made-up public keys, since the store doesn't validate
+static Identity makeStoreTestIdentity(uint64_t a)
+{
+	unsigned char pub[ZT_C25519_PUBLIC_KEY_LEN];
+	Utils::getSecureRandom(pub,sizeof(pub));
+	Identity id;
+	id.fromString((Address(a).toString() + ":0:" + Utils::hex(pub,sizeof(pub))).c_str());
+	return id;
+}
+
+static int testIdentityStore()
+{
+	const char *path = "selftest-identities.db";
+	const char *dir = "selftest-iddb.d";
+	const unsigned int count = 20000;
+	Utils::rm(path);
+	Utils::rm(std::string(path) + ".compact");
+
+	std::vector<Identity> ids;
+	for(unsigned int i=0;i<count;++i)
+		ids.push_back(makeStoreTestIdentity(0x0100000000ULL + ((uint64_t)i * 7919ULL)));
+
+	std::cout << "[idstore] Store and look up " << count << " identities... "; std::cout.flush();
+	{
+		IdentityStore st;
+		if (!st.open(path)) {
+			std::cout << "FAIL (open)" << std::endl;
+			return -1;
+		}
+		for(unsigned int i=0;i<count;++i) {
+			if (!st.put(ids[i])) {
+				std::cout << "FAIL (put)" << std::endl;
+				return -1;
+			}
+		}
+		if ((st.put(ids[0]))||(st.size() != count)) {
+			std::cout << "FAIL (duplicate)" << std::endl;
+			return -1;
+		}
+		uint64_t start = Utils::now();
+		for(unsigned int k=0;k<10;++k) {
+			for(unsigned int i=0;i<count;++i) {
+				if (st.get(ids[i].address()) != ids[i]) {
+					std::cout << "FAIL (get)" << std::endl;
+					return -1;
+				}
+			}
+		}
+		uint64_t end = Utils::now();
+		if (st.get(Address(0x0200000000ULL))) {
+			std::cout << "FAIL (phantom)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << ((double)(count * 10) / ((double)(end - start + 1) / 1000.0)) << " lookups/sec)" << std::endl;
+	}
+
+	std::cout << "[idstore] Replace identities and reopen... "; std::cout.flush();
+	{
+		IdentityStore st;
+		if ((!st.open(path))||(st.size() != count)) {
+			std::cout << "FAIL (reopen)" << std::endl;
+			return -1;
+		}
+		for(unsigned int k=0;k<2;++k) {
+			for(unsigned int i=0;i<count;++i) {
+				ids[i] = makeStoreTestIdentity(ids[i].address().toInt());
+				st.put(ids[i]);
+			}
+		}
+	}
+	{
+		IdentityStore st;
+		if ((!st.open(path))||(st.size() != count)||(st.superseded() != (count * 2))) {
+			std::cout << "FAIL (reopen)" << std::endl;
+			return -1;
+		}
+		for(unsigned int i=0;i<count;++i) {
+			if (st.get(ids[i].address()) != ids[i]) {
+				std::cout << "FAIL (get)" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+
+		std::cout << "[idstore] Compact in background... "; std::cout.flush();
+		if (!st.compactInBackground()) {
+			std::cout << "FAIL (not started)" << std::endl;
+			return -1;
+		}
+		// Keep reading and writing while compaction runs
+		Identity extra(makeStoreTestIdentity(0x0300000000ULL));
+		st.put(extra);
+		for(unsigned int i=0;i<count;++i) {
+			if (st.get(ids[i].address()) != ids[i]) {
+				std::cout << "FAIL (get during compaction)" << std::endl;
+				return -1;
+			}
+		}
+		for(unsigned int i=0;((i<1000)&&(st.superseded()));++i)
+			Thread::sleep(10);
+		if ((st.superseded())||(st.size() != (count + 1))||(st.get(extra.address()) != extra)) {
+			std::cout << "FAIL (superseded: " << st.superseded() << ")" << std::endl;
+			return -1;
+		}
+		for(unsigned int i=0;i<count;++i) {
+			if (st.get(ids[i].address()) != ids[i]) {
+				std::cout << "FAIL (get after compaction)" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS (" << (Utils::getFileSize(path) / ZT_IDENTITY_STORE_RECORD_SIZE) << " records in file)" << std::endl;
+	}
+	Utils::rm(path);
+
+	std::cout << "[idstore] Import iddb.d directory... "; std::cout.flush();
+	{
+#ifdef __WINDOWS__
+		CreateDirectoryA(dir,NULL);
+#else
+		mkdir(dir,0700);
+#endif
+		for(unsigned int i=0;i<100;++i)
+			Utils::writeFile((std::string(dir) + ZT_PATH_SEPARATOR_S + ids[i].address().toString()).c_str(),ids[i].toString(false));
+		Utils::writeFile((std::string(dir) + ZT_PATH_SEPARATOR_S + "garbage").c_str(),std::string("garbage"));
+		IdentityStore st;
+		unsigned long n = 0;
+		if (st.open(path))
+			n = st.importDirectory(dir);
+		bool ok = (n == 100);
+		for(unsigned int i=0;i<100;++i) {
+			ok &= (st.get(ids[i].address()) == ids[i]);
+			Utils::rm(std::string(dir) + ZT_PATH_SEPARATOR_S + ids[i].address().toString());
+		}
+		Utils::rm(std::string(dir) + ZT_PATH_SEPARATOR_S + "garbage");
+#ifdef __WINDOWS__
+		RemoveDirectoryA(dir);
+#else
+		rmdir(dir);
+#endif
+		if (!ok) {
+			std::cout << "FAIL" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+	Utils::rm(path);
+
 	return 0;
 }
 
+// Calls back into Topology from inside eachPeer(), which used to deadlock
+struct TopologyTestReentrantVisitor
+{
+	TopologyTestReentrantVisitor() : visited(0),found(0),slow(false) {}
+	inline void operator()(Topology &t,const SharedPtr<Peer> &p)
+	{
+		++visited;
+		if (t.getPeer(p->address()) == p)
+			++found;
+		if (slow)
+			Thread::sleep(1); // stand-in for sending a ping
+	}
+	unsigned int visited,found;
+	bool slow;
+};
+
+struct TopologyTestLookupThread
+{
+	TopologyTestLookupThread(Topology &t,const std::vector<Address> &a) : topology(t),addrs(a),lookups(0),run(true) {}
+	void threadMain()
+		throw()
+	{
+		for(unsigned int i=0;run;++i) {
+			topology.getPeer(addrs[i % addrs.size()]);
+			++lookups;
+		}
+	}
+	Topology &topology;
+	const std::vector<Address> &addrs;
+	volatile unsigned long lookups;
+	volatile bool run;
+};
+
+static int testTopology()
+{
+	const char *home = "selftest-topology.d";
+	const unsigned int count = 500;
+#ifdef __WINDOWS__
+	CreateDirectoryA(home,NULL);
+#else
+	mkdir(home,0700);
+#endif
+	const std::string idsPath(std::string(home) + ZT_PATH_SEPARATOR_S + "identities.db");
+	Utils::rm(idsPath);
+
+	RuntimeEnvironment renv;
+	renv.homePath = home;
+	renv.identity.fromString(KNOWN_GOOD_IDENTITY);
+
+	int r = 0;
+	{
+		Topology t(&renv);
+		std::vector<Address> addrs;
+		for(unsigned int i=0;i<count;++i) {
+			SharedPtr<Peer> p(new Peer(renv.identity,makeStoreTestIdentity(0x0200000000ULL + (uint64_t)i)));
+			t.addPeer(p);
+			addrs.push_back(p->address());
+		}
+
+		std::cout << "[topology] eachPeer() callbacks calling back into Topology... "; std::cout.flush();
+		TopologyTestReentrantVisitor v;
+		t.eachPeer<TopologyTestReentrantVisitor &>(v);
+		if ((v.visited != count)||(v.found != count)) {
+			std::cout << "FAIL (" << v.visited << " visited, " << v.found << " found)" << std::endl;
+			r = -1;
+		} else std::cout << "PASS" << std::endl;
+
+		if (!r) {
+			std::cout << "[topology] getPeer() from another thread during a slow eachPeer()... "; std::cout.flush();
+			TopologyTestLookupThread lt(t,addrs);
+			Thread th(Thread::start(&lt));
+			TopologyTestReentrantVisitor sv;
+			sv.slow = true;
+			uint64_t start = Utils::now();
+			t.eachPeer<TopologyTestReentrantVisitor &>(sv);
+			uint64_t end = Utils::now();
+			const unsigned long during = lt.lookups;
+			lt.run = false;
+			Thread::join(th);
+			if ((sv.visited != count)||(during == 0)) {
+				std::cout << "FAIL" << std::endl;
+				r = -1;
+			} else std::cout << "PASS (" << during << " lookups during a " << (end - start) << "ms iteration)" << std::endl;
+		}
+	}
+
+	Utils::rm(idsPath);
+#ifdef __WINDOWS__
+	RemoveDirectoryA(home);
+#else
+	rmdir(home);
+#endif
+	return r;
+}
+
+static int testKeepalive()
+{
+	const unsigned int count = 2000;
+	const unsigned long interval = 60000;
+	const uint64_t t0 = 1000000000ULL; // simulated clock
+	Identity self;
+	self.fromString(KNOWN_GOOD_IDENTITY);
+
+	std::cout << "[keepalive] Spreading keepalives for " << count << " peers learned at once... "; std::cout.flush();
+
+	// Treat them as supernodes so they're pinged with no frame traffic. Also
+	// add some idle ordinary peers, which should never be pinged.
+	KeepaliveScheduler ks;
+	ks.setIntervals(interval,interval,0);
+	std::vector< SharedPtr<Peer> > peers;
+	for(unsigned int i=0;i<(count + 100);++i) {
+		SharedPtr<Peer> p(new Peer(self,makeStoreTestIdentity(0x0300000000ULL + (uint64_t)i)));
+		Path path(InetAddress(Utils::hton((uint32_t)(0x0a000000 + i)),9993),Path::PATH_TYPE_UDP,false);
+		path.received(t0);
+		p->addPath(path);
+		p->use(t0);
+		ks.add(p,(i < count),t0);
+		peers.push_back(p);
+	}
+
+	// Run until every peer should have had its first ping, as the main
+	// loop would. Peers never answer, so anything after that is a retry.
+	std::map<Address,unsigned int> pinged;
+	unsigned long perSecond = 0,peak = 0,mostPerRun = 0;
+	uint64_t second = 0;
+	for(uint64_t now=t0;now<=(t0 + interval);now+=10) {
+		std::vector< SharedPtr<Peer> > ping;
+		ks.due(now,false,ping);
+		if (ping.size() > mostPerRun)
+			mostPerRun = (unsigned long)ping.size();
+		if ((now / 1000) != second) {
+			second = now / 1000;
+			perSecond = 0;
+		}
+		perSecond += (unsigned long)ping.size();
+		if (perSecond > peak)
+			peak = perSecond;
+		for(std::vector< SharedPtr<Peer> >::iterator p(ping.begin());p!=ping.end();++p)
+			++pinged[(*p)->address()];
+	}
+
+	bool ok = (pinged.size() == count)&&(mostPerRun <= ZT_KEEPALIVE_MAX_PER_TICK)&&(peak < (count / 2))&&(ks.stats().pingsSent == count);
+	for(unsigned int i=0;i<count;++i)
+		ok &= (pinged[peers[i]->address()] == 1);
+	for(unsigned int i=count;i<(count + 100);++i)
+		ok &= (pinged.find(peers[i]->address()) == pinged.end());
+	if (!ok) {
+		std::cout << "FAIL (" << pinged.size() << " pinged, " << mostPerRun << " most per run, peak " << peak << "/sec)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS (peak " << peak << "/sec, " << mostPerRun << " most per run)" << std::endl;
+
+	std::cout << "[keepalive] Removed peers are never pinged again... "; std::cout.flush();
+	for(unsigned int i=0;i<(count / 2);++i)
+		ks.remove(peers[i]->address());
+	pinged.clear();
+	for(uint64_t now=(t0 + interval + 10);now<=(t0 + interval + (ZT_PING_CHECK_DELAY * 2));now+=10) {
+		std::vector< SharedPtr<Peer> > ping;
+		ks.due(now,false,ping);
+		for(std::vector< SharedPtr<Peer> >::iterator p(ping.begin());p!=ping.end();++p)
+			++pinged[(*p)->address()];
+	}
+	ok = ((ks.size() == (count + 100 - (count / 2)))&&(pinged.size() == (count - (count / 2))));
+	for(unsigned int i=0;i<(count / 2);++i)
+		ok &= (pinged.find(peers[i]->address()) == pinged.end());
+	if (!ok) {
+		std::cout << "FAIL (" << ks.size() << " scheduled, " << pinged.size() << " pinged)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[keepalive] pings/sec histogram:";
+	const KeepaliveScheduler::Stats st(ks.stats());
+	for(unsigned int i=0;i<ZT_KEEPALIVE_HISTOGRAM_BUCKETS;++i) {
+		if (st.pingsPerSecondHistogram[i])
+			std::cout << " " << (1UL << i) << "+:" << st.pingsPerSecondHistogram[i] << "s";
+	}
+	std::cout << std::endl;
+
+	return 0;
+}
+
+// Runs one gather and returns the member indices it listed, or an empty vector
+// and ok=false if the packet's count fields don't match what was appended.
+static std::vector<unsigned int> multicasterGather(const Multicaster &mc,const std::vector<Address> &members,const Address &queryingPeer,uint64_t nwid,const MulticastGroup &mg,unsigned int limit,unsigned int &totalKnown,bool &ok)
+{
+	std::vector<unsigned int> got;
+	Packet outp(Address(),Address(),Packet::VERB_OK);
+	const unsigned int at = outp.size();
+	const unsigned int added = mc.gather(queryingPeer,nwid,mg,outp,limit);
+	totalKnown = outp.at<uint32_t>(at);
+	ok = ((outp.at<uint16_t>(at + 4) == added)&&(outp.size() == (at + 6 + (added * ZT_ADDRESS_LENGTH))));
+	for(unsigned int i=0;i<added;++i) {
+		const Address a(outp.field(at + 6 + (i * ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
+		const std::vector<Address>::const_iterator m(std::find(members.begin(),members.end(),a));
+		if (m == members.end()) {
+			ok = false;
+			got.push_back(0xffffffff);
+		} else got.push_back((unsigned int)(m - members.begin()));
+	}
+	return got;
+}
+
+static int testMulticaster()
+{
+	const char *home = "selftest-multicaster.d";
+	const unsigned int count = 40;
+	const unsigned int qi = 7; // index of querying peer
+	const uint64_t nwid = 0x8056c2e21c000001ULL;
+	const MulticastGroup mg(MAC(0xff,0xff,0xff,0xff,0xff,0xff),0);
+	const uint64_t t0 = 1000000000ULL;
+#ifdef __WINDOWS__
+	CreateDirectoryA(home,NULL);
+#else
+	mkdir(home,0700);
+#endif
+	const std::string idsPath(std::string(home) + ZT_PATH_SEPARATOR_S + "identities.db");
+	const std::string localConfPath(std::string(home) + ZT_PATH_SEPARATOR_S + "local.conf");
+
+	RuntimeEnvironment renv; // no Switch, so nothing is ever sent
+	renv.homePath = home;
+	renv.identity.fromString(KNOWN_GOOD_IDENTITY);
+	renv.prng = new CMWC4096();
+	renv.topology = new Topology(&renv);
+	renv.nc = new NodeConfig(&renv);
+
+	int r = 0;
+	{
+		Multicaster mc(&renv);
+		std::vector<Address> members;
+		for(unsigned int i=0;i<count;++i) {
+			members.push_back(Address(0x0400000000ULL + (uint64_t)i));
+			mc.add(t0,nwid,mg,members.back(),members.back());
+		}
+
+		// Below, just below, at and above the member count. Each limit is tried
+		// enough times that random windows both wrap and cover the querying peer.
+		const unsigned int limits[4] = { 5,count - 1,count,count + 10 };
+		for(unsigned int li=0;((!r)&&(li<4));++li) {
+			const unsigned int limit = limits[li];
+			const unsigned int n = std::min(limit,count); // window length before skipping the querying peer
+			std::cout << "[multicaster] gather() with limit " << limit << " from a group of " << count << "... "; std::cout.flush();
+			unsigned int wrapped = 0,coveredQuerier = 0;
+			for(unsigned int k=0;k<500;++k) {
+				unsigned int totalKnown = 0;
+				bool ok = false;
+				const std::vector<unsigned int> got(multicasterGather(mc,members,members[qi],nwid,mg,limit,totalKnown,ok));
+				ok &= ((got.size() == std::min(limit,count - 1))&&(totalKnown == count));
+
+				// Must be the window starting at some member, with the querying peer
+				// replaced by the next member after the window or, if the window
+				// already covers the group, by the window's last member.
+				bool matched = false;
+				for(unsigned int s=0;((ok)&&(!matched)&&(s<count));++s) {
+					std::vector<unsigned int> w;
+					for(unsigned int i=0;i<n;++i)
+						w.push_back((s + i) % count);
+					const std::vector<unsigned int>::iterator q(std::find(w.begin(),w.end(),qi));
+					const bool hasQuerier = (q != w.end());
+					if (hasQuerier) {
+						if (n < count)
+							*q = (s + n) % count;
+						else {
+							*q = w.back();
+							w.pop_back();
+						}
+					}
+					if (w == got) {
+						matched = true;
+						if ((s + n) > count)
+							++wrapped;
+						if (hasQuerier)
+							++coveredQuerier;
+					}
+				}
+				ok &= matched;
+
+				std::vector<unsigned int> sorted(got);
+				std::sort(sorted.begin(),sorted.end());
+				ok &= ((std::unique(sorted.begin(),sorted.end()) == sorted.end())&&(std::find(got.begin(),got.end(),qi) == got.end()));
+
+				if (!ok) {
+					std::cout << "FAIL (got " << got.size() << " members, total " << totalKnown << ")" << std::endl;
+					r = -1;
+					break;
+				}
+			}
+			if ((!r)&&((!wrapped)||(!coveredQuerier))) {
+				std::cout << "FAIL (window never wrapped or never covered the querying peer)" << std::endl;
+				r = -1;
+			}
+			if (!r)
+				std::cout << "PASS (" << wrapped << " wrapped)" << std::endl;
+		}
+
+		// Refresh everyone except one member halfway through its lifetime. It
+		// stays in the block until clean() rebuilds it, and is gone after that.
+		// A member added after the rebuild is appended to the new block in place.
+		if (!r) {
+			std::cout << "[multicaster] gather() after a member expires between block rebuilds... "; std::cout.flush();
+			const unsigned int xi = 20;
+			for(unsigned int i=0;i<count;++i) {
+				if (i != xi)
+					mc.add(t0 + (ZT_MULTICAST_LIKE_EXPIRE / 2),nwid,mg,members[i],members[i]);
+			}
+
+			unsigned int totalKnown = 0;
+			bool ok = false;
+			std::vector<unsigned int> got(multicasterGather(mc,members,members[qi],nwid,mg,count + 10,totalKnown,ok));
+			ok &= ((got.size() == (count - 1))&&(totalKnown == count)&&(std::find(got.begin(),got.end(),xi) != got.end()));
+
+			mc.clean(t0 + ZT_MULTICAST_LIKE_EXPIRE + 1);
+			members.push_back(Address(0x0400000000ULL + (uint64_t)count));
+			mc.add(t0 + ZT_MULTICAST_LIKE_EXPIRE + 2,nwid,mg,members.back(),members.back());
+
+			for(unsigned int k=0;((ok)&&(k<100));++k) {
+				got = multicasterGather(mc,members,members[qi],nwid,mg,(k & 1) ? 5 : (count + 10),totalKnown,ok);
+				std::vector<unsigned int> sorted(got);
+				std::sort(sorted.begin(),sorted.end());
+				ok &= ((totalKnown == count)&&(got.size() == ((k & 1) ? 5 : (count - 1))));
+				ok &= ((std::unique(sorted.begin(),sorted.end()) == sorted.end())&&(std::find(got.begin(),got.end(),qi) == got.end())&&(std::find(got.begin(),got.end(),xi) == got.end()));
+				if (!(k & 1))
+					ok &= (std::find(got.begin(),got.end(),count) != got.end());
+			}
+			if (!ok) {
+				std::cout << "FAIL (got " << got.size() << " members, total " << totalKnown << ")" << std::endl;
+				r = -1;
+			} else std::cout << "PASS" << std::endl;
+		}
+	}
+
+	delete renv.nc;
+	delete renv.topology;
+	delete renv.prng;
+	Utils::rm(idsPath);
+	Utils::rm(localConfPath);
+#ifdef __WINDOWS__
+	RemoveDirectoryA(home);
+#else
+	rmdir(home);
+#endif
+	return r;
+}
+
 static int testCertificate()
 {
 	Identity authority;
@@ -548,6 +1350,79 @@ static int testCertificate()
 	return 0;
 }
 
+// Representative Ethernet payloads for compression benchmarks
+static const char *const benchHttpPayload =
+	"HTTP/1.1 200 OK\r\nDate: Mon, 27 Jul 2014 12:28:53 GMT\r\nServer: Apache/2.2.14 (Ubuntu)\r\n"
+	"Last-Modified: Wed, 22 Jul 2014 19:15:56 GMT\r\nContent-Type: text/html; charset=UTF-8\r\n"
+	"Cache-Control: max-age=3600\r\nConnection: keep-alive\r\n\r\n"
+	"<!DOCTYPE html><html><head><title>Example</title><link rel=\"stylesheet\" href=\"/css/main.css\"></head>"
+	"<body><div class=\"nav\"><ul><li><a href=\"/\">Home</a></li><li><a href=\"/about\">About</a></li>"
+	"<li><a href=\"/blog\">Blog</a></li><li><a href=\"/contact\">Contact</a></li></ul></div>"
+	"<div class=\"content\"><p>Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor "
+	"incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco "
+	"laboris nisi ut aliquip ex ea commodo consequat.</p><p>Duis aute irure dolor in reprehenderit in voluptate "
+	"velit esse cillum dolore eu fugiat nulla pariatur.</p></div><div class=\"footer\"><a href=\"/\">Home</a> "
+	"| <a href=\"/about\">About</a> | <a href=\"/blog\">Blog</a></div></body></html>";
+static const unsigned char benchArpPayload[28] = { 0x00,0x01,0x08,0x00,0x06,0x04,0x00,0x01,0x32,0x8a,0x1f,0x20,0x31,0x0c,0x0a,0x01,0x02,0x03,0x00,0x00,0x00,0x00,0x00,0x00,0x0a,0x01,0x02,0x04 };
+static const unsigned char benchDnsPayload[74] = { 0x45,0x00,0x00,0x4a,0x1c,0x46,0x40,0x00,0x40,0x11,0x0b,0x6e,0x0a,0x01,0x02,0x03,0x08,0x08,0x08,0x08,0xd4,0x31,0x00,0x35,0x00,0x36,0x8f,0x1a,0x9e,0x5b,0x01,0x00,0x00,0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x03,0x77,0x77,0x77,0x07,0x65,0x78,0x61,0x6d,0x70,0x6c,0x65,0x03,0x63,0x6f,0x6d,0x00,0x00,0x01,0x00,0x01,0x00,0x00,0x29,0x10,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 };
+
+static int benchCompression(const char *name,const void *payload,unsigned int len)
+{
+	static unsigned int lz4State[16384]; // larger than LZ4_sizeofState(), aligned
+	static const char *const modeNames[5] = { "oneshot","accel1","accel1+state","accel4+state","accel16+state" };
+	char tmp[ZT_PROTO_MAX_PACKET_LENGTH * 2];
+
+	if ((unsigned int)LZ4_sizeofState() > sizeof(lz4State)) {
+		std::cout << "FAIL (LZ4 state too large)" << std::endl;
+		return -1;
+	}
+
+	Packet tmpl(Address(),Address(),Packet::VERB_FRAME);
+	tmpl.append((uint64_t)0);
+	tmpl.append((uint16_t)0x0800);
+	tmpl.append(payload,len);
+
+	std::cout << "[packet] Benchmarking compression (" << name << ", " << tmpl.size() << " bytes):";
+	for(unsigned int mode=0;mode<5;++mode) {
+		unsigned long iterations = 0;
+		unsigned int outSize = 0;
+		const uint64_t start = Utils::now();
+		uint64_t end;
+		do {
+			for(unsigned int k=0;k<1000;++k) {
+				Packet p(tmpl);
+				if (mode == 0) {
+					// The old one-shot path: always compresses in full, even if there's no gain
+					const int pl = (int)(p.size() - ZT_PACKET_IDX_PAYLOAD);
+					const int cl = LZ4_compress((const char *)p.field(ZT_PACKET_IDX_PAYLOAD,pl),tmp,pl);
+					outSize = ((cl > 0)&&(cl < pl)) ? (unsigned int)cl + ZT_PACKET_IDX_PAYLOAD : p.size();
+				} else {
+					switch(mode) {
+						case 1: p.compress(1); break;
+						case 2: p.compress(1,lz4State); break;
+						case 3: p.compress(4,lz4State); break;
+						default: p.compress(16,lz4State); break;
+					}
+					if ((k == 0)&&(iterations == 0)) {
+						Packet u(p);
+						if ((!u.uncompress())||(u != tmpl)) {
+							std::cout << " FAIL (" << modeNames[mode] << " round trip)" << std::endl;
+							return -1;
+						}
+					}
+					outSize = p.size();
+				}
+			}
+			iterations += 1000;
+			end = Utils::now();
+		} while ((end - start) < 100);
+		std::cout << ' ' << modeNames[mode] << '=' << (((double)iterations * (double)tmpl.size() / 1048576.0) / ((double)(end - start) / 1000.0)) << "MiB/s," << ((double)outSize / (double)tmpl.size());
+	}
+	std::cout << std::endl;
+
+	return 0;
+}
+
 static int testPacket()
 {
 	unsigned char salsaKey[32],hmacKey[32];
@@ -589,7 +1464,660 @@ static int testPacket()
 		return -1;
 	}
 
+	{
+		Packet tmpl(b);
+		tmpl.compress();
+		unsigned char copybuf[ZT_PROTO_MAX_PACKET_LENGTH];
+		const Address copyDest((uint64_t)0x1234567890ULL);
+		tmpl.armorCopy(salsaKey,true,copyDest,copybuf);
+		Packet c(Buffer<ZT_PROTO_MAX_PACKET_LENGTH>(copybuf,tmpl.size()));
+		if ((c.destination() != copyDest)||(!c.dearmor(salsaKey))||(!c.uncompress())||(c.size() != b.size())||(memcmp(c.field(ZT_PACKET_IDX_PAYLOAD,c.size() - ZT_PACKET_IDX_PAYLOAD),b.field(ZT_PACKET_IDX_PAYLOAD,b.size() - ZT_PACKET_IDX_PAYLOAD),c.size() - ZT_PACKET_IDX_PAYLOAD))) {
+			std::cout << "FAIL (armorCopy)" << std::endl;
+			return -1;
+		}
+	}
+
 	std::cout << "PASS" << std::endl;
+
+	for(unsigned int i=0;i<1400;++i)
+		fuzzbuf[i] = (unsigned char)rand();
+	if (benchCompression("HTTP",benchHttpPayload,(unsigned int)strlen(benchHttpPayload)))
+		return -1;
+	if (benchCompression("ARP",benchArpPayload,sizeof(benchArpPayload)))
+		return -1;
+	if (benchCompression("DNS",benchDnsPayload,sizeof(benchDnsPayload)))
+		return -1;
+	if (benchCompression("encrypted",fuzzbuf,1400))
+		return -1;
+
+	return 0;
+}
+
+struct LoggerTestThread
+{
+	LoggerTestThread() : log((Logger *)0),id(0),count(0),burst(0) {}
+	void threadMain()
+		throw()
+	{
+		for(unsigned int i=0;i<count;++i) {
+			log->log("thread %u message %u (%s)",id,i,"padding to make this look like a typical log line");
+			if ((burst)&&(((i + 1) % burst) == 0))
+				Thread::sleep(5);
+		}
+	}
+	Logger *log;
+	unsigned int id,count;
+	unsigned int burst; // if nonzero, pause after this many lines
+};
+
+static int testLogger()
+{
+	const char *path = "selftest-logger.log";
+	const unsigned int threads = 4;
+	const unsigned int perThread = 50000;
+
+	for(int async=0;async<2;++async) {
+		Utils::rm(path);
+		Utils::rm(std::string(path) + ".old");
+
+		std::cout << "[logger] " << threads << " threads logging " << perThread << " lines each, " << (async ? "async" : "sync") << "... "; std::cout.flush();
+		Logger *log = new Logger(path,(const char *)0,0,(async != 0));
+		LoggerTestThread lt[threads];
+		Thread th[threads];
+		uint64_t start = Utils::now();
+		for(unsigned int i=0;i<threads;++i) {
+			lt[i].log = log;
+			lt[i].id = i;
+			lt[i].count = perThread;
+			th[i] = Thread::start(&(lt[i]));
+		}
+		for(unsigned int i=0;i<threads;++i)
+			Thread::join(th[i]);
+		uint64_t end = Utils::now();
+		const unsigned long dropped = log->dropped();
+		delete log; // async mode writes everything still queued
+
+		std::string contents;
+		Utils::readFile(path,contents);
+		unsigned long lines = 0,dropNotices = 0,droppedReported = 0;
+		for(std::string::size_type p=0;p<contents.length();) {
+			std::string::size_type eol = contents.find('\n',p);
+			if (eol == std::string::npos)
+				eol = contents.length();
+			const std::string line(contents.substr(p,eol - p));
+			std::string::size_type d = line.find(" log messages dropped");
+			if (d != std::string::npos) {
+				droppedReported += strtoul(line.c_str() + line.rfind(' ',d - 1) + 1,(char **)0,10);
+				++dropNotices;
+			} else ++lines;
+			p = eol + 1;
+		}
+		if (((lines + dropped) != (threads * perThread))||(droppedReported != dropped)||((!async)&&(dropped))) {
+			std::cout << "FAIL (" << lines << " lines, " << dropped << " dropped, " << droppedReported << " reported)" << std::endl;
+			Utils::rm(path);
+			return -1;
+		}
+		std::cout << "PASS (" << ((double)((end - start) * 1000000ULL) / (double)(threads * perThread)) << " ns/line, " << dropped << " dropped)" << std::endl;
+	}
+
+	// At a rate the writer can keep up with, async mode must not drop
+	// anything and each thread's lines must come out in the order logged.
+	{
+		const unsigned int paced = 2000;
+		Utils::rm(path);
+		std::cout << "[logger] " << threads << " threads logging " << paced << " lines each in bursts of 32, async... "; std::cout.flush();
+		Logger *log = new Logger(path,(const char *)0,0,true);
+		LoggerTestThread lt[threads];
+		Thread th[threads];
+		for(unsigned int i=0;i<threads;++i) {
+			lt[i].log = log;
+			lt[i].id = i;
+			lt[i].count = paced;
+			lt[i].burst = 32;
+			th[i] = Thread::start(&(lt[i]));
+		}
+		for(unsigned int i=0;i<threads;++i)
+			Thread::join(th[i]);
+		const unsigned long dropped = log->dropped();
+		delete log;
+
+		std::string contents;
+		Utils::readFile(path,contents);
+		unsigned int next[threads];
+		memset(next,0,sizeof(next));
+		bool ok = (dropped == 0);
+		for(std::string::size_type p=0;(ok)&&(p<contents.length());) {
+			std::string::size_type eol = contents.find('\n',p);
+			if (eol == std::string::npos)
+				eol = contents.length();
+			const std::string line(contents.substr(p,eol - p));
+			unsigned int id = threads,seq = 0;
+			std::string::size_type t = line.find("thread ");
+			if ((t == std::string::npos)||(sscanf(line.c_str() + t,"thread %u message %u",&id,&seq) != 2)||(id >= threads)||(seq != next[id]))
+				ok = false;
+			else ++next[id];
+			p = eol + 1;
+		}
+		for(unsigned int i=0;i<threads;++i)
+			ok &= (next[i] == paced);
+		if (!ok) {
+			std::cout << "FAIL (" << dropped << " dropped, lines missing or out of order)" << std::endl;
+			Utils::rm(path);
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+	Utils::rm(path);
+
+	return 0;
+}
+
+struct MPSCQueueTestEntry
+{
+	unsigned int producer;
+	unsigned int seq;
+};
+
+struct MPSCQueueTestThread
+{
+	MPSCQueueTestThread() : q((MPSCQueue<MPSCQueueTestEntry> *)0),id(0),count(0),retries(0) {}
+	void threadMain()
+		throw()
+	{
+		for(unsigned int i=0;i<count;++i) {
+			unsigned int ticket;
+			MPSCQueueTestEntry *e;
+			while (!(e = q->claim(ticket))) {
+				++retries; // full, let the consumer catch up
+				Thread::sleep(1);
+			}
+			e->producer = id;
+			e->seq = i;
+			q->publish(ticket);
+		}
+	}
+	MPSCQueue<MPSCQueueTestEntry> *q;
+	unsigned int id,count;
+	unsigned long retries;
+};
+
+static int testMPSCQueue()
+{
+	const unsigned int threads = 4;
+	const unsigned int perThread = 250000;
+
+	std::cout << "[mpscqueue] Testing fill, overflow and wrap in one thread... "; std::cout.flush();
+	{
+		MPSCQueue<MPSCQueueTestEntry> q(5);
+		MPSCQueueTestEntry e;
+		e.producer = 0;
+		if (q.capacity() != 8) {
+			std::cout << "FAIL (capacity " << q.capacity() << ")" << std::endl;
+			return -1;
+		}
+		for(unsigned int round=0;round<3;++round) {
+			for(unsigned int i=0;i<8;++i) {
+				e.seq = (round * 8) + i;
+				if (!q.push(e)) {
+					std::cout << "FAIL (push into ring that is not full)" << std::endl;
+					return -1;
+				}
+			}
+			if ((q.push(e))||(q.overflows() != (round + 1))) {
+				std::cout << "FAIL (push into full ring)" << std::endl;
+				return -1;
+			}
+			if ((!q.pop(e))||(e.seq != (round * 8))||(!q.push(e))) {
+				std::cout << "FAIL (pop/push after full)" << std::endl;
+				return -1;
+			}
+			unsigned int n = 0;
+			MPSCQueueTestEntry *f;
+			while ((f = q.front())) {
+				if (f->seq != ((n == 7) ? (round * 8) : ((round * 8) + n + 1))) {
+					std::cout << "FAIL (out of order)" << std::endl;
+					return -1;
+				}
+				q.pop();
+				++n;
+			}
+			if ((n != 8)||(!q.empty())) {
+				std::cout << "FAIL (drained " << n << " entries)" << std::endl;
+				return -1;
+			}
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[mpscqueue] " << threads << " threads pushing " << perThread << " entries each through a 256 entry ring... "; std::cout.flush();
+	MPSCQueue<MPSCQueueTestEntry> q(256);
+	MPSCQueueTestThread qt[threads];
+	Thread th[threads];
+	unsigned int next[threads];
+	uint64_t start = Utils::now();
+	for(unsigned int i=0;i<threads;++i) {
+		qt[i].q = &q;
+		qt[i].id = i;
+		qt[i].count = perThread;
+		next[i] = 0;
+		th[i] = Thread::start(&(qt[i]));
+	}
+	unsigned int total = 0;
+	while (total < (threads * perThread)) {
+		MPSCQueueTestEntry *e = q.front();
+		if (!e) {
+			if ((Utils::now() - start) > 60000) {
+				std::cout << "FAIL (timed out after " << total << " entries)" << std::endl;
+				return -1;
+			}
+			q.wait(100);
+			continue;
+		}
+		if ((e->producer >= threads)||(e->seq != next[e->producer])) {
+			std::cout << "FAIL (entry " << e->seq << " from thread " << e->producer << " out of order)" << std::endl;
+			return -1;
+		}
+		++next[e->producer];
+		q.pop();
+		++total;
+	}
+	for(unsigned int i=0;i<threads;++i)
+		Thread::join(th[i]);
+	uint64_t end = Utils::now();
+	unsigned long retries = 0;
+	for(unsigned int i=0;i<threads;++i)
+		retries += qt[i].retries;
+	if ((!q.empty())||(q.overflows() != retries)) {
+		std::cout << "FAIL (" << q.overflows() << " overflows, " << retries << " retries)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS (" << ((double)((end - start) * 1000000ULL) / (double)(threads * perThread)) << " ns/entry, " << retries << " full)" << std::endl;
+
+	return 0;
+}
+
+struct MetricsTestThread
+{
+	MetricsTestThread() : m((Metrics *)0),count(0) {}
+	void threadMain()
+		throw()
+	{
+		for(unsigned int i=0;i<count;++i) {
+			m->inc(Metrics::COUNTER_PACKETS_RELAYED);
+			m->received(Packet::VERB_FRAME);
+			m->wireReceived(i & 2047);
+		}
+	}
+	Metrics *m;
+	unsigned int count;
+};
+
+static int testMetrics()
+{
+	const unsigned int threads = 4;
+	const unsigned int perThread = 1000000;
+
+	std::cout << "[metrics] Histogram buckets... "; std::cout.flush();
+	if ((Metrics::bucket(0) != 0)||(Metrics::bucket(1) != 1)||(Metrics::bucket(2) != 2)||(Metrics::bucket(3) != 2)||(Metrics::bucket(1024) != 11)||(Metrics::bucket(0xffffffffffffffffULL) != (ZT_METRICS_HISTOGRAM_BUCKETS - 1))) {
+		std::cout << "FAIL" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[metrics] " << threads << " threads updating " << perThread << " times each... "; std::cout.flush();
+	Metrics *m = new Metrics();
+	MetricsTestThread mt[threads];
+	Thread th[threads];
+	uint64_t start = Utils::now();
+	for(unsigned int i=0;i<threads;++i) {
+		mt[i].m = m;
+		mt[i].count = perThread;
+		th[i] = Thread::start(&(mt[i]));
+	}
+	for(unsigned int i=0;i<threads;++i)
+		Thread::join(th[i]);
+	uint64_t end = Utils::now();
+
+	uint64_t buckets[ZT_METRICS_HISTOGRAM_BUCKETS];
+	uint64_t sum = m->histogram(Metrics::HISTOGRAM_WIRE_BYTES_RECEIVED,buckets);
+	uint64_t expectedSum = 0,expectedZeros = 0;
+	for(unsigned int i=0;i<perThread;++i) {
+		expectedSum += (i & 2047);
+		if (!(i & 2047))
+			++expectedZeros;
+	}
+	expectedSum *= threads;
+	expectedZeros *= threads;
+	uint64_t n = 0;
+	for(unsigned int b=0;b<ZT_METRICS_HISTOGRAM_BUCKETS;++b)
+		n += buckets[b];
+	if ((m->counter(Metrics::COUNTER_PACKETS_RELAYED) != (threads * perThread))||(m->counter(Metrics::COUNTER_WIRE_MESSAGES_RECEIVED) != (threads * perThread))||(m->verbReceived(Packet::VERB_FRAME) != (threads * perThread))||(m->verbReceived(Packet::VERB_HELLO) != 0)||(n != (threads * perThread))||(sum != expectedSum)||(buckets[0] != expectedZeros)) {
+		std::cout << "FAIL (lost updates)" << std::endl;
+		delete m;
+		return -1;
+	}
+	std::cout << "PASS (" << ((double)((end - start) * 1000000ULL) / (double)(threads * perThread * 3)) << " ns/update)" << std::endl;
+
+	std::cout << "[metrics] Prometheus text format... "; std::cout.flush();
+	m->set(Metrics::GAUGE_RX_QUEUE_DEPTH,7);
+	RuntimeEnvironment renv; // no topology, so no per-peer series
+	std::string prom(m->toPrometheus(&renv));
+	char expect[128];
+	Utils::snprintf(expect,sizeof(expect),"\nzt_packets_relayed_total %u\n",threads * perThread);
+	if ((prom.find(expect) == std::string::npos)||(prom.find("\nzt_rx_queue_depth 7\n") == std::string::npos)||(prom.find("zt_packets_received_total{verb=\"FRAME\"}") == std::string::npos)||(prom.find("# TYPE zt_wire_message_received_bytes histogram\n") == std::string::npos)||(prom.find("zt_wire_message_received_bytes_bucket{le=\"+Inf\"}") == std::string::npos)) {
+		std::cout << "FAIL" << std::endl << prom;
+		delete m;
+		return -1;
+	}
+	std::cout << "PASS (" << prom.length() << " bytes)" << std::endl;
+
+	std::cout << "[metrics] Latency bucket bounds... "; std::cout.flush();
+	for(uint64_t v=0;v<=0xffffffffULL;v=(v * 3) + 1) {
+		const unsigned int b = Metrics::latencyBucket(v);
+		if ((Metrics::latencyBucketMax(b) < v)||((b > 0)&&(Metrics::latencyBucketMax(b - 1) >= v))||((v >= 16)&&(((double)Metrics::latencyBucketMax(b) / (double)v) > 1.125))) {
+			std::cout << "FAIL (" << v << " in bucket " << b << ")" << std::endl;
+			delete m;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[metrics] Latency percentiles... "; std::cout.flush();
+	m->latency(Metrics::STAGE_DECRYPT,100);
+	if (m->latencySummary(Metrics::STAGE_DECRYPT).count != 0) {
+		std::cout << "FAIL (recorded while disabled)" << std::endl;
+		delete m;
+		return -1;
+	}
+	m->enableLatency();
+	start = Utils::now();
+	for(uint64_t v=1;v<=1000000;++v)
+		m->latency(Metrics::STAGE_DECRYPT,v);
+	end = Utils::now();
+	const Metrics::LatencySummary ls(m->latencySummary(Metrics::STAGE_DECRYPT));
+	if ((ls.count != 1000000)||(ls.sum != 500000500000ULL)||(ls.p50 < 500000)||(ls.p50 > 562500)||(ls.p99 < 990000)||(ls.p99 > 1113750)||(ls.p999 < 999000)||(ls.max < 1000000)) {
+		std::cout << "FAIL (p50 " << ls.p50 << " p99 " << ls.p99 << " p999 " << ls.p999 << " max " << ls.max << ")" << std::endl;
+		delete m;
+		return -1;
+	}
+	std::cout << "PASS (p50 " << ls.p50 << " p99 " << ls.p99 << " p999 " << ls.p999 << ", " << ((double)((end - start) * 1000000ULL) / 1000000.0) << " ns/sample)" << std::endl;
+
+	delete m;
+	return 0;
+}
+
+static int testControlStream()
+{
+	std::string buf,payload;
+	unsigned int type = 0;
+
+	std::cout << "[control] Frame encode/decode... "; std::cout.flush();
+	ControlStream::appendFrame(buf,ControlStream::FRAME_AUTH,std::string("token"));
+	ControlStream::appendFrame(buf,ControlStream::FRAME_SUBSCRIBE,std::string(1,(char)ControlStream::SUBSCRIBE_PEERS));
+	ControlStream::appendFrame(buf,ControlStream::FRAME_SYNC,std::string());
+	std::string partial(buf.substr(0,buf.length() - 1));
+	if ((!ControlStream::nextFrame(buf,type,payload))||(type != ControlStream::FRAME_AUTH)||(payload != "token")) {
+		std::cout << "FAIL (first frame)" << std::endl;
+		return -1;
+	}
+	if ((!ControlStream::nextFrame(buf,type,payload))||(type != ControlStream::FRAME_SUBSCRIBE)||(payload.length() != 1)||(payload[0] != (char)ControlStream::SUBSCRIBE_PEERS)) {
+		std::cout << "FAIL (second frame)" << std::endl;
+		return -1;
+	}
+	if ((!ControlStream::nextFrame(buf,type,payload))||(type != ControlStream::FRAME_SYNC)||(payload.length() != 0)||(buf.length() != 0)) {
+		std::cout << "FAIL (empty frame)" << std::endl;
+		return -1;
+	}
+	ControlStream::nextFrame(partial,type,payload);
+	ControlStream::nextFrame(partial,type,payload);
+	if ((ControlStream::nextFrame(partial,type,payload))||(partial.length() != 2)) {
+		std::cout << "FAIL (returned incomplete frame)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[control] Delta generation... "; std::cout.flush();
+	std::map<uint64_t,std::string> prev,cur;
+	prev[1] = "one";
+	prev[2] = "two";
+	prev[3] = "three";
+	cur[2] = "two";
+	cur[3] = "THREE";
+	cur[4] = "four";
+	buf.clear();
+	if (ControlStream::diff(prev,prev,ControlStream::FRAME_PEER,ControlStream::FRAME_PEER_REMOVED,5,buf) != 0) {
+		std::cout << "FAIL (unchanged records sent)" << std::endl;
+		return -1;
+	}
+	if (ControlStream::diff(prev,cur,ControlStream::FRAME_PEER,ControlStream::FRAME_PEER_REMOVED,5,buf) != 3) {
+		std::cout << "FAIL (wrong number of frames)" << std::endl;
+		return -1;
+	}
+	bool ok = ((ControlStream::nextFrame(buf,type,payload))&&(type == ControlStream::FRAME_PEER_REMOVED)&&(payload == std::string("\0\0\0\0\1",5)));
+	ok &= ((ControlStream::nextFrame(buf,type,payload))&&(type == ControlStream::FRAME_PEER)&&(payload == "THREE"));
+	ok &= ((ControlStream::nextFrame(buf,type,payload))&&(type == ControlStream::FRAME_PEER)&&(payload == "four"));
+	if ((!ok)||(buf.length() != 0)) {
+		std::cout << "FAIL (wrong frames)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	return 0;
+}
+
+static int testService()
+{
+#ifndef __WINDOWS__
+	RuntimeEnvironment renv; // no Logger, so service stderr goes nowhere
+	renv.homePath = "/tmp";
+
+	// A service that never reads its stdin, like a wedged netconf master
+	const char *path = "/tmp/zt-selftest-service.sh";
+	if (!Utils::writeFile(path,std::string("#!/bin/sh\nexec sleep 30\n"))) {
+		std::cout << "[service] FAIL (could not write " << path << ")" << std::endl;
+		return -1;
+	}
+	::chmod(path,0755);
+
+	Service *svc = new Service(&renv,"selftest",path,(void (*)(void *,Service &,const Dictionary &))0,(void *)0);
+	for(unsigned int i=0;((i<50)&&(!svc->running()));++i)
+		Thread::sleep(100);
+
+	Dictionary msg;
+	msg["type"] = "netconf-request";
+	msg["nwid"] = "8056c2e21c000001";
+
+	std::cout << "[service] Request coalescing... "; std::cout.flush();
+	if ((svc->request("peer-net",msg) != Service::REQUEST_QUEUED)||(svc->request("peer-net",msg) != Service::REQUEST_COALESCED)||(svc->request("peer-net2",msg) != Service::REQUEST_QUEUED)||(svc->inFlight() != 2)) {
+		std::cout << "FAIL (not coalesced, " << svc->inFlight() << " in flight)" << std::endl;
+		delete svc;
+		return -1;
+	}
+	if ((svc->complete("peer-net") < 0)||(svc->complete("peer-net") >= 0)||(svc->inFlight() != 1)) {
+		std::cout << "FAIL (complete)" << std::endl;
+		delete svc;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[service] Sending to a service that is not reading... "; std::cout.flush();
+	msg["meta"] = std::string(4096,'x');
+	unsigned int sent = 0;
+	uint64_t start = Utils::now();
+	while ((svc->send(msg))&&(sent < (ZT_SERVICE_MAX_QUEUE * 4)))
+		++sent;
+	uint64_t end = Utils::now();
+	if ((sent < ZT_SERVICE_MAX_QUEUE)||(sent >= (ZT_SERVICE_MAX_QUEUE * 4))||(svc->request("peer-net3",msg) != Service::REQUEST_REFUSED)||((end - start) > 2000)) {
+		std::cout << "FAIL (" << sent << " accepted in " << (end - start) << "ms)" << std::endl;
+		delete svc;
+		return -1;
+	}
+	std::cout << "PASS (" << sent << " accepted then refused, " << (end - start) << "ms)" << std::endl;
+
+	delete svc;
+	::unlink(path);
+#endif
+	return 0;
+}
+
+static int testNetconfCache()
+{
+	const Address a((uint64_t)0x1122334455ULL),b((uint64_t)0x5544332211ULL);
+	const uint64_t nwid = 0x8056c2e21c000001ULL;
+	std::string nc;
+
+	std::cout << "[netconf] Config cache... "; std::cout.flush();
+	NetconfCache cache(1000,4);
+	cache.put(nwid,a,"unsolicited",0);
+	if ((cache.lookup(nwid,a,"",0,nc))||(cache.lookup(nwid,a,"",1,nc))) {
+		std::cout << "FAIL (hit before a response was cached)" << std::endl;
+		return -1;
+	}
+	cache.put(nwid,a,"config-a",2);
+	if ((!cache.lookup(nwid,a,"",3,nc))||(nc != "config-a")||(cache.lookup(nwid,b,"",3,nc))||(cache.lookup(nwid + 1,a,"",3,nc))) {
+		std::cout << "FAIL (lookup)" << std::endl;
+		return -1;
+	}
+	if (cache.lookup(nwid,a,"rev=2",4,nc)) {
+		std::cout << "FAIL (hit with different request meta-data)" << std::endl;
+		return -1;
+	}
+	cache.put(nwid,a,"config-a2",5);
+	if ((!cache.lookup(nwid,a,"rev=2",6,nc))||(nc != "config-a2")) {
+		std::cout << "FAIL (lookup after meta-data change)" << std::endl;
+		return -1;
+	}
+	if (cache.lookup(nwid,a,"rev=2",1005,nc)) {
+		std::cout << "FAIL (hit after TTL)" << std::endl;
+		return -1;
+	}
+	cache.put(nwid,a,"config-a3",1006);
+	cache.invalidate(nwid,a);
+	if (cache.lookup(nwid,a,"rev=2",1007,nc)) {
+		std::cout << "FAIL (hit after invalidate)" << std::endl;
+		return -1;
+	}
+	for(uint64_t i=0;i<8;++i)
+		cache.lookup(nwid + i,b,"",1008,nc);
+	if (cache.size() > 4) {
+		std::cout << "FAIL (" << cache.size() << " entries, limit is 4)" << std::endl;
+		return -1;
+	}
+	for(uint64_t i=0;i<8;++i)
+		cache.lookup(nwid + 100 + i,b,"",3000,nc); // everything from before is stale now
+	cache.put(nwid + 100,b,"config-b",3001);
+	if ((!cache.lookup(nwid + 100,b,"",3002,nc))||(nc != "config-b")) {
+		std::cout << "FAIL (stale entries not evicted when full)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	return 0;
+}
+
+static int testNetworkConfig()
+{
+	const uint64_t nwid = 0x8056c2e21c000001ULL;
+	const Address member((uint64_t)0x1122334455ULL);
+	const MulticastGroup arp(MAC((unsigned char)0xff),0x0a000001);
+	char tmp[32];
+
+	std::cout << "[netconf] Network config dictionary and binary forms... "; std::cout.flush();
+
+	Dictionary rates;
+	rates[MulticastGroup().toString()] = "1,2,3";
+	rates[arp.toString()] = "10,20,30";
+	std::string bridges;
+	for(uint64_t i=0;i<2000;++i) {
+		Utils::snprintf(tmp,sizeof(tmp),"%.10llx,",(unsigned long long)(0x1000000000ULL + (i * 7)));
+		bridges.append(tmp);
+	}
+	bridges.append("1000000000,junk,ffffffffff"); // duplicate, garbage, and reserved
+	const CertificateOfMembership com(0x14a2b3c4d5eULL,1000,nwid,member);
+
+	Dictionary d;
+	d[ZT_NETWORKCONFIG_DICT_KEY_ALLOWED_ETHERNET_TYPES] = "800,806,86dd";
+	d[ZT_NETWORKCONFIG_DICT_KEY_NETWORK_ID] = "8056c2e21c000001";
+	d[ZT_NETWORKCONFIG_DICT_KEY_TIMESTAMP] = "14a2b3c4d5e";
+	d[ZT_NETWORKCONFIG_DICT_KEY_ISSUED_TO] = member.toString();
+	d[ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_LIMIT] = "20";
+	d[ZT_NETWORKCONFIG_DICT_KEY_COMPRESSION_ACCELERATION] = "2";
+	d[ZT_NETWORKCONFIG_DICT_KEY_PRIVATE] = "1";
+	d[ZT_NETWORKCONFIG_DICT_KEY_ENABLE_BROADCAST] = "0";
+	d[ZT_NETWORKCONFIG_DICT_KEY_NAME] = "selftest=net";
+	d[ZT_NETWORKCONFIG_DICT_KEY_DESC] = "multi\nline";
+	d[ZT_NETWORKCONFIG_DICT_KEY_IPV4_STATIC] = "10.1.2.3/8,,10.1.2.3/8,192.168.0.1/33";
+	d[ZT_NETWORKCONFIG_DICT_KEY_IPV6_STATIC] = "fd00::1/88";
+	d[ZT_NETWORKCONFIG_DICT_KEY_ACTIVE_BRIDGES] = bridges;
+	d[ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_RATES] = rates.toString();
+	d[ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATE_OF_MEMBERSHIP] = com.toString();
+	const std::string ds(d.toString());
+
+	SharedPtr<NetworkConfig> a(new NetworkConfig(ds.data(),(unsigned int)ds.length()));
+	if ((a->networkId() != nwid)||(a->timestamp() != 0x14a2b3c4d5eULL)||(a->issuedTo() != member)||(a->multicastLimit() != 0x20)||(a->compressionAcceleration() != 2)||(!a->isPrivate())||(a->enableBroadcast())||(a->allowPassiveBridging())) {
+		std::cout << "FAIL (dictionary scalars)" << std::endl;
+		return -1;
+	}
+	if ((a->name() != "selftest=net")||(a->description() != "multi\nline")||(a->staticIps().size() != 2)||(a->activeBridges().size() != 2000)||(!(a->com() == com))) {
+		std::cout << "FAIL (dictionary strings and lists)" << std::endl;
+		return -1;
+	}
+	if ((!a->permitsEtherType(0x86dd))||(!a->permitsEtherType(0x806))||(a->permitsEtherType(0x842))||(a->multicastRate(arp).accrual != 0x30)||(a->multicastRate(MulticastGroup(MAC((unsigned char)0x33),0)).preload != 1)) {
+		std::cout << "FAIL (dictionary ethertypes and multicast rates)" << std::endl;
+		return -1;
+	}
+
+	Buffer<ZT_NETWORKCONFIG_BINARY_MAX_LENGTH> b;
+	a->serialize(b);
+	if (b.size() >= (ds.length() / 2)) {
+		std::cout << "FAIL (binary form is " << b.size() << " bytes, dictionary is " << ds.length() << ")" << std::endl;
+		return -1;
+	}
+	SharedPtr<NetworkConfig> c(new NetworkConfig(b.data(),b.size()));
+	bool same = (
+		(a->allowedEtherTypes() == c->allowedEtherTypes())&&
+		(a->networkId() == c->networkId())&&
+		(a->timestamp() == c->timestamp())&&
+		(a->issuedTo() == c->issuedTo())&&
+		(a->multicastLimit() == c->multicastLimit())&&
+		(a->compressionAcceleration() == c->compressionAcceleration())&&
+		(a->allowPassiveBridging() == c->allowPassiveBridging())&&
+		(a->isPrivate() == c->isPrivate())&&
+		(a->enableBroadcast() == c->enableBroadcast())&&
+		(a->name() == c->name())&&
+		(a->description() == c->description())&&
+		(a->staticIps() == c->staticIps())&&
+		(a->activeBridges() == c->activeBridges())&&
+		(a->com() == c->com())&&
+		(a->multicastRates().size() == c->multicastRates().size()));
+	for(std::map<MulticastGroup,NetworkConfig::MulticastRate>::const_iterator r(a->multicastRates().begin());((same)&&(r!=a->multicastRates().end()));++r) {
+		const NetworkConfig::MulticastRate &cr = c->multicastRate(r->first);
+		same = ((cr.preload == r->second.preload)&&(cr.maxBalance == r->second.maxBalance)&&(cr.accrual == r->second.accrual));
+	}
+	if (!same) {
+		std::cout << "FAIL (binary round trip)" << std::endl;
+		return -1;
+	}
+
+	unsigned int rejected = 0;
+	try {
+		SharedPtr<NetworkConfig> t(new NetworkConfig(b.data(),b.size() - 1));
+	} catch ( ... ) {
+		++rejected;
+	}
+	d.erase(ZT_NETWORKCONFIG_DICT_KEY_NAME);
+	const std::string dsn(d.toString());
+	try {
+		SharedPtr<NetworkConfig> t(new NetworkConfig(dsn.data(),(unsigned int)dsn.length()));
+	} catch (std::invalid_argument &exc) {
+		++rejected;
+	}
+	if (rejected != 2) {
+		std::cout << "FAIL (accepted truncated binary or dictionary missing a required field)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS (" << ds.length() << " byte dictionary, " << b.size() << " byte binary)" << std::endl;
+
 	return 0;
 }
 
@@ -633,6 +2161,142 @@ static int testOther()
 	}
 	std::cout << "PASS" << std::endl;
 
+	std::cout << "[other] Testing DictionaryReader... "; std::cout.flush();
+	for(int k=0;k<2000;++k) {
+		std::string s;
+		if ((k & 1)) {
+			Dictionary a;
+			int nk = rand() % 32;
+			for(int q=0;q<nk;++q) {
+				std::string k,v;
+				int kl = (rand() % 64);
+				int vl = (rand() % 64);
+				for(int i=0;i<kl;++i)
+					k.push_back((char)rand());
+				for(int i=0;i<vl;++i)
+					v.push_back((char)rand());
+				a[k] = v;
+			}
+			s = a.toString();
+		} else {
+			// Junk heavy in syntax, repeated keys, stray '=', trailing backslashes, etc.
+			static const char syntax[8] = { 'a','b','=','\\','\r','\n','0',(char)0xff };
+			int l = rand() % 256;
+			for(int i=0;i<l;++i)
+				s.push_back(((rand() & 7) == 0) ? (char)rand() : syntax[rand() & 7]);
+		}
+		Dictionary d(s);
+		DictionaryReader dr(s.data(),(unsigned int)s.length());
+		if (dr.size() != d.size()) {
+			std::cout << "FAIL (" << dr.size() << " fields, Dictionary has " << d.size() << ")" << std::endl;
+			return -1;
+		}
+		unsigned int i = 0;
+		for(Dictionary::const_iterator kv(d.begin());kv!=d.end();++kv,++i) {
+			unsigned int klen,vlen;
+			const char *v;
+			const char *key = dr.field(i,klen,v,vlen);
+			if ((kv->first != std::string(key,klen))||(kv->second != std::string(v,vlen))||((kv->first.find((char)0) == std::string::npos)&&(!dr.get(kv->first.c_str(),v,vlen)))) {
+				std::cout << "FAIL (field mismatch)" << std::endl;
+				return -1;
+			}
+		}
+	}
+	{
+		Identity id;
+		id.fromString(KNOWN_GOOD_IDENTITY);
+		Dictionary d;
+		d["nwid"] = "8056c2e21c000001";
+		d["a=b"] = "c\nd";
+		d["foo"] = "bar";
+		d.sign(id);
+		std::string s(d.toString());
+		DictionaryReader dr(s.data(),(unsigned int)s.length());
+		if ((!dr.hasSignature())||(!dr.verify(id))||(dr.signatureTimestamp() != d.signatureTimestamp())||(dr.getHex("nwid",0) != 0x8056c2e21c000001ULL)||(dr.get("a=b",std::string()) != "c\nd")) {
+			std::cout << "FAIL (signed dictionary)" << std::endl;
+			return -1;
+		}
+		s[s.find("bar")] = 'c';
+		DictionaryReader dr2(s.data(),(unsigned int)s.length());
+		if (dr2.verify(id)) {
+			std::cout << "FAIL (verified a modified dictionary)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing Hashtable... "; std::cout.flush();
+	{
+		Hashtable<Address,unsigned long> ht(2);
+		std::map<Address,unsigned long> ref;
+		for(int k=0;k<20000;++k) {
+			Address a((uint64_t)(rand() % 4096));
+			if ((rand() & 3) == 0) {
+				if (ht.erase(a) != (ref.erase(a) != 0)) {
+					std::cout << "FAIL (erase)" << std::endl;
+					return -1;
+				}
+			} else {
+				ht.set(a,(unsigned long)k);
+				ref[a] = (unsigned long)k;
+			}
+		}
+		if (ht.size() != ref.size()) {
+			std::cout << "FAIL (size)" << std::endl;
+			return -1;
+		}
+		Hashtable<Address,unsigned long> ht2(ht);
+		for(std::map<Address,unsigned long>::iterator i(ref.begin());i!=ref.end();++i) {
+			const unsigned long *v = ht2.get(i->first);
+			if ((!v)||(*v != i->second)) {
+				std::cout << "FAIL (get)" << std::endl;
+				return -1;
+			}
+		}
+		unsigned long cnt = 0;
+		Address *kp = (Address *)0;
+		unsigned long *vp = (unsigned long *)0;
+		Hashtable<Address,unsigned long>::Iterator i(ht2);
+		while (i.next(kp,vp)) {
+			if (ref[*kp] != *vp) {
+				std::cout << "FAIL (iterate)" << std::endl;
+				return -1;
+			}
+			++cnt;
+		}
+		if (cnt != ref.size()) {
+			std::cout << "FAIL (iterate count)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing CompressionPolicy... "; std::cout.flush();
+	{
+		CompressionPolicy cp;
+		const Address noisy((uint64_t)0x1111111111ULL),chatty((uint64_t)0x2222222222ULL);
+		for(unsigned int k=0;k<1000;++k) {
+			Packet p(noisy,Address(),Packet::VERB_FRAME);
+			for(unsigned int i=0;i<512;++i)
+				p.append((unsigned char)rand());
+			cp.compress(p,noisy,0x0800);
+			Packet q(chatty,Address(),Packet::VERB_FRAME);
+			for(unsigned int i=0;i<16;++i)
+				q.append("GET /index.html HTTP/1.1\r\n",26);
+			if (!cp.compress(q,chatty,0x0800)) {
+				std::cout << "FAIL (compressible flow not compressed)" << std::endl;
+				return -1;
+			}
+		}
+		CompressionPolicy::Stats st(cp.stats());
+		if ((st.packetsCompressed != 1000)||(st.packetsSkipped < 900)||(st.packetsIncompressible < 10)||(st.bytesSaved == 0)) {
+			std::cout << "FAIL (skipped " << st.packetsSkipped << ", incompressible " << st.packetsIncompressible << ")" << std::endl;
+			return -1;
+		}
+		std::cout << "(skipped " << st.packetsSkipped << " of 1000 incompressible) ";
+	}
+	std::cout << "PASS" << std::endl;
+
 	return 0;
 }
 
@@ -690,7 +2354,18 @@ int main(int argc,char **argv)
 	r |= testHttp();
 	r |= testPacket();
 	r |= testOther();
+	r |= testLogger();
+	r |= testMPSCQueue();
+	r |= testMetrics();
+	r |= testControlStream();
+	r |= testService();
+	r |= testNetconfCache();
+	r |= testNetworkConfig();
 	r |= testIdentity();
+	r |= testIdentityStore();
+	r |= testTopology();
+	r |= testKeepalive();
+	r |= testMulticaster();
 	r |= testCertificate();
 
 	if (r)
@@ -0,0 +1,918 @@
+/*
+ * ZeroTier One - Global Peer to Peer Ethernet
+ * Copyright (C) 2011-2014  ZeroTier Networks LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+
+/*
+ * End-to-end tap-to-tap throughput benchmark (Linux only, run as root)
+ *
+ * This starts a supernode and two or more member zerotier-one instances,
+ * each with its own home folder in its own network namespace. The namespaces
+ * are wired together by veth pairs on a bridge in one more namespace, so
+ * nothing touches the host's own interfaces. Members join the built-in test
+ * network with testNetworkUnrestricted=1 in local.conf, which permits
+ * bridging and lifts multicast rate limits.
+ *
+ * Traffic is generated by child processes that enter the members'
+ * namespaces and send UDP through the taps, so each frame crosses
+ * LinuxEthernetTap, Switch and NativeSocketManager on both ends. Results are
+ * received Gbit/s and packets per second and zerotier-one CPU time per
+ * delivered packet, summed over all instances.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netpacket/packet.h>
+#include <net/ethernet.h>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+
+#include "node/Constants.hpp"
+#include "node/Utils.hpp"
+#include "node/Identity.hpp"
+#include "node/Address.hpp"
+#include "node/MAC.hpp"
+#include "node/InetAddress.hpp"
+#include "node/Dictionary.hpp"
+#include "node/NetworkConfig.hpp"
+
+using namespace ZeroTier;
+
+/**
+ * Prefix of the namespaces we create; stale ones with this prefix are removed
+ */
+#define ZT_TAPBENCH_NS_PREFIX "ztb-"
+
+/**
+ * Namespace holding the bridge that connects all instances
+ */
+#define ZT_TAPBENCH_WIRE_NS ZT_TAPBENCH_NS_PREFIX "wire"
+
+/**
+ * Underlay addresses are this followed by instance number + 1 (RFC 2544 benchmarking range)
+ */
+#define ZT_TAPBENCH_UNDERLAY_PREFIX "198.18.0."
+
+/**
+ * UDP port used by the traffic generator on the taps
+ */
+#define ZT_TAPBENCH_PORT 9999
+
+/**
+ * Name of the tap device the members will create
+ */
+#define ZT_TAPBENCH_TAP_DEVICE "zt0"
+
+#define ZT_TAPBENCH_DEFAULT_MEMBERS 2
+#define ZT_TAPBENCH_MAX_MEMBERS 64
+#define ZT_TAPBENCH_DEFAULT_DURATION 10
+#define ZT_TAPBENCH_DEFAULT_PAYLOAD 1400
+#define ZT_TAPBENCH_MIN_PAYLOAD 18
+#define ZT_TAPBENCH_MAX_PAYLOAD (ZT_IF_MTU - 28)
+
+/**
+ * Bytes of Ethernet, IPv4 and UDP header added to each payload on the tap
+ */
+#define ZT_TAPBENCH_FRAME_OVERHEAD 42
+
+/**
+ * Seconds to wait for instances to come up and for peers to reach each other
+ */
+#define ZT_TAPBENCH_STARTUP_TIMEOUT 60
+
+/**
+ * Milliseconds receivers keep counting after senders finish
+ */
+#define ZT_TAPBENCH_DRAIN 1000
+
+// Marks in the first payload byte
+#define ZT_TAPBENCH_MARK_PROBE 'P'
+#define ZT_TAPBENCH_MARK_DATA 'D'
+
+/**
+ * One zerotier-one instance; index 0 is the supernode
+ */
+struct Instance
+{
+	Identity id;
+	std::string ns;
+	std::string home;
+	uint32_t ip; // member's address on the test network, network byte order
+	MAC mac;
+	pid_t pid;
+};
+
+/**
+ * What a generator child does
+ */
+enum GeneratorKind
+{
+	GEN_FIND_TAP, // succeed once our test network address is on an interface
+	GEN_RESPOND,  // echo probes until stopped
+	GEN_PROBE,    // probe until enough distinct members have echoed
+	GEN_RECEIVE,  // count data packets until stopped
+	GEN_SEND,     // send data packets through a UDP socket
+	GEN_SEND_RAW  // send data frames with a foreign source MAC through a raw socket (bridged)
+};
+
+struct GeneratorArgs
+{
+	GeneratorKind kind;
+	uint32_t self; // our test network IP
+	uint32_t dest; // destination IP (may be the test network broadcast address)
+	unsigned char destMac[6];
+	unsigned char srcMac[6];
+	unsigned int expect; // distinct echoes GEN_PROBE waits for
+	unsigned int payload;
+	unsigned int seconds;
+	unsigned long rate; // packets per second per sender, 0 for as fast as possible
+};
+
+struct GeneratorResult
+{
+	int ok;
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t errors;
+	uint64_t elapsedUs;
+};
+
+/**
+ * A forked generator running in a member's namespace
+ */
+struct Generator
+{
+	pid_t pid;
+	int fd; // read end of result pipe
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+static void stopHandler(int sig) { stopRequested = 1; }
+
+static volatile sig_atomic_t interrupted = 0;
+static void interruptHandler(int sig) { interrupted = 1; }
+
+/* ------------------------------------------------------------------------ */
+
+static int sh(const std::string &cmd)
+{
+	return system((cmd + " >/dev/null 2>&1").c_str());
+}
+
+static std::string ipString(uint32_t ip)
+{
+	struct in_addr a;
+	a.s_addr = ip;
+	return std::string(inet_ntoa(a));
+}
+
+static uint16_t ipChecksum(const unsigned char *p,unsigned int len)
+{
+	uint32_t sum = 0;
+	for(unsigned int i=0;(i+1)<len;i+=2)
+		sum += (((uint32_t)p[i]) << 8) | (uint32_t)p[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+static void sleepMs(unsigned long ms)
+{
+	usleep((useconds_t)(ms * 1000));
+}
+
+/**
+ * @return CPU time used so far by a process in microseconds (user + system)
+ */
+static uint64_t processCpuTime(pid_t pid)
+{
+	char path[64],buf[1024];
+	Utils::snprintf(path,sizeof(path),"/proc/%d/stat",(int)pid);
+	FILE *f = fopen(path,"r");
+	if (!f)
+		return 0;
+	size_t n = fread(buf,1,sizeof(buf) - 1,f);
+	fclose(f);
+	buf[n] = (char)0;
+
+	// Fields after the parenthesized command name start with state (field 3)
+	const char *p = strrchr(buf,')');
+	if (!p)
+		return 0;
+	unsigned long utime = 0,stime = 0;
+	if (sscanf(p + 2,"%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",&utime,&stime) != 2)
+		return 0;
+	return (((uint64_t)utime + (uint64_t)stime) * 1000000ULL) / (uint64_t)sysconf(_SC_CLK_TCK);
+}
+
+static uint64_t totalCpuTime(const std::vector<Instance> &instances)
+{
+	uint64_t t = 0;
+	for(std::vector<Instance>::const_iterator i(instances.begin());i!=instances.end();++i)
+		t += processCpuTime(i->pid);
+	return t;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static int generatorSocket(const GeneratorArgs &a,bool bindPort)
+{
+	int s = socket(AF_INET,SOCK_DGRAM,0);
+	if (s < 0)
+		return -1;
+	int one = 1;
+	setsockopt(s,SOL_SOCKET,SO_BROADCAST,&one,sizeof(one));
+	int bufsize = 8388608;
+	setsockopt(s,SOL_SOCKET,SO_RCVBUFFORCE,&bufsize,sizeof(bufsize));
+	setsockopt(s,SOL_SOCKET,SO_SNDBUFFORCE,&bufsize,sizeof(bufsize));
+	struct timeval tv;
+	tv.tv_sec = 0;
+	tv.tv_usec = 100000;
+	setsockopt(s,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+	if (bindPort) {
+		struct sockaddr_in sin;
+		memset(&sin,0,sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(ZT_TAPBENCH_PORT);
+		if (bind(s,(const struct sockaddr *)&sin,sizeof(sin))) {
+			close(s);
+			return -1;
+		}
+	}
+	return s;
+}
+
+static void pace(const GeneratorArgs &a,uint64_t start,uint64_t sent)
+{
+	if (a.rate) {
+		const uint64_t due = start + ((sent * 1000000ULL) / (uint64_t)a.rate);
+		const uint64_t now = Utils::nowMicros();
+		if (due > now)
+			usleep((useconds_t)(due - now));
+	}
+}
+
+// Runs in a forked child that has entered a member's namespace
+static void generatorMain(const GeneratorArgs &a,GeneratorResult &r)
+{
+	signal(SIGTERM,&stopHandler);
+	signal(SIGINT,SIG_IGN);
+
+	unsigned char buf[ZT_IF_MTU + 64];
+	struct sockaddr_in to;
+	memset(&to,0,sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_port = htons(ZT_TAPBENCH_PORT);
+	to.sin_addr.s_addr = a.dest;
+
+	const uint64_t start = Utils::nowMicros();
+	const uint64_t deadline = start + ((uint64_t)a.seconds * 1000000ULL);
+
+	switch(a.kind) {
+		case GEN_FIND_TAP: {
+			struct ifaddrs *ifa = (struct ifaddrs *)0;
+			if (!getifaddrs(&ifa)) {
+				for(struct ifaddrs *i=ifa;i;i=i->ifa_next) {
+					if ((i->ifa_addr)&&(i->ifa_addr->sa_family == AF_INET)&&(((const struct sockaddr_in *)i->ifa_addr)->sin_addr.s_addr == a.self)&&(!strcmp(i->ifa_name,ZT_TAPBENCH_TAP_DEVICE)))
+						r.ok = 1;
+				}
+				freeifaddrs(ifa);
+			}
+		}	break;
+
+		case GEN_RESPOND:
+		case GEN_RECEIVE: {
+			int s = generatorSocket(a,true);
+			if (s < 0)
+				break;
+			while (!stopRequested) {
+				struct sockaddr_in from;
+				socklen_t fromlen = sizeof(from);
+				long n = (long)recvfrom(s,buf,sizeof(buf),0,(struct sockaddr *)&from,&fromlen);
+				if ((n <= 0)||(from.sin_addr.s_addr == a.self)) // also skip our own looped-back broadcasts
+					continue;
+				if (buf[0] == ZT_TAPBENCH_MARK_PROBE) {
+					sendto(s,buf,(size_t)n,0,(const struct sockaddr *)&from,fromlen);
+				} else if ((buf[0] == ZT_TAPBENCH_MARK_DATA)&&(a.kind == GEN_RECEIVE)) {
+					++r.packets;
+					r.bytes += (uint64_t)n;
+				}
+			}
+			close(s);
+			r.ok = 1;
+		}	break;
+
+		case GEN_PROBE: {
+			int s = generatorSocket(a,false);
+			if (s < 0)
+				break;
+			std::set<uint32_t> echoed;
+			buf[0] = ZT_TAPBENCH_MARK_PROBE;
+			uint64_t lastProbe = 0;
+			while ((!stopRequested)&&(echoed.size() < a.expect)&&(Utils::nowMicros() < deadline)) {
+				if ((Utils::nowMicros() - lastProbe) >= 250000) {
+					sendto(s,buf,1,0,(const struct sockaddr *)&to,sizeof(to));
+					lastProbe = Utils::nowMicros();
+				}
+				struct sockaddr_in from;
+				socklen_t fromlen = sizeof(from);
+				if ((recvfrom(s,buf + 1,sizeof(buf) - 1,0,(struct sockaddr *)&from,&fromlen) > 0)&&(from.sin_addr.s_addr != a.self))
+					echoed.insert(from.sin_addr.s_addr);
+			}
+			close(s);
+			r.ok = (echoed.size() >= a.expect) ? 1 : 0;
+		}	break;
+
+		case GEN_SEND: {
+			int s = generatorSocket(a,false);
+			if ((s < 0)||(connect(s,(const struct sockaddr *)&to,sizeof(to))))
+				break;
+			memset(buf,0,a.payload);
+			buf[0] = ZT_TAPBENCH_MARK_DATA;
+			uint64_t now = start;
+			while ((!stopRequested)&&(now < deadline)) {
+				for(unsigned int k=0;k<64;++k) { // check the clock every 64 sends
+					if (send(s,buf,a.payload,0) == (long)a.payload) {
+						++r.packets;
+						r.bytes += a.payload;
+					} else ++r.errors;
+					pace(a,start,r.packets + r.errors);
+				}
+				now = Utils::nowMicros();
+			}
+			r.elapsedUs = now - start;
+			close(s);
+			r.ok = 1;
+		}	break;
+
+		case GEN_SEND_RAW: {
+			int s = socket(AF_PACKET,SOCK_RAW,htons(ETH_P_ALL));
+			if (s < 0)
+				break;
+			struct sockaddr_ll sll;
+			memset(&sll,0,sizeof(sll));
+			sll.sll_family = AF_PACKET;
+			sll.sll_protocol = htons(ETH_P_ALL);
+			sll.sll_ifindex = (int)if_nametoindex(ZT_TAPBENCH_TAP_DEVICE);
+			if ((!sll.sll_ifindex)||(bind(s,(const struct sockaddr *)&sll,sizeof(sll)))) {
+				close(s);
+				break;
+			}
+
+			// Ethernet + IPv4 + UDP, with our own IP but a MAC that isn't our tap's
+			const unsigned int ipLen = 28 + a.payload;
+			const unsigned int frameLen = 14 + ipLen;
+			memset(buf,0,frameLen);
+			memcpy(buf,a.destMac,6);
+			memcpy(buf + 6,a.srcMac,6);
+			buf[12] = 0x08;
+			buf[13] = 0x00;
+			unsigned char *ip = buf + 14;
+			ip[0] = 0x45;
+			ip[2] = (unsigned char)(ipLen >> 8);
+			ip[3] = (unsigned char)ipLen;
+			ip[6] = 0x40; // don't fragment
+			ip[8] = 64;
+			ip[9] = 17;
+			memcpy(ip + 12,&a.self,4);
+			memcpy(ip + 16,&a.dest,4);
+			const uint16_t csum = ipChecksum(ip,20);
+			ip[10] = (unsigned char)(csum >> 8);
+			ip[11] = (unsigned char)csum;
+			unsigned char *udp = ip + 20;
+			udp[0] = (unsigned char)((ZT_TAPBENCH_PORT + 1) >> 8);
+			udp[1] = (unsigned char)(ZT_TAPBENCH_PORT + 1);
+			udp[2] = (unsigned char)(ZT_TAPBENCH_PORT >> 8);
+			udp[3] = (unsigned char)ZT_TAPBENCH_PORT;
+			udp[4] = (unsigned char)((8 + a.payload) >> 8);
+			udp[5] = (unsigned char)(8 + a.payload);
+			udp[8] = ZT_TAPBENCH_MARK_DATA; // UDP checksum left zero (none)
+
+			uint64_t now = start;
+			while ((!stopRequested)&&(now < deadline)) {
+				for(unsigned int k=0;k<64;++k) {
+					if (send(s,buf,frameLen,0) == (long)frameLen) {
+						++r.packets;
+						r.bytes += a.payload;
+					} else ++r.errors;
+					pace(a,start,r.packets + r.errors);
+				}
+				now = Utils::nowMicros();
+			}
+			r.elapsedUs = now - start;
+			close(s);
+			r.ok = 1;
+		}	break;
+	}
+
+	if (!r.elapsedUs)
+		r.elapsedUs = Utils::nowMicros() - start;
+}
+
+static Generator startGenerator(const Instance &in,const GeneratorArgs &a)
+{
+	Generator g;
+	g.pid = -1;
+	g.fd = -1;
+	int p[2];
+	if (pipe(p))
+		return g;
+	g.pid = fork();
+	if (g.pid == 0) {
+		close(p[0]);
+		GeneratorResult r;
+		memset(&r,0,sizeof(r));
+		const int nsfd = open((std::string("/var/run/netns/") + in.ns).c_str(),O_RDONLY);
+		if ((nsfd >= 0)&&(setns(nsfd,CLONE_NEWNET) == 0))
+			generatorMain(a,r);
+		if (write(p[1],&r,sizeof(r)) != (long)sizeof(r))
+			_exit(1);
+		_exit(0);
+	}
+	close(p[1]);
+	if (g.pid < 0)
+		close(p[0]);
+	else g.fd = p[0];
+	return g;
+}
+
+static GeneratorResult finishGenerator(Generator &g,bool stop)
+{
+	GeneratorResult r;
+	memset(&r,0,sizeof(r));
+	if (g.pid > 0) {
+		if (stop)
+			kill(g.pid,SIGTERM);
+		unsigned int got = 0;
+		while (got < sizeof(r)) {
+			long n = (long)read(g.fd,((char *)&r) + got,sizeof(r) - got);
+			if (n <= 0) {
+				if ((n < 0)&&(errno == EINTR))
+					continue;
+				memset(&r,0,sizeof(r));
+				break;
+			}
+			got += (unsigned int)n;
+		}
+		close(g.fd);
+		waitpid(g.pid,(int *)0,0);
+		g.pid = -1;
+	}
+	return r;
+}
+
+static GeneratorResult runGenerator(const Instance &in,const GeneratorArgs &a)
+{
+	Generator g(startGenerator(in,a));
+	return finishGenerator(g,false);
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void removeNamespaces(unsigned int count)
+{
+	for(unsigned int i=0;i<count;++i) {
+		char tmp[64];
+		Utils::snprintf(tmp,sizeof(tmp),"ip netns del " ZT_TAPBENCH_NS_PREFIX "%u",i);
+		sh(tmp);
+	}
+	sh("ip netns del " ZT_TAPBENCH_WIRE_NS);
+}
+
+static bool createNamespaces(std::vector<Instance> &instances)
+{
+	if (sh("ip netns add " ZT_TAPBENCH_WIRE_NS))
+		return false;
+	if (sh("ip -n " ZT_TAPBENCH_WIRE_NS " link add br0 type bridge")||sh("ip -n " ZT_TAPBENCH_WIRE_NS " link set br0 up"))
+		return false;
+	for(unsigned int i=0;i<instances.size();++i) {
+		char tmp[1024];
+		const char *ns = instances[i].ns.c_str();
+		Utils::snprintf(tmp,sizeof(tmp),"ip netns add %s",ns);
+		if (sh(tmp)) return false;
+		Utils::snprintf(tmp,sizeof(tmp),"ip -n " ZT_TAPBENCH_WIRE_NS " link add v%u type veth peer name eth0 netns %s",i,ns);
+		if (sh(tmp)) return false;
+		Utils::snprintf(tmp,sizeof(tmp),"ip -n " ZT_TAPBENCH_WIRE_NS " link set v%u master br0 up",i);
+		if (sh(tmp)) return false;
+		Utils::snprintf(tmp,sizeof(tmp),"ip -n %s addr add " ZT_TAPBENCH_UNDERLAY_PREFIX "%u/24 dev eth0",ns,i + 1);
+		if (sh(tmp)) return false;
+		Utils::snprintf(tmp,sizeof(tmp),"ip -n %s link set eth0 up",ns);
+		if (sh(tmp)) return false;
+		Utils::snprintf(tmp,sizeof(tmp),"ip -n %s link set lo up",ns);
+		if (sh(tmp)) return false;
+	}
+	return true;
+}
+
+static bool writeHomes(const std::string &dir,std::vector<Instance> &instances)
+{
+	// Instance 0 is the only supernode, reachable at the first underlay address
+	Dictionary supernodes,snd,rtd;
+	snd["id"] = instances[0].id.toString(false);
+	snd["udp"] = InetAddress(ZT_TAPBENCH_UNDERLAY_PREFIX "1",ZT_DEFAULT_UDP_PORT).toString();
+	supernodes[instances[0].id.address().toString()] = snd.toString();
+	rtd["supernodes"] = supernodes.toString();
+	const std::string rtPath(dir + ZT_PATH_SEPARATOR_S + "root-topology");
+	if (!Utils::writeFile(rtPath.c_str(),rtd.toString()))
+		return false;
+
+	for(unsigned int i=0;i<instances.size();++i) {
+		Instance &in = instances[i];
+		mkdir(in.home.c_str(),0700);
+		if ((!Utils::writeFile((in.home + ZT_PATH_SEPARATOR_S + "identity.secret").c_str(),in.id.toString(true)))||(!Utils::writeFile((in.home + ZT_PATH_SEPARATOR_S + "identity.public").c_str(),in.id.toString(false))))
+			return false;
+		if (i) {
+			Dictionary lc;
+			lc["testNetworkUnrestricted"] = "1";
+			if (!Utils::writeFile((in.home + ZT_PATH_SEPARATOR_S + "local.conf").c_str(),lc.toString()))
+				return false;
+			const std::string nd(in.home + ZT_PATH_SEPARATOR_S + "networks.d");
+			mkdir(nd.c_str(),0700);
+			char tmp[32];
+			Utils::snprintf(tmp,sizeof(tmp),"%.16llx.conf",(unsigned long long)ZT_TEST_NETWORK_ID);
+			if (!Utils::writeFile((nd + ZT_PATH_SEPARATOR_S + tmp).c_str(),std::string()))
+				return false;
+		}
+	}
+	return true;
+}
+
+static bool startInstances(const std::string &zt1,const std::string &dir,std::vector<Instance> &instances)
+{
+	const std::string rtArg(std::string("-T") + dir + ZT_PATH_SEPARATOR_S + "root-topology");
+	for(std::vector<Instance>::iterator in(instances.begin());in!=instances.end();++in) {
+		in->pid = fork();
+		if (in->pid < 0)
+			return false;
+		if (in->pid == 0) {
+			const int logfd = open((in->home + ZT_PATH_SEPARATOR_S + "console.log").c_str(),O_WRONLY|O_CREAT|O_TRUNC,0600);
+			if (logfd >= 0) {
+				dup2(logfd,STDOUT_FILENO);
+				dup2(logfd,STDERR_FILENO);
+				close(logfd);
+			}
+			signal(SIGINT,SIG_IGN); // we shut instances down ourselves
+			execlp("ip","ip","netns","exec",in->ns.c_str(),zt1.c_str(),rtArg.c_str(),in->home.c_str(),(const char *)0);
+			_exit(1);
+		}
+	}
+	return true;
+}
+
+static void stopInstances(std::vector<Instance> &instances)
+{
+	for(std::vector<Instance>::iterator in(instances.begin());in!=instances.end();++in) {
+		if (in->pid > 0)
+			kill(in->pid,SIGTERM);
+	}
+	for(std::vector<Instance>::iterator in(instances.begin());in!=instances.end();++in) {
+		if (in->pid > 0) {
+			for(unsigned int k=0;k<50;++k) {
+				if (waitpid(in->pid,(int *)0,WNOHANG) == in->pid) {
+					in->pid = 0;
+					break;
+				}
+				sleepMs(100);
+			}
+			if (in->pid > 0) {
+				kill(in->pid,SIGKILL);
+				waitpid(in->pid,(int *)0,0);
+				in->pid = 0;
+			}
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------ */
+
+/**
+ * Settings for one benchmark run
+ */
+struct TapBenchSettings
+{
+	unsigned int payload;
+	unsigned int seconds;
+	unsigned long rate;
+	bool allSend;
+};
+
+/**
+ * Run one test and print its result line
+ *
+ * Unicast and bridged send from each sender to the next member; multicast
+ * broadcasts to all members. Members 1..n are indexes into instances.
+ */
+static bool runTest(const char *name,std::vector<Instance> &instances,const TapBenchSettings &s)
+{
+	const bool multicast = (!strcmp(name,"multicast"));
+	const bool bridged = (!strcmp(name,"bridged"));
+	const unsigned int members = (unsigned int)instances.size() - 1;
+	const unsigned int senders = (s.allSend) ? members : 1;
+	const uint32_t broadcast = instances[1].ip | htonl(0x00ffffff); // test network is a /8
+
+	std::vector<GeneratorArgs> sends;
+	std::vector<unsigned int> senderIdx,receiverIdx;
+	for(unsigned int k=0;k<senders;++k) {
+		const unsigned int from = 1 + k;
+		const unsigned int to = 1 + (k + 1) % members;
+		GeneratorArgs a;
+		memset(&a,0,sizeof(a));
+		a.self = instances[from].ip;
+		a.dest = (multicast) ? broadcast : instances[to].ip;
+		instances[to].mac.copyTo(a.destMac,6);
+		a.srcMac[0] = 0x02; // locally administered, not any tap's MAC
+		a.srcMac[1] = 0x7a;
+		a.srcMac[2] = 0x62;
+		a.srcMac[5] = (unsigned char)from;
+		a.expect = (multicast) ? (members - 1) : 1;
+		a.payload = s.payload;
+		a.seconds = s.seconds;
+		a.rate = s.rate;
+		sends.push_back(a);
+		senderIdx.push_back(from);
+		if (!multicast)
+			receiverIdx.push_back(to);
+	}
+	if (multicast) {
+		for(unsigned int m=1;m<=members;++m) {
+			if ((s.allSend)||(m != 1))
+				receiverIdx.push_back(m);
+		}
+	}
+
+	GeneratorArgs ra;
+	memset(&ra,0,sizeof(ra));
+
+	// Warm up: probe until every receiver has echoed, so paths, ARP and
+	// multicast subscriptions are in place before anything is timed
+	std::vector<Generator> gens;
+	for(std::vector<unsigned int>::const_iterator r(receiverIdx.begin());r!=receiverIdx.end();++r) {
+		ra.kind = GEN_RESPOND;
+		ra.self = instances[*r].ip;
+		gens.push_back(startGenerator(instances[*r],ra));
+	}
+	sleepMs(200);
+	bool warm = true;
+	for(unsigned int k=0;k<senders;++k) {
+		GeneratorArgs pa(sends[k]);
+		pa.kind = GEN_PROBE;
+		pa.seconds = ZT_TAPBENCH_STARTUP_TIMEOUT;
+		if (!runGenerator(instances[senderIdx[k]],pa).ok)
+			warm = false;
+	}
+	for(std::vector<Generator>::iterator g(gens.begin());g!=gens.end();++g)
+		finishGenerator(*g,true);
+	gens.clear();
+	if (!warm) {
+		printf("%-10s FAILED: members could not reach each other within %u seconds" ZT_EOL_S,name,ZT_TAPBENCH_STARTUP_TIMEOUT);
+		return false;
+	}
+
+	// Measure
+	for(std::vector<unsigned int>::const_iterator r(receiverIdx.begin());r!=receiverIdx.end();++r) {
+		ra.kind = GEN_RECEIVE;
+		ra.self = instances[*r].ip;
+		gens.push_back(startGenerator(instances[*r],ra));
+	}
+	sleepMs(200);
+	const uint64_t cpuStart = totalCpuTime(instances);
+	std::vector<Generator> sgens;
+	for(unsigned int k=0;k<senders;++k) {
+		sends[k].kind = (bridged) ? GEN_SEND_RAW : GEN_SEND;
+		sgens.push_back(startGenerator(instances[senderIdx[k]],sends[k]));
+	}
+	uint64_t txPackets = 0,txErrors = 0,elapsedUs = 0;
+	for(std::vector<Generator>::iterator g(sgens.begin());g!=sgens.end();++g) {
+		const GeneratorResult r(finishGenerator(*g,false));
+		txPackets += r.packets;
+		txErrors += r.errors;
+		elapsedUs = std::max(elapsedUs,r.elapsedUs);
+	}
+	sleepMs(ZT_TAPBENCH_DRAIN);
+	uint64_t rxPackets = 0,rxBytes = 0;
+	for(std::vector<Generator>::iterator g(gens.begin());g!=gens.end();++g) {
+		const GeneratorResult r(finishGenerator(*g,true));
+		rxPackets += r.packets;
+		rxBytes += r.bytes;
+	}
+	const uint64_t cpuUs = totalCpuTime(instances) - cpuStart;
+
+	const double secs = (elapsedUs) ? ((double)elapsedUs / 1000000.0) : 1.0;
+	const double expected = (double)txPackets * ((multicast) ? (double)(members - 1) : 1.0); // senders don't hear their own broadcasts
+	printf("%-10s %7u %12.0f %12.0f %9.3f %7.2f%% %10.2f" ZT_EOL_S,
+		name,
+		senders,
+		(double)txPackets / secs,
+		(double)rxPackets / secs,
+		(((double)rxBytes + ((double)rxPackets * ZT_TAPBENCH_FRAME_OVERHEAD)) * 8.0) / (secs * 1000000000.0),
+		(expected > 0.0) ? ((1.0 - ((double)rxPackets / expected)) * 100.0) : 0.0,
+		(rxPackets) ? ((double)cpuUs / (double)rxPackets) : 0.0);
+	if (txErrors)
+		printf("%-10s (%llu sends failed, e.g. tap queue full)" ZT_EOL_S,"",(unsigned long long)txErrors);
+	fflush(stdout);
+	return true;
+}
+
+static void printUsage(const char *pn)
+{
+	printf("Usage: %s [-option ...] [unicast] [multicast] [bridged]" ZT_EOL_S,pn);
+	printf("Runs all three tests if none are named. Must be run as root." ZT_EOL_S);
+	printf("Options:" ZT_EOL_S);
+	printf("  -h           - Display this help" ZT_EOL_S);
+	printf("  -z<path>     - zerotier-one binary (default: ./zerotier-one)" ZT_EOL_S);
+	printf("  -m<members>  - Member instances, besides the supernode (default: %u)" ZT_EOL_S,ZT_TAPBENCH_DEFAULT_MEMBERS);
+	printf("  -t<seconds>  - Duration of each test (default: %u)" ZT_EOL_S,ZT_TAPBENCH_DEFAULT_DURATION);
+	printf("  -s<bytes>    - UDP payload size, %u to %u (default: %u)" ZT_EOL_S,ZT_TAPBENCH_MIN_PAYLOAD,ZT_TAPBENCH_MAX_PAYLOAD,ZT_TAPBENCH_DEFAULT_PAYLOAD);
+	printf("  -r<pps>      - Packets per second per sender (default: as fast as possible)" ZT_EOL_S);
+	printf("  -a           - Every member sends, not just the first" ZT_EOL_S);
+	printf("  -k           - Keep instance home folders and logs" ZT_EOL_S);
+	printf("Unicast and bridged send to the next member; multicast broadcasts to all." ZT_EOL_S);
+	printf("Bridged frames carry a source MAC that isn't the sending tap's." ZT_EOL_S);
+	printf("Gbit/s counts whole Ethernet frames. CPU is zerotier-one user+system time" ZT_EOL_S);
+	printf("for all instances, per packet received." ZT_EOL_S);
+}
+
+int main(int argc,char **argv)
+{
+	std::string zt1("./zerotier-one");
+	unsigned int members = ZT_TAPBENCH_DEFAULT_MEMBERS;
+	TapBenchSettings s;
+	s.payload = ZT_TAPBENCH_DEFAULT_PAYLOAD;
+	s.seconds = ZT_TAPBENCH_DEFAULT_DURATION;
+	s.rate = 0;
+	s.allSend = false;
+	bool keep = false;
+	std::vector<std::string> tests;
+
+	for(int i=1;i<argc;++i) {
+		if (argv[i][0] == '-') {
+			switch(argv[i][1]) {
+				case 'z': zt1 = argv[i] + 2; break;
+				case 'm': members = Utils::strToUInt(argv[i] + 2); break;
+				case 't': s.seconds = Utils::strToUInt(argv[i] + 2); break;
+				case 's': s.payload = Utils::strToUInt(argv[i] + 2); break;
+				case 'r': s.rate = Utils::strToULong(argv[i] + 2); break;
+				case 'a': s.allSend = true; break;
+				case 'k': keep = true; break;
+				case 'h':
+				default:
+					printUsage(argv[0]);
+					return ((argv[i][1] == 'h') ? 0 : 1);
+			}
+		} else if ((!strcmp(argv[i],"unicast"))||(!strcmp(argv[i],"multicast"))||(!strcmp(argv[i],"bridged"))) {
+			tests.push_back(std::string(argv[i]));
+		} else {
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	if ((members < 2)||(members > ZT_TAPBENCH_MAX_MEMBERS)||(!s.seconds)||(s.payload < ZT_TAPBENCH_MIN_PAYLOAD)||(s.payload > ZT_TAPBENCH_MAX_PAYLOAD)) {
+		printUsage(argv[0]);
+		return 1;
+	}
+	if (tests.empty()) {
+		tests.push_back("unicast");
+		tests.push_back("multicast");
+		tests.push_back("bridged");
+	}
+	if (geteuid() != 0) {
+		fprintf(stderr,"%s: must be run as root to create network namespaces" ZT_EOL_S,argv[0]);
+		return 1;
+	}
+	if (access(zt1.c_str(),X_OK)) {
+		fprintf(stderr,"%s: %s is not executable (use -z)" ZT_EOL_S,argv[0],zt1.c_str());
+		return 1;
+	}
+	if (zt1[0] != '/') {
+		char cwd[4096];
+		if (getcwd(cwd,sizeof(cwd)))
+			zt1 = std::string(cwd) + ZT_PATH_SEPARATOR_S + zt1;
+	}
+
+	char dirTemplate[64];
+	Utils::snprintf(dirTemplate,sizeof(dirTemplate),"/tmp/zerotier-tapbench-XXXXXX");
+	if (!mkdtemp(dirTemplate)) {
+		fprintf(stderr,"%s: unable to create temporary folder" ZT_EOL_S,argv[0]);
+		return 1;
+	}
+	const std::string dir(dirTemplate);
+
+	signal(SIGINT,&interruptHandler);
+	signal(SIGTERM,&interruptHandler);
+	signal(SIGPIPE,SIG_IGN);
+
+	std::vector<Instance> instances(members + 1);
+	printf("generating %u identities..." ZT_EOL_S,members + 1);
+	fflush(stdout);
+	for(unsigned int i=0;i<instances.size();++i) {
+		Instance &in = instances[i];
+		in.id.generate();
+		char tmp[64];
+		Utils::snprintf(tmp,sizeof(tmp),ZT_TAPBENCH_NS_PREFIX "%u",i);
+		in.ns = tmp;
+		Utils::snprintf(tmp,sizeof(tmp),"%u",i);
+		in.home = dir + ZT_PATH_SEPARATOR_S + tmp;
+		in.ip = 0;
+		in.pid = 0;
+		in.mac = MAC(in.id.address(),ZT_TEST_NETWORK_ID);
+		if (i) {
+			SharedPtr<NetworkConfig> nc(NetworkConfig::createTestNetworkConfig(in.id.address()));
+			in.ip = *((const uint32_t *)nc->staticIps()[0].rawIpData());
+		}
+	}
+
+	int exitCode = 1;
+	removeNamespaces(ZT_TAPBENCH_MAX_MEMBERS + 1);
+	if (!createNamespaces(instances)) {
+		fprintf(stderr,"%s: unable to create network namespaces (is iproute2 installed?)" ZT_EOL_S,argv[0]);
+	} else if (!writeHomes(dir,instances)) {
+		fprintf(stderr,"%s: unable to write instance home folders under %s" ZT_EOL_S,argv[0],dir.c_str());
+	} else if (!startInstances(zt1,dir,instances)) {
+		fprintf(stderr,"%s: unable to start instances" ZT_EOL_S,argv[0]);
+	} else {
+		printf("started supernode %s and %u members in %s, waiting for taps..." ZT_EOL_S,instances[0].id.address().toString().c_str(),members,dir.c_str());
+		fflush(stdout);
+
+		bool ready = false;
+		const uint64_t giveUp = Utils::now() + (ZT_TAPBENCH_STARTUP_TIMEOUT * 1000);
+		while ((!interrupted)&&(!ready)&&(Utils::now() < giveUp)) {
+			ready = true;
+			for(unsigned int i=1;i<instances.size();++i) {
+				GeneratorArgs a;
+				memset(&a,0,sizeof(a));
+				a.kind = GEN_FIND_TAP;
+				a.self = instances[i].ip;
+				if (!runGenerator(instances[i],a).ok) {
+					ready = false;
+					break;
+				}
+			}
+			if (!ready)
+				sleepMs(250);
+		}
+
+		if (!ready) {
+			fprintf(stderr,"%s: taps did not come up, see console.log files in %s (use -k to keep them)" ZT_EOL_S,argv[0],dir.c_str());
+		} else {
+			for(unsigned int i=1;i<instances.size();++i)
+				printf("member %s  %-15s  %s" ZT_EOL_S,instances[i].id.address().toString().c_str(),ipString(instances[i].ip).c_str(),instances[i].mac.toString().c_str());
+			printf("%u byte payloads, %u seconds per test" ZT_EOL_S ZT_EOL_S,s.payload,s.seconds);
+			printf("%-10s %7s %12s %12s %9s %8s %10s" ZT_EOL_S,"test","senders","tx pps","rx pps","Gbit/s","loss","CPU us/pkt");
+			exitCode = 0;
+			for(std::vector<std::string>::const_iterator t(tests.begin());(t!=tests.end())&&(!interrupted);++t) {
+				if (!runTest(t->c_str(),instances,s))
+					exitCode = 1;
+			}
+		}
+	}
+
+	stopInstances(instances);
+	removeNamespaces((unsigned int)instances.size());
+	if (keep)
+		printf("instance home folders kept in %s" ZT_EOL_S,dir.c_str());
+	else sh(std::string("rm -rf ") + dir);
+
+	return ((interrupted) ? 1 : exitCode);
+}
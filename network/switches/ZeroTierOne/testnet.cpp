@@ -31,11 +31,13 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 #include <string>
 #include <map>
 #include <vector>
 #include <set>
+#include <algorithm>
 
 #include "node/Constants.hpp"
 #include "node/Node.hpp"
@@ -45,6 +47,8 @@
 #include "node/Thread.hpp"
 #include "node/CMWC4096.hpp"
 #include "node/Dictionary.hpp"
+#include "node/Packet.hpp"
+#include "node/MAC.hpp"
 
 #include "testnet/SimNet.hpp"
 #include "testnet/SimNetSocketManager.hpp"
@@ -59,6 +63,21 @@
 #include <sys/stat.h>
 #endif
 
+// Virtual clock starts here in discrete-event mode (-d)
+#define ZT_TESTNET_SIMULATION_EPOCH 1400000000000ULL
+
+// Default one-way packet latency in discrete-event mode (threaded mode defaults to none)
+#define ZT_TESTNET_DEFAULT_LATENCY 10
+
+// Storms send this many frames per second per flow unless told otherwise
+#define ZT_TESTNET_STORM_DEFAULT_RATE 10
+
+// Storms inject frames and collect arrivals in steps of this many ms
+#define ZT_TESTNET_STORM_TICK 10
+
+// Storms wait this long after the last frame is sent for stragglers (ms)
+#define ZT_TESTNET_STORM_DRAIN 2000
+
 using namespace ZeroTier;
 
 class SimNode
@@ -66,26 +85,58 @@ class SimNode
 public:
 	SimNode(SimNet &net,const std::string &hp,const char *rootTopology,bool issn,const InetAddress &addr) :
 		home(hp),
-		tapFactory(),
+		tapFactory(net.isDiscrete()),
 		routingTable(),
-		socketManager(net.newEndpoint(addr)),
+		socketManager(net.get(addr) ? net.get(addr) : net.newEndpoint(addr)), // endpoint survives restarts
 		node(home.c_str(),&tapFactory,&routingTable,socketManager,false,rootTopology),
 		reasonForTermination(Node::NODE_RUNNING),
-		supernode(issn)
+		supernode(issn),
+		discrete(net.isDiscrete()),
+		cpuBase(socketManager->cpuTime()),
+		haveCpuClock(false)
 	{
-		thread = Thread::start(this);
+		if (discrete) {
+			reasonForTermination = node.init();
+			socketManager->attach(&node);
+		} else thread = Thread::start(this);
 	}
 
 	~SimNode()
 	{
 		node.terminate(Node::NODE_NORMAL_TERMINATION,"SimNode shutdown");
-		Thread::join(thread);
+		if (thread) {
+			Thread::join(thread);
+		} else {
+			socketManager->attach((Node *)0);
+			reasonForTermination = node.shutdown();
+		}
 	}
 
 	void threadMain()
 		throw()
 	{
+#ifdef __LINUX__
+		if (!pthread_getcpuclockid(pthread_self(),&cpuClock))
+			haveCpuClock = true;
+#endif
 		reasonForTermination = node.run();
+		haveCpuClock = false;
+	}
+
+	// Microseconds of CPU time this node has spent on packets, timers, and
+	// frames from its taps. In threaded mode the node's main thread is only
+	// counted on Linux, and its service threads are never counted.
+	uint64_t cpuTime()
+	{
+		uint64_t t = tapFactory.cpuTime();
+		if (discrete)
+			return (t + (socketManager->cpuTime() - cpuBase));
+#ifdef __LINUX__
+		struct timespec ts;
+		if ((haveCpuClock)&&(!clock_gettime(cpuClock,&ts)))
+			t += ((uint64_t)ts.tv_sec * 1000000ULL) + ((uint64_t)ts.tv_nsec / 1000ULL);
+#endif
+		return t;
 	}
 
 	std::string home;
@@ -95,6 +146,12 @@ public:
 	Node node;
 	Node::ReasonForTermination reasonForTermination;
 	bool supernode;
+	bool discrete;
+	uint64_t cpuBase;
+	volatile bool haveCpuClock;
+#ifdef __LINUX__
+	clockid_t cpuClock;
+#endif
 	Thread thread;
 };
 
@@ -104,6 +161,22 @@ static std::map< Address,SimNode * > nodes;
 static std::map< InetAddress,Address > usedIps;
 static CMWC4096 prng;
 static std::string rootTopology;
+static std::vector<std::string> jsonTests; // results of storms as JSON objects
+
+// Let time pass: in real time, or in virtual time by running the simulation
+static void advance(unsigned long ms)
+{
+	if (net.isDiscrete())
+		net.run(Utils::now() + ms);
+	else Thread::sleep(ms);
+}
+
+static bool nextReceivedFrame(TestEthernetTap *tap,TestEthernetTap::TestFrame &frame)
+{
+	if (net.isDiscrete())
+		return tap->getNextReceivedFrame(frame);
+	return tap->getNextReceivedFrame(frame,5);
+}
 
 // Converts an address into a fake IP not already claimed.
 // Be sure to call only once, as this claims the IP before returning it.
@@ -128,6 +201,30 @@ static InetAddress inetAddressFromZeroTierAddress(const Address &addr)
 	}
 }
 
+// Looks up the fake IP claimed by a node, or returns a nil address if none
+static InetAddress inetAddressOf(const Address &addr)
+{
+	for(std::map< InetAddress,Address >::iterator u(usedIps.begin());u!=usedIps.end();++u) {
+		if (u->second == addr)
+			return u->first;
+	}
+	return InetAddress();
+}
+
+// Expands an address/*/** command argument into node addresses
+static std::vector<Address> expandAddresses(const std::string &spec)
+{
+	std::vector<Address> addrs;
+	if ((spec == "*")||(spec == "**")) {
+		bool includeSuper = (spec == "**");
+		for(std::map< Address,SimNode * >::iterator n(nodes.begin());n!=nodes.end();++n) {
+			if ((includeSuper)||(!n->second->supernode))
+				addrs.push_back(n->first);
+		}
+	} else addrs.push_back(Address(spec));
+	return addrs;
+}
+
 static Identity makeNodeHome(bool super)
 {
 	Identity id;
@@ -146,6 +243,12 @@ static Identity makeNodeHome(bool super)
 	if (!Utils::writeFile((path + ZT_PATH_SEPARATOR_S + "identity.public").c_str(),id.toString(false)))
 		return Identity();
 
+	// Save peer snapshots so restart can come back warm
+	Dictionary localConf;
+	localConf["persistPeers"] = "1";
+	if (!Utils::writeFile((path + ZT_PATH_SEPARATOR_S + "local.conf").c_str(),localConf.toString()))
+		return Identity();
+
 	return id;
 }
 
@@ -168,6 +271,9 @@ static std::vector<Address> initSupernodes()
 					Dictionary snd;
 					snd["id"] = id.toString(false);
 					snd["udp"] = inaddr.toString();
+					InetAddress tcpaddr(inaddr);
+					tcpaddr.setPort(ZT_SIMNET_TCP_PORT);
+					snd["tcp"] = tcpaddr.toString();
 					snd["desc"] = id.address().toString();
 					snd["dns"] = inaddr.toIpString();
 					supernodes[id.address().toString()] = snd.toString();
@@ -227,6 +333,14 @@ static void doHelp(const std::vector<std::string> &cmd)
 	printf("---------- listpeers <address/*/**>"ZT_EOL_S);
 	printf("---------- unicast <address/*/**> <address/*/**> <network ID> <frame length, min: 16> [<timeout (sec)>]"ZT_EOL_S);
 	printf("---------- multicast <address/*/**> <MAC/* for bcast> <network ID> <frame length, min: 16> [<timeout (sec)>]"ZT_EOL_S);
+	printf("---------- restart <address/*/**> [cold]"ZT_EOL_S);
+	printf("---------- unicaststorm <address/*/**> <address/*/**> <network ID> <frame length, min: 24> <seconds> [<frames/sec per pair>]"ZT_EOL_S);
+	printf("---------- multicaststorm <address/*/**> <MAC/* for bcast> <network ID> <frame length, min: 24> <seconds> [<frames/sec per sender>]"ZT_EOL_S);
+	printf("---------- run <milliseconds>"ZT_EOL_S);
+	printf("---------- link <default/address/*/**> [<address/*/**>] [latency=<ms>] [jitter=<ms>] [loss=<%%>] [reorder=<%%>] [bw=<kbit/s>]"ZT_EOL_S);
+	printf("---------- link <address/*/**> reset"ZT_EOL_S);
+	printf("---------- nat <address/*/**> <none/full/restricted/portrestricted/symmetric/udpblocked> [timeout=<sec>]"ZT_EOL_S);
+	printf("---------- netstats"ZT_EOL_S);
 	printf("---------- quit"ZT_EOL_S);
 	printf("---------- ( * means all regular nodes, ** means including supernodes )"ZT_EOL_S);
 	printf("---------- ( . runs previous command again )"ZT_EOL_S);
@@ -559,7 +673,7 @@ static void doUnicast(const std::vector<std::string> &cmd)
 			SimNode *receiver = nodes[*r];
 			TestEthernetTap *rtap = receiver->tapFactory.getByNwid(nwid);
 
-			if ((rtap)&&(rtap->getNextReceivedFrame(frame,5))) {
+			if ((rtap)&&(nextReceivedFrame(rtap,frame))) {
 				if ((frame.len == frameLen)&&(!memcmp(frame.data + 16,pkt.data + 16,frameLen - 16))) {
 					uint64_t ints[2];
 					memcpy(ints,frame.data,16);
@@ -571,7 +685,7 @@ static void doUnicast(const std::vector<std::string> &cmd)
 			}
 		}
 
-		Thread::sleep(100);
+		advance(100);
 	} while ((receivedPairs.size() < sentPairs.size())&&(Utils::now() < toutend));
 
 	for(std::vector<Address>::iterator s(senders.begin());s!=senders.end();++s) {
@@ -587,6 +701,62 @@ static void doUnicast(const std::vector<std::string> &cmd)
 	printf("---------- sent %u, received %u"ZT_EOL_S,(unsigned int)sentPairs.size(),(unsigned int)receivedPairs.size());
 }
 
+static void doRestart(const std::vector<std::string> &cmd)
+{
+	if (cmd.size() < 2) {
+		doHelp(cmd);
+		return;
+	}
+	const bool cold = ((cmd.size() >= 3)&&(cmd[2] == "cold"));
+
+	std::vector<Address> addrs;
+	if ((cmd[1] == "*")||(cmd[1] == "**")) {
+		bool includeSuper = (cmd[1] == "**");
+		for(std::map< Address,SimNode * >::iterator n(nodes.begin());n!=nodes.end();++n) {
+			if ((includeSuper)||(!n->second->supernode))
+				addrs.push_back(n->first);
+		}
+	} else addrs.push_back(Address(cmd[1]));
+
+	printf("---------- <ztaddr> <ms until online with previous direct links> <direct links before> <direct links after>"ZT_EOL_S);
+
+	for(std::vector<Address>::iterator a(addrs.begin());a!=addrs.end();++a) {
+		std::map< Address,SimNode * >::iterator n(nodes.find(*a));
+		if (n == nodes.end())
+			continue;
+
+		const InetAddress inaddr(inetAddressOf(*a));
+
+		ZT1_Node_Status status;
+		n->second->node.status(&status);
+		const unsigned int directBefore = status.directlyConnectedPeers;
+		const std::string home(n->second->home);
+		const bool super = n->second->supernode;
+
+		delete n->second; // writes peers.persist on the way down
+		if (cold)
+			Utils::rm((home + ZT_PATH_SEPARATOR_S + "peers.persist").c_str());
+
+		const uint64_t start = Utils::now();
+		n->second = new SimNode(net,home,rootTopology.c_str(),super,inaddr);
+
+		bool up = false;
+		memset(&status,0,sizeof(status));
+		while ((Utils::now() - start) < 30000) {
+			n->second->node.status(&status);
+			if ((status.initialized)&&(status.online)&&(status.directlyConnectedPeers >= directBefore)) {
+				up = true;
+				break;
+			}
+			advance(10);
+		}
+
+		if (up)
+			printf("%s %llu %u %u"ZT_EOL_S,a->toString().c_str(),(unsigned long long)(Utils::now() - start),directBefore,status.directlyConnectedPeers);
+		else printf("%s TIMEOUT %u %u"ZT_EOL_S,a->toString().c_str(),directBefore,status.directlyConnectedPeers);
+	}
+}
+
 static void doMulticast(const std::vector<std::string> &cmd)
 {
 	union {
@@ -656,7 +826,7 @@ static void doMulticast(const std::vector<std::string> &cmd)
 			SimNode *receiver = nn->second;
 			TestEthernetTap *rtap = receiver->tapFactory.getByNwid(nwid);
 
-			if ((rtap)&&(rtap->getNextReceivedFrame(frame,5))) {
+			if ((rtap)&&(nextReceivedFrame(rtap,frame))) {
 				if ((frame.len == frameLen)&&(!memcmp(frame.data + 16,pkt.data + 16,frameLen - 16))) {
 					uint64_t ints[2];
 					memcpy(ints,frame.data,16);
@@ -668,22 +838,527 @@ static void doMulticast(const std::vector<std::string> &cmd)
 			}
 		}
 
-		Thread::sleep(100);
+		advance(100);
 	} while (Utils::now() < toutend);
 
 	printf("---------- test multicast received by %u peers"ZT_EOL_S,receiveCount);
 }
 
+static std::string jsonEscape(const std::string &s)
+{
+	std::string r;
+	for(std::string::const_iterator c(s.begin());c!=s.end();++c) {
+		if ((*c == '"')||(*c == '\\')) {
+			r.push_back('\\');
+			r.push_back(*c);
+		} else if ((unsigned char)*c >= 32)
+			r.push_back(*c);
+	}
+	return r;
+}
+
+// Packet counts by verb name as a JSON object, skipping verbs with none
+static std::string jsonVerbCounts(const uint64_t *counts)
+{
+	std::string r("{");
+	char tmp[128];
+	for(unsigned int v=0;v<ZT1_NODE_VERBS;++v) {
+		if (counts[v]) {
+			Utils::snprintf(tmp,sizeof(tmp),"%s\"%s\":%llu",((r.length() > 1) ? "," : ""),Packet::verbString((Packet::Verb)v),(unsigned long long)counts[v]);
+			r.append(tmp);
+		}
+	}
+	r.push_back('}');
+	return r;
+}
+
+// Sums packet counts by verb over all nodes
+static void totalVerbCounts(uint64_t *sent,uint64_t *received)
+{
+	ZT1_Node_Status status;
+	memset(sent,0,sizeof(uint64_t) * ZT1_NODE_VERBS);
+	memset(received,0,sizeof(uint64_t) * ZT1_NODE_VERBS);
+	for(std::map< Address,SimNode * >::iterator n(nodes.begin());n!=nodes.end();++n) {
+		n->second->node.status(&status);
+		for(unsigned int v=0;v<ZT1_NODE_VERBS;++v) {
+			sent[v] += status.packetsSentByVerb[v];
+			received[v] += status.packetsReceivedByVerb[v];
+		}
+	}
+}
+
+static uint64_t totalCpuTime()
+{
+	uint64_t t = 0;
+	for(std::map< Address,SimNode * >::iterator n(nodes.begin());n!=nodes.end();++n)
+		t += n->second->cpuTime();
+	return t;
+}
+
+// Value at percentile p of sorted values
+static uint64_t percentile(const std::vector<uint64_t> &sorted,unsigned int p)
+{
+	if (sorted.empty())
+		return 0;
+	return sorted[std::min((sorted.size() * p) / 100,sorted.size() - 1)];
+}
+
+// One sender's stream of frames to one destination MAC in a storm
+struct StormFlow
+{
+	Address sender;
+	TestEthernetTap *tap;
+	MAC to;
+	uint64_t sent;
+};
+
+static void doStorm(const std::vector<std::string> &cmd,bool multicast)
+{
+	union {
+		uint64_t i[3];
+		unsigned char data[2800];
+	} pkt;
+
+	if (cmd.size() < 6) {
+		doHelp(cmd);
+		return;
+	}
+
+	const uint64_t nwid = Utils::hexStrToU64(cmd[3].c_str());
+	unsigned int frameLen = std::max(std::min(Utils::strToUInt(cmd[4].c_str()),2800U),24U);
+	const uint64_t duration = Utils::strToU64(cmd[5].c_str()) * 1000ULL;
+	const uint64_t rate = (cmd.size() >= 7) ? Utils::strToU64(cmd[6].c_str()) : (uint64_t)ZT_TESTNET_STORM_DEFAULT_RATE;
+
+	std::vector<Address> senders(expandAddresses(cmd[1]));
+	std::vector<Address> receivers;
+	std::vector<StormFlow> flows;
+	for(std::vector<Address>::iterator s(senders.begin());s!=senders.end();++s) {
+		std::map< Address,SimNode * >::iterator sn(nodes.find(*s));
+		TestEthernetTap *stap = (sn == nodes.end()) ? (TestEthernetTap *)0 : sn->second->tapFactory.getByNwid(nwid);
+		if (!stap) {
+			printf("%s !! not a member of %.16llx, not sending"ZT_EOL_S,s->toString().c_str(),(unsigned long long)nwid);
+			continue;
+		}
+
+		StormFlow f;
+		f.sender = *s;
+		f.tap = stap;
+		f.sent = 0;
+		if (multicast) {
+			if (cmd[2] == "*")
+				f.to = MAC(0xff,0xff,0xff,0xff,0xff,0xff);
+			else f.to.fromString(cmd[2].c_str());
+			if (!f.to.isMulticast()) {
+				printf("---------- %s is not a multicast MAC address"ZT_EOL_S,f.to.toString().c_str());
+				return;
+			}
+			flows.push_back(f);
+		} else {
+			std::vector<Address> rcv(expandAddresses(cmd[2]));
+			for(std::vector<Address>::iterator r(rcv.begin());r!=rcv.end();++r) {
+				std::map< Address,SimNode * >::iterator rn(nodes.find(*r));
+				TestEthernetTap *rtap = (rn == nodes.end()) ? (TestEthernetTap *)0 : rn->second->tapFactory.getByNwid(nwid);
+				if ((rtap)&&(*r != *s)) {
+					f.to = rtap->mac();
+					flows.push_back(f);
+				}
+			}
+		}
+	}
+	if (multicast) {
+		for(std::map< Address,SimNode * >::iterator n(nodes.begin());n!=nodes.end();++n)
+			receivers.push_back(n->first);
+	} else receivers = expandAddresses(cmd[2]);
+
+	if (flows.empty()) {
+		printf("---------- nothing to send"ZT_EOL_S);
+		return;
+	}
+
+	for(unsigned int i=0;i<frameLen;++i)
+		pkt.data[i] = (unsigned char)prng.next32();
+	pkt.i[2] = prng.next64(); // tags this storm's frames
+
+	printf("---------- %s storm: %u flows, %llu frames/sec each, %u byte frames for %llu seconds..."ZT_EOL_S,
+		(multicast ? "multicast" : "unicast"),
+		(unsigned int)flows.size(),
+		(unsigned long long)rate,
+		frameLen,
+		(unsigned long long)(duration / 1000ULL));
+
+	uint64_t verbsSentBefore[ZT1_NODE_VERBS],verbsReceivedBefore[ZT1_NODE_VERBS];
+	totalVerbCounts(verbsSentBefore,verbsReceivedBefore);
+	const uint64_t cpuBefore = totalCpuTime();
+	const SimNet::Stats netBefore(net.stats());
+
+	uint64_t sent = 0,received = 0;
+	std::vector<uint64_t> latencies;
+	TestEthernetTap::TestFrame frame;
+	const uint64_t start = Utils::now();
+	for(;;) {
+		const uint64_t now = Utils::now();
+		if (now < (start + duration)) {
+			const uint64_t due = (((now - start) * rate) / 1000ULL) + 1;
+			for(std::vector<StormFlow>::iterator f(flows.begin());f!=flows.end();++f) {
+				while (f->sent < due) {
+					pkt.i[0] = f->sender.toInt();
+					pkt.i[1] = now;
+					f->tap->injectPacketFromHost(f->tap->mac(),f->to,0xdead,pkt.data,frameLen);
+					++f->sent;
+					++sent;
+				}
+			}
+		} else if ((now >= (start + duration + ZT_TESTNET_STORM_DRAIN))||((!multicast)&&(received >= sent))) {
+			break;
+		}
+
+		for(std::vector<Address>::iterator r(receivers.begin());r!=receivers.end();++r) {
+			std::map< Address,SimNode * >::iterator rn(nodes.find(*r));
+			TestEthernetTap *rtap = (rn == nodes.end()) ? (TestEthernetTap *)0 : rn->second->tapFactory.getByNwid(nwid);
+			while ((rtap)&&(rtap->getNextReceivedFrame(frame))) {
+				if ((frame.len == frameLen)&&(!memcmp(frame.data + 16,pkt.data + 16,frameLen - 16))) {
+					uint64_t sentAt;
+					memcpy(&sentAt,frame.data + 8,8);
+					latencies.push_back(frame.timestamp - sentAt);
+					++received;
+				}
+			}
+		}
+
+		advance(ZT_TESTNET_STORM_TICK);
+	}
+
+	uint64_t verbsSent[ZT1_NODE_VERBS],verbsReceived[ZT1_NODE_VERBS];
+	totalVerbCounts(verbsSent,verbsReceived);
+	for(unsigned int v=0;v<ZT1_NODE_VERBS;++v) {
+		verbsSent[v] -= std::min(verbsSent[v],verbsSentBefore[v]); // nodes may have restarted
+		verbsReceived[v] -= std::min(verbsReceived[v],verbsReceivedBefore[v]);
+	}
+	const uint64_t cpuAfter = totalCpuTime();
+	const uint64_t cpu = cpuAfter - std::min(cpuAfter,cpuBefore);
+	const SimNet::Stats netAfter(net.stats());
+
+	std::sort(latencies.begin(),latencies.end());
+	const double seconds = (double)duration / 1000.0;
+	const double fps = (seconds > 0.0) ? ((double)received / seconds) : 0.0;
+
+	printf("---------- sent %llu, received %llu, %.1f frames/sec, %.0f bytes/sec, latency p50 %llums p90 %llums p99 %llums max %llums, %llu wire packets, %llums CPU"ZT_EOL_S,
+		(unsigned long long)sent,
+		(unsigned long long)received,
+		fps,
+		fps * (double)frameLen,
+		(unsigned long long)percentile(latencies,50),
+		(unsigned long long)percentile(latencies,90),
+		(unsigned long long)percentile(latencies,99),
+		(unsigned long long)(latencies.empty() ? 0 : latencies.back()),
+		(unsigned long long)(netAfter.packets - netBefore.packets),
+		(unsigned long long)(cpu / 1000ULL));
+
+	std::string cmdline;
+	for(std::vector<std::string>::const_iterator c(cmd.begin());c!=cmd.end();++c) {
+		if (c != cmd.begin())
+			cmdline.push_back(' ');
+		cmdline.append(*c);
+	}
+	char tmp[1024];
+	Utils::snprintf(tmp,sizeof(tmp),
+		"{\"command\":\"%s\",\"type\":\"%s\",\"flows\":%u,\"rate\":%llu,\"frameLength\":%u,\"durationMs\":%llu,"
+		"\"sent\":%llu,\"received\":%llu,\"framesPerSecond\":%.3f,\"bytesPerSecond\":%.3f,"
+		"\"latencyMs\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu},"
+		"\"wirePackets\":%llu,\"wireBytes\":%llu,\"cpuUs\":%llu,",
+		jsonEscape(cmdline).c_str(),
+		(multicast ? "multicast" : "unicast"),
+		(unsigned int)flows.size(),
+		(unsigned long long)rate,
+		frameLen,
+		(unsigned long long)duration,
+		(unsigned long long)sent,
+		(unsigned long long)received,
+		fps,
+		fps * (double)frameLen,
+		(unsigned long long)percentile(latencies,50),
+		(unsigned long long)percentile(latencies,90),
+		(unsigned long long)percentile(latencies,99),
+		(unsigned long long)(latencies.empty() ? 0 : latencies.back()),
+		(unsigned long long)(netAfter.packets - netBefore.packets),
+		(unsigned long long)(netAfter.bytes - netBefore.bytes),
+		(unsigned long long)cpu);
+	jsonTests.push_back(std::string(tmp) + "\"packetsSent\":" + jsonVerbCounts(verbsSent) + ",\"packetsReceived\":" + jsonVerbCounts(verbsReceived) + "}");
+}
+
+static void doRun(const std::vector<std::string> &cmd)
+{
+	if (cmd.size() < 2) {
+		doHelp(cmd);
+		return;
+	}
+
+	const uint64_t ms = Utils::strToU64(cmd[1].c_str());
+	if (!net.isDiscrete()) {
+		Thread::sleep((unsigned long)ms);
+		printf("---------- slept %llu ms"ZT_EOL_S,(unsigned long long)ms);
+		return;
+	}
+
+	const SimNet::Stats before(net.stats());
+	const uint64_t realStart = Utils::nowReal();
+	const unsigned long steps = net.run(Utils::now() + ms);
+	const SimNet::Stats after(net.stats());
+	printf("---------- ran %llu ms of virtual time in %llu ms: %lu node steps, %llu packets, %llu bytes"ZT_EOL_S,
+		(unsigned long long)ms,
+		(unsigned long long)(Utils::nowReal() - realStart),
+		steps,
+		(unsigned long long)(after.packets - before.packets),
+		(unsigned long long)(after.bytes - before.bytes));
+}
+
+static void printLink(const char *what,const SimNet::Link &l)
+{
+	printf("%s latency=%lu jitter=%lu loss=%g reorder=%g bw=%lu"ZT_EOL_S,
+		what,
+		l.latency,
+		l.jitter,
+		l.loss * 100.0,
+		l.reorder * 100.0,
+		(l.bandwidth * 8) / 1000);
+}
+
+static void doLink(const std::vector<std::string> &cmd)
+{
+	if (cmd.size() < 2) {
+		doHelp(cmd);
+		return;
+	}
+
+	if ((cmd.size() == 3)&&(cmd[2] == "reset")) {
+		std::vector<Address> from(expandAddresses(cmd[1]));
+		for(std::vector<Address>::iterator a(from.begin());a!=from.end();++a) {
+			const InetAddress fromIp(inetAddressOf(*a));
+			if (fromIp) {
+				net.resetLink(fromIp);
+				printf("%s link reset"ZT_EOL_S,a->toString().c_str());
+			}
+		}
+		return;
+	}
+
+	// Unspecified settings are inherited from the default link
+	SimNet::Link l(net.defaultLink());
+	std::vector<Address> to;
+	for(unsigned int i=2;i<cmd.size();++i) {
+		const std::string::size_type eq = cmd[i].find('=');
+		if (eq == std::string::npos) {
+			if ((i == 2)&&(cmd[1] != "default")) {
+				to = expandAddresses(cmd[i]);
+				continue;
+			}
+			doHelp(cmd);
+			return;
+		}
+		const std::string k(cmd[i].substr(0,eq));
+		const char *v = cmd[i].c_str() + eq + 1;
+		if (k == "latency")
+			l.latency = Utils::strToULong(v);
+		else if (k == "jitter")
+			l.jitter = Utils::strToULong(v);
+		else if (k == "loss")
+			l.loss = std::min(Utils::strToDouble(v) / 100.0,1.0);
+		else if (k == "reorder")
+			l.reorder = std::min(Utils::strToDouble(v) / 100.0,1.0);
+		else if (k == "bw")
+			l.bandwidth = (Utils::strToULong(v) * 1000) / 8;
+		else {
+			doHelp(cmd);
+			return;
+		}
+	}
+
+	if (cmd[1] == "default") {
+		net.setDefaultLink(l);
+		printLink("default",l);
+		return;
+	}
+
+	std::vector<Address> from(expandAddresses(cmd[1]));
+	for(std::vector<Address>::iterator a(from.begin());a!=from.end();++a) {
+		const InetAddress fromIp(inetAddressOf(*a));
+		if (!fromIp)
+			continue;
+		if (to.empty()) {
+			net.setLink(fromIp,l);
+			printLink(a->toString().c_str(),l);
+		} else {
+			for(std::vector<Address>::iterator b(to.begin());b!=to.end();++b) {
+				const InetAddress toIp(inetAddressOf(*b));
+				if ((toIp)&&(*b != *a)) {
+					net.setLink(fromIp,toIp,l);
+					printLink((a->toString() + " -> " + b->toString()).c_str(),l);
+				}
+			}
+		}
+	}
+}
+
+static void doNat(const std::vector<std::string> &cmd)
+{
+	if (cmd.size() < 3) {
+		doHelp(cmd);
+		return;
+	}
+
+	SimNet::NatType type;
+	if (cmd[2] == "none")
+		type = SimNet::NAT_NONE;
+	else if (cmd[2] == "full")
+		type = SimNet::NAT_FULL_CONE;
+	else if (cmd[2] == "restricted")
+		type = SimNet::NAT_RESTRICTED_CONE;
+	else if (cmd[2] == "portrestricted")
+		type = SimNet::NAT_PORT_RESTRICTED_CONE;
+	else if (cmd[2] == "symmetric")
+		type = SimNet::NAT_SYMMETRIC;
+	else if (cmd[2] == "udpblocked")
+		type = SimNet::NAT_UDP_BLOCKED;
+	else {
+		doHelp(cmd);
+		return;
+	}
+
+	unsigned long timeout = ZT_SIMNET_DEFAULT_NAT_TIMEOUT;
+	if ((cmd.size() >= 4)&&(cmd[3].substr(0,8) == "timeout="))
+		timeout = Utils::strToULong(cmd[3].c_str() + 8) * 1000;
+
+	std::vector<Address> addrs(expandAddresses(cmd[1]));
+	for(std::vector<Address>::iterator a(addrs.begin());a!=addrs.end();++a) {
+		const InetAddress inaddr(inetAddressOf(*a));
+		if (inaddr) {
+			net.setNat(inaddr,type,timeout);
+			printf("%s nat %s"ZT_EOL_S,a->toString().c_str(),cmd[2].c_str());
+		}
+	}
+}
+
+static void doNetStats(const std::vector<std::string> &cmd)
+{
+	const SimNet::Stats s(net.stats());
+	printf("---------- %llu packets, %llu bytes sent; dropped: %llu lost, %llu filtered, %llu overflowed"ZT_EOL_S,
+		(unsigned long long)s.packets,
+		(unsigned long long)s.bytes,
+		(unsigned long long)s.lost,
+		(unsigned long long)s.filtered,
+		(unsigned long long)s.overflowed);
+}
+
+// Writes storm results and the state of the network and every node as JSON
+static bool writeJsonResults(const char *path,const std::string &mode,uint64_t elapsed,uint64_t realElapsed)
+{
+	FILE *f = fopen(path,"w");
+	if (!f)
+		return false;
+
+	const SimNet::Stats ns(net.stats());
+	fprintf(f,"{\"version\":\"%s\",%s,\"elapsedMs\":%llu,\"realMs\":%llu,\"tests\":[",
+		Node::versionString(),
+		mode.c_str(),
+		(unsigned long long)elapsed,
+		(unsigned long long)realElapsed);
+	for(std::vector<std::string>::iterator t(jsonTests.begin());t!=jsonTests.end();++t)
+		fprintf(f,"%s%s",((t == jsonTests.begin()) ? "" : ","),t->c_str());
+	fprintf(f,"],\"network\":{\"packets\":%llu,\"bytes\":%llu,\"lost\":%llu,\"filtered\":%llu,\"overflowed\":%llu},\"nodes\":[",
+		(unsigned long long)ns.packets,
+		(unsigned long long)ns.bytes,
+		(unsigned long long)ns.lost,
+		(unsigned long long)ns.filtered,
+		(unsigned long long)ns.overflowed);
+	ZT1_Node_Status status;
+	for(std::map< Address,SimNode * >::iterator n(nodes.begin());n!=nodes.end();++n) {
+		n->second->node.status(&status);
+		fprintf(f,"%s{\"address\":\"%s\",\"supernode\":%s,\"online\":%s,\"peers\":%u,\"directLinks\":%u,\"cpuUs\":%llu,\"packetsSent\":%s,\"packetsReceived\":%s}",
+			((n == nodes.begin()) ? "" : ","),
+			n->first.toString().c_str(),
+			(n->second->supernode ? "true" : "false"),
+			(status.online ? "true" : "false"),
+			status.knownPeers,
+			status.directlyConnectedPeers,
+			(unsigned long long)n->second->cpuTime(),
+			jsonVerbCounts(status.packetsSentByVerb).c_str(),
+			jsonVerbCounts(status.packetsReceivedByVerb).c_str());
+	}
+	fprintf(f,"]}"ZT_EOL_S);
+
+	fclose(f);
+	return true;
+}
+
+static void printUsage(const char *pn)
+{
+	fprintf(stderr,"Usage: %s [-d[<seed>]] [-l<latency ms>] [-s<scenario file>] [-j<JSON results file>] <base path for temporary node home directories>"ZT_EOL_S,pn);
+	fprintf(stderr,"  -d[<seed>]      - Deterministic single-threaded discrete-event simulation"ZT_EOL_S);
+	fprintf(stderr,"  -l<latency ms>  - Default one-way packet latency (default: %d in discrete-event mode, else 0)"ZT_EOL_S,ZT_TESTNET_DEFAULT_LATENCY);
+	fprintf(stderr,"  -s<file>        - Run commands from a scenario file and exit"ZT_EOL_S);
+	fprintf(stderr,"  -j<file>        - Write results as JSON on exit "ZT_EOL_S);
+}
+
 int main(int argc,char **argv)
 {
 	char linebuf[1024];
-
-	if (argc <= 1) {
-		fprintf(stderr,"Usage: %s <base path for temporary node home directories>"ZT_EOL_S,argv[0]);
+	bool discrete = false;
+	uint64_t seed = 0;
+	unsigned long latency = 0;
+	bool latencySet = false;
+	const char *scenarioPath = (const char *)0;
+	const char *jsonPath = (const char *)0;
+
+	for(int i=1;i<argc;++i) {
+		if (argv[i][0] == '-') {
+			switch(argv[i][1]) {
+				case 'd':
+					discrete = true;
+					seed = Utils::strToU64(argv[i] + 2);
+					break;
+				case 'l':
+					latency = Utils::strToUInt(argv[i] + 2);
+					latencySet = true;
+					break;
+				case 's':
+					scenarioPath = argv[i] + 2;
+					break;
+				case 'j':
+					jsonPath = argv[i] + 2;
+					break;
+				default:
+					printUsage(argv[0]);
+					return 1;
+			}
+		} else if (!basePath.length()) {
+			basePath = argv[i];
+		} else {
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	if (!basePath.length()) {
+		printUsage(argv[0]);
 		return 1;
 	}
 
-	basePath = argv[1];
+	if (discrete) {
+#ifdef ZT_SIMULATION
+		Utils::simulate(seed,ZT_TESTNET_SIMULATION_EPOCH);
+#else
+		fprintf(stderr,"%s: discrete-event mode needs a testnet built with -DZT_SIMULATION"ZT_EOL_S,argv[0]);
+		return 1;
+#endif
+		prng = CMWC4096(); // reseed from the simulation's random stream
+		net.discrete();
+		if (!latencySet)
+			latency = ZT_TESTNET_DEFAULT_LATENCY;
+	}
+	{
+		SimNet::Link l;
+		l.latency = latency;
+		net.setDefaultLink(l);
+	}
 #ifdef __WINDOWS__
 	CreateDirectoryA(basePath.c_str(),NULL);
 #else
@@ -691,6 +1366,8 @@ int main(int argc,char **argv)
 #endif
 
 	printf("*** ZeroTier One Version %s -- Headless Network Simulator ***"ZT_EOL_S,Node::versionString());
+	if (discrete)
+		printf("*** Discrete-event mode: seed %llu, latency %lu ms ***"ZT_EOL_S,(unsigned long long)seed,latency);
 	printf(ZT_EOL_S);
 
 	{
@@ -710,18 +1387,42 @@ int main(int argc,char **argv)
 	}
 	printf(ZT_EOL_S);
 
-	printf("Type 'help' for help."ZT_EOL_S);
-	printf(ZT_EOL_S);
+	FILE *in = stdin;
+	if (scenarioPath) {
+		in = fopen(scenarioPath,"r");
+		if (!in) {
+			fprintf(stderr,"%s: unable to open scenario file %s"ZT_EOL_S,argv[0],scenarioPath);
+			return 1;
+		}
+	} else {
+		printf("Type 'help' for help."ZT_EOL_S);
+		printf(ZT_EOL_S);
+	}
 
+	const uint64_t start = Utils::now();
+	const uint64_t realStart = Utils::nowReal();
 	std::vector<std::string> cmd,prevCmd;
+	unsigned int lineNo = 0;
+	int exitCode = 0;
 	bool run = true;
 	while (run) {
-		printf(">> ");
-		fflush(stdout);
-		if (!fgets(linebuf,sizeof(linebuf),stdin))
+		if (!scenarioPath) {
+			printf(">> ");
+			fflush(stdout);
+		}
+		if (!fgets(linebuf,sizeof(linebuf),in))
 			break;
+		++lineNo;
 
 		cmd = Utils::split(linebuf," \r\n\t","\\","\"");
+		if ((cmd.size() > 0)&&(cmd[0][0] == '#'))
+			continue; // comment
+		if ((scenarioPath)&&(cmd.size() > 0)) {
+			printf(">> %s",linebuf);
+			if (linebuf[strlen(linebuf) - 1] != '\n')
+				printf(ZT_EOL_S);
+			fflush(stdout);
+		}
 
 		for(;;) {
 			if (cmd.size() == 0)
@@ -748,9 +1449,27 @@ int main(int argc,char **argv)
 				doUnicast(cmd);
 			else if (cmd[0] == "multicast")
 				doMulticast(cmd);
+			else if (cmd[0] == "restart")
+				doRestart(cmd);
+			else if (cmd[0] == "run")
+				doRun(cmd);
+			else if (cmd[0] == "link")
+				doLink(cmd);
+			else if (cmd[0] == "nat")
+				doNat(cmd);
+			else if (cmd[0] == "netstats")
+				doNetStats(cmd);
+			else if (cmd[0] == "unicaststorm")
+				doStorm(cmd,false);
+			else if (cmd[0] == "multicaststorm")
+				doStorm(cmd,true);
 			else if ((cmd[0] == ".")&&(prevCmd.size() > 0)) {
 				cmd = prevCmd;
 				continue;
+			} else if (scenarioPath) {
+				printf("---------- %s:%u: unknown command '%s'"ZT_EOL_S,scenarioPath,lineNo,cmd[0].c_str());
+				exitCode = 1;
+				run = false;
 			} else doHelp(cmd);
 			break;
 		}
@@ -758,11 +1477,26 @@ int main(int argc,char **argv)
 		if ((cmd.size() > 0)&&(cmd[0] != "."))
 			prevCmd = cmd;
 	}
+	if (in != stdin)
+		fclose(in);
+
+	if (jsonPath) {
+		char mode[128];
+		if (discrete)
+			Utils::snprintf(mode,sizeof(mode),"\"mode\":\"discrete\",\"seed\":%llu,\"latencyMs\":%lu",(unsigned long long)seed,latency);
+		else Utils::snprintf(mode,sizeof(mode),"\"mode\":\"threaded\",\"latencyMs\":%lu",latency);
+		if (writeJsonResults(jsonPath,mode,Utils::now() - start,Utils::nowReal() - realStart))
+			printf("---------- results written to %s"ZT_EOL_S,jsonPath);
+		else {
+			printf("---------- unable to write results to %s"ZT_EOL_S,jsonPath);
+			exitCode = 1;
+		}
+	}
 
 	for(std::map< Address,SimNode * >::iterator n(nodes.begin());n!=nodes.end();++n) {
 		printf("%s shutting down..."ZT_EOL_S,n->first.toString().c_str());
 		delete n->second;
 	}
 
-	return 0;
+	return exitCode;
 }
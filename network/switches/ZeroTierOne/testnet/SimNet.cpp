@@ -25,14 +25,32 @@
  * LLC. Start here: http://www.zerotier.com/
  */
 
+
+#include <time.h>
+
+#include <algorithm>
+
 #include "SimNet.hpp"
 
 #include "../node/Constants.hpp"
 #include "../node/Utils.hpp"
+#include "../node/Node.hpp"
+
+#ifdef __WINDOWS__
+#include <windows.h>
+#endif
+
+// First port handed out for NAT mappings and TCP client connections
+#define ZT_SIMNET_FIRST_EPHEMERAL_PORT 20000
 
 namespace ZeroTier {
 
-SimNet::SimNet()
+SimNet::SimNet() :
+	_nextPublicIp(1),
+	_nextPort(ZT_SIMNET_FIRST_EPHEMERAL_PORT),
+	_discrete(false),
+	_seq(0),
+	_steps(0)
 {
 }
 
@@ -40,6 +58,70 @@ SimNet::~SimNet()
 {
 }
 
+uint64_t SimNet::threadCpuTime()
+{
+#ifdef __WINDOWS__
+	FILETIME c,e,k,u;
+	if (!GetThreadTimes(GetCurrentThread(),&c,&e,&k,&u))
+		return 0;
+	return (((((uint64_t)k.dwHighDateTime) << 32) | (uint64_t)k.dwLowDateTime) + ((((uint64_t)u.dwHighDateTime) << 32) | (uint64_t)u.dwLowDateTime)) / 10ULL;
+#else
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts))
+		return 0;
+	return (((uint64_t)ts.tv_sec * 1000000ULL) + ((uint64_t)ts.tv_nsec / 1000ULL));
+#endif
+}
+
+void SimNet::discrete()
+{
+	_discrete = true;
+	_prng = CMWC4096(); // reseed from the simulation's random stream
+}
+
+unsigned long SimNet::run(uint64_t until)
+{
+	unsigned long n = 0;
+	while ((!_events.empty())&&(_events.top().at <= until)) {
+		const _Event e(_events.top());
+		_events.pop();
+
+		SimNetSocketManager *const ep = e.ep;
+		if (!ep->_node)
+			continue;
+		if (e.timer) {
+			if (e.at != ep->_nextStepAt)
+				continue; // superseded by an earlier timer
+		} else if ((ep->_arrivals.empty())||(ep->_arrivals.begin()->first > e.at)) {
+			continue; // already picked up by an earlier step at this time
+		}
+
+#ifdef ZT_SIMULATION
+		if (e.at > Utils::now())
+			Utils::setSimulatedTime(e.at);
+#endif
+		const uint64_t now = Utils::now();
+
+		const uint64_t cpuStart = threadCpuTime();
+		const uint64_t next = now + std::max(ep->_node->step(),1UL);
+		ep->_cpuTime += threadCpuTime() - cpuStart;
+		++n;
+
+		// Keep whichever pending timer is sooner, since the node will
+		// recompute its delay then anyway.
+		if ((ep->_nextStepAt <= now)||(next < ep->_nextStepAt)) {
+			ep->_nextStepAt = next;
+			_schedule(ep,next,true);
+		}
+	}
+#ifdef ZT_SIMULATION
+	if (until > Utils::now())
+		Utils::setSimulatedTime(until);
+#endif
+	_steps += n;
+	return n;
+}
+
 SimNetSocketManager *SimNet::newEndpoint(const InetAddress &addr)
 {
 	Mutex::Lock _l(_lock);
@@ -53,6 +135,12 @@ SimNetSocketManager *SimNet::newEndpoint(const InetAddress &addr)
 	sm->_sn = this;
 	sm->_address = addr;
 	_endpoints[addr] = sm;
+
+	InetAddress tcpAddr(addr);
+	tcpAddr.setPort(ZT_SIMNET_TCP_PORT);
+	if (_tcpListeners.find(tcpAddr) == _tcpListeners.end())
+		_tcpListeners[tcpAddr] = sm;
+
 	return sm;
 }
 
@@ -65,4 +153,286 @@ SimNetSocketManager *SimNet::get(const InetAddress &addr)
 	return ep->second;
 }
 
+void SimNet::setDefaultLink(const Link &l)
+{
+	Mutex::Lock _l(_lock);
+	_defaultLink = l;
+}
+
+void SimNet::setLink(const InetAddress &from,const Link &l)
+{
+	Mutex::Lock _l(_lock);
+	_sendLinks[from] = l;
+}
+
+void SimNet::setLink(const InetAddress &from,const InetAddress &to,const Link &l)
+{
+	Mutex::Lock _l(_lock);
+	_pairLinks[std::pair<InetAddress,InetAddress>(from,to)] = l;
+}
+
+void SimNet::resetLink(const InetAddress &from)
+{
+	Mutex::Lock _l(_lock);
+	_sendLinks.erase(from);
+	for(std::map< std::pair<InetAddress,InetAddress>,Link >::iterator pl(_pairLinks.begin());pl!=_pairLinks.end();) {
+		if (pl->first.first == from)
+			_pairLinks.erase(pl++);
+		else ++pl;
+	}
+}
+
+void SimNet::setNat(const InetAddress &ep,NatType type,unsigned long timeout)
+{
+	Mutex::Lock _l(_lock);
+
+	_Nat &nat = _nats[ep];
+	for(std::map< InetAddress,InetAddress >::iterator o(nat.outbound.begin());o!=nat.outbound.end();++o)
+		_mappings.erase(o->second);
+	nat.outbound.clear();
+
+	if (type == NAT_NONE) {
+		_nats.erase(ep);
+		return;
+	}
+
+	nat.type = type;
+	nat.timeout = std::max(timeout,1UL);
+	if (!nat.publicIp) {
+		// Each NAT gets its own address in 198.18.0.0/15, reserved for benchmarking
+		const uint32_t n = _nextPublicIp++;
+		const unsigned char ip[4] = { 198,(unsigned char)(18 + ((n >> 16) & 1)),(unsigned char)((n >> 8) & 0xff),(unsigned char)(n & 0xff) };
+		nat.publicIp.set(ip,4,0);
+	}
+}
+
+SimNet::NatType SimNet::nat(const InetAddress &ep) const
+{
+	Mutex::Lock _l(_lock);
+	std::map< InetAddress,_Nat >::const_iterator n(_nats.find(ep));
+	return ((n == _nats.end()) ? NAT_NONE : n->second.type);
+}
+
+bool SimNet::_send(SimNetSocketManager *from,const InetAddress &to,bool tcp,bool autoConnectTcp,const void *data,unsigned int len)
+{
+	Mutex::Lock _l(_lock);
+	const uint64_t now = Utils::now();
+	uint64_t at = 0;
+
+	_stats.packets += 1;
+	_stats.bytes += len;
+
+	std::map< InetAddress,_Nat >::iterator fromNat(_nats.find(from->_address));
+
+	if (tcp) {
+		// Reply from a server over a connection a client opened to it
+		std::map< InetAddress,_TcpConnection >::iterator c(_tcpConnections.find(to));
+		if ((c != _tcpConnections.end())&&(c->second.server == from)) {
+			if ((_delay(from->_address,c->second.client->_address,true,len,now,at))&&(!c->second.client->_deliver(at,c->second.serverAddress,Socket::ZT_SOCKET_TYPE_TCP_OUT,data,len)))
+				_stats.overflowed += 1;
+			return true;
+		}
+
+		// Send from a client to a server, connecting first if allowed
+		InetAddress clientAddress;
+		SimNetSocketManager *server;
+		std::map< std::pair<InetAddress,InetAddress>,InetAddress >::iterator ce(_tcpConnectionsByEnds.find(std::pair<InetAddress,InetAddress>(from->_address,to)));
+		if (ce != _tcpConnectionsByEnds.end()) {
+			clientAddress = ce->second;
+			server = _tcpConnections[clientAddress].server;
+		} else {
+			std::map< InetAddress,SimNetSocketManager * >::iterator l(_tcpListeners.find(to));
+			if ((!autoConnectTcp)||(l == _tcpListeners.end())||(_nats.find(l->second->_address) != _nats.end())) {
+				_stats.filtered += 1; // no connection, nobody listening, or listener behind NAT or firewall
+				return false;
+			}
+			server = l->second;
+
+			// NATs and firewalls let outgoing TCP through, even UDP blocking ones
+			if ((fromNat != _nats.end())&&(fromNat->second.type != NAT_UDP_BLOCKED))
+				clientAddress = fromNat->second.publicIp;
+			else clientAddress = from->_address;
+			clientAddress.setPort(_nextPort++);
+			if (_nextPort > 0xffff)
+				_nextPort = ZT_SIMNET_FIRST_EPHEMERAL_PORT;
+
+			_TcpConnection &nc = _tcpConnections[clientAddress];
+			nc.client = from;
+			nc.server = server;
+			nc.serverAddress = to;
+			_tcpConnectionsByEnds[std::pair<InetAddress,InetAddress>(from->_address,to)] = clientAddress;
+		}
+
+		if ((_delay(from->_address,server->_address,true,len,now,at))&&(!server->_deliver(at,clientAddress,Socket::ZT_SOCKET_TYPE_TCP_IN,data,len)))
+			_stats.overflowed += 1;
+		return true;
+	}
+
+	if ((fromNat != _nats.end())&&(fromNat->second.type == NAT_UDP_BLOCKED)) {
+		_stats.filtered += 1;
+		return true;
+	}
+	const InetAddress src((fromNat != _nats.end()) ? _natOut(fromNat->second,from->_address,to,now) : from->_address);
+
+	SimNetSocketManager *dest = (SimNetSocketManager *)0;
+	if (_mappings.find(to) != _mappings.end()) {
+		dest = _natIn(to,src,now);
+	} else {
+		std::map< InetAddress,SimNetSocketManager * >::iterator ep(_endpoints.find(to));
+		if ((ep != _endpoints.end())&&(_nats.find(to) == _nats.end()))
+			dest = ep->second; // endpoints behind NATs and firewalls are only reachable via mappings
+	}
+	if (!dest) {
+		_stats.filtered += 1;
+		return true; // UDP has no delivery guarantee semantics
+	}
+
+	if ((_delay(from->_address,dest->_address,false,len,now,at))&&(!dest->_deliver(at,src,Socket::ZT_SOCKET_TYPE_UDP_V4,data,len)))
+		_stats.overflowed += 1;
+	return true;
+}
+
+void SimNet::_closeTcp(SimNetSocketManager *ep)
+{
+	Mutex::Lock _l(_lock);
+	for(std::map< InetAddress,_TcpConnection >::iterator c(_tcpConnections.begin());c!=_tcpConnections.end();) {
+		if ((c->second.client == ep)||(c->second.server == ep)) {
+			_tcpConnectionsByEnds.erase(std::pair<InetAddress,InetAddress>(c->second.client->_address,c->second.serverAddress));
+			_tcpConnections.erase(c++);
+		} else ++c;
+	}
+}
+
+void SimNet::_schedule(SimNetSocketManager *ep,uint64_t at,bool timer)
+{
+	_Event e;
+	e.at = at;
+	e.seq = _seq++;
+	e.ep = ep;
+	e.timer = timer;
+	_events.push(e);
+}
+
+InetAddress SimNet::_natOut(_Nat &nat,const InetAddress &internal,const InetAddress &to,uint64_t now)
+{
+	// Cone NATs use one mapping for everything, symmetric NATs one per destination
+	const InetAddress key((nat.type == NAT_SYMMETRIC) ? to : InetAddress());
+
+	InetAddress pub;
+	std::map< InetAddress,InetAddress >::iterator o(nat.outbound.find(key));
+	if (o != nat.outbound.end()) {
+		std::map< InetAddress,_Mapping >::iterator m(_mappings.find(o->second));
+		if ((m != _mappings.end())&&((now - m->second.lastOut) < nat.timeout))
+			pub = o->second;
+		else _mappings.erase(o->second); // expired
+	}
+	if (!pub) {
+		pub = nat.publicIp;
+		pub.setPort(_nextPort++);
+		if (_nextPort > 0xffff)
+			_nextPort = ZT_SIMNET_FIRST_EPHEMERAL_PORT;
+		nat.outbound[key] = pub;
+		_Mapping &nm = _mappings[pub];
+		nm.internal = internal;
+		nm.key = key;
+	}
+
+	_Mapping &m = _mappings[pub];
+	m.lastOut = now;
+	switch(nat.type) {
+		case NAT_RESTRICTED_CONE: {
+			InetAddress ip(to);
+			ip.setPort(0);
+			m.permitted.insert(ip);
+		}	break;
+		case NAT_PORT_RESTRICTED_CONE:
+		case NAT_SYMMETRIC:
+			m.permitted.insert(to);
+			break;
+		default:
+			break;
+	}
+
+	return pub;
+}
+
+SimNetSocketManager *SimNet::_natIn(const InetAddress &to,const InetAddress &from,uint64_t now)
+{
+	std::map< InetAddress,_Mapping >::iterator m(_mappings.find(to));
+	if (m == _mappings.end())
+		return (SimNetSocketManager *)0;
+	std::map< InetAddress,_Nat >::iterator nat(_nats.find(m->second.internal));
+	if (nat == _nats.end())
+		return (SimNetSocketManager *)0;
+
+	if ((now - m->second.lastOut) >= nat->second.timeout) {
+		nat->second.outbound.erase(m->second.key);
+		_mappings.erase(m);
+		return (SimNetSocketManager *)0;
+	}
+
+	switch(nat->second.type) {
+		case NAT_FULL_CONE:
+			break;
+		case NAT_RESTRICTED_CONE: {
+			InetAddress ip(from);
+			ip.setPort(0);
+			if (m->second.permitted.find(ip) == m->second.permitted.end())
+				return (SimNetSocketManager *)0;
+		}	break;
+		default:
+			if (m->second.permitted.find(from) == m->second.permitted.end())
+				return (SimNetSocketManager *)0;
+			break;
+	}
+
+	std::map< InetAddress,SimNetSocketManager * >::iterator ep(_endpoints.find(m->second.internal));
+	return ((ep == _endpoints.end()) ? (SimNetSocketManager *)0 : ep->second);
+}
+
+bool SimNet::_delay(const InetAddress &from,const InetAddress &to,bool tcp,unsigned int len,uint64_t now,uint64_t &at)
+{
+	const std::pair<InetAddress,InetAddress> ends(from,to);
+
+	const Link *l = &_defaultLink;
+	std::map< std::pair<InetAddress,InetAddress>,Link >::const_iterator pl(_pairLinks.find(ends));
+	if (pl != _pairLinks.end()) {
+		l = &(pl->second);
+	} else {
+		std::map< InetAddress,Link >::const_iterator sl(_sendLinks.find(from));
+		if (sl != _sendLinks.end())
+			l = &(sl->second);
+	}
+
+	uint64_t delay = l->latency;
+	if (!tcp) { // TCP retransmits and reorders for us, so it only sees latency and bandwidth
+		if ((l->loss > 0.0)&&(_prng.nextDouble() < l->loss)) {
+			_stats.lost += 1;
+			return false;
+		}
+		if (l->jitter)
+			delay += _prng.next32() % (l->jitter + 1);
+		if ((l->reorder > 0.0)&&(_prng.nextDouble() < l->reorder))
+			delay += std::max(l->latency,1UL); // held back behind packets sent after it
+	}
+
+	if (l->bandwidth) {
+		// Serialize onto the link after whatever is already queued, in microseconds
+		const uint64_t nowUs = now * 1000ULL;
+		uint64_t &busyUntil = _linkBusyUntil[ends];
+		const uint64_t start = std::max(busyUntil,nowUs);
+		if ((start - nowUs) > (ZT_SIMNET_MAX_QUEUE_DELAY * 1000ULL)) {
+			_stats.overflowed += 1;
+			return false;
+		}
+		busyUntil = start + (((uint64_t)len * 1000000ULL) / (uint64_t)l->bandwidth);
+		delay += (busyUntil - nowUs) / 1000ULL;
+	}
+
+	if (_discrete)
+		delay = std::max(delay,(uint64_t)1);
+	at = now + delay;
+	return true;
+}
+
 } // namespace ZeroTier
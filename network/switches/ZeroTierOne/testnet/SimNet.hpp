@@ -25,31 +25,147 @@
  * LLC. Start here: http://www.zerotier.com/
  */
 
+
 #ifndef ZT_SIMNET_HPP
 #define ZT_SIMNET_HPP
 
 #include <map>
+#include <set>
 #include <vector>
+#include <queue>
+#include <utility>
+#include <functional>
 
 #include "../node/Constants.hpp"
 #include "../node/InetAddress.hpp"
 #include "../node/Mutex.hpp"
+#include "../node/CMWC4096.hpp"
 
 #include "SimNetSocketManager.hpp"
 
 #define ZT_SIMNET_MAX_TESTNET_SIZE 1048576
 
+/**
+ * Port on which simulated endpoints accept TCP tunnel connections
+ */
+#define ZT_SIMNET_TCP_PORT 443
+
+/**
+ * Packets that would wait longer than this for a bandwidth-capped link are dropped (ms)
+ */
+#define ZT_SIMNET_MAX_QUEUE_DELAY 1000
+
+/**
+ * Default idle time after which NAT mappings expire (ms)
+ */
+#define ZT_SIMNET_DEFAULT_NAT_TIMEOUT 60000
+
 namespace ZeroTier {
 
 /**
  * A simulated headless IP network for testing
+ *
+ * By default every node runs in its own thread in real time. In
+ * discrete-event mode everything instead happens in the calling thread in
+ * virtual time (see Utils::simulate(), ZT_SIMULATION builds only): run()
+ * steps each node when a packet arrives for it or when its timers are due.
+ * Nothing happens between calls to run(), and runs with the same seed and
+ * inputs are identical.
+ *
+ * Links are perfect unless impaired with setLink(), and endpoints can be
+ * put behind emulated NATs with setNat(). Packets sent with tcp set travel
+ * over emulated TCP connections to ZT_SIMNET_TCP_PORT, which are reliable
+ * and in order and pass through NATs and UDP-blocking firewalls.
  */
 class SimNet
 {
 public:
+	/**
+	 * Impairments applied to packets sent over a link
+	 */
+	struct Link
+	{
+		Link() : latency(0),jitter(0),loss(0.0),reorder(0.0),bandwidth(0) {}
+
+		unsigned long latency; // one-way delay in ms
+		unsigned long jitter; // up to this many ms more, chosen at random per UDP packet
+		double loss; // fraction of UDP packets dropped
+		double reorder; // fraction of UDP packets held back by an extra one-way delay
+		unsigned long bandwidth; // bytes per second or 0 for unlimited
+	};
+
+	/**
+	 * NAT or firewall in front of an endpoint
+	 */
+	enum NatType
+	{
+		NAT_NONE = 0,
+		NAT_FULL_CONE = 1,             // one mapping for all destinations, anyone may send to it
+		NAT_RESTRICTED_CONE = 2,       // one mapping, only IPs we've sent to may send to it
+		NAT_PORT_RESTRICTED_CONE = 3,  // one mapping, only IP/ports we've sent to may send to it
+		NAT_SYMMETRIC = 4,             // a new mapping per destination, only it may reply
+		NAT_UDP_BLOCKED = 5            // no NAT but all UDP is dropped, TCP still gets out
+	};
+
+	/**
+	 * Network-wide packet counters
+	 */
+	struct Stats
+	{
+		Stats() : packets(0),bytes(0),lost(0),filtered(0),overflowed(0) {}
+
+		uint64_t packets; // packets sent
+		uint64_t bytes; // bytes sent
+		uint64_t lost; // packets dropped by link loss
+		uint64_t filtered; // packets dropped by NATs, firewalls or for lack of a route
+		uint64_t overflowed; // packets dropped by bandwidth-capped links with full queues or by full endpoint inboxes
+	};
+
 	SimNet();
 	~SimNet();
 
+	/**
+	 * Switch to discrete-event mode
+	 *
+	 * Call after Utils::simulate() and before creating any endpoints. Links
+	 * always have at least 1ms of latency in discrete-event mode.
+	 */
+	void discrete();
+
+	/**
+	 * @return True if in discrete-event mode
+	 */
+	inline bool isDiscrete() const throw() { return _discrete; }
+
+	/**
+	 * Deliver packets and step nodes up to and including a virtual time
+	 *
+	 * The simulated clock is left at 'until' on return.
+	 *
+	 * @param until Virtual time to run until in ms since epoch
+	 * @return Number of node steps taken
+	 */
+	unsigned long run(uint64_t until);
+
+	/**
+	 * @return CPU time used so far by the calling thread in microseconds, or 0 if unavailable
+	 */
+	static uint64_t threadCpuTime();
+
+	/**
+	 * @return Total node steps taken by run()
+	 */
+	inline uint64_t steps() const throw() { return _steps; }
+
+	/**
+	 * @return Packet counters
+	 */
+	inline Stats stats() const
+	{
+		Mutex::Lock _l(_lock);
+		return _stats;
+	}
+
 	/**
 	 * @return New endpoint or NULL on failure
 	 */
@@ -61,9 +177,136 @@ public:
 	 */
 	SimNetSocketManager *get(const InetAddress &addr);
 
+	/**
+	 * @param l Impairments for links not otherwise configured
+	 */
+	void setDefaultLink(const Link &l);
+
+	/**
+	 * @return Impairments for links not otherwise configured
+	 */
+	inline Link defaultLink() const
+	{
+		Mutex::Lock _l(_lock);
+		return _defaultLink;
+	}
+
+	/**
+	 * Impair everything an endpoint sends
+	 *
+	 * @param from Sending endpoint
+	 * @param l Impairments
+	 */
+	void setLink(const InetAddress &from,const Link &l);
+
+	/**
+	 * Impair what one endpoint sends to another, overriding setLink(from)
+	 *
+	 * @param from Sending endpoint
+	 * @param to Receiving endpoint
+	 * @param l Impairments
+	 */
+	void setLink(const InetAddress &from,const InetAddress &to,const Link &l);
+
+	/**
+	 * Remove impairments set for an endpoint's sends, including to specific endpoints
+	 *
+	 * @param from Sending endpoint
+	 */
+	void resetLink(const InetAddress &from);
+
+	/**
+	 * Put an endpoint behind a NAT or firewall, or take it out
+	 *
+	 * Changing an endpoint's NAT forgets all of its mappings. Other endpoints
+	 * can't send to an endpoint behind a NAT at its own address, only via its
+	 * mappings, which live on a public IP of their own.
+	 *
+	 * @param ep Endpoint address
+	 * @param type NAT type
+	 * @param timeout Mappings expire after this many ms without outgoing traffic
+	 */
+	void setNat(const InetAddress &ep,NatType type,unsigned long timeout = ZT_SIMNET_DEFAULT_NAT_TIMEOUT);
+
+	/**
+	 * @param ep Endpoint address
+	 * @return NAT type in front of endpoint
+	 */
+	NatType nat(const InetAddress &ep) const;
+
 private:
+	friend class SimNetSocketManager;
+
+	struct _Event
+	{
+		uint64_t at;
+		uint64_t seq; // breaks ties in order of scheduling, for repeatability
+		SimNetSocketManager *ep;
+		bool timer; // false for packet arrival
+
+		inline bool operator>(const _Event &e) const throw() { return ((at > e.at)||((at == e.at)&&(seq > e.seq))); }
+	};
+
+	struct _Nat
+	{
+		_Nat() : type(NAT_NONE),timeout(ZT_SIMNET_DEFAULT_NAT_TIMEOUT) {}
+
+		NatType type;
+		InetAddress publicIp; // port unused
+		unsigned long timeout;
+		std::map< InetAddress,InetAddress > outbound; // destination (or nil for cone NATs) -> mapping
+	};
+
+	struct _Mapping
+	{
+		InetAddress internal; // endpoint behind the NAT
+		InetAddress key; // key in _Nat::outbound
+		uint64_t lastOut;
+		std::set< InetAddress > permitted; // remote IPs (port 0) or IP/ports allowed in
+	};
+
+	// Called by SimNetSocketManager
+	bool _send(SimNetSocketManager *from,const InetAddress &to,bool tcp,bool autoConnectTcp,const void *data,unsigned int len);
+	void _closeTcp(SimNetSocketManager *ep);
+	void _schedule(SimNetSocketManager *ep,uint64_t at,bool timer);
+
+	// These assume _lock is held
+	InetAddress _natOut(_Nat &nat,const InetAddress &internal,const InetAddress &to,uint64_t now);
+	SimNetSocketManager *_natIn(const InetAddress &to,const InetAddress &from,uint64_t now);
+	bool _delay(const InetAddress &from,const InetAddress &to,bool tcp,unsigned int len,uint64_t now,uint64_t &at);
+
 	std::map< InetAddress,SimNetSocketManager * > _endpoints;
+
+	Link _defaultLink;
+	std::map< InetAddress,Link > _sendLinks;
+	std::map< std::pair<InetAddress,InetAddress>,Link > _pairLinks;
+	std::map< std::pair<InetAddress,InetAddress>,uint64_t > _linkBusyUntil; // microseconds, for bandwidth caps
+
+	std::map< InetAddress,_Nat > _nats; // by internal endpoint address
+	std::map< InetAddress,_Mapping > _mappings; // by public address
+	uint32_t _nextPublicIp;
+	unsigned int _nextPort;
+
+	struct _TcpConnection
+	{
+		SimNetSocketManager *client;
+		SimNetSocketManager *server;
+		InetAddress serverAddress; // server IP at ZT_SIMNET_TCP_PORT
+	};
+
+	std::map< InetAddress,SimNetSocketManager * > _tcpListeners; // by endpoint IP at ZT_SIMNET_TCP_PORT
+	std::map< std::pair<InetAddress,InetAddress>,InetAddress > _tcpConnectionsByEnds; // (client endpoint, server address) -> client address as seen by server
+	std::map< InetAddress,_TcpConnection > _tcpConnections; // by client address as seen by server
+
+	Stats _stats;
+	CMWC4096 _prng;
 	Mutex _lock;
+
+	// Discrete-event mode only, not thread-safe
+	bool _discrete;
+	uint64_t _seq;
+	uint64_t _steps;
+	std::priority_queue< _Event,std::vector<_Event>,std::greater<_Event> > _events;
 };
 
 } // namespace ZeroTier
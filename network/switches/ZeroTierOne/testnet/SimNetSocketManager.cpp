@@ -25,27 +25,27 @@
  * LLC. Start here: http://www.zerotier.com/
  */
 
+#include <algorithm>
+
 #include "SimNetSocketManager.hpp"
 #include "SimNet.hpp"
 
 #include "../node/Constants.hpp"
 #include "../node/Socket.hpp"
+#include "../node/Utils.hpp"
 
 namespace ZeroTier {
 
 class SimNetSocket : public Socket
 {
 public:
-	SimNetSocket(SimNetSocketManager *sm) :
-		Socket(ZT_SOCKET_TYPE_UDP_V4),
+	SimNetSocket(SimNetSocketManager *sm,Type t) :
+		Socket(t),
 		_parent(sm) {}
 
 	virtual bool send(const InetAddress &to,const void *msg,unsigned int msglen)
 	{
-		SimNetSocketManager *dest = _parent->net()->get(to);
-		if (dest)
-			dest->enqueue(_parent->address(),msg,msglen);
-		return true; // we emulate UDP, which has no delivery guarantee semantics
+		return _parent->send(to,tcp(),(type() == ZT_SOCKET_TYPE_TCP_OUT),msg,msglen);
 	}
 
 	SimNetSocketManager *_parent;
@@ -53,7 +53,14 @@ public:
 
 SimNetSocketManager::SimNetSocketManager() :
 	_sn((SimNet *)0), // initialized by SimNet
-	_mySocket(new SimNetSocket(this))
+	_udpSocket(new SimNetSocket(this,Socket::ZT_SOCKET_TYPE_UDP_V4)),
+	_tcpInSocket(new SimNetSocket(this,Socket::ZT_SOCKET_TYPE_TCP_IN)),
+	_tcpOutSocket(new SimNetSocket(this,Socket::ZT_SOCKET_TYPE_TCP_OUT)),
+	_inbox(ZT_SIMNETSOCKETMANAGER_INBOX_SIZE),
+	_whacked(false),
+	_node((Node *)0),
+	_nextStepAt(0),
+	_cpuTime(0)
 {
 }
 
@@ -63,28 +70,117 @@ SimNetSocketManager::~SimNetSocketManager()
 
 bool SimNetSocketManager::send(const InetAddress &to,bool tcp,bool autoConnectTcp,const void *msg,unsigned int msglen)
 {
-	if (tcp)
-		return false; // we emulate UDP
-	SimNetSocketManager *dest = _sn->get(to);
-	if (dest)
-		dest->enqueue(_address,msg,msglen);
-	return true; // we emulate UDP, which has no delivery guarantee semantics
+	// For UDP this is true even if the packet is lost, as with a real socket
+	if (!_sn->_send(this,to,tcp,autoConnectTcp,msg,msglen))
+		return false;
+	Mutex::Lock _l(_stats_m);
+	_totals.sent += msglen;
+	_stats[to].sent += msglen;
+	return true;
+}
+
+void SimNetSocketManager::attach(Node *n)
+{
+	_node = n;
+	if (n) {
+		_nextStepAt = Utils::now();
+		_sn->_schedule(this,_nextStepAt,true);
+	} else {
+		_arrivals.clear();
+		_nextStepAt = 0;
+	}
 }
 
 void SimNetSocketManager::poll(unsigned long timeout,void (*handler)(const SharedPtr<Socket> &,void *,const InetAddress &,Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> &),void *arg)
 {
-	std::pair< InetAddress,Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> > msg;
-	if ((_inbox.pop(msg,timeout))&&(msg.second.size()))
-		handler(_mySocket,arg,msg.first,msg.second);
+	const bool discrete = _sn->isDiscrete(); // poll() never blocks in discrete-event mode
+	const uint64_t deadline = Utils::now() + timeout;
+	for(;;) {
+		const uint64_t now = Utils::now();
+		unsigned int handled = 0;
+
+		// Handle parked packets that have arrived by now, then everything
+		// handed over since the last call: in place if it has arrived,
+		// parked until it does if not.
+		while ((!_arrivals.empty())&&(_arrivals.begin()->first <= now)) {
+			_Arrival &a = _arrivals.begin()->second;
+			_received(a);
+			handler(_socket(a.type),arg,a.from,a.data);
+			_arrivals.erase(_arrivals.begin());
+			++handled;
+		}
+		if (!discrete) {
+			_Arrival *a;
+			for(unsigned int n=0;((n<_inbox.capacity())&&((a = _inbox.front())));++n) {
+				if (a->at <= now) {
+					_received(*a);
+					handler(_socket(a->type),arg,a->from,a->data);
+					++handled;
+				} else _arrivals.insert(std::pair< uint64_t,_Arrival >(a->at,*a));
+				_inbox.pop();
+			}
+		}
+
+		if ((handled)||(discrete)||(now >= deadline))
+			break;
+		if (_whacked) {
+			_whacked = false;
+			break;
+		}
+
+		// Sleep until the first parked packet arrives or something new is handed over
+		uint64_t wakeAt = deadline;
+		if (!_arrivals.empty())
+			wakeAt = std::min(wakeAt,_arrivals.begin()->first);
+		if (wakeAt > now)
+			_inbox.wait((unsigned long)(wakeAt - now));
+	}
 }
 
 void SimNetSocketManager::whack()
 {
-	_inbox.push(std::pair< InetAddress,Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> >());
+	if (!_sn->isDiscrete()) {
+		_whacked = true;
+		_inbox.wake();
+	}
 }
 
 void SimNetSocketManager::closeTcpSockets()
 {
+	_sn->_closeTcp(this);
+}
+
+bool SimNetSocketManager::_deliver(uint64_t at,const InetAddress &from,Socket::Type type,const void *data,unsigned int len)
+{
+	if (_sn->isDiscrete()) {
+		if (!_node)
+			return true; // nobody home
+		_Arrival &a = _arrivals.insert(std::pair< uint64_t,_Arrival >(at,_Arrival()))->second;
+		a.at = at;
+		a.from = from;
+		a.type = type;
+		a.data.copyFrom(data,len);
+		_sn->_schedule(this,at,false);
+		return true;
+	}
+
+	unsigned int ticket;
+	_Arrival *const a = _inbox.claim(ticket);
+	if (!a)
+		return false;
+	a->at = at;
+	a->from = from;
+	a->type = type;
+	a->data.copyFrom(data,len);
+	_inbox.publish(ticket);
+	return true;
+}
+
+void SimNetSocketManager::_received(const _Arrival &a)
+{
+	Mutex::Lock _l(_stats_m);
+	_totals.received += a.data.size();
+	_stats[a.from].received += a.data.size();
 }
 
 } // namespace ZeroTier
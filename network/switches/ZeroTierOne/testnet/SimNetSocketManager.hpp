@@ -34,13 +34,19 @@
 
 #include "../node/Constants.hpp"
 #include "../node/SocketManager.hpp"
+#include "../node/Socket.hpp"
 #include "../node/Mutex.hpp"
+#include "../node/MPSCQueue.hpp"
 
-#include "MTQ.hpp"
+/**
+ * Packets that can be delivered to a threaded-mode endpoint before its node polls
+ */
+#define ZT_SIMNETSOCKETMANAGER_INBOX_SIZE 256
 
 namespace ZeroTier {
 
 class SimNet;
+class Node;
 
 /**
  * Socket manager for an IP endpoint in a simulated network
@@ -89,16 +95,19 @@ public:
 	inline SimNet *net() const { return _sn; }
 
 	/**
-	 * Enqueue data from another endpoint to be picked up on next poll()
+	 * @return Microseconds of CPU time spent stepping this endpoint's node(s) (discrete-event mode only)
+	 */
+	inline uint64_t cpuTime() const throw() { return _cpuTime; }
+
+	/**
+	 * Attach the node using this endpoint in discrete-event mode
 	 *
-	 * @param from Originating endpoint address
-	 * @param data Data
-	 * @param len Length of data in bytes
+	 * Attaching schedules a step() right away. Detaching drops packets still
+	 * in flight to this endpoint, like a host that went down would.
+	 *
+	 * @param n Node (already initialized with Node::init()) or NULL to detach
 	 */
-	inline void enqueue(const InetAddress &from,const void *data,unsigned int len)
-	{
-		_inbox.push(std::pair< InetAddress,Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> >(from,Buffer<ZT_SOCKET_MAX_MESSAGE_LEN>(data,len)));
-	}
+	void attach(Node *n);
 
 	virtual bool send(const InetAddress &to,bool tcp,bool autoConnectTcp,const void *msg,unsigned int msglen);
 	virtual void poll(unsigned long timeout,void (*handler)(const SharedPtr<Socket> &,void *,const InetAddress &,Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> &),void *arg);
@@ -110,10 +119,48 @@ private:
 	SimNet *_sn;
 	InetAddress _address;
 
-	SharedPtr<Socket> _mySocket;
+	// Called by SimNet with its lock held to hand over a packet arriving at
+	// 'at' from 'from' on the socket of type 'type'; returns false if the
+	// packet was dropped because our inbox is full
+	bool _deliver(uint64_t at,const InetAddress &from,Socket::Type type,const void *data,unsigned int len);
+
+	inline const SharedPtr<Socket> &_socket(Socket::Type type) const
+	{
+		switch(type) {
+			case Socket::ZT_SOCKET_TYPE_TCP_IN: return _tcpInSocket;
+			case Socket::ZT_SOCKET_TYPE_TCP_OUT: return _tcpOutSocket;
+			default: return _udpSocket;
+		}
+	}
+
+	SharedPtr<Socket> _udpSocket;
+	SharedPtr<Socket> _tcpInSocket;
+	SharedPtr<Socket> _tcpOutSocket;
 	TransferStats _totals;
 
-	MTQ< std::pair< InetAddress,Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> > > _inbox;
+	struct _Arrival
+	{
+		uint64_t at;
+		InetAddress from;
+		Socket::Type type;
+		Buffer<ZT_SOCKET_MAX_MESSAGE_LEN> data;
+	};
+
+	// Threaded mode: packets handed over by sending threads, which poll()
+	// drains in place, parking any not yet due in _arrivals
+	MPSCQueue<_Arrival> _inbox;
+	volatile bool _whacked;
+
+	// Packets in flight to us by arrival time, touched only by the thread
+	// in poll() in threaded mode and by the stepping thread in discrete mode
+	std::multimap< uint64_t,_Arrival > _arrivals;
+
+	void _received(const _Arrival &a);
+
+	// Discrete-event mode: the node SimNet steps for us
+	Node *_node;
+	uint64_t _nextStepAt;
+	uint64_t _cpuTime;
 
 	std::map< InetAddress,TransferStats > _stats;
 	Mutex _stats_m;
@@ -27,6 +27,7 @@
 
 #include "TestEthernetTap.hpp"
 #include "TestEthernetTapFactory.hpp"
+#include "SimNet.hpp"
 
 #include "../node/Constants.hpp"
 #include "../node/Utils.hpp"
@@ -50,12 +51,16 @@ TestEthernetTap::TestEthernetTap(
 	const char *desiredDevice,
 	const char *friendlyName,
 	void (*handler)(void *,const MAC &,const MAC &,unsigned int,const Buffer<4096> &),
-	void *arg) :
+	void *arg,
+	bool synchronous) :
 	EthernetTap("TestEthernetTap",mac,mtu,metric),
 	_nwid(nwid),
 	_handler(handler),
 	_arg(arg),
-	_enabled(true)
+	_enabled(true),
+	_cpuTime(0),
+	_pq((synchronous) ? 1 : ZT_TESTETHERNETTAP_QUEUE_SIZE), // synchronous taps inject directly
+	_gq(ZT_TESTETHERNETTAP_QUEUE_SIZE)
 {
 	static volatile unsigned int testTapCounter = 0;
 
@@ -67,17 +72,26 @@ TestEthernetTap::TestEthernetTap(
 #ifdef __WINDOWS__
 	pid = (int)_getpid();
 #endif
-	Utils::snprintf(tmp,sizeof(tmp),"test%dtap%d",pid,testTapCounter++);
+	if (synchronous) // no pid, so repeated simulations print identical output
+		Utils::snprintf(tmp,sizeof(tmp),"simtap%d",testTapCounter++);
+	else Utils::snprintf(tmp,sizeof(tmp),"test%dtap%d",pid,testTapCounter++);
 	_dev = tmp;
 
-	_thread = Thread::start(this);
+	if (!synchronous)
+		_thread = Thread::start(this);
 }
 
 TestEthernetTap::~TestEthernetTap()
 {
-	static const TestFrame zf; // use a static empty frame because of weirdo G++ warning bug...
-	_pq.push(zf); // empty frame terminates thread
-	Thread::join(_thread);
+	if (_thread) {
+		unsigned int ticket;
+		TestFrame *f;
+		while (!(f = _pq.claim(ticket)))
+			Thread::sleep(10);
+		f->len = 0; // empty frame terminates thread
+		_pq.publish(ticket);
+		Thread::join(_thread);
+	}
 }
 
 void TestEthernetTap::setEnabled(bool en)
@@ -107,7 +121,30 @@ std::set<InetAddress> TestEthernetTap::ips() const
 
 void TestEthernetTap::put(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
 {
-	_gq.push(TestFrame(from,to,data,etherType,len));
+	unsigned int ticket;
+	TestFrame *const f = _gq.claim(ticket);
+	if (f) {
+		f->from = from;
+		f->to = to;
+		f->timestamp = Utils::now();
+		f->etherType = etherType;
+		f->len = len;
+		memcpy(f->data,data,len);
+		_gq.publish(ticket);
+	}
+}
+
+bool TestEthernetTap::getNextReceivedFrame(TestFrame &v,unsigned long timeout)
+{
+	const uint64_t deadline = Utils::now() + timeout;
+	for(;;) {
+		if (_gq.pop(v))
+			return true;
+		const uint64_t now = Utils::now();
+		if (now >= deadline)
+			return false;
+		_gq.wait((unsigned long)(deadline - now));
+	}
 }
 
 std::string TestEthernetTap::deviceName() const
@@ -128,22 +165,45 @@ bool TestEthernetTap::injectPacketFromHost(const MAC &from,const MAC &to,unsigne
 {
 	if ((len == 0)||(len > _mtu))
 		return false;
-	_pq.push(TestFrame(from,to,data,etherType & 0xffff,len));
+	if (!_thread) {
+		const uint64_t cpuStart = SimNet::threadCpuTime();
+		try {
+			_handler(_arg,from,to,etherType & 0xffff,Buffer<4096>(data,len));
+		} catch ( ... ) {}
+		_cpuTime += SimNet::threadCpuTime() - cpuStart;
+		return true;
+	}
+	unsigned int ticket;
+	TestFrame *const f = _pq.claim(ticket);
+	if (!f)
+		return false;
+	f->from = from;
+	f->to = to;
+	f->timestamp = Utils::now();
+	f->etherType = etherType & 0xffff;
+	f->len = len;
+	memcpy(f->data,data,len);
+	_pq.publish(ticket);
 	return true;
 }
 
 void TestEthernetTap::threadMain()
 	throw()
 {
-	TestFrame f;
 	for(;;) {
-		if (_pq.pop(f,0)) {
-			if (f.len) {
-				try {
-					_handler(_arg,f.from,f.to,f.etherType,Buffer<4096>(f.data,f.len));
-				} catch ( ... ) {}
-			} else break;
+		TestFrame *const f = _pq.front();
+		if (!f) {
+			_pq.wait();
+			continue;
 		}
+		if (!f->len)
+			break;
+		const uint64_t cpuStart = SimNet::threadCpuTime();
+		try {
+			_handler(_arg,f->from,f->to,f->etherType,Buffer<4096>(f->data,f->len));
+		} catch ( ... ) {}
+		_cpuTime += SimNet::threadCpuTime() - cpuStart;
+		_pq.pop();
 	}
 }
 
@@ -38,8 +38,12 @@
 #include "../node/EthernetTap.hpp"
 #include "../node/Thread.hpp"
 #include "../node/Mutex.hpp"
+#include "../node/MPSCQueue.hpp"
 
-#include "MTQ.hpp"
+/**
+ * Frames a test tap can queue in each direction before dropping more
+ */
+#define ZT_TESTETHERNETTAP_QUEUE_SIZE 128
 
 namespace ZeroTier {
 
@@ -52,6 +56,9 @@ class TestEthernetTapFactory;
  * and also prints outgoing packets when they are injected. It does not
  * connect to any real tap or other interface. It's useful for running
  * test networks.
+ *
+ * A synchronous tap has no thread and hands injected packets straight to
+ * the node, for use with nodes driven by Node::step().
  */
 class TestEthernetTap : public EthernetTap
 {
@@ -85,7 +92,8 @@ public:
 		const char *desiredDevice,
 		const char *friendlyName,
 		void (*handler)(void *,const MAC &,const MAC &,unsigned int,const Buffer<4096> &),
-		void *arg);
+		void *arg,
+		bool synchronous = false);
 
 	virtual ~TestEthernetTap();
 
@@ -101,7 +109,32 @@ public:
 	virtual bool injectPacketFromHost(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len);
 
 	inline uint64_t nwid() const { return _nwid; }
-	inline bool getNextReceivedFrame(TestFrame &v,unsigned long timeout) { return _gq.pop(v,timeout); }
+	/**
+	 * Get the next frame the node has put() to this tap, waiting if there is none
+	 *
+	 * Only one thread may read frames from a tap.
+	 *
+	 * @param v Result parameter set to frame
+	 * @param timeout Maximum time to wait in milliseconds
+	 * @return False if no frame arrived in time
+	 */
+	bool getNextReceivedFrame(TestFrame &v,unsigned long timeout);
+
+	/**
+	 * @param v Result parameter set to next frame the node has put() to this tap
+	 * @return False if there are none waiting
+	 */
+	inline bool getNextReceivedFrame(TestFrame &v) { return _gq.pop(v); }
+
+	/**
+	 * @return Frames dropped because the node or the reader fell behind
+	 */
+	inline unsigned long dropped() const throw() { return (_pq.overflows() + _gq.overflows()); }
+
+	/**
+	 * @return Microseconds of CPU time the node has spent on frames injected from the host
+	 */
+	inline uint64_t cpuTime() const throw() { return _cpuTime; }
 
 	void threadMain()
 		throw();
@@ -114,9 +147,10 @@ private:
 	Thread _thread;
 	std::string _dev;
 	volatile bool _enabled;
+	volatile uint64_t _cpuTime;
 
-	MTQ<TestFrame> _pq;
-	MTQ<TestFrame> _gq;
+	MPSCQueue<TestFrame> _pq; // injected frames for the thread that hands them to the node
+	MPSCQueue<TestFrame> _gq; // frames from the node for getNextReceivedFrame()
 };
 
 } // namespace ZeroTier
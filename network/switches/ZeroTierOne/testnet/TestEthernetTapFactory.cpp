@@ -30,7 +30,9 @@
 
 namespace ZeroTier {
 
-TestEthernetTapFactory::TestEthernetTapFactory()
+TestEthernetTapFactory::TestEthernetTapFactory(bool synchronous) :
+	_synchronous(synchronous),
+	_closedCpuTime(0)
 {
 }
 
@@ -53,7 +55,7 @@ EthernetTap *TestEthernetTapFactory::open(
 	void (*handler)(void *,const MAC &,const MAC &,unsigned int,const Buffer<4096> &),
 	void *arg)
 {
-	TestEthernetTap *tap = new TestEthernetTap(mac,mtu,metric,nwid,desiredDevice,friendlyName,handler,arg);
+	TestEthernetTap *tap = new TestEthernetTap(mac,mtu,metric,nwid,desiredDevice,friendlyName,handler,arg,_synchronous);
 	Mutex::Lock _l1(_taps_m);
 	Mutex::Lock _l2(_tapsByMac_m);
 	Mutex::Lock _l3(_tapsByNwid_m);
@@ -73,7 +75,17 @@ void TestEthernetTapFactory::close(EthernetTap *tap,bool destroyPersistentDevice
 	_taps.erase(tap);
 	_tapsByMac.erase(tap->mac());
 	_tapsByNwid.erase(((TestEthernetTap *)tap)->nwid());
+	_closedCpuTime += ((TestEthernetTap *)tap)->cpuTime();
 	delete tap;
 }
 
+uint64_t TestEthernetTapFactory::cpuTime() const
+{
+	Mutex::Lock _l(_taps_m);
+	uint64_t t = _closedCpuTime;
+	for(std::set<EthernetTap *>::const_iterator tap(_taps.begin());tap!=_taps.end();++tap)
+		t += ((TestEthernetTap *)*tap)->cpuTime();
+	return t;
+}
+
 } // namespace ZeroTier
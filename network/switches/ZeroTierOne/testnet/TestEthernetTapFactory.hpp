@@ -42,7 +42,10 @@ namespace ZeroTier {
 class TestEthernetTapFactory : public EthernetTapFactory
 {
 public:
-	TestEthernetTapFactory();
+	/**
+	 * @param synchronous If true, create threadless taps (see TestEthernetTap)
+	 */
+	TestEthernetTapFactory(bool synchronous = false);
 	virtual ~TestEthernetTapFactory();
 
 	virtual EthernetTap *open(
@@ -66,6 +69,11 @@ public:
 		return t->second;
 	}
 
+	/**
+	 * @return Microseconds of CPU time spent on frames injected into this factory's taps, including closed ones
+	 */
+	uint64_t cpuTime() const;
+
 	inline TestEthernetTap *getByNwid(uint64_t nwid) const
 	{
 		Mutex::Lock _l(_tapsByNwid_m);
@@ -76,6 +84,9 @@ public:
 	}
 
 private:
+	bool _synchronous;
+	uint64_t _closedCpuTime;
+
 	std::set< EthernetTap * > _taps;
 	Mutex _taps_m;
 